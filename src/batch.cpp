@@ -0,0 +1,138 @@
+#include "batch.hpp"
+#include "helpers.hpp"
+#include "transfer.hpp"
+#include "vdlisp.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace vdlisp {
+
+namespace {
+
+struct Job {
+    std::string file;
+    std::string out;
+    std::string err;
+    bool failed = false;
+    bool done = false;
+};
+
+// Run `job` in a fresh State cloned from `baseline`.
+void run_job(const Frozen &baseline, Job &job) {
+    std::ostringstream out;
+    std::ostringstream err;
+    {
+        State S;
+        baseline.thaw_globals(S);
+        trap_exit(S);
+        S.bind_global("argv", S.make_string_list(&job.file, &job.file + 1));
+        S.out = &out;
+        try {
+            std::ifstream f(job.file);
+            if (!f)
+                throw std::runtime_error("could not open file: " + job.file);
+            std::ostringstream ss;
+            ss << f.rdbuf();
+            Value e = S.parse_all(ss.str(), job.file);
+            if (e) {
+                Value r = S.do_list(e, S.global);
+                S.write_out(S.to_string(r) + "\n");
+            }
+        } catch (const ScriptExit &ex) {
+            job.failed = ex.code != 0;
+        } catch (const std::exception &ex) {
+            report_exception(S, ex, err);
+            job.failed = true;
+        }
+        S.flush_out();
+        S.out = &std::cout;
+    }
+    rc_safepoint();
+    job.out = out.str();
+    job.err = err.str();
+}
+
+auto default_jobs() -> size_t {
+    if (const char *env = std::getenv("VDLISP__WORKERS")) {
+        long n = std::strtol(env, nullptr, 10);
+        if (n > 0)
+            return static_cast<size_t>(n);
+    }
+    unsigned hw = std::thread::hardware_concurrency();
+    return hw ? hw : 1;
+}
+
+} // namespace
+
+auto batch_main(const std::vector<std::string> &args) -> int {
+    size_t threads = default_jobs();
+    std::vector<Job> jobs;
+    for (size_t i = 0; i < args.size(); ++i) {
+        if (args[i] == "--jobs" || args[i] == "-j") {
+            // the count is never taken for a file name, even when it is
+            // missing or not a number
+            char *end = nullptr;
+            long n = i + 1 < args.size() ? std::strtol(args[++i].c_str(), &end, 10) : 0;
+            if (n <= 0 || *end != '\0') {
+                std::cerr << "vdlisp: --jobs requires a positive number\n";
+                return 2;
+            }
+            threads = static_cast<size_t>(n);
+            continue;
+        }
+        jobs.push_back(Job{args[i]});
+    }
+    if (jobs.empty()) {
+        std::cerr << "usage: vdlisp --batch [--jobs N] FILE...\n";
+        return 2;
+    }
+
+    Frozen baseline;
+    {
+        State base;
+        load_lang_basics(base);
+        base.global->map.erase("argv");
+        baseline = Frozen::freeze_globals(base);
+    }
+
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+    auto worker = [&] {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < jobs.size();) {
+            run_job(baseline, jobs[i]);
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs[i].done = true;
+            cv.notify_all();
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < std::min(threads, jobs.size()); ++t)
+        pool.emplace_back(worker);
+
+    // write each job's output as soon as it and every job before it are done
+    bool failed = false;
+    for (Job &job : jobs) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&job] { return job.done; });
+        }
+        std::cout << job.out;
+        std::cout.flush();
+        std::cerr << job.err;
+        failed |= job.failed;
+        job.out.clear();
+        job.err.clear();
+    }
+    for (auto &t : pool)
+        t.join();
+    return failed ? 1 : 0;
+}
+
+} // namespace vdlisp
@@ -0,0 +1,22 @@
+#ifndef VDLISP__BATCH_HPP
+#define VDLISP__BATCH_HPP
+
+#include <string>
+#include <vector>
+
+namespace vdlisp {
+
+// `vdlisp --batch [--jobs N] a.lisp b.lisp ...`: run independent scripts in
+// one process on N threads (default: `VDLISP__WORKERS` or the CPU count).
+//
+// A baseline State is initialized once (builtins, lang_basics) and its
+// globals are frozen; every job runs in a fresh State cloned from that
+// snapshot, with `argv` bound to `(file)`. Each job's output (what it prints,
+// then its result, or its error report) is buffered and written in the
+// order of the files on the command line. The exit status is 1 when any job
+// failed, else 0; `exit` ends only its own job.
+auto batch_main(const std::vector<std::string> &args) -> int;
+
+} // namespace vdlisp
+
+#endif // VDLISP__BATCH_HPP
@@ -0,0 +1,294 @@
+#include "bytes.hpp"
+#include "helpers.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace vdlisp {
+
+BytesData::BytesData(size_t n) : storage_(new uint8_t[n]()), data_(storage_.get()), size_(n) {}
+
+BytesData::BytesData(const Value &of, size_t offset, size_t n)
+    : owner_(of.get_bytes()->owner() ? of.get_bytes()->owner() : of), data_(of.get_bytes()->data() + offset),
+      size_(n) {}
+
+void require_writable(const BytesData *b, const char *who) {
+    require_mutable(b, who);
+    if (b->owner())
+        require_mutable(b->owner().get_bytes(), who);
+}
+
+// -------------------- builtins --------------------
+
+namespace {
+
+auto require_bytes(const Value &v, const char *who) -> BytesData * {
+    if (!v || v.get_type() != TBYTES)
+        throw std::runtime_error(std::string(who) + " requires bytes");
+    return v.get_bytes();
+}
+
+auto require_byte(const Value &v, const char *who) -> uint8_t {
+    double d = require_number(v, who);
+    if (d < 0 || d > 255 || d != std::floor(d))
+        throw std::runtime_error(std::string(who) + ": byte value must be an integer in 0..255");
+    return static_cast<uint8_t>(d);
+}
+
+// The optional [start end] of `args` within a buffer of `size` bytes; end
+// defaults to size.
+auto require_range(const Value &args, size_t size, const char *who) -> std::pair<size_t, size_t> {
+    Value s = pair_car(args);
+    Value e = pair_car(pair_cdr(args));
+    size_t start = s ? require_index(s, size, who, true) : 0;
+    size_t end = e ? require_index(e, size, who, true) : size;
+    if (end < start)
+        throw std::runtime_error(std::string(who) + ": start " + std::to_string(start) + " is after end " +
+                                 std::to_string(end));
+    return {start, end};
+}
+
+auto make_view(State &S, const Value &of, size_t offset, size_t n) -> Value {
+    auto *b = new BytesData(of, offset, n);
+    Value v = S.make_pooled_value(TBYTES);
+    v.set_bytes(b);
+    return v;
+}
+
+// Element types of the bytes-<type>-ref / -set! accessors: the C type and the
+// unsigned type of the same width its bytes are swapped as.
+struct U16 {
+    using type = uint16_t;
+    using bits = uint16_t;
+    static constexpr const char *ref = "bytes-u16-ref";
+    static constexpr const char *set = "bytes-u16-set!";
+};
+struct S16 {
+    using type = int16_t;
+    using bits = uint16_t;
+    static constexpr const char *ref = "bytes-s16-ref";
+    static constexpr const char *set = "bytes-s16-set!";
+};
+struct U32 {
+    using type = uint32_t;
+    using bits = uint32_t;
+    static constexpr const char *ref = "bytes-u32-ref";
+    static constexpr const char *set = "bytes-u32-set!";
+};
+struct S32 {
+    using type = int32_t;
+    using bits = uint32_t;
+    static constexpr const char *ref = "bytes-s32-ref";
+    static constexpr const char *set = "bytes-s32-set!";
+};
+// 64-bit integers come back as numbers, so above 2^53 they are rounded
+struct U64 {
+    using type = uint64_t;
+    using bits = uint64_t;
+    static constexpr const char *ref = "bytes-u64-ref";
+    static constexpr const char *set = "bytes-u64-set!";
+};
+struct S64 {
+    using type = int64_t;
+    using bits = uint64_t;
+    static constexpr const char *ref = "bytes-s64-ref";
+    static constexpr const char *set = "bytes-s64-set!";
+};
+struct F32 {
+    using type = float;
+    using bits = uint32_t;
+    static constexpr const char *ref = "bytes-f32-ref";
+    static constexpr const char *set = "bytes-f32-set!";
+};
+struct F64 {
+    using type = double;
+    using bits = uint64_t;
+    static constexpr const char *ref = "bytes-f64-ref";
+    static constexpr const char *set = "bytes-f64-set!";
+};
+
+template <typename Bits> auto byteswap(Bits x) -> Bits {
+    if constexpr (sizeof(Bits) == 2)
+        return __builtin_bswap16(x);
+    else if constexpr (sizeof(Bits) == 4)
+        return __builtin_bswap32(x);
+    else
+        return __builtin_bswap64(x);
+}
+
+// The optional byte order argument: 'little (default) or 'big; true when it
+// differs from the host's.
+auto require_swap(const Value &v, const char *who) -> bool {
+    std::endian order = std::endian::little;
+    if (v) {
+        if (v.get_type() == TSYMBOL && *v.get_symbol() == "big")
+            order = std::endian::big;
+        else if (v.get_type() != TSYMBOL || *v.get_symbol() != "little")
+            throw std::runtime_error(std::string(who) + ": byte order must be 'little or 'big");
+    }
+    return order != std::endian::native;
+}
+
+// The element at `offset` of `b` as a pointer; the whole element must fit.
+template <typename Spec> auto require_slot(BytesData *b, const Value &offset, const char *who) -> uint8_t * {
+    double d = require_number(offset, who);
+    if (d != std::floor(d) || d < 0 || d + sizeof(typename Spec::type) > static_cast<double>(b->size()))
+        throw std::runtime_error(index_error(who, "offset", d, b->size()));
+    return b->data() + static_cast<size_t>(d);
+}
+
+template <typename Spec> void register_accessors(State &S) {
+    using T = typename Spec::type;
+    using Bits = typename Spec::bits;
+    // (bytes-<type>-ref b offset [order])
+    S.register_builtin(Spec::ref, [](State &S, const Value &args) -> Value {
+        BytesData *b = require_bytes(pair_car(args), Spec::ref);
+        Value rest = pair_cdr(args);
+        const uint8_t *p = require_slot<Spec>(b, pair_car(rest), Spec::ref);
+        Bits bits;
+        std::memcpy(&bits, p, sizeof bits);
+        if (require_swap(pair_car(pair_cdr(rest)), Spec::ref))
+            bits = byteswap(bits);
+        return S.make_number(static_cast<double>(std::bit_cast<T>(bits)));
+    });
+    // (bytes-<type>-set! b offset x [order]): returns x
+    S.register_builtin(Spec::set, [](State &S, const Value &args) -> Value {
+        BytesData *b = require_bytes(pair_car(args), Spec::set);
+        require_writable(b, Spec::set);
+        Value rest = pair_cdr(args);
+        uint8_t *p = require_slot<Spec>(b, pair_car(rest), Spec::set);
+        rest = pair_cdr(rest);
+        Value x = pair_car(rest);
+        double d = require_number(x, Spec::set);
+        if constexpr (std::is_integral_v<T>) {
+            // max + 1 as a power of two: exact, unlike the 64-bit maxima
+            constexpr double lo = static_cast<double>(std::numeric_limits<T>::min());
+            constexpr double hi = 2.0 * static_cast<double>(T(1) << (std::numeric_limits<T>::digits - 1));
+            if (d != std::floor(d) || d < lo || d >= hi)
+                throw std::runtime_error(std::string(Spec::set) + ": " + x.to_repr(S) + " out of range");
+        }
+        Bits bits = std::bit_cast<Bits>(static_cast<T>(d));
+        if (require_swap(pair_car(pair_cdr(rest)), Spec::set))
+            bits = byteswap(bits);
+        std::memcpy(p, &bits, sizeof bits);
+        return x;
+    });
+}
+
+} // namespace
+
+void register_bytes(State &S) {
+    // (make-bytes n [fill]): n bytes, all `fill` (default 0)
+    S.register_builtin("make-bytes", [](State &S, const Value &args) -> Value {
+        size_t n = require_length(pair_car(args), 1, "make-bytes");
+        Value fill = pair_car(pair_cdr(args));
+        uint8_t x = fill ? require_byte(fill, "make-bytes") : 0;
+        Value v = S.make_bytes(n);
+        BytesData *b = v.get_bytes();
+        std::fill(b->data(), b->data() + b->size(), x);
+        return v;
+    });
+    // (bytes x ...): a buffer of the arguments
+    S.register_builtin("bytes", [](State &S, const Value &args) -> Value {
+        size_t n = 0;
+        for (Value cur = args; cur; cur = pair_cdr(cur))
+            ++n;
+        Value v = S.make_bytes(n);
+        uint8_t *d = v.get_bytes()->data();
+        for (Value cur = args; cur; cur = pair_cdr(cur))
+            *d++ = require_byte(pair_car(cur), "bytes");
+        return v;
+    });
+    S.register_builtin("bytes-length", [](State &S, const Value &args) -> Value {
+        return S.make_number(static_cast<double>(require_bytes(pair_car(args), "bytes-length")->size()));
+    });
+    S.register_builtin("bytes-ref", [](State &S, const Value &args) -> Value {
+        BytesData *b = require_bytes(pair_car(args), "bytes-ref");
+        return S.make_number(b->data()[require_index(pair_car(pair_cdr(args)), b->size(), "bytes-ref")]);
+    });
+    // (bytes-set! b i x): store the byte x at i; returns x
+    S.register_builtin("bytes-set!", [](State &, const Value &args) -> Value {
+        BytesData *b = require_bytes(pair_car(args), "bytes-set!");
+        require_writable(b, "bytes-set!");
+        Value rest = pair_cdr(args);
+        size_t k = require_index(pair_car(rest), b->size(), "bytes-set!");
+        Value x = pair_car(pair_cdr(rest));
+        b->data()[k] = require_byte(x, "bytes-set!");
+        return x;
+    });
+    // (bytes-slice b [start end]): a view of b's bytes in [start, end), no copy
+    S.register_builtin("bytes-slice", [](State &S, const Value &args) -> Value {
+        Value of = pair_car(args);
+        BytesData *b = require_bytes(of, "bytes-slice");
+        auto [start, end] = require_range(pair_cdr(args), b->size(), "bytes-slice");
+        return make_view(S, of, start, end - start);
+    });
+    // (bytes-copy b [start end]): a new buffer holding a copy of the range
+    S.register_builtin("bytes-copy", [](State &S, const Value &args) -> Value {
+        BytesData *b = require_bytes(pair_car(args), "bytes-copy");
+        auto [start, end] = require_range(pair_cdr(args), b->size(), "bytes-copy");
+        Value v = S.make_bytes(end - start);
+        std::memcpy(v.get_bytes()->data(), b->data() + start, end - start);
+        return v;
+    });
+    // (bytes-copy! dst at src [start end]): copy src's range into dst from
+    // `at` on (the ranges may overlap); returns dst
+    S.register_builtin("bytes-copy!", [](State &, const Value &args) -> Value {
+        Value dst = pair_car(args);
+        BytesData *d = require_bytes(dst, "bytes-copy!");
+        require_writable(d, "bytes-copy!");
+        Value rest = pair_cdr(args);
+        size_t at = require_index(pair_car(rest), d->size(), "bytes-copy!", true);
+        rest = pair_cdr(rest);
+        BytesData *s = require_bytes(pair_car(rest), "bytes-copy!");
+        auto [start, end] = require_range(pair_cdr(rest), s->size(), "bytes-copy!");
+        if (end - start > d->size() - at)
+            throw std::runtime_error("bytes-copy!: " + std::to_string(end - start) + " bytes do not fit at " +
+                                     std::to_string(at) + " in length " + std::to_string(d->size()));
+        std::memmove(d->data() + at, s->data() + start, end - start);
+        return dst;
+    });
+    // (bytes-fill! b x [start end]): returns b
+    S.register_builtin("bytes-fill!", [](State &, const Value &args) -> Value {
+        Value of = pair_car(args);
+        BytesData *b = require_bytes(of, "bytes-fill!");
+        require_writable(b, "bytes-fill!");
+        Value rest = pair_cdr(args);
+        uint8_t x = require_byte(pair_car(rest), "bytes-fill!");
+        auto [start, end] = require_range(pair_cdr(rest), b->size(), "bytes-fill!");
+        std::memset(b->data() + start, x, end - start);
+        return of;
+    });
+    S.register_builtin("string->bytes", [](State &S, const Value &args) -> Value {
+        Value s = pair_car(args);
+        if (!s || s.get_type() != TSTRING)
+            throw std::runtime_error("string->bytes requires a string");
+        std::string_view str = s.get_string_view();
+        Value v = S.make_bytes(str.size());
+        std::memcpy(v.get_bytes()->data(), str.data(), str.size());
+        return v;
+    });
+    // (bytes->string b [start end])
+    S.register_builtin("bytes->string", [](State &S, const Value &args) -> Value {
+        BytesData *b = require_bytes(pair_car(args), "bytes->string");
+        auto [start, end] = require_range(pair_cdr(args), b->size(), "bytes->string");
+        return S.make_string(std::string(reinterpret_cast<const char *>(b->data()) + start, end - start));
+    });
+
+    register_accessors<U16>(S);
+    register_accessors<S16>(S);
+    register_accessors<U32>(S);
+    register_accessors<S32>(S);
+    register_accessors<U64>(S);
+    register_accessors<S64>(S);
+    register_accessors<F32>(S);
+    register_accessors<F64>(S);
+}
+
+} // namespace vdlisp
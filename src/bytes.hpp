@@ -0,0 +1,49 @@
+#ifndef VDLISP__BYTES_HPP
+#define VDLISP__BYTES_HPP
+
+#include "nanbox.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace vdlisp {
+
+class State;
+
+// BytesData: mutable fixed-length byte buffer (TBYTES), printed as
+// `#u8(1 2 255)`. A buffer either owns its storage or is a view of a range of
+// another buffer's: views share the bytes (a write through one is seen by the
+// other) and keep the owning buffer alive. The storage never moves, so I/O can
+// read and write it in place.
+class BytesData : public RcBase {
+  public:
+    // `n` zero bytes
+    explicit BytesData(size_t n);
+    // view of [offset, offset + n) of the TBYTES value `of`
+    BytesData(const Value &of, size_t offset, size_t n);
+
+    [[nodiscard]] auto data() noexcept -> uint8_t * { return data_; }
+    [[nodiscard]] auto data() const noexcept -> const uint8_t * { return data_; }
+    [[nodiscard]] auto size() const noexcept -> size_t { return size_; }
+    // the buffer owning the storage of a view; nil for an owning buffer
+    [[nodiscard]] auto owner() const noexcept -> const Value & { return owner_; }
+
+  private:
+    std::unique_ptr<uint8_t[]> storage_;
+    Value owner_;
+    uint8_t *data_;
+    size_t size_;
+};
+
+// Throw unless `who` may write to `b`: neither it nor the buffer it views was
+// frozen by `share`.
+void require_writable(const BytesData *b, const char *who);
+
+// make-bytes / bytes / bytes-length / bytes-ref / bytes-set! / bytes-slice /
+// bytes-copy / bytes-copy! / bytes-fill! / string->bytes / bytes->string and
+// the typed accessors bytes-{u16,s16,u32,s32,u64,s64,f32,f64}-{ref,set!}
+void register_bytes(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__BYTES_HPP
@@ -0,0 +1,207 @@
+#include "channel.hpp"
+#include "helpers.hpp"
+#include <bit>
+#include <stdexcept>
+#include <thread>
+
+namespace vdlisp {
+
+ChannelCore::ChannelCore(size_t capacity) : bound(capacity) {
+    size_t n = std::bit_ceil(capacity < 2 ? size_t(2) : capacity);
+    cells = std::make_unique<Cell[]>(n);
+    mask = n - 1;
+    for (size_t i = 0; i < n; ++i)
+        cells[i].seq.store(i, std::memory_order_relaxed);
+}
+
+auto ChannelCore::try_push(Frozen &v) -> bool {
+    // counted before `closed` is read, so a pop that sees the channel closed
+    // also sees every push that may still publish a value (see pop)
+    sending.fetch_add(1, std::memory_order_seq_cst);
+    bool ok = !closed() && push_slot(v);
+    sending.fetch_sub(1, std::memory_order_release);
+    return ok;
+}
+
+auto ChannelCore::push_slot(Frozen &v) -> bool {
+    uint64_t pos = tail.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+        cell = &cells[pos & mask];
+        uint64_t seq = cell->seq.load(std::memory_order_acquire);
+        auto diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos);
+        if (diff == 0) {
+            // head only grows, so a stale read can only make this stricter
+            if (pos - head.load(std::memory_order_acquire) >= bound)
+                return false; // full
+            if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return false; // full
+        } else {
+            pos = tail.load(std::memory_order_relaxed);
+        }
+    }
+    cell->value = std::move(v);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    wake(recv_waiters, recv_epoch);
+    return true;
+}
+
+auto ChannelCore::try_pop(Frozen &out) -> bool {
+    uint64_t pos = head.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+        cell = &cells[pos & mask];
+        uint64_t seq = cell->seq.load(std::memory_order_acquire);
+        auto diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos + 1);
+        if (diff == 0) {
+            if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return false; // empty
+        } else {
+            pos = head.load(std::memory_order_relaxed);
+        }
+    }
+    out = std::move(cell->value);
+    cell->value = Frozen();
+    cell->seq.store(pos + mask + 1, std::memory_order_release);
+    wake(send_waiters, send_epoch);
+    return true;
+}
+
+void ChannelCore::wake(std::atomic<uint32_t> &waiters, std::atomic<uint32_t> &epoch) {
+    // pairs with the fetch_add in push/pop: either the waiter's retry sees our
+    // update or we see the waiter
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_relaxed) == 0)
+        return;
+    epoch.fetch_add(1, std::memory_order_release);
+    epoch.notify_all();
+}
+
+void ChannelCore::park(std::atomic<uint32_t> &epoch, uint32_t seen) {
+    epoch.wait(seen, std::memory_order_acquire);
+}
+
+// Snapshot the epoch, register as a waiter, retry once (a concurrent
+// operation may have completed in between), then sleep until the epoch moves.
+auto ChannelCore::push(Frozen &v) -> bool {
+    while (true) {
+        if (try_push(v))
+            return true;
+        if (closed())
+            return false;
+        uint32_t seen = send_epoch.load(std::memory_order_acquire);
+        send_waiters.fetch_add(1, std::memory_order_seq_cst);
+        bool done = try_push(v);
+        if (!done && !closed())
+            park(send_epoch, seen);
+        send_waiters.fetch_sub(1, std::memory_order_relaxed);
+        if (done)
+            return true;
+    }
+}
+
+auto ChannelCore::pop(Frozen &out) -> bool {
+    while (true) {
+        if (try_pop(out))
+            return true;
+        if (closed()) {
+            // a push that passed its `closed` check may still be filling its
+            // slot; wait for it so its value is not left behind the close
+            while (sending.load(std::memory_order_acquire) != 0)
+                std::this_thread::yield();
+            return try_pop(out);
+        }
+        uint32_t seen = recv_epoch.load(std::memory_order_acquire);
+        recv_waiters.fetch_add(1, std::memory_order_seq_cst);
+        bool done = try_pop(out);
+        if (!done && !closed())
+            park(recv_epoch, seen);
+        recv_waiters.fetch_sub(1, std::memory_order_relaxed);
+        if (done)
+            return true;
+    }
+}
+
+void ChannelCore::close() {
+    closed_.store(true, std::memory_order_seq_cst);
+    // bump both epochs so sleepers that already checked `closed` wake up
+    recv_epoch.fetch_add(1, std::memory_order_release);
+    recv_epoch.notify_all();
+    send_epoch.fetch_add(1, std::memory_order_release);
+    send_epoch.notify_all();
+}
+
+// -------------------- builtins --------------------
+
+class ChannelHandle : public HandleData {
+  public:
+    explicit ChannelHandle(std::shared_ptr<ChannelCore> core) : core(std::move(core)) {}
+    [[nodiscard]] auto type_name() const -> const char * override { return "chan"; }
+    [[nodiscard]] auto detach() const -> std::function<HandleData *()> override {
+        auto c = core;
+        return [c]() -> HandleData * { return new ChannelHandle(c); };
+    }
+
+    std::shared_ptr<ChannelCore> core;
+};
+
+static auto require_chan(const Value &v, const char *who) -> ChannelCore & {
+    auto *ch = v.get_type() == THANDLE ? dynamic_cast<ChannelHandle *>(v.get_handle()) : nullptr;
+    if (!ch)
+        throw std::runtime_error(std::string(who) + ": expected chan, got " + type_name(v));
+    return *ch->core;
+}
+
+void register_channels(State &S) {
+    // (make-chan [capacity]): holds at most `capacity` values (default 64)
+    S.register_builtin("make-chan", [](State &S, const Value &args) -> Value {
+        double cap = pair_car(args) ? require_number(pair_car(args), "make-chan") : 64.0;
+        if (!(cap >= 1) || cap > 0x1p40)
+            throw std::runtime_error("make-chan: capacity must be between 1 and 2^40");
+        return S.make_handle(new ChannelHandle(std::make_shared<ChannelCore>(static_cast<size_t>(cap))));
+    });
+    // (send ch v): block while the channel is full; returns v
+    S.register_builtin("send", [](State &S, const Value &args) -> Value {
+        ChannelCore &ch = require_chan(pair_car(args), "send");
+        Value v = pair_car(pair_cdr(args));
+        Frozen fz = Frozen::freeze(S, v);
+        if (!ch.push(fz))
+            throw std::runtime_error("send: channel is closed");
+        return v;
+    });
+    // (try-send ch v): #t if queued, nil if the channel is full or closed
+    S.register_builtin("try-send", [](State &S, const Value &args) -> Value {
+        ChannelCore &ch = require_chan(pair_car(args), "try-send");
+        Frozen fz = Frozen::freeze(S, pair_car(pair_cdr(args)));
+        return ch.try_push(fz) ? S.get_bound("#t", S.global) : Value();
+    });
+    // (recv ch [closed]): block until a value arrives; `closed` (default nil)
+    // once the channel is closed and drained, so a sent nil can be told apart
+    S.register_builtin("recv", [](State &S, const Value &args) -> Value {
+        ChannelCore &ch = require_chan(pair_car(args), "recv");
+        Frozen fz;
+        bool got = ch.pop(fz);
+        rc_safepoint();
+        if (!got)
+            return pair_car(pair_cdr(args));
+        return thaw_tracked(S, fz);
+    });
+    // (try-recv ch [none]): next value, or `none` (default nil) when nothing is queued
+    S.register_builtin("try-recv", [](State &S, const Value &args) -> Value {
+        ChannelCore &ch = require_chan(pair_car(args), "try-recv");
+        Frozen fz;
+        if (!ch.try_pop(fz))
+            return pair_car(pair_cdr(args));
+        return thaw_tracked(S, fz);
+    });
+    S.register_builtin("close-chan", [](State &, const Value &args) -> Value {
+        require_chan(pair_car(args), "close-chan").close();
+        return {};
+    });
+}
+
+} // namespace vdlisp
@@ -0,0 +1,76 @@
+#ifndef VDLISP__CHANNEL_HPP
+#define VDLISP__CHANNEL_HPP
+
+#include "transfer.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace vdlisp {
+
+// ChannelCore: bounded multi-producer/multi-consumer queue of Frozen values
+// shared by every isolate holding the channel.
+//
+// The ring follows Vyukov's bounded MPMC design: each cell carries a sequence
+// number that tells producers and consumers whether it is free or filled, so
+// the non-blocking paths are a single CAS on `tail` / `head` with no lock.
+// The ring is the capacity rounded up to a power of two; a producer also
+// refuses a slot while `capacity` values are queued, so the bound is exact.
+// Blocking operations park the thread on a wake-up epoch with
+// std::atomic::wait; the other side only bumps the epoch and notifies when a
+// waiter is registered, keeping the uncontended path free of syscalls. A
+// parked worker thread runs nothing else: a pipeline whose stages block on
+// each other needs a worker for every stage that can be blocked at once.
+// Closing does not wait for pushes in flight: one that checked `closed` just
+// before still queues its value, and a pop that finds the channel closed
+// waits for such pushes to finish, so it returns false only once nothing more
+// can arrive.
+class ChannelCore {
+  public:
+    explicit ChannelCore(size_t capacity);
+    ChannelCore(const ChannelCore &) = delete;
+    ChannelCore &operator=(const ChannelCore &) = delete;
+
+    // Non-blocking: false when full (push) / empty (pop), or push on a closed channel.
+    auto try_push(Frozen &v) -> bool;
+    auto try_pop(Frozen &out) -> bool;
+    // Blocking: push returns false if the channel is closed; pop returns false
+    // once the channel is closed and drained.
+    auto push(Frozen &v) -> bool;
+    auto pop(Frozen &out) -> bool;
+    void close();
+    [[nodiscard]] auto closed() const noexcept -> bool { return closed_.load(std::memory_order_acquire); }
+    [[nodiscard]] auto capacity() const noexcept -> size_t { return bound; }
+
+  private:
+    // try_push without the `closed` check
+    auto push_slot(Frozen &v) -> bool;
+
+    struct Cell {
+        std::atomic<uint64_t> seq;
+        Frozen value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    size_t bound;
+    alignas(64) std::atomic<uint64_t> tail{0}; // next slot to fill
+    std::atomic<uint32_t> sending{0};          // try_push calls under way
+    alignas(64) std::atomic<uint64_t> head{0}; // next slot to drain
+    alignas(64) std::atomic<uint32_t> recv_waiters{0};
+    std::atomic<uint32_t> recv_epoch{0};
+    alignas(64) std::atomic<uint32_t> send_waiters{0};
+    std::atomic<uint32_t> send_epoch{0};
+    std::atomic<bool> closed_{false};
+
+    static void wake(std::atomic<uint32_t> &waiters, std::atomic<uint32_t> &epoch);
+    static void park(std::atomic<uint32_t> &epoch, uint32_t seen);
+};
+
+// make-chan / send / recv / try-send / try-recv / close-chan
+void register_channels(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__CHANNEL_HPP
@@ -0,0 +1,65 @@
+#include "server.hpp"
+#include "wire.hpp"
+#include <filesystem>
+#include <iostream>
+
+// The client side of the evaluation server. It does not depend on the
+// interpreter, so the standalone `vdlisp-client` (src/client/main.cpp) starts
+// without loading LLVM.
+
+namespace vdlisp {
+
+using namespace wire;
+
+auto client_main(const std::string &path, const std::vector<std::string> &args) -> int {
+    std::string req;
+    if (args.empty()) {
+        std::cerr << "usage: vdlisp --client SOCK (-e EXPR | --stop | FILE [ARGS...])\n";
+        return 2;
+    }
+    if (args[0] == "-e") {
+        if (args.size() < 2) {
+            std::cerr << "vdlisp: -e requires an expression\n";
+            return 2;
+        }
+        req = "e" + args[1];
+    } else if (args[0] == "--stop") {
+        req = "q";
+    } else {
+        // the server has its own working directory: send an absolute path
+        std::error_code ec;
+        req = "f" + std::filesystem::absolute(args[0], ec).string();
+        for (size_t i = 1; i < args.size(); ++i)
+            req += '\0' + args[i];
+    }
+    sockaddr_un addr{};
+    if (!unix_address(path, addr)) {
+        std::cerr << "vdlisp: invalid socket path: " << path << "\n";
+        return 2;
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0) {
+        std::cerr << "vdlisp: cannot connect to " << path << ": " << std::strerror(errno) << "\n";
+        if (fd >= 0)
+            ::close(fd);
+        return 2;
+    }
+    std::string resp;
+    bool ok = write_frame(fd, req) && read_frame(fd, resp, -1) && resp.size() >= 5;
+    ::close(fd);
+    if (!ok) {
+        std::cerr << "vdlisp: no reply from server\n";
+        return 2;
+    }
+    uint32_t out_len = get_u32(resp.data() + 1);
+    if (out_len > resp.size() - 5) {
+        std::cerr << "vdlisp: malformed reply from server\n";
+        return 2;
+    }
+    std::cout.write(resp.data() + 5, out_len);
+    std::cout.flush();
+    std::cerr.write(resp.data() + 5 + out_len, static_cast<std::streamsize>(resp.size() - 5 - out_len));
+    return static_cast<unsigned char>(resp[0]);
+}
+
+} // namespace vdlisp
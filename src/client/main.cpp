@@ -0,0 +1,12 @@
+// vdlisp-client: standalone client of `vdlisp --serve` (see server.hpp).
+// Same arguments as `vdlisp --client SOCK ...`.
+#include "server.hpp"
+#include <iostream>
+
+auto main(int argc, char **argv) -> int {
+    if (argc < 2) {
+        std::cerr << "usage: vdlisp-client SOCK (-e EXPR | --stop | FILE [ARGS...])\n";
+        return 2;
+    }
+    return vdlisp::client_main(argv[1], std::vector<std::string>(argv + 2, argv + argc));
+}
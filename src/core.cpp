@@ -1,6 +1,23 @@
 #include "core.hpp"
+#include "bytes.hpp"
+#include "channel.hpp"
+#include "coroutine.hpp"
+#include "csv.hpp"
+#include "event.hpp"
+#include "f64array.hpp"
+#include "files.hpp"
 #include "helpers.hpp"
+#include "json.hpp"
+#include "lists.hpp"
+#include "output.hpp"
+#include "persistent.hpp"
+#include "record.hpp"
+#include "sort.hpp"
 #include "require.hpp"
+#include "strings.hpp"
+#include "table.hpp"
+#include "vectors.hpp"
+#include "workers.hpp"
 #include <filesystem>
 #include <fstream>
 #include <functional>
@@ -60,14 +77,14 @@ void register_core(State &S) {
         Value cur = args;
         while (cur) {
             if (!first)
-                std::cout << ' ';
+                S.write_out(" ");
             Value el = pair_car(cur);
-            std::cout << S.to_string(el);
+            write_display(S, el);
             first = false;
             last = el;
             cur = pair_cdr(cur);
         }
-        std::cout << '\n';
+        S.write_out("\n");
         return last;
     });
 
@@ -124,6 +141,7 @@ void register_core(State &S) {
         Value v = pair_car(pair_cdr(args));
         if (!p || p.get_type() != TPAIR)
             throw std::runtime_error("setcar expects a pair");
+        require_mutable(p.get_pair(), "setcar");
         pair_set_car(p, v);
         return v;
     });
@@ -132,6 +150,7 @@ void register_core(State &S) {
         Value v = pair_car(pair_cdr(args));
         if (!p || p.get_type() != TPAIR)
             throw std::runtime_error("setcdr expects a pair");
+        require_mutable(p.get_pair(), "setcdr");
         pair_set_cdr(p, v);
         return v;
     });
@@ -156,6 +175,27 @@ void register_core(State &S) {
 
     // use centralized require implementation
     register_require(S);
+    // spawn / await on worker isolates
+    register_workers(S);
+    register_parallel(S);
+    // channels between isolates
+    register_channels(S);
+    // coroutine / resume / yield
+    register_coroutines(S);
+    register_events(S);
+    register_vectors(S);
+    register_tables(S);
+    register_f64arrays(S);
+    register_bytes(S);
+    register_persistent(S);
+    register_records(S);
+    register_sort(S);
+    register_lists(S);
+    register_output(S);
+    register_files(S);
+    register_csv(S);
+    register_json(S);
+    register_strings(S);
 
     // --- prims ---
     S.register_prim("quote", [](State &, const Value &args, Env *) -> Value {
@@ -0,0 +1,388 @@
+#include "coroutine.hpp"
+#include "helpers.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+
+#if defined(__SANITIZE_ADDRESS__)
+#define VDLISP__ASAN_FIBERS 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define VDLISP__ASAN_FIBERS 1
+#endif
+#endif
+#if defined(__SANITIZE_THREAD__)
+#define VDLISP__TSAN_FIBERS 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define VDLISP__TSAN_FIBERS 1
+#endif
+#endif
+#if VDLISP__ASAN_FIBERS
+#include <sanitizer/asan_interface.h>
+#include <sanitizer/common_interface_defs.h>
+#endif
+#if VDLISP__TSAN_FIBERS
+#include <sanitizer/tsan_interface.h>
+#endif
+
+namespace vdlisp {
+
+// -------------------- context switch --------------------
+
+#if defined(__x86_64__)
+// vdlisp_coro_switch(save, to): push the callee-saved registers plus MXCSR
+// and the x87 control word, store rsp in *save, load `to` and pop the same
+// frame from it. A fresh stack is primed with a frame whose return address is
+// vdlisp_coro_boot, which calls r13(r12).
+extern "C" void vdlisp_coro_switch(void **save, void *to);
+extern "C" void vdlisp_coro_boot();
+asm(R"(
+    .text
+    .globl vdlisp_coro_switch
+    .hidden vdlisp_coro_switch
+    .type vdlisp_coro_switch,@function
+vdlisp_coro_switch:
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .size vdlisp_coro_switch,.-vdlisp_coro_switch
+
+    .globl vdlisp_coro_boot
+    .hidden vdlisp_coro_boot
+    .type vdlisp_coro_boot,@function
+vdlisp_coro_boot:
+    movq %r12, %rdi
+    callq *%r13
+    ud2
+    .size vdlisp_coro_boot,.-vdlisp_coro_boot
+)");
+
+struct CoroContext {
+    void *sp = nullptr;
+};
+
+static void ctx_make(CoroContext &c, void *lo, size_t size, void (*fn)(void *), void *arg) {
+    auto top = (reinterpret_cast<uintptr_t>(lo) + size) & ~uintptr_t(15);
+    auto *frame = reinterpret_cast<uint64_t *>(top - 16 - 8 * 8);
+    frame[0] = (uint64_t(0x037F) << 32) | 0x1F80; // default MXCSR / x87 control word
+    frame[1] = 0;                                 // r15
+    frame[2] = 0;                                 // r14
+    frame[3] = reinterpret_cast<uint64_t>(fn);    // r13
+    frame[4] = reinterpret_cast<uint64_t>(arg);   // r12
+    frame[5] = 0;                                 // rbx
+    frame[6] = 0;                                 // rbp
+    frame[7] = reinterpret_cast<uint64_t>(&vdlisp_coro_boot);
+    c.sp = frame;
+}
+
+static inline void ctx_switch(CoroContext &from, CoroContext &to) {
+    vdlisp_coro_switch(&from.sp, to.sp);
+}
+#else
+// Portable fallback.
+struct CoroContext {
+    ucontext_t uc;
+};
+
+static void ctx_trampoline(unsigned hi, unsigned lo) {
+    auto bits = (uint64_t(hi) << 32) | lo;
+    auto *pair = reinterpret_cast<void **>(bits);
+    reinterpret_cast<void (*)(void *)>(pair[0])(pair[1]);
+}
+
+static void ctx_make(CoroContext &c, void *lo, size_t size, void (*fn)(void *), void *arg) {
+    // the two words live at the top of the new stack until the trampoline reads them
+    auto top = (reinterpret_cast<uintptr_t>(lo) + size - 2 * sizeof(void *)) & ~uintptr_t(15);
+    auto *pair = reinterpret_cast<void **>(top);
+    pair[0] = reinterpret_cast<void *>(fn);
+    pair[1] = arg;
+    getcontext(&c.uc);
+    c.uc.uc_stack.ss_sp = lo;
+    c.uc.uc_stack.ss_size = top - reinterpret_cast<uintptr_t>(lo);
+    c.uc.uc_link = nullptr;
+    auto bits = reinterpret_cast<uint64_t>(pair);
+    makecontext(&c.uc, reinterpret_cast<void (*)()>(ctx_trampoline), 2, unsigned(bits >> 32), unsigned(bits));
+}
+
+static inline void ctx_switch(CoroContext &from, CoroContext &to) {
+    swapcontext(&from.uc, &to.uc);
+}
+#endif
+
+// -------------------- stacks --------------------
+
+static auto page_size() -> size_t {
+    static const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page;
+}
+
+// Usable stack size, from `VDLISP__CORO_STACK_KB` (default 8 MiB, like a
+// thread's). The mapping reserves no swap and pages are only committed when
+// touched; recursion deeper than the stack allows is a "stack overflow"
+// error (see stack_limit).
+static auto stack_size() -> size_t {
+    static const size_t size = [] {
+        size_t kb = 8 * 1024;
+        if (const char *env = getenv("VDLISP__CORO_STACK_KB")) {
+            long n = strtol(env, nullptr, 10);
+            if (n >= 16)
+                kb = static_cast<size_t>(n);
+        }
+        size_t page = page_size();
+        return (kb * 1024 + page - 1) / page * page;
+    }();
+    return size;
+}
+
+namespace {
+// Recently released stacks of this thread, reused by the next coroutines.
+struct StackCache {
+    static constexpr size_t kMax = 16;
+    std::vector<std::pair<void *, size_t>> free;
+    ~StackCache() {
+        for (auto &s : free)
+            munmap(s.first, s.second);
+    }
+};
+thread_local StackCache stack_cache;
+thread_local Coroutine *current_coroutine = nullptr;
+
+// Thrown from `yield` into a coroutine that is being destroyed; caught at its entry.
+struct CoroutineCancel {};
+} // namespace
+
+auto Coroutine::acquire_stack() -> Stack {
+    if (!stack_cache.free.empty()) {
+        auto s = stack_cache.free.back();
+        stack_cache.free.pop_back();
+#if VDLISP__ASAN_FIBERS
+        // frames left by the previous owner were never popped normally
+        __asan_unpoison_memory_region(static_cast<char *>(s.first) + page_size(), s.second - page_size());
+#endif
+        return Stack{s.first, s.second};
+    }
+    size_t total = stack_size() + page_size();
+    void *p = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if (p == MAP_FAILED)
+        throw std::runtime_error("coroutine: cannot allocate a stack");
+    // guard page below the stack: overflowing it faults instead of corrupting the heap
+    mprotect(p, page_size(), PROT_NONE);
+    return Stack{p, total};
+}
+
+void Coroutine::release_stack(Stack s) noexcept {
+    if (!s.base)
+        return;
+    if (stack_cache.free.size() < StackCache::kMax) {
+        stack_cache.free.emplace_back(s.base, s.size);
+        return;
+    }
+    munmap(s.base, s.size);
+}
+
+// -------------------- coroutine --------------------
+
+Coroutine::Coroutine(State &S, Value fn) : S(S), fn(std::move(fn)), ctx(new CoroContext()), caller(new CoroContext()) {}
+
+Coroutine::~Coroutine() {
+    if (started && status_ == Status::Suspended) {
+        // unwind the suspended stack so values held by its frames are released
+        cancel = true;
+        switch_in();
+    }
+    release_stack(stack);
+#if VDLISP__TSAN_FIBERS
+    if (tsan_fiber)
+        __tsan_destroy_fiber(tsan_fiber);
+#endif
+    delete ctx;
+    delete caller;
+}
+
+void Coroutine::entry(void *self) noexcept {
+    auto *co = static_cast<Coroutine *>(self);
+#if VDLISP__ASAN_FIBERS
+    __sanitizer_finish_switch_fiber(nullptr, &co->caller_bottom, &co->caller_size);
+#endif
+    try {
+        if (!co->cancel) {
+            // errors are reported at the resume that raised them, not the first one
+            co->S.current_expr = Value();
+            Value args = std::move(co->transfer);
+            co->transfer = co->S.call(co->fn, args);
+        }
+    } catch (const CoroutineCancel &) {
+        co->transfer = Value();
+    } catch (...) {
+        co->error = std::current_exception();
+        co->transfer = Value();
+    }
+    co->status_ = Status::Dead;
+#if VDLISP__ASAN_FIBERS
+    __sanitizer_start_switch_fiber(nullptr, co->caller_bottom, co->caller_size);
+#endif
+#if VDLISP__TSAN_FIBERS
+    __tsan_switch_to_fiber(co->tsan_caller, 0);
+#endif
+    ctx_switch(*co->ctx, *co->caller);
+    abort(); // a dead coroutine is never resumed
+}
+
+// Switch from the resumer onto the coroutine stack and back.
+void Coroutine::switch_in() {
+    prev = current_coroutine;
+    current_coroutine = this;
+    status_ = Status::Running;
+    State *active = jit_active_state;
+    Value expr = S.current_expr;
+    uintptr_t limit = stack_limit;
+    stack_limit = stack_limit_of(static_cast<char *>(stack.base) + page_size(), stack.size - page_size());
+#if VDLISP__TSAN_FIBERS
+    tsan_caller = __tsan_get_current_fiber();
+    if (!tsan_fiber)
+        tsan_fiber = __tsan_create_fiber(0);
+    __tsan_switch_to_fiber(tsan_fiber, 0);
+#endif
+#if VDLISP__ASAN_FIBERS
+    void *fake = nullptr;
+    __sanitizer_start_switch_fiber(&fake, static_cast<char *>(stack.base) + page_size(), stack.size - page_size());
+#endif
+    ctx_switch(*caller, *ctx);
+#if VDLISP__ASAN_FIBERS
+    __sanitizer_finish_switch_fiber(fake, nullptr, nullptr);
+#endif
+    jit_active_state = active;
+    stack_limit = limit;
+    S.current_expr = expr;
+    current_coroutine = prev;
+}
+
+// Switch from the coroutine stack back to its resumer.
+void Coroutine::switch_out() {
+    State *active = jit_active_state;
+#if VDLISP__ASAN_FIBERS
+    __sanitizer_start_switch_fiber(&fake_stack, caller_bottom, caller_size);
+#endif
+#if VDLISP__TSAN_FIBERS
+    __tsan_switch_to_fiber(tsan_caller, 0);
+#endif
+    ctx_switch(*ctx, *caller);
+#if VDLISP__ASAN_FIBERS
+    __sanitizer_finish_switch_fiber(fake_stack, &caller_bottom, &caller_size);
+#endif
+    jit_active_state = active;
+}
+
+auto Coroutine::resume(const Value &args) -> Value {
+    if (status_ == Status::Dead)
+        throw std::runtime_error("resume: coroutine is dead");
+    if (status_ == Status::Running)
+        throw std::runtime_error("resume: coroutine is already running");
+    if (!started) {
+        stack = acquire_stack();
+        ctx_make(*ctx, static_cast<char *>(stack.base) + page_size(), stack.size - page_size(), &Coroutine::entry, this);
+        started = true;
+        transfer = args;
+    } else {
+        transfer = pair_car(args);
+    }
+    switch_in();
+    if (error) {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+    Value out = std::move(transfer);
+    transfer = Value();
+    return out;
+}
+
+auto Coroutine::yield(State &S, const Value &v) -> Value {
+    Coroutine *co = current_coroutine;
+    if (!co || &co->S != &S)
+        throw std::runtime_error("yield outside of a coroutine");
+    if (co->cancel)
+        throw CoroutineCancel{};
+    co->transfer = v;
+    co->status_ = Status::Suspended;
+    co->switch_out();
+    if (co->cancel)
+        throw CoroutineCancel{};
+    Value in = std::move(co->transfer);
+    co->transfer = Value();
+    return in;
+}
+
+auto Coroutine::current() noexcept -> Coroutine * {
+    return current_coroutine;
+}
+
+auto coroutine_next(const Value &gen, Value &out) -> bool {
+    auto *co = dynamic_cast<Coroutine *>(gen.get_handle());
+    if (co->status() == Coroutine::Status::Dead)
+        return false;
+    Value v = co->resume(Value());
+    if (co->status() == Coroutine::Status::Dead)
+        return false;
+    out = std::move(v);
+    return true;
+}
+
+// -------------------- builtins --------------------
+
+static auto require_coroutine(const Value &v, const char *who) -> Coroutine * {
+    auto *co = v.get_type() == THANDLE ? dynamic_cast<Coroutine *>(v.get_handle()) : nullptr;
+    if (!co)
+        throw std::runtime_error(std::string(who) + " requires a coroutine");
+    return co;
+}
+
+void register_coroutines(State &S) {
+    // (coroutine f): a suspended coroutine that will run f on its own stack
+    S.register_builtin("coroutine", [](State &S, const Value &args) -> Value {
+        Value fn = pair_car(args);
+        if (!fn || (fn.get_type() != TFUNC && fn.get_type() != TCFUNC))
+            throw std::runtime_error("coroutine requires a function");
+        return S.make_handle(new Coroutine(S, fn));
+    });
+    // (resume c args...): run c until it yields or returns; the first resume
+    // passes args to f, later ones make the first arg the value of `yield`
+    S.register_builtin("resume", [](State &, const Value &args) -> Value {
+        return require_coroutine(pair_car(args), "resume")->resume(pair_cdr(args));
+    });
+    // (yield [v]): suspend the running coroutine, handing v to its resumer
+    S.register_builtin("yield", [](State &S, const Value &args) -> Value {
+        return Coroutine::yield(S, pair_car(args));
+    });
+    S.register_builtin("coroutine-done?", [](State &S, const Value &args) -> Value {
+        Coroutine *co = require_coroutine(pair_car(args), "coroutine-done?");
+        return co->status() == Coroutine::Status::Dead ? S.get_bound("#t", S.global) : Value();
+    });
+}
+
+} // namespace vdlisp
@@ -0,0 +1,135 @@
+#ifndef VDLISP__COROUTINE_HPP
+#define VDLISP__COROUTINE_HPP
+
+#include "persistent.hpp"
+#include "vdlisp.hpp"
+#include <cstddef>
+#include <exception>
+#include <stdexcept>
+#include <string>
+
+namespace vdlisp {
+
+// Saved machine context of a suspended stack. On x86-64 this is just the
+// stack pointer (callee-saved registers live on the stack, see
+// coroutine.cpp); elsewhere it wraps a ucontext_t.
+struct CoroContext;
+
+// A stackful coroutine running `fn` on its own mmap'd stack inside one State.
+//
+// `resume` switches onto the coroutine's stack until it calls `yield` or
+// returns; errors raised inside are rethrown by `resume`. A coroutine that is
+// destroyed while suspended is cancelled: its stack is unwound (running the
+// C++ destructors that drop its references) before the memory is released.
+// Coroutines belong to their State and thread and cannot be transferred.
+class Coroutine : public HandleData {
+  public:
+    enum class Status { Suspended, Running, Dead };
+
+    Coroutine(State &S, Value fn);
+    ~Coroutine() override;
+    [[nodiscard]] auto type_name() const -> const char * override { return "coroutine"; }
+
+    // Run until the next yield (returns the yielded value) or until `fn`
+    // returns (returns its result and the coroutine becomes Dead). The first
+    // resume passes `args` to `fn`; later ones make `args`' first element the
+    // value of the pending `yield`.
+    auto resume(const Value &args) -> Value;
+    // Suspend the running coroutine of this thread; returns the next resume value.
+    static auto yield(State &S, const Value &v) -> Value;
+    // Coroutine running on this thread, nullptr outside of any.
+    [[nodiscard]] static auto current() noexcept -> Coroutine *;
+    [[nodiscard]] auto status() const noexcept -> Status { return status_; }
+
+  private:
+    struct Stack {
+        void *base = nullptr; // lowest mapped address (guard page)
+        size_t size = 0;
+    };
+    static auto acquire_stack() -> Stack;
+    static void release_stack(Stack s) noexcept;
+    [[noreturn]] static void entry(void *self) noexcept;
+    void switch_in();
+    void switch_out();
+
+    State &S;
+    Value fn;
+    Value transfer; // value passed by resume / yield / return
+    Stack stack;
+    CoroContext *ctx = nullptr;    // this coroutine
+    CoroContext *caller = nullptr; // whoever resumed it last
+    Coroutine *prev = nullptr;     // coroutine running before the last resume
+    Status status_ = Status::Suspended;
+    bool started = false;
+    bool cancel = false;
+    std::exception_ptr error;
+    // sanitizer fiber bookkeeping (unused in regular builds)
+    void *fake_stack = nullptr;
+    const void *caller_bottom = nullptr;
+    size_t caller_size = 0;
+    void *tsan_fiber = nullptr;
+    void *tsan_caller = nullptr;
+};
+
+// Advance `gen` if it is a coroutine: true with the next yielded value in
+// `out`, false once it has returned. Used to iterate generators.
+[[nodiscard]] auto coroutine_next(const Value &gen, Value &out) -> bool;
+
+// A native handle producing values one at a time (the lines of a file, see
+// files.hpp); iterated like a generator.
+class ItemStream : public HandleData {
+  public:
+    // true with the next value in `out`, false at the end
+    [[nodiscard]] virtual auto next(Value &out) -> bool = 0;
+};
+
+// Call `fn` on every element of a list, vector or pvector, or on every value yielded
+// by a coroutine (its final return value is not an element) or an ItemStream.
+// `who` names the builtin in the error raised for other values.
+template <class Fn>
+void for_each_item(const Value &seq, const char *who, Fn &&fn) {
+    if (seq.get_type() == THANDLE && dynamic_cast<Coroutine *>(seq.get_handle())) {
+        Value v;
+        while (coroutine_next(seq, v))
+            fn(v);
+        return;
+    }
+    if (seq.get_type() == THANDLE) {
+        if (auto *stream = dynamic_cast<ItemStream *>(seq.get_handle())) {
+            Value hold = seq;
+            Value v;
+            while (stream->next(v))
+                fn(v);
+            return;
+        }
+    }
+    if (seq.get_type() == TVECTOR) {
+        // by index: `fn` may push onto the vector
+        VectorData *vd = seq.get_vector();
+        for (size_t i = 0; i < vd->items.size(); ++i) {
+            Value v = vd->items[i];
+            fn(v);
+        }
+        return;
+    }
+    if (seq.get_type() == TPVECTOR) {
+        // hold the version: `fn` may drop the caller's reference
+        Value hold = seq;
+        hold.get_pvector()->for_each(fn);
+        return;
+    }
+    Value cur = seq;
+    while (cur.get_type() == TPAIR) {
+        fn(cur.get_pair()->car);
+        cur = cur.get_pair()->cdr;
+    }
+    if (cur)
+        throw std::runtime_error(std::string(who) + ": expected list, got " + (seq ? seq.type_name() : std::string("nil")));
+}
+
+// coroutine / resume / yield / coroutine-done? builtins
+void register_coroutines(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__COROUTINE_HPP
@@ -0,0 +1,379 @@
+#include "csv.hpp"
+#include "f64array.hpp"
+#include "helpers.hpp"
+#include "strings.hpp"
+#include "table.hpp"
+#include "workers.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#define VDLISP__CSV_X86 1
+#include <immintrin.h>
+#endif
+
+namespace vdlisp {
+
+namespace {
+
+// Files with at least this many bytes of records (and no quotes) are parsed in
+// chunks of about kCsvChunk bytes on the worker pool.
+constexpr size_t kParallelCsv = 4 * 1024 * 1024;
+constexpr size_t kCsvChunk = 1024 * 1024;
+
+// -------------------- field splitting --------------------
+
+// Bit i set when byte i of the 64 at `p` is `sep`, '\n' or '"': the only
+// bytes that end or quote a field ('\r' is trimmed at the line end).
+using MaskFn = uint64_t (*)(const char *p, char sep) noexcept;
+
+auto mask_scalar(const char *p, char sep) noexcept -> uint64_t {
+    uint64_t bits = 0;
+    for (unsigned i = 0; i < 64; ++i)
+        bits |= static_cast<uint64_t>(p[i] == sep || p[i] == '\n' || p[i] == '"') << i;
+    return bits;
+}
+
+#if VDLISP__CSV_X86
+__attribute__((target("avx2"))) auto mask_avx2(const char *p, char sep) noexcept -> uint64_t {
+    const __m256i s = _mm256_set1_epi8(sep);
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i q = _mm256_set1_epi8('"');
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 32));
+    __m256i ha = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(a, s), _mm256_cmpeq_epi8(a, nl)), _mm256_cmpeq_epi8(a, q));
+    __m256i hb = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(b, s), _mm256_cmpeq_epi8(b, nl)), _mm256_cmpeq_epi8(b, q));
+    return static_cast<uint32_t>(_mm256_movemask_epi8(ha)) |
+           static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(hb))) << 32;
+}
+#endif
+
+auto pick_mask() noexcept -> MaskFn {
+#if VDLISP__CSV_X86
+    const char *env = std::getenv("VDLISP__SIMD");
+    __builtin_cpu_init();
+    if (!(env && std::strcmp(env, "scalar") == 0) && __builtin_cpu_supports("avx2"))
+        return mask_avx2;
+#endif
+    return mask_scalar;
+}
+
+// A field: bytes [off, off + len) of the file, without its quotes. `escaped`
+// when it holds "" pairs standing for one quote each.
+struct Field {
+    size_t off = 0;
+    uint32_t len = 0;
+    bool escaped = false;
+};
+
+// Splits the records in [begin, end) of `text` into fields. `end` must be a
+// record boundary (or the end of the text).
+class Tokenizer {
+  public:
+    Tokenizer(std::string_view text, size_t begin, size_t end, char sep, const std::string &path)
+        : text_(text), end_(end), sep_(sep), path_(path), pos_(begin), base_(begin) {
+        static const MaskFn mask = pick_mask();
+        mask_ = mask;
+        load();
+    }
+
+    // The fields of the next record in `out`; false when none is left. Blank
+    // lines are skipped.
+    auto next(std::vector<Field> &out) -> bool {
+        out.clear();
+        const char *p = text_.data();
+        size_t start = pos_;
+        record_ = pos_;
+        size_t quote_end = npos; // closing quote of the current field
+        bool escaped = false;
+        if (start >= end_)
+            return false;
+        for (;;) {
+            size_t k = advance();
+            char c = k < end_ ? p[k] : '\n';
+            if (c == '"') {
+                if (quote_end != npos)
+                    fail(k, "text after closing quote");
+                if (k != start)
+                    continue; // a quote inside an unquoted field is data
+                for (;;) {
+                    size_t q = advance();
+                    if (q >= end_)
+                        fail(start, "unterminated quoted field");
+                    if (p[q] != '"')
+                        continue;
+                    if (q + 1 < end_ && p[q + 1] == '"') {
+                        (void)advance();
+                        escaped = true;
+                        continue;
+                    }
+                    quote_end = q;
+                    break;
+                }
+                continue;
+            }
+            size_t stop = k;
+            if (c == '\n' && stop > start && p[stop - 1] == '\r')
+                --stop;
+            if (stop - start > std::numeric_limits<uint32_t>::max())
+                fail(start, "field too long");
+            Field f;
+            if (quote_end != npos) {
+                if (stop != quote_end + 1)
+                    fail(quote_end + 1, "text after closing quote");
+                f = Field{start + 1, static_cast<uint32_t>(quote_end - start - 1), escaped};
+            } else {
+                f = Field{start, static_cast<uint32_t>(stop - start), false};
+            }
+            start = k + 1;
+            if (c == '\n' && out.empty() && f.len == 0 && quote_end == npos) {
+                record_ = pos_ = std::min(start, end_);
+                if (start >= end_)
+                    return false;
+                continue;
+            }
+            out.push_back(f);
+            quote_end = npos;
+            escaped = false;
+            if (c == '\n') {
+                pos_ = std::min(start, end_);
+                return true;
+            }
+        }
+    }
+
+    // where the next record starts
+    [[nodiscard]] auto pos() const noexcept -> size_t { return pos_; }
+
+    // Error for the record last returned by next.
+    [[noreturn]] void fail_record(const std::string &what) const { fail(record_, what); }
+
+  private:
+    static constexpr size_t npos = std::string_view::npos;
+
+    // the next byte from mask_ at or after the last one, or end_
+    auto advance() noexcept -> size_t {
+        while (!bits_) {
+            base_ += 64;
+            if (base_ >= end_)
+                return end_;
+            load();
+        }
+        size_t k = base_ + static_cast<size_t>(__builtin_ctzll(bits_));
+        bits_ &= bits_ - 1;
+        return k < end_ ? k : end_;
+    }
+
+    void load() noexcept {
+        if (base_ >= end_) {
+            bits_ = 0;
+        } else if (base_ + 64 <= text_.size()) {
+            bits_ = mask_(text_.data() + base_, sep_);
+        } else {
+            char tail[64] = {};
+            std::memcpy(tail, text_.data() + base_, text_.size() - base_);
+            bits_ = mask_(tail, sep_) & ((uint64_t{1} << (text_.size() - base_)) - 1);
+        }
+    }
+
+    [[noreturn]] void fail(size_t at, const std::string &what) const {
+        size_t line = 1 + static_cast<size_t>(std::count(text_.data(), text_.data() + at, '\n'));
+        throw std::runtime_error("read-csv: " + path_ + ": line " + std::to_string(line) + ": " + what);
+    }
+
+    std::string_view text_;
+    size_t end_;
+    char sep_;
+    const std::string &path_;
+    MaskFn mask_;
+    size_t pos_;
+    size_t record_ = 0;
+    size_t base_;      // offset of the 64 bytes in bits_
+    uint64_t bits_ = 0; // their field bytes not yet returned by advance
+};
+
+// -------------------- columns --------------------
+
+// The records in [begin, end) of the file, column by column. A column is
+// `numeric` when every field is a number or empty (NaN in `nums`).
+struct Chunk {
+    size_t begin = 0;
+    size_t end = 0;
+    size_t rows = 0;
+    std::vector<std::vector<Field>> cols;
+    std::vector<std::vector<double>> nums;
+    std::vector<char> numeric;
+    std::vector<size_t> numbers; // non-empty fields per numeric column
+};
+
+// `f` as a finite number (as string->number reads it), NaN when empty; false
+// when it is neither ("nan" and "inf" stay text: NaN marks a missing value).
+auto parse_number(std::string_view text, const Field &f, double &out) noexcept -> bool {
+    if (f.escaped)
+        return false;
+    const char *b = text.data() + f.off, *e = b + f.len;
+    while (b < e && (*b == ' ' || *b == '\t'))
+        ++b;
+    while (e > b && (e[-1] == ' ' || e[-1] == '\t'))
+        --e;
+    if (b == e) {
+        out = std::numeric_limits<double>::quiet_NaN();
+        return true;
+    }
+    if (*b == '+')
+        ++b;
+    auto res = std::from_chars(b, e, out);
+    return b != e && res.ec == std::errc() && res.ptr == e && std::isfinite(out);
+}
+
+// Split chunk `c` into `ncols` columns and read its numbers. Touches no
+// Values: it runs on pool threads.
+void parse_chunk(std::string_view text, char sep, size_t ncols, const std::string &path, Chunk &c) {
+    c.cols.assign(ncols, {});
+    Tokenizer tok(text, c.begin, c.end, sep, path);
+    std::vector<Field> record;
+    while (tok.next(record)) {
+        if (record.size() > ncols)
+            tok.fail_record(std::to_string(record.size()) + " fields, expected " + std::to_string(ncols));
+        for (size_t j = 0; j < ncols; ++j)
+            c.cols[j].push_back(j < record.size() ? record[j] : Field{});
+        ++c.rows;
+    }
+    c.nums.assign(ncols, {});
+    c.numeric.assign(ncols, 1);
+    c.numbers.assign(ncols, 0);
+    for (size_t j = 0; j < ncols; ++j) {
+        std::vector<double> &nums = c.nums[j];
+        nums.resize(c.rows);
+        for (size_t i = 0; i < c.rows; ++i) {
+            const Field &f = c.cols[j][i];
+            if (!parse_number(text, f, nums[i])) {
+                c.numeric[j] = 0;
+                std::vector<double>().swap(nums);
+                break;
+            }
+            c.numbers[j] += f.len != 0;
+        }
+    }
+}
+
+auto field_value(State &S, const Value &text, const Field &f) -> Value {
+    if (!f.escaped)
+        return S.make_string_slice(text, f.off, f.len);
+    std::string_view raw = text.get_string_view().substr(f.off, f.len);
+    std::string s;
+    s.reserve(raw.size());
+    for (size_t i = 0; i < raw.size(); ++i) {
+        s += raw[i];
+        if (raw[i] == '"')
+            ++i; // the second of a "" pair
+    }
+    return S.make_string(std::move(s));
+}
+
+// Chunks of about kCsvChunk bytes covering [begin, size), split after line
+// ends. One chunk for small files and files with quotes (a quoted field may
+// hold a newline).
+auto split_chunks(std::string_view text, size_t begin) -> std::vector<Chunk> {
+    size_t n = text.size() - begin;
+    size_t count = 1;
+    if (n >= kParallelCsv && !std::memchr(text.data() + begin, '"', n))
+        count = std::min(n / kCsvChunk, 4 * (WorkerPool::instance().size() + 1));
+    std::vector<Chunk> chunks(count);
+    size_t at = begin;
+    for (size_t i = 0; i < count; ++i) {
+        chunks[i].begin = at;
+        if (i + 1 < count) {
+            size_t want = std::max(at, begin + n / count * (i + 1));
+            const void *nl = std::memchr(text.data() + want, '\n', text.size() - want);
+            at = nl ? static_cast<size_t>(static_cast<const char *>(nl) - text.data()) + 1 : text.size();
+        } else {
+            at = text.size();
+        }
+        chunks[i].end = at;
+    }
+    return chunks;
+}
+
+auto require_path(const Value &v) -> std::string {
+    if (!v || v.get_type() != TSTRING)
+        throw std::runtime_error("read-csv: expected string, got " + type_name(v));
+    return std::string(v.get_string_view());
+}
+
+} // namespace
+
+void register_csv(State &S) {
+    // (read-csv path [sep [header]]): see csv.hpp
+    S.register_builtin("read-csv", [](State &S, const Value &args) -> Value {
+        std::string path = require_path(pair_car(args));
+        Value rest = pair_cdr(args);
+        char sep = path.size() >= 4 && path.compare(path.size() - 4, 4, ".tsv") == 0 ? '\t' : ',';
+        if (Value s = pair_car(rest)) {
+            std::string_view sv = s.get_type() == TSTRING ? s.get_string_view() : std::string_view();
+            if (sv.size() != 1 || sv[0] == '"' || sv[0] == '\n' || sv[0] == '\r')
+                throw std::runtime_error("read-csv: separator must be one character other than a quote or newline");
+            sep = sv[0];
+        }
+        bool header = !is_pair(pair_cdr(rest)) || static_cast<bool>(pair_car(pair_cdr(rest)));
+
+        Value text = read_file(S, path, "read-csv");
+        std::string_view sv = text.get_string_view();
+        Value table = S.make_table();
+        std::vector<Field> first;
+        Tokenizer tok(sv, 0, sv.size(), sep, path);
+        if (!tok.next(first))
+            return table;
+        size_t ncols = first.size();
+
+        std::vector<Chunk> chunks = split_chunks(sv, header ? tok.pos() : 0);
+        if (chunks.size() == 1)
+            parse_chunk(sv, sep, ncols, path, chunks[0]);
+        else
+            parallel_chunks(S, chunks.size(), [&](size_t c) { parse_chunk(sv, sep, ncols, path, chunks[c]); });
+
+        size_t rows = 0;
+        for (const Chunk &c : chunks)
+            rows += c.rows;
+        TableData *t = table.get_table();
+        for (size_t j = 0; j < ncols; ++j) {
+            bool numeric = true;
+            size_t numbers = 0;
+            for (const Chunk &c : chunks) {
+                numeric = numeric && c.numeric[j];
+                numbers += c.numbers[j];
+            }
+            Value column;
+            if (numeric && numbers > 0) {
+                column = S.make_f64array(rows);
+                double *out = column.get_f64array()->data();
+                for (const Chunk &c : chunks)
+                    out = std::copy(c.nums[j].begin(), c.nums[j].end(), out);
+            } else {
+                std::vector<Value> items;
+                items.reserve(rows);
+                for (const Chunk &c : chunks)
+                    for (const Field &f : c.cols[j])
+                        items.push_back(field_value(S, text, f));
+                column = S.make_vector(std::move(items));
+            }
+            Value name = header ? field_value(S, text, first[j]) : S.make_number(static_cast<double>(j));
+            if (t->find(name))
+                throw std::runtime_error("read-csv: " + path + ": duplicate column name " +
+                                         std::string(name.get_string_view()));
+            t->set(name, std::move(column));
+        }
+        return table;
+    });
+}
+
+} // namespace vdlisp
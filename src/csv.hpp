@@ -0,0 +1,26 @@
+#ifndef VDLISP__CSV_HPP
+#define VDLISP__CSV_HPP
+
+namespace vdlisp {
+
+class State;
+
+// (read-csv path [sep [header]]): a delimited file as a table of columns, in
+// file order. `sep` is a one-character string, "," by default ("\t" for a
+// .tsv path); with `header` (the default) the first record names the
+// columns, otherwise they are numbered from 0. A column whose fields are all
+// numbers (or empty: NaN, a missing value that f64-ref reads as nil) becomes
+// an f64array, any other a vector of strings sharing one copy of the file's
+// bytes. Fields may be quoted as in RFC 4180 ("" for a quote, separators and
+// newlines inside quotes); CRLF line ends and blank
+// lines are accepted, short records are padded with empty fields and a record
+// with too many is an error, as is a header naming a column twice.
+//
+// Field boundaries are found with AVX2 64 bytes at a time when the CPU has it
+// (see VDLISP__SIMD), numbers are read with from_chars, and large files
+// without quotes are split at line ends and parsed on the worker pool.
+void register_csv(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__CSV_HPP
@@ -0,0 +1,870 @@
+#include "event.hpp"
+#include "bytes.hpp"
+#include "coroutine.hpp"
+#include "helpers.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define VDLISP__HAVE_IO_URING 1
+#else
+#define VDLISP__HAVE_IO_URING 0
+#endif
+
+namespace vdlisp {
+
+namespace {
+
+auto wants_input(const IoOp *op) -> bool {
+    return op->kind == IoOp::Kind::Read || op->kind == IoOp::Kind::Accept || op->kind == IoOp::Kind::PollIn;
+}
+
+auto is_poll(const IoOp *op) -> bool {
+    return op->kind == IoOp::Kind::PollIn || op->kind == IoOp::Kind::PollOut;
+}
+
+// Attempt `op` with a plain non-blocking syscall: result or -errno.
+auto try_now(IoOp *op) -> int64_t {
+    for (;;) {
+        ssize_t r = 0;
+        switch (op->kind) {
+        case IoOp::Kind::Read:
+            r = ::read(op->fd, op->buf, op->len);
+            break;
+        case IoOp::Kind::Write:
+            r = ::write(op->fd, op->buf, op->len);
+            break;
+        case IoOp::Kind::Accept:
+            r = ::accept4(op->fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            break;
+        case IoOp::Kind::PollIn:
+        case IoOp::Kind::PollOut:
+            return -EAGAIN; // readiness is reported by the backend
+        }
+        if (r >= 0)
+            return r;
+        if (errno != EINTR)
+            return errno == EWOULDBLOCK ? -EAGAIN : -errno;
+    }
+}
+
+// -------------------- epoll --------------------
+
+// Readiness-based backend: ops are tried immediately and queued per fd and
+// direction when they would block. Interest is level-triggered and tracks
+// which queues are non-empty.
+class EpollBackend final : public IoBackend {
+  public:
+    EpollBackend() : epfd(::epoll_create1(EPOLL_CLOEXEC)) {
+        if (epfd < 0)
+            throw std::runtime_error(std::string("event loop: epoll_create1: ") + std::strerror(errno));
+    }
+    ~EpollBackend() override { ::close(epfd); }
+    EpollBackend(const EpollBackend &) = delete;
+    EpollBackend &operator=(const EpollBackend &) = delete;
+
+    [[nodiscard]] auto name() const -> const char * override { return "epoll"; }
+    [[nodiscard]] auto pending() const -> size_t override { return count; }
+
+    void submit(IoOp *op, std::vector<IoOp *> &done) override {
+        if (op->kind == IoOp::Kind::Read || op->kind == IoOp::Kind::Write)
+            make_nonblocking(op->fd);
+        int64_t r = try_now(op);
+        if (r != -EAGAIN) {
+            op->result = r;
+            done.push_back(op);
+            return;
+        }
+        Waiters &w = fds[op->fd];
+        (wants_input(op) ? w.in : w.out).push_back(op);
+        ++count;
+        update(op->fd, done);
+    }
+
+    void wait(int timeout_ms, std::vector<IoOp *> &done) override {
+        epoll_event events[64];
+        int n = ::epoll_wait(epfd, events, 64, timeout_ms);
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            auto it = fds.find(fd);
+            if (it == fds.end())
+                continue;
+            uint32_t ev = events[i].events;
+            if (ev & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                drain(it->second.in, done);
+            if (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+                drain(it->second.out, done);
+            update(fd, done);
+        }
+    }
+
+    void cancel(IoOp *op, std::vector<IoOp *> &) override {
+        auto it = fds.find(op->fd);
+        if (it == fds.end())
+            return;
+        for (auto *q : {&it->second.in, &it->second.out}) {
+            auto pos = std::find(q->begin(), q->end(), op);
+            if (pos != q->end()) {
+                q->erase(pos);
+                --count;
+            }
+        }
+        std::vector<IoOp *> none;
+        update(op->fd, none);
+    }
+
+    void cancel_fd(int fd, std::vector<IoOp *> &done) override {
+        // the fd is being closed; a new one with its number starts unchecked
+        nonblocking.erase(fd);
+        auto it = fds.find(fd);
+        if (it == fds.end())
+            return;
+        for (auto *q : {&it->second.in, &it->second.out}) {
+            for (IoOp *op : *q) {
+                op->result = -ECANCELED;
+                done.push_back(op);
+                --count;
+            }
+            q->clear();
+        }
+        update(fd, done);
+    }
+
+  private:
+    // Ops are tried with plain read/write first, which must not block the
+    // whole loop: fds the loop did not open (stdin, inherited ones) are
+    // switched to O_NONBLOCK on first use. The flag belongs to the open file
+    // description, so other holders of it see the change too.
+    void make_nonblocking(int fd) {
+        if (!nonblocking.insert(fd).second)
+            return;
+        int fl = ::fcntl(fd, F_GETFL);
+        if (fl >= 0 && !(fl & O_NONBLOCK))
+            (void)::fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+    }
+
+    struct Waiters {
+        std::deque<IoOp *> in, out;
+        uint32_t mask = 0; // registered interest
+    };
+
+    // Retry queued ops in order until one would block again.
+    void drain(std::deque<IoOp *> &q, std::vector<IoOp *> &done) {
+        while (!q.empty()) {
+            IoOp *op = q.front();
+            int64_t r = is_poll(op) ? 0 : try_now(op);
+            if (r == -EAGAIN)
+                return;
+            op->result = r;
+            q.pop_front();
+            --count;
+            done.push_back(op);
+        }
+    }
+
+    void update(int fd, std::vector<IoOp *> &done) {
+        auto it = fds.find(fd);
+        Waiters &w = it->second;
+        uint32_t want = (w.in.empty() ? 0 : EPOLLIN) | (w.out.empty() ? 0 : EPOLLOUT);
+        if (want == w.mask) {
+            if (!want)
+                fds.erase(it);
+            return;
+        }
+        epoll_event ev{};
+        ev.events = want;
+        ev.data.fd = fd;
+        int rc = !want ? ::epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr)
+                       : ::epoll_ctl(epfd, w.mask ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+        if (!want) {
+            fds.erase(it);
+            return;
+        }
+        if (rc < 0) {
+            // the fd cannot be watched, so its queued ops would never be woken:
+            // complete them now. EPERM: regular files cannot be polled and are
+            // always ready, so the op itself is simply done.
+            int err = errno;
+            if (w.mask)
+                (void)::epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+            for (auto *q : {&w.in, &w.out}) {
+                for (IoOp *op : *q) {
+                    if (err == EPERM)
+                        op->result = is_poll(op) ? 0 : try_now(op);
+                    else
+                        op->result = -err;
+                    done.push_back(op);
+                    --count;
+                }
+            }
+            fds.erase(it);
+            return;
+        }
+        w.mask = want;
+    }
+
+    int epfd;
+    std::unordered_map<int, Waiters> fds;
+    std::unordered_set<int> nonblocking; // fds make_nonblocking has seen
+    size_t count = 0;
+};
+
+// -------------------- io_uring --------------------
+
+#if VDLISP__HAVE_IO_URING
+
+// Completion-based backend on the raw io_uring syscalls (no liburing). Every
+// IoOp is one SQE whose user_data is the op itself. An op that comes back
+// with -EAGAIN (non-blocking fd not ready) is turned into a POLL_ADD and
+// reissued once the fd is ready. Wait timeouts are IORING_OP_TIMEOUT SQEs.
+class IoUringBackend final : public IoBackend {
+  public:
+    // nullptr when the kernel (or a seccomp policy) does not provide io_uring
+    // with the features used here.
+    static auto open() -> std::unique_ptr<IoBackend> {
+        io_uring_params p{};
+        int fd = static_cast<int>(::syscall(__NR_io_uring_setup, kEntries, &p));
+        if (fd < 0)
+            return nullptr;
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_FAST_POLL) ||
+            !(p.features & IORING_FEAT_NODROP)) {
+            ::close(fd);
+            return nullptr;
+        }
+        std::unique_ptr<IoUringBackend> b(new IoUringBackend(fd, p));
+        if (!b->ring || !b->sqes)
+            return nullptr;
+        return b;
+    }
+
+    ~IoUringBackend() override {
+        std::vector<IoOp *> done;
+        try {
+            std::vector<IoOp *> live(inflight.begin(), inflight.end());
+            for (IoOp *op : live)
+                cancel(op, done);
+        } catch (...) {
+        }
+        if (sqes)
+            ::munmap(sqes, sqes_size);
+        if (ring)
+            ::munmap(ring, ring_size);
+        ::close(ring_fd);
+    }
+    IoUringBackend(const IoUringBackend &) = delete;
+    IoUringBackend &operator=(const IoUringBackend &) = delete;
+
+    [[nodiscard]] auto name() const -> const char * override { return "io_uring"; }
+    [[nodiscard]] auto pending() const -> size_t override { return inflight.size(); }
+
+    void submit(IoOp *op, std::vector<IoOp *> &) override {
+        op->polling = false;
+        inflight.insert(op);
+        prep(op);
+    }
+
+    void wait(int timeout_ms, std::vector<IoOp *> &done) override {
+        if (timeout_ms == 0) {
+            enter(0, 0);
+        } else {
+            if (timeout_ms > 0) {
+                io_uring_sqe *e = get_sqe();
+                e->opcode = IORING_OP_TIMEOUT;
+                timeout.tv_sec = timeout_ms / 1000;
+                timeout.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+                e->addr = reinterpret_cast<uint64_t>(&timeout);
+                e->len = 1;
+                e->off = 1; // also complete on the first other completion
+                e->user_data = kTimeoutTag;
+            }
+            enter(1, IORING_ENTER_GETEVENTS);
+        }
+        reap(done);
+    }
+
+    void cancel(IoOp *op, std::vector<IoOp *> &done) override {
+        if (!inflight.count(op))
+            return;
+        cancelling.insert(op);
+        io_uring_sqe *e = get_sqe();
+        e->opcode = IORING_OP_ASYNC_CANCEL;
+        e->fd = -1;
+        e->addr = reinterpret_cast<uint64_t>(op);
+        e->user_data = kCancelTag;
+        // the op's buffer must stay valid until the kernel has let go of it
+        while (inflight.count(op)) {
+            enter(1, IORING_ENTER_GETEVENTS);
+            reap(done);
+        }
+        cancelling.erase(op);
+    }
+
+    void cancel_fd(int fd, std::vector<IoOp *> &done) override {
+        std::vector<IoOp *> ops;
+        for (IoOp *op : inflight)
+            if (op->fd == fd)
+                ops.push_back(op);
+        for (IoOp *op : ops)
+            cancel(op, done);
+    }
+
+  private:
+    static constexpr unsigned kEntries = 256;
+    static constexpr uint64_t kTimeoutTag = 1;
+    static constexpr uint64_t kCancelTag = 2;
+
+    IoUringBackend(int fd, const io_uring_params &p) : ring_fd(fd) {
+        size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        ring_size = std::max(sq_size, cq_size);
+        void *r = ::mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (r == MAP_FAILED)
+            return;
+        ring = r;
+        sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+        void *s = ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (s == MAP_FAILED)
+            return;
+        sqes = static_cast<io_uring_sqe *>(s);
+        auto *base = static_cast<char *>(ring);
+        sq_head = reinterpret_cast<unsigned *>(base + p.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned *>(base + p.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned *>(base + p.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(base + p.sq_off.array);
+        sq_entries = p.sq_entries;
+        cq_head = reinterpret_cast<unsigned *>(base + p.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(base + p.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned *>(base + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(base + p.cq_off.cqes);
+        local_tail = *sq_tail;
+    }
+
+    auto get_sqe() -> io_uring_sqe * {
+        if (local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+            enter(0, 0);
+        unsigned idx = local_tail & sq_mask;
+        io_uring_sqe *e = &sqes[idx];
+        std::memset(e, 0, sizeof *e);
+        sq_array[idx] = idx;
+        ++local_tail;
+        ++unsubmitted;
+        return e;
+    }
+
+    // Publish queued SQEs and optionally wait for `min_complete` CQEs.
+    void enter(unsigned min_complete, unsigned flags) {
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        long r = ::syscall(__NR_io_uring_enter, ring_fd, unsubmitted, min_complete, flags, nullptr, 0);
+        if (r >= 0) {
+            unsubmitted -= static_cast<unsigned>(r);
+            return;
+        }
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            return; // the caller reaps and comes back
+        throw std::runtime_error(std::string("event loop: io_uring_enter: ") + std::strerror(errno));
+    }
+
+    void prep(IoOp *op) {
+        io_uring_sqe *e = get_sqe();
+        e->fd = op->fd;
+        e->user_data = reinterpret_cast<uint64_t>(op);
+        if (op->polling || is_poll(op)) {
+            e->opcode = IORING_OP_POLL_ADD;
+            e->poll32_events = wants_input(op) ? POLLIN : POLLOUT;
+            return;
+        }
+        switch (op->kind) {
+        case IoOp::Kind::Read:
+        case IoOp::Kind::Write:
+            e->opcode = op->kind == IoOp::Kind::Read ? IORING_OP_READ : IORING_OP_WRITE;
+            e->addr = reinterpret_cast<uint64_t>(op->buf);
+            e->len = static_cast<uint32_t>(std::min<size_t>(op->len, INT_MAX));
+            e->off = ~0ULL; // current file position
+            break;
+        case IoOp::Kind::Accept:
+            e->opcode = IORING_OP_ACCEPT;
+            e->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+            break;
+        default:
+            break;
+        }
+    }
+
+    void reap(std::vector<IoOp *> &done) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe &c = cqes[head & cq_mask];
+            if (c.user_data == kTimeoutTag || c.user_data == kCancelTag)
+                continue;
+            auto *op = reinterpret_cast<IoOp *>(c.user_data);
+            int64_t res = c.res;
+            bool cancelled = cancelling.count(op) != 0;
+            if (!is_poll(op)) {
+                if (op->polling) {
+                    op->polling = false;
+                    if (res >= 0 && !cancelled) {
+                        prep(op);
+                        continue;
+                    }
+                    if (res >= 0)
+                        res = -ECANCELED;
+                } else if (res == -EAGAIN && !cancelled) {
+                    op->polling = true;
+                    prep(op);
+                    continue;
+                }
+            } else if (res > 0) {
+                res = 0;
+            }
+            inflight.erase(op);
+            op->result = res;
+            done.push_back(op);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    int ring_fd;
+    void *ring = nullptr;
+    size_t ring_size = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqes_size = 0;
+    unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_array = nullptr;
+    unsigned sq_mask = 0, sq_entries = 0;
+    unsigned *cq_head = nullptr, *cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe *cqes = nullptr;
+    unsigned local_tail = 0;
+    unsigned unsubmitted = 0;
+    __kernel_timespec timeout{};
+    std::unordered_set<IoOp *> inflight;
+    std::unordered_set<IoOp *> cancelling;
+};
+
+#endif
+
+} // namespace
+
+auto IoBackend::create() -> std::unique_ptr<IoBackend> {
+#if VDLISP__HAVE_IO_URING
+    const char *want = std::getenv("VDLISP__EVENT_BACKEND");
+    if (!want || std::strcmp(want, "epoll") != 0)
+        if (auto b = IoUringBackend::open())
+            return b;
+#endif
+    return std::make_unique<EpollBackend>();
+}
+
+// -------------------- EventLoop --------------------
+
+EventLoop::EventLoop(State &S) : S(S), backend(IoBackend::create()) {}
+
+EventLoop::~EventLoop() {
+    // Cancelling a task unwinds it through `perform`, which withdraws its
+    // pending op from the backend; so tasks go first.
+    auto doomed = std::move(tasks);
+    tasks.clear();
+    doomed.clear();
+    ready.clear();
+    parked.clear();
+}
+
+auto EventLoop::current_task() -> Coroutine * {
+    Coroutine *co = Coroutine::current();
+    return co && tasks.count(co) ? co : nullptr;
+}
+
+template <class Pred>
+void EventLoop::park(Coroutine *task, Pred done) {
+    try {
+        while (!done()) {
+            parked.insert(task);
+            Coroutine::yield(S, Value());
+        }
+    } catch (...) {
+        parked.erase(task);
+        throw;
+    }
+}
+
+void EventLoop::go(const Value &fn, const Value &args) {
+    auto *co = new Coroutine(S, fn);
+    tasks.emplace(co, Task{S.make_handle(co), args});
+    ready.push_back(co);
+}
+
+void EventLoop::run() {
+    if (current_task())
+        throw std::runtime_error("run-loop: called from a task");
+    while (step()) {
+    }
+}
+
+void EventLoop::complete(std::vector<IoOp *> &done) {
+    for (IoOp *op : done) {
+        Coroutine *w = op->waiter;
+        op->waiter = nullptr;
+        op->done = true;
+        if (w && parked.erase(w))
+            ready.push_back(w);
+    }
+    done.clear();
+}
+
+void EventLoop::fire_timers() {
+    auto now = Clock::now();
+    while (!timers.empty() && timers.top().deadline <= now) {
+        Timer t = timers.top();
+        timers.pop();
+        *t.fired = true;
+        if (t.waiter && parked.erase(t.waiter))
+            ready.push_back(t.waiter);
+    }
+}
+
+void EventLoop::run_ready() {
+    std::deque<Coroutine *> batch;
+    batch.swap(ready);
+    while (!batch.empty()) {
+        Coroutine *co = batch.front();
+        batch.pop_front();
+        auto it = tasks.find(co);
+        if (it == tasks.end() || co->status() != Coroutine::Status::Suspended)
+            continue;
+        Value keep = it->second.handle;
+        Value args = std::move(it->second.args);
+        it->second.args = Value();
+        try {
+            co->resume(args);
+        } catch (...) {
+            tasks.erase(co);
+            parked.erase(co);
+            ready.insert(ready.begin(), batch.begin(), batch.end());
+            throw;
+        }
+        if (co->status() == Coroutine::Status::Dead)
+            tasks.erase(co);
+        else if (!parked.count(co))
+            ready.push_back(co); // plain (yield): runs again next round
+    }
+}
+
+auto EventLoop::step() -> bool {
+    std::vector<IoOp *> done;
+    if (!ready.empty()) {
+        run_ready();
+        if (backend->pending()) {
+            backend->wait(0, done);
+            complete(done);
+        }
+        fire_timers();
+        return true;
+    }
+    fire_timers();
+    if (!ready.empty())
+        return true;
+    if (timers.empty() && !backend->pending())
+        return false;
+    int timeout = -1;
+    if (!timers.empty()) {
+        auto left = std::chrono::duration<double, std::milli>(timers.top().deadline - Clock::now()).count();
+        timeout = static_cast<int>(std::clamp(std::ceil(left), 0.0, static_cast<double>(INT_MAX)));
+    }
+    // about to block: what the tasks printed so far goes out first
+    S.flush_out();
+    backend->wait(timeout, done);
+    complete(done);
+    fire_timers();
+    return true;
+}
+
+auto EventLoop::perform(IoOp &op) -> int64_t {
+    std::vector<IoOp *> done;
+    backend->submit(&op, done);
+    complete(done);
+    if (op.done)
+        return op.result;
+    Coroutine *task = current_task();
+    op.waiter = task;
+    try {
+        if (task) {
+            park(task, [&op] { return op.done; });
+        } else {
+            while (!op.done)
+                if (!step())
+                    throw std::runtime_error("event loop stalled");
+        }
+    } catch (...) {
+        if (!op.done) {
+            op.waiter = nullptr;
+            backend->cancel(&op, done);
+            complete(done);
+        }
+        throw;
+    }
+    return op.result;
+}
+
+void EventLoop::sleep(double ms) {
+    auto fired = std::make_shared<bool>(false);
+    Coroutine *task = current_task();
+    auto delay = std::chrono::duration<double, std::milli>(std::max(0.0, ms));
+    timers.push(Timer{Clock::now() + std::chrono::duration_cast<Clock::duration>(delay), timer_seq++, task, fired});
+    if (task) {
+        park(task, [&fired] { return *fired; });
+        return;
+    }
+    while (!*fired)
+        step();
+}
+
+void EventLoop::close_fd(int fd) {
+    std::vector<IoOp *> done;
+    backend->cancel_fd(fd, done);
+    complete(done);
+    ::close(fd);
+}
+
+auto event_loop(State &S) -> EventLoop & {
+    if (!S.event_loop)
+        S.event_loop = std::make_unique<EventLoop>(S);
+    return *S.event_loop;
+}
+
+// -------------------- builtins --------------------
+
+namespace {
+
+auto require_fd(const Value &v, const char *who) -> int {
+    double d = require_number(v, who);
+    if (d < 0 || d > INT_MAX || d != std::floor(d))
+        throw std::runtime_error(std::string(who) + ": invalid file descriptor");
+    return static_cast<int>(d);
+}
+
+void require_string_type(const Value &v, const char *who) {
+    if (!v || v.get_type() != TSTRING)
+        throw std::runtime_error(std::string(who) + ": expected string, got " + type_name(v));
+}
+
+auto require_str(const Value &v, const char *who) -> const std::string & {
+    require_string_type(v, who);
+    return *v.get_string();
+}
+
+[[noreturn]] void sys_error(const char *who, int64_t err) {
+    throw std::runtime_error(std::string(who) + ": " + std::strerror(static_cast<int>(err)));
+}
+
+auto run_op(State &S, IoOp::Kind kind, int fd, void *buf, size_t len, const char *who) -> int64_t {
+    IoOp op;
+    op.kind = kind;
+    op.fd = fd;
+    op.buf = buf;
+    op.len = len;
+    int64_t r = event_loop(S).perform(op);
+    if (r < 0)
+        sys_error(who, -r);
+    return r;
+}
+
+auto unix_address(const std::string &path, const char *who) -> sockaddr_un {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error(std::string(who) + ": invalid socket path");
+    std::memcpy(addr.sun_path, path.data(), path.size());
+    return addr;
+}
+
+auto unix_socket(const char *who) -> int {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        sys_error(who, errno);
+    return fd;
+}
+
+} // namespace
+
+void register_events(State &S) {
+    // (go f args...): start (f args...) as a task of the event loop. Tasks run
+    // when the loop runs: from run-loop, or while any I/O builtin or sleep
+    // called outside a task waits. Returns nil (tasks have no handle; report
+    // results through a variable or a channel).
+    S.register_builtin("go", [](State &S, const Value &args) -> Value {
+        Value fn = pair_car(args);
+        if (!fn || (fn.get_type() != TFUNC && fn.get_type() != TCFUNC))
+            throw std::runtime_error("go requires a function");
+        event_loop(S).go(fn, pair_cdr(args));
+        return {};
+    });
+    // (run-loop): run tasks until all of them have finished
+    S.register_builtin("run-loop", [](State &S, const Value &) -> Value {
+        event_loop(S).run();
+        return {};
+    });
+    // (sleep ms): inside a task, let the other tasks run meanwhile
+    S.register_builtin("sleep", [](State &S, const Value &args) -> Value {
+        event_loop(S).sleep(require_number(pair_car(args), "sleep"));
+        return {};
+    });
+    S.register_builtin("event-backend", [](State &S, const Value &) -> Value {
+        return S.make_string(event_loop(S).backend_name());
+    });
+    // (pipe): (read-fd write-fd), both non-blocking
+    S.register_builtin("pipe", [](State &S, const Value &) -> Value {
+        int fds[2];
+        if (::pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0)
+            sys_error("pipe", errno);
+        return S.make_pair(S.make_number(fds[0]), S.make_pair(S.make_number(fds[1]), Value()));
+    });
+    // (fd-open path [mode]): mode is "r" (default), "w" (truncate), "a" or
+    // "rw"; opened non-blocking, like the ends of a pipe
+    S.register_builtin("fd-open", [](State &S, const Value &args) -> Value {
+        const std::string &path = require_str(pair_car(args), "fd-open");
+        Value m = pair_car(pair_cdr(args));
+        std::string mode = m ? require_str(m, "fd-open") : std::string("r");
+        int flags = O_CLOEXEC | O_NONBLOCK;
+        if (mode == "r")
+            flags |= O_RDONLY;
+        else if (mode == "w")
+            flags |= O_WRONLY | O_CREAT | O_TRUNC;
+        else if (mode == "a")
+            flags |= O_WRONLY | O_CREAT | O_APPEND;
+        else if (mode == "rw")
+            flags |= O_RDWR | O_CREAT;
+        else
+            throw std::runtime_error("fd-open: invalid mode " + mode);
+        int fd = ::open(path.c_str(), flags, 0666);
+        if (fd < 0)
+            throw std::runtime_error("fd-open: " + path + ": " + std::strerror(errno));
+        return S.make_number(fd);
+    });
+    // (fd-read fd [max]): up to max bytes (default 65536) as a string, nil at end of file
+    S.register_builtin("fd-read", [](State &S, const Value &args) -> Value {
+        int fd = require_fd(pair_car(args), "fd-read");
+        Value m = pair_car(pair_cdr(args));
+        double max = m ? require_number(m, "fd-read") : 65536;
+        if (max < 1 || max > INT_MAX)
+            throw std::runtime_error("fd-read: invalid size");
+        std::string buf(static_cast<size_t>(max), '\0');
+        int64_t n = run_op(S, IoOp::Kind::Read, fd, buf.data(), buf.size(), "fd-read");
+        if (n == 0)
+            return {};
+        buf.resize(static_cast<size_t>(n));
+        return S.make_string(buf);
+    });
+    // (fd-read-into fd buf): read into the bytes `buf` (a bytes-slice for part
+    // of a buffer) without an intermediate string; the byte count, 0 at end of
+    // file
+    S.register_builtin("fd-read-into", [](State &S, const Value &args) -> Value {
+        int fd = require_fd(pair_car(args), "fd-read-into");
+        // held for the duration of the read: the task may yield meanwhile
+        Value buf = pair_car(pair_cdr(args));
+        if (!buf || buf.get_type() != TBYTES)
+            throw std::runtime_error("fd-read-into: expected bytes, got " + type_name(buf));
+        BytesData *b = buf.get_bytes();
+        require_writable(b, "fd-read-into");
+        return S.make_number(static_cast<double>(run_op(S, IoOp::Kind::Read, fd, b->data(), b->size(), "fd-read-into")));
+    });
+    // (fd-write fd data): write all of the string or bytes `data`; returns the
+    // byte count
+    S.register_builtin("fd-write", [](State &S, const Value &args) -> Value {
+        int fd = require_fd(pair_car(args), "fd-write");
+        Value v = pair_car(pair_cdr(args));
+        Value owner;
+        char *data;
+        size_t len;
+        if (v && v.get_type() == TBYTES) {
+            // written in place: a buffer never moves or changes length
+            data = reinterpret_cast<char *>(v.get_bytes()->data());
+            len = v.get_bytes()->size();
+        } else {
+            // so is a string; a slice may drop its owner meanwhile, so hold it
+            require_string_type(v, "fd-write");
+            std::string_view text = v.get_string_view();
+            owner = v.get_string_data()->owner();
+            data = const_cast<char *>(text.data());
+            len = text.size();
+        }
+        size_t off = 0;
+        while (off < len)
+            off += static_cast<size_t>(run_op(S, IoOp::Kind::Write, fd, data + off, len - off, "fd-write"));
+        return S.make_number(static_cast<double>(len));
+    });
+    // (fd-close fd): pending operations of other tasks on fd fail first
+    S.register_builtin("fd-close", [](State &S, const Value &args) -> Value {
+        event_loop(S).close_fd(require_fd(pair_car(args), "fd-close"));
+        return {};
+    });
+    // (unix-listen path): listening Unix-domain stream socket; a stale socket
+    // file left at path is replaced
+    S.register_builtin("unix-listen", [](State &S, const Value &args) -> Value {
+        const std::string &path = require_str(pair_car(args), "unix-listen");
+        sockaddr_un addr = unix_address(path, "unix-listen");
+        struct stat st{};
+        if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+            ::unlink(path.c_str());
+        int fd = unix_socket("unix-listen");
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0 || ::listen(fd, 128) < 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::runtime_error("unix-listen: " + path + ": " + std::strerror(err));
+        }
+        return S.make_number(fd);
+    });
+    // (unix-accept fd): the next connection on a listening socket
+    S.register_builtin("unix-accept", [](State &S, const Value &args) -> Value {
+        int fd = require_fd(pair_car(args), "unix-accept");
+        return S.make_number(static_cast<double>(run_op(S, IoOp::Kind::Accept, fd, nullptr, 0, "unix-accept")));
+    });
+    // (unix-connect path): connected non-blocking socket
+    S.register_builtin("unix-connect", [](State &S, const Value &args) -> Value {
+        const std::string &path = require_str(pair_car(args), "unix-connect");
+        sockaddr_un addr = unix_address(path, "unix-connect");
+        int fd = unix_socket("unix-connect");
+        try {
+            for (;;) {
+                if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) == 0)
+                    break;
+                int err = errno;
+                if (err == EINTR)
+                    continue;
+                if (err != EAGAIN && err != EINPROGRESS)
+                    throw std::runtime_error("unix-connect: " + path + ": " + std::strerror(err));
+                // EAGAIN: the listener's backlog is full, retry once writable
+                run_op(S, IoOp::Kind::PollOut, fd, nullptr, 0, "unix-connect");
+                if (err == EINPROGRESS) {
+                    int so = 0;
+                    socklen_t len = sizeof so;
+                    ::getsockopt(fd, SOL_SOCKET, SO_ERROR, &so, &len);
+                    if (so)
+                        throw std::runtime_error("unix-connect: " + path + ": " + std::strerror(so));
+                    break;
+                }
+            }
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        return S.make_number(fd);
+    });
+}
+
+} // namespace vdlisp
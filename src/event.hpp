@@ -0,0 +1,120 @@
+#ifndef VDLISP__EVENT_HPP
+#define VDLISP__EVENT_HPP
+
+#include "vdlisp.hpp"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace vdlisp {
+
+class Coroutine;
+
+// One I/O operation in flight. It lives in the frame of the builtin that
+// issued it (on the waiting task's coroutine stack) until it completes.
+struct IoOp {
+    enum class Kind { Read, Write, Accept, PollIn, PollOut };
+    Kind kind = Kind::Read;
+    int fd = -1;
+    void *buf = nullptr;
+    size_t len = 0;
+    int64_t result = 0; // bytes / new fd / 0, or -errno
+    bool done = false;
+    Coroutine *waiter = nullptr; // task parked on this op
+    bool polling = false;        // io_uring: waiting for readiness after -EAGAIN
+};
+
+// Kernel interface used by EventLoop: io_uring when the kernel allows it,
+// epoll otherwise (or when VDLISP__EVENT_BACKEND=epoll).
+class IoBackend {
+  public:
+    virtual ~IoBackend() = default;
+    [[nodiscard]] virtual auto name() const -> const char * = 0;
+    // Start `op`. May complete it immediately (then it is appended to `done`).
+    virtual void submit(IoOp *op, std::vector<IoOp *> &done) = 0;
+    // Wait up to `timeout_ms` (-1: forever) and append completed ops to `done`.
+    virtual void wait(int timeout_ms, std::vector<IoOp *> &done) = 0;
+    // Withdraw a pending `op`. On return the kernel no longer touches it; ops
+    // that complete meanwhile are appended to `done`.
+    virtual void cancel(IoOp *op, std::vector<IoOp *> &done) = 0;
+    // Cancel every pending op on `fd` (before closing it); they complete with -ECANCELED.
+    virtual void cancel_fd(int fd, std::vector<IoOp *> &done) = 0;
+    [[nodiscard]] virtual auto pending() const -> size_t = 0;
+
+    [[nodiscard]] static auto create() -> std::unique_ptr<IoBackend>;
+};
+
+// Per-State event loop. Tasks started with `go` are coroutines; an I/O
+// builtin called from a task parks it and the loop resumes it once the
+// operation completes. Called anywhere else (top level, plain coroutines),
+// the builtin drives the loop itself until its own operation is done, so
+// other tasks keep running meanwhile.
+class EventLoop {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit EventLoop(State &S);
+    ~EventLoop();
+    EventLoop(const EventLoop &) = delete;
+    EventLoop &operator=(const EventLoop &) = delete;
+
+    // Start `(fn . args)` as a task. Its coroutine stays private to the loop:
+    // resuming it from elsewhere would bypass the scheduler.
+    void go(const Value &fn, const Value &args);
+    // Run until no task is runnable, parked or sleeping. An error raised by a
+    // task stops the loop and propagates.
+    void run();
+    // Complete `op`, returning its result (see IoOp::result).
+    auto perform(IoOp &op) -> int64_t;
+    void sleep(double ms);
+    // Cancel pending operations on `fd`, then close it.
+    void close_fd(int fd);
+    [[nodiscard]] auto backend_name() const -> const char * { return backend->name(); }
+
+  private:
+    struct Task {
+        Value handle;
+        Value args; // passed by the first resume
+    };
+    struct Timer {
+        Clock::time_point deadline;
+        uint64_t seq;
+        Coroutine *waiter;
+        std::shared_ptr<bool> fired;
+        auto operator>(const Timer &o) const -> bool { return deadline != o.deadline ? deadline > o.deadline : seq > o.seq; }
+    };
+
+    // Run ready tasks, then wait for I/O or timers. Returns false when idle.
+    auto step() -> bool;
+    void run_ready();
+    void complete(std::vector<IoOp *> &done);
+    void fire_timers();
+    auto current_task() -> Coroutine *;
+    // Suspend `task` until `done` holds (the loop resumes it when woken).
+    template <class Pred>
+    void park(Coroutine *task, Pred done);
+
+    State &S;
+    std::unique_ptr<IoBackend> backend;
+    std::unordered_map<Coroutine *, Task> tasks; // live tasks (keeps them alive)
+    std::unordered_set<Coroutine *> parked;
+    std::deque<Coroutine *> ready;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<>> timers;
+    uint64_t timer_seq = 0;
+};
+
+// The loop of `S`, created on first use.
+[[nodiscard]] auto event_loop(State &S) -> EventLoop &;
+
+// go / run-loop / sleep / pipe / fd-* / unix-* builtins
+void register_events(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__EVENT_HPP
@@ -0,0 +1,203 @@
+#include "f64array.hpp"
+#include "coroutine.hpp"
+#include "f64kernels.hpp"
+#include "helpers.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace vdlisp {
+
+namespace {
+
+constexpr std::align_val_t kAlign{64};
+
+// the allocation for `n` doubles; a count whose size wraps is refused
+auto byte_size(size_t n) -> size_t {
+    if (n > SIZE_MAX / sizeof(double))
+        throw std::bad_array_new_length();
+    return n * sizeof(double);
+}
+
+} // namespace
+
+F64ArrayData::F64ArrayData(size_t n)
+    : data_(n ? static_cast<double *>(::operator new(byte_size(n), kAlign)) : nullptr), size_(n) {}
+
+F64ArrayData::~F64ArrayData() {
+    if (data_)
+        ::operator delete(data_, kAlign);
+}
+
+// -------------------- builtins --------------------
+
+namespace {
+
+auto require_f64array(const Value &v, const char *who) -> F64ArrayData * {
+    if (!v || v.get_type() != TF64ARRAY)
+        throw std::runtime_error(std::string(who) + " requires an f64array");
+    return v.get_f64array();
+}
+
+// `x` as a Value. NaN, which marks a missing value (an empty numeric field in
+// read-csv), is nil rather than the 0 a NaN number Value would hold.
+auto f64_value(State &S, double x) -> Value { return std::isnan(x) ? Value() : S.make_number(x); }
+
+auto has_nan(const F64ArrayData *a) noexcept -> bool {
+    return std::any_of(a->data(), a->data() + a->size(), [](double x) { return std::isnan(x); });
+}
+
+// The two f64array arguments of an elementwise builtin; same length.
+auto require_pair(const Value &args, const char *who) -> std::pair<F64ArrayData *, F64ArrayData *> {
+    F64ArrayData *x = require_f64array(pair_car(args), who);
+    F64ArrayData *y = require_f64array(pair_car(pair_cdr(args)), who);
+    if (x->size() != y->size())
+        throw std::runtime_error(std::string(who) + ": length mismatch (" + std::to_string(x->size()) + " vs " +
+                                 std::to_string(y->size()) + ")");
+    return {x, y};
+}
+
+using Elementwise = void (*)(const double *, const double *, double *, size_t);
+
+// (who a b): a new f64array of kernel(a[i], b[i])
+auto elementwise(State &S, const Value &args, const char *who, Elementwise kernel) -> Value {
+    auto [x, y] = require_pair(args, who);
+    Value out = S.make_f64array(x->size());
+    kernel(x->data(), y->data(), out.get_f64array()->data(), x->size());
+    return out;
+}
+
+} // namespace
+
+void register_f64arrays(State &S) {
+    // (make-f64array n [fill]): n elements, all `fill` (default 0)
+    S.register_builtin("make-f64array", [](State &S, const Value &args) -> Value {
+        size_t n = require_length(pair_car(args), sizeof(double), "make-f64array");
+        Value fill = pair_car(pair_cdr(args));
+        double x = fill ? require_number(fill, "make-f64array") : 0.0;
+        Value v = S.make_f64array(n);
+        F64ArrayData *a = v.get_f64array();
+        std::fill(a->data(), a->data() + a->size(), x);
+        return v;
+    });
+    // (f64array x ...): an f64array of the arguments
+    S.register_builtin("f64array", [](State &S, const Value &args) -> Value {
+        size_t n = 0;
+        for (Value cur = args; cur; cur = pair_cdr(cur))
+            ++n;
+        Value v = S.make_f64array(n);
+        double *d = v.get_f64array()->data();
+        for (Value cur = args; cur; cur = pair_cdr(cur))
+            *d++ = require_number(pair_car(cur), "f64array");
+        return v;
+    });
+    // (list->f64array seq): numbers of a list, vector or generator
+    S.register_builtin("list->f64array", [](State &S, const Value &args) -> Value {
+        std::vector<double> items;
+        for_each_item(pair_car(args), "list->f64array",
+                      [&items](const Value &v) { items.push_back(require_number(v, "list->f64array")); });
+        Value v = S.make_f64array(items.size());
+        std::copy(items.begin(), items.end(), v.get_f64array()->data());
+        return v;
+    });
+    S.register_builtin("f64array->list", [](State &S, const Value &args) -> Value {
+        F64ArrayData *a = require_f64array(pair_car(args), "f64array->list");
+        Value head;
+        for (size_t i = a->size(); i-- > 0;)
+            head = S.make_pair(f64_value(S, a->data()[i]), std::move(head));
+        return head;
+    });
+    // (f64-ref a i): element i; nil for a missing value (NaN)
+    S.register_builtin("f64-ref", [](State &S, const Value &args) -> Value {
+        F64ArrayData *a = require_f64array(pair_car(args), "f64-ref");
+        return f64_value(S, a->data()[require_index(pair_car(pair_cdr(args)), a->size(), "f64-ref")]);
+    });
+    // (f64-set! a i x): store x at i; returns x
+    S.register_builtin("f64-set!", [](State &, const Value &args) -> Value {
+        F64ArrayData *a = require_f64array(pair_car(args), "f64-set!");
+        require_mutable(a, "f64-set!");
+        Value rest = pair_cdr(args);
+        size_t i = require_index(pair_car(rest), a->size(), "f64-set!");
+        Value x = pair_car(pair_cdr(rest));
+        a->data()[i] = require_number(x, "f64-set!");
+        return x;
+    });
+    S.register_builtin("f64-length", [](State &S, const Value &args) -> Value {
+        return S.make_number(static_cast<double>(require_f64array(pair_car(args), "f64-length")->size()));
+    });
+
+    // reductions: nil when an element is missing (NaN)
+    S.register_builtin("f64-sum", [](State &S, const Value &args) -> Value {
+        F64ArrayData *a = require_f64array(pair_car(args), "f64-sum");
+        return f64_value(S, f64_kernels().sum(a->data(), a->size()));
+    });
+    S.register_builtin("f64-dot", [](State &S, const Value &args) -> Value {
+        auto [x, y] = require_pair(args, "f64-dot");
+        return f64_value(S, f64_kernels().dot(x->data(), y->data(), x->size()));
+    });
+    S.register_builtin("f64-min", [](State &S, const Value &args) -> Value {
+        F64ArrayData *a = require_f64array(pair_car(args), "f64-min");
+        if (!a->size())
+            throw std::runtime_error("f64-min requires a non-empty f64array");
+        // the SIMD min drops a NaN depending on where it falls
+        if (has_nan(a))
+            return {};
+        return S.make_number(f64_kernels().min(a->data(), a->size()));
+    });
+    S.register_builtin("f64-max", [](State &S, const Value &args) -> Value {
+        F64ArrayData *a = require_f64array(pair_car(args), "f64-max");
+        if (!a->size())
+            throw std::runtime_error("f64-max requires a non-empty f64array");
+        if (has_nan(a))
+            return {};
+        return S.make_number(f64_kernels().max(a->data(), a->size()));
+    });
+
+    // (f64-scale a k): a new f64array of a[i] * k
+    S.register_builtin("f64-scale", [](State &S, const Value &args) -> Value {
+        F64ArrayData *a = require_f64array(pair_car(args), "f64-scale");
+        double k = require_number(pair_car(pair_cdr(args)), "f64-scale");
+        Value out = S.make_f64array(a->size());
+        f64_kernels().scale(a->data(), k, out.get_f64array()->data(), a->size());
+        return out;
+    });
+    // (f64-axpy! alpha x y): y[i] += alpha * x[i] in place; returns y
+    S.register_builtin("f64-axpy!", [](State &S, const Value &args) -> Value {
+        double alpha = require_number(pair_car(args), "f64-axpy!");
+        Value rest = pair_cdr(args);
+        auto [x, y] = require_pair(rest, "f64-axpy!");
+        require_mutable(y, "f64-axpy!");
+        f64_kernels().axpy(alpha, x->data(), y->data(), x->size());
+        return pair_car(pair_cdr(rest));
+    });
+    // elementwise: new f64arrays (comparisons give 1 or 0 per element)
+    S.register_builtin("f64-add", [](State &S, const Value &args) -> Value {
+        return elementwise(S, args, "f64-add", f64_kernels().add);
+    });
+    S.register_builtin("f64-mul", [](State &S, const Value &args) -> Value {
+        return elementwise(S, args, "f64-mul", f64_kernels().mul);
+    });
+    S.register_builtin("f64-lt", [](State &S, const Value &args) -> Value {
+        return elementwise(S, args, "f64-lt", f64_kernels().lt);
+    });
+    S.register_builtin("f64-le", [](State &S, const Value &args) -> Value {
+        return elementwise(S, args, "f64-le", f64_kernels().le);
+    });
+    S.register_builtin("f64-eq", [](State &S, const Value &args) -> Value {
+        return elementwise(S, args, "f64-eq", f64_kernels().eq);
+    });
+    // (f64-prefix-sum a): a new f64array of running totals
+    S.register_builtin("f64-prefix-sum", [](State &S, const Value &args) -> Value {
+        F64ArrayData *a = require_f64array(pair_car(args), "f64-prefix-sum");
+        Value out = S.make_f64array(a->size());
+        f64_kernels().prefix_sum(a->data(), out.get_f64array()->data(), a->size());
+        return out;
+    });
+}
+
+} // namespace vdlisp
@@ -0,0 +1,41 @@
+#ifndef VDLISP__F64ARRAY_HPP
+#define VDLISP__F64ARRAY_HPP
+
+#include "nanbox.hpp"
+#include <cstddef>
+
+namespace vdlisp {
+
+class State;
+
+// F64ArrayData: fixed-length array of raw doubles (TF64ARRAY), printed as
+// `#f64(1 2 3)`. The elements are stored unboxed in one 64-byte aligned
+// block, so the numeric builtins run SIMD kernels over them (see
+// f64kernels.hpp) and compiled code can index them directly.
+class F64ArrayData : public RcBase {
+  public:
+    // `n` uninitialized elements
+    explicit F64ArrayData(size_t n);
+    ~F64ArrayData();
+    F64ArrayData(const F64ArrayData &) = delete;
+    auto operator=(const F64ArrayData &) -> F64ArrayData & = delete;
+
+    [[nodiscard]] auto data() noexcept -> double * { return data_; }
+    [[nodiscard]] auto data() const noexcept -> const double * { return data_; }
+    [[nodiscard]] auto size() const noexcept -> size_t { return size_; }
+
+  private:
+    double *data_;
+    size_t size_;
+};
+
+// make-f64array / f64array / list->f64array / f64array->list / f64-ref /
+// f64-set! / f64-length / f64-sum / f64-dot / f64-min / f64-max / f64-scale /
+// f64-axpy! / f64-add / f64-mul / f64-lt / f64-le / f64-eq / f64-prefix-sum.
+// A NaN element is a missing value: f64-ref and f64array->list give nil for
+// it and the reductions give nil when they meet one.
+void register_f64arrays(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__F64ARRAY_HPP
@@ -0,0 +1,163 @@
+#include "f64kernels.hpp"
+#include <cstdlib>
+#include <string_view>
+#if defined(__x86_64__) || defined(__i386__)
+#define VDLISP__F64_X86 1
+#include <immintrin.h>
+#endif
+
+namespace vdlisp {
+
+namespace {
+
+// Lane types: what f64kernels.inc needs from one instruction set.
+
+struct ScalarLanes {
+    using reg = double;
+    static constexpr size_t W = 1;
+    static auto load(const double *p) -> reg { return *p; }
+    static void store(double *p, reg r) { *p = r; }
+    static auto set1(double x) -> reg { return x; }
+    static auto zero() -> reg { return 0; }
+    static auto add(reg a, reg b) -> reg { return a + b; }
+    static auto mul(reg a, reg b) -> reg { return a * b; }
+    static auto fmadd(reg a, reg b, reg c) -> reg { return a * b + c; }
+    static auto min(reg a, reg b) -> reg { return b < a ? b : a; }
+    static auto max(reg a, reg b) -> reg { return b > a ? b : a; }
+    static auto lt(reg a, reg b) -> reg { return a < b ? 1.0 : 0.0; }
+    static auto le(reg a, reg b) -> reg { return a <= b ? 1.0 : 0.0; }
+    static auto eq(reg a, reg b) -> reg { return a == b ? 1.0 : 0.0; }
+    static auto hsum(reg r) -> double { return r; }
+    static auto hmin(reg r) -> double { return r; }
+    static auto hmax(reg r) -> double { return r; }
+    static auto scan(reg r) -> reg { return r; }
+    static auto last(reg r) -> double { return r; }
+};
+
+namespace scalar {
+using V = ScalarLanes;
+#define VDLISP__F64_TARGET
+#define VDLISP__F64_NAME "scalar"
+#include "f64kernels.inc"
+#undef VDLISP__F64_TARGET
+#undef VDLISP__F64_NAME
+} // namespace scalar
+
+#if VDLISP__F64_X86
+
+#define VDLISP__F64_TARGET __attribute__((target("avx2,fma")))
+
+struct Avx2Lanes {
+    using reg = __m256d;
+    static constexpr size_t W = 4;
+    VDLISP__F64_TARGET static auto load(const double *p) -> reg { return _mm256_loadu_pd(p); }
+    VDLISP__F64_TARGET static void store(double *p, reg r) { _mm256_storeu_pd(p, r); }
+    VDLISP__F64_TARGET static auto set1(double x) -> reg { return _mm256_set1_pd(x); }
+    VDLISP__F64_TARGET static auto zero() -> reg { return _mm256_setzero_pd(); }
+    VDLISP__F64_TARGET static auto add(reg a, reg b) -> reg { return _mm256_add_pd(a, b); }
+    VDLISP__F64_TARGET static auto mul(reg a, reg b) -> reg { return _mm256_mul_pd(a, b); }
+    VDLISP__F64_TARGET static auto fmadd(reg a, reg b, reg c) -> reg { return _mm256_fmadd_pd(a, b, c); }
+    VDLISP__F64_TARGET static auto min(reg a, reg b) -> reg { return _mm256_min_pd(a, b); }
+    VDLISP__F64_TARGET static auto max(reg a, reg b) -> reg { return _mm256_max_pd(a, b); }
+    // all-ones compare masks and-ed with 1.0
+    VDLISP__F64_TARGET static auto lt(reg a, reg b) -> reg { return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ), _mm256_set1_pd(1.0)); }
+    VDLISP__F64_TARGET static auto le(reg a, reg b) -> reg { return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_LE_OQ), _mm256_set1_pd(1.0)); }
+    VDLISP__F64_TARGET static auto eq(reg a, reg b) -> reg { return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ), _mm256_set1_pd(1.0)); }
+    VDLISP__F64_TARGET static auto hsum(reg r) -> double {
+        __m128d s = _mm_add_pd(_mm256_castpd256_pd128(r), _mm256_extractf128_pd(r, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+    VDLISP__F64_TARGET static auto hmin(reg r) -> double {
+        __m128d s = _mm_min_pd(_mm256_castpd256_pd128(r), _mm256_extractf128_pd(r, 1));
+        return _mm_cvtsd_f64(_mm_min_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+    VDLISP__F64_TARGET static auto hmax(reg r) -> double {
+        __m128d s = _mm_max_pd(_mm256_castpd256_pd128(r), _mm256_extractf128_pd(r, 1));
+        return _mm_cvtsd_f64(_mm_max_sd(s, _mm_unpackhi_pd(s, s)));
+    }
+    // [a b c d] -> [a a+b a+b+c a+b+c+d]: add the register shifted up by one
+    // lane, then by two
+    VDLISP__F64_TARGET static auto scan(reg r) -> reg {
+        r = _mm256_add_pd(r, _mm256_blend_pd(_mm256_permute4x64_pd(r, _MM_SHUFFLE(2, 1, 0, 0)), _mm256_setzero_pd(), 0x1));
+        return _mm256_add_pd(r, _mm256_permute2f128_pd(r, r, 0x08));
+    }
+    VDLISP__F64_TARGET static auto last(reg r) -> double {
+        __m128d hi = _mm256_extractf128_pd(r, 1);
+        return _mm_cvtsd_f64(_mm_unpackhi_pd(hi, hi));
+    }
+};
+
+namespace avx2 {
+using V = Avx2Lanes;
+#define VDLISP__F64_NAME "avx2"
+#include "f64kernels.inc"
+#undef VDLISP__F64_NAME
+} // namespace avx2
+
+#undef VDLISP__F64_TARGET
+#define VDLISP__F64_TARGET __attribute__((target("avx512f")))
+
+struct Avx512Lanes {
+    using reg = __m512d;
+    static constexpr size_t W = 8;
+    VDLISP__F64_TARGET static auto load(const double *p) -> reg { return _mm512_loadu_pd(p); }
+    VDLISP__F64_TARGET static void store(double *p, reg r) { _mm512_storeu_pd(p, r); }
+    VDLISP__F64_TARGET static auto set1(double x) -> reg { return _mm512_set1_pd(x); }
+    VDLISP__F64_TARGET static auto zero() -> reg { return _mm512_setzero_pd(); }
+    VDLISP__F64_TARGET static auto add(reg a, reg b) -> reg { return _mm512_add_pd(a, b); }
+    VDLISP__F64_TARGET static auto mul(reg a, reg b) -> reg { return _mm512_mul_pd(a, b); }
+    VDLISP__F64_TARGET static auto fmadd(reg a, reg b, reg c) -> reg { return _mm512_fmadd_pd(a, b, c); }
+    VDLISP__F64_TARGET static auto min(reg a, reg b) -> reg { return _mm512_min_pd(a, b); }
+    VDLISP__F64_TARGET static auto max(reg a, reg b) -> reg { return _mm512_max_pd(a, b); }
+    // compare into a mask register, then take 1.0 where it is set
+    VDLISP__F64_TARGET static auto lt(reg a, reg b) -> reg { return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(a, b, _CMP_LT_OQ), _mm512_set1_pd(1.0)); }
+    VDLISP__F64_TARGET static auto le(reg a, reg b) -> reg { return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(a, b, _CMP_LE_OQ), _mm512_set1_pd(1.0)); }
+    VDLISP__F64_TARGET static auto eq(reg a, reg b) -> reg { return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ), _mm512_set1_pd(1.0)); }
+    VDLISP__F64_TARGET static auto hsum(reg r) -> double { return _mm512_reduce_add_pd(r); }
+    VDLISP__F64_TARGET static auto hmin(reg r) -> double { return _mm512_reduce_min_pd(r); }
+    VDLISP__F64_TARGET static auto hmax(reg r) -> double { return _mm512_reduce_max_pd(r); }
+    // add the register shifted up by one, two and four lanes (the lanes
+    // shifted in are zeroed by the mask)
+    VDLISP__F64_TARGET static auto scan(reg r) -> reg {
+        r = _mm512_add_pd(r, _mm512_maskz_permutexvar_pd(0xFE, _mm512_set_epi64(6, 5, 4, 3, 2, 1, 0, 0), r));
+        r = _mm512_add_pd(r, _mm512_maskz_permutexvar_pd(0xFC, _mm512_set_epi64(5, 4, 3, 2, 1, 0, 0, 0), r));
+        return _mm512_add_pd(r, _mm512_maskz_permutexvar_pd(0xF0, _mm512_set_epi64(3, 2, 1, 0, 0, 0, 0, 0), r));
+    }
+    VDLISP__F64_TARGET static auto last(reg r) -> double {
+        __m128d hi = _mm256_extractf128_pd(_mm512_extractf64x4_pd(r, 1), 1);
+        return _mm_cvtsd_f64(_mm_unpackhi_pd(hi, hi));
+    }
+};
+
+namespace avx512 {
+using V = Avx512Lanes;
+#define VDLISP__F64_NAME "avx512"
+#include "f64kernels.inc"
+#undef VDLISP__F64_NAME
+} // namespace avx512
+
+#undef VDLISP__F64_TARGET
+
+#endif // VDLISP__F64_X86
+
+auto pick_kernels() noexcept -> const F64Kernels & {
+    const char *env = std::getenv("VDLISP__SIMD");
+    std::string_view cap = env ? env : "";
+#if VDLISP__F64_X86
+    __builtin_cpu_init();
+    if (cap != "scalar" && cap != "avx2" && __builtin_cpu_supports("avx512f"))
+        return avx512::kernels;
+    if (cap != "scalar" && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return avx2::kernels;
+#endif
+    return scalar::kernels;
+}
+
+} // namespace
+
+auto f64_kernels() noexcept -> const F64Kernels & {
+    static const F64Kernels &kernels = pick_kernels();
+    return kernels;
+}
+
+} // namespace vdlisp
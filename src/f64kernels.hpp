@@ -0,0 +1,37 @@
+#ifndef VDLISP__F64KERNELS_HPP
+#define VDLISP__F64KERNELS_HPP
+
+#include <cstddef>
+
+namespace vdlisp {
+
+// Loops behind the f64array builtins. One set is compiled per instruction set
+// (AVX-512, AVX2 + FMA, and a portable scalar one) and the best set the CPU
+// supports is picked on first use; `VDLISP__SIMD=scalar|avx2|avx512` caps the
+// choice. Outputs may alias inputs element for element. Reductions combine
+// the elements in lane order, so their rounding may differ between sets.
+struct F64Kernels {
+    const char *name;
+    double (*sum)(const double *x, size_t n);
+    double (*dot)(const double *x, const double *y, size_t n);
+    // n >= 1
+    double (*min)(const double *x, size_t n);
+    double (*max)(const double *x, size_t n);
+    // y[i] += a * x[i]
+    void (*axpy)(double a, const double *x, double *y, size_t n);
+    void (*scale)(const double *x, double k, double *out, size_t n);
+    void (*add)(const double *x, const double *y, double *out, size_t n);
+    void (*mul)(const double *x, const double *y, double *out, size_t n);
+    // out[i] = 1 when x[i] < y[i] (<=, ==) else 0
+    void (*lt)(const double *x, const double *y, double *out, size_t n);
+    void (*le)(const double *x, const double *y, double *out, size_t n);
+    void (*eq)(const double *x, const double *y, double *out, size_t n);
+    // inclusive scan: out[i] = x[0] + ... + x[i]
+    void (*prefix_sum)(const double *x, double *out, size_t n);
+};
+
+[[nodiscard]] auto f64_kernels() noexcept -> const F64Kernels &;
+
+} // namespace vdlisp
+
+#endif // VDLISP__F64KERNELS_HPP
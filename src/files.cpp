@@ -0,0 +1,268 @@
+#include "files.hpp"
+#include "coroutine.hpp"
+#include "helpers.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace vdlisp {
+
+// size of the read buffer (grown for longer lines) and of the write buffer
+constexpr size_t kFileChunk = 64 * 1024;
+
+// -------------------- FileHandle --------------------
+
+FileHandle::FileHandle(int fd, std::string path, bool writing) noexcept
+    : fd_(fd), path_(std::move(path)), writing_(writing) {}
+
+FileHandle::~FileHandle() {
+    try {
+        close("close");
+    } catch (...) {
+    }
+}
+
+void FileHandle::fail(const char *who, int err) const {
+    throw std::runtime_error(std::string(who) + ": " + path_ + ": " + std::strerror(err));
+}
+
+void FileHandle::check(bool want_writing, const char *who) const {
+    if (fd_ < 0)
+        throw std::runtime_error(std::string(who) + ": file is closed");
+    if (writing_ != want_writing)
+        throw std::runtime_error(std::string(who) + ": file is not open for " + (want_writing ? "writing" : "reading"));
+}
+
+auto FileHandle::fill(const char *who) -> bool {
+    if (eof_)
+        return false;
+    if (pos_ > 0) {
+        std::memmove(in_.data(), in_.data() + pos_, end_ - pos_);
+        end_ -= pos_;
+        pos_ = 0;
+    }
+    if (end_ == in_.size())
+        in_.resize(std::max(kFileChunk, in_.size() * 2));
+    for (;;) {
+        ssize_t r = ::read(fd_, in_.data() + end_, in_.size() - end_);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            fail(who, errno);
+        if (r == 0) {
+            eof_ = true;
+            return false;
+        }
+        end_ += static_cast<size_t>(r);
+        return true;
+    }
+}
+
+auto FileHandle::read_line(std::string_view &line, const char *who) -> bool {
+    check(false, who);
+    size_t scanned = 0; // bytes after pos_ known to hold no newline
+    for (;;) {
+        const char *start = in_.data() + pos_;
+        if (const auto *nl = static_cast<const char *>(std::memchr(start + scanned, '\n', end_ - pos_ - scanned))) {
+            line = std::string_view(start, static_cast<size_t>(nl - start));
+            pos_ += line.size() + 1;
+            return true;
+        }
+        scanned = end_ - pos_;
+        if (!fill(who)) {
+            // a last line without a newline
+            if (pos_ == end_)
+                return false;
+            line = std::string_view(in_.data() + pos_, end_ - pos_);
+            pos_ = end_;
+            return true;
+        }
+    }
+}
+
+auto FileHandle::read_all(const char *who) -> std::string {
+    check(false, who);
+    std::string text(in_.data() + pos_, end_ - pos_);
+    pos_ = end_ = 0;
+    struct stat st{};
+    off_t at = ::lseek(fd_, 0, SEEK_CUR);
+    if (::fstat(fd_, &st) == 0 && S_ISREG(st.st_mode) && at >= 0 && st.st_size > at)
+        text.reserve(text.size() + static_cast<size_t>(st.st_size - at));
+    while (!eof_) {
+        size_t n = text.size();
+        text.resize(std::max(n + kFileChunk, text.capacity()));
+        ssize_t r = ::read(fd_, text.data() + n, text.size() - n);
+        if (r < 0) {
+            text.resize(n);
+            if (errno == EINTR)
+                continue;
+            fail(who, errno);
+        }
+        text.resize(n + static_cast<size_t>(r));
+        eof_ = r == 0;
+    }
+    return text;
+}
+
+void FileHandle::write_all(const char *p, size_t n, const char *who) {
+    while (n > 0) {
+        ssize_t w = ::write(fd_, p, n);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            fail(who, errno);
+        }
+        p += w;
+        n -= static_cast<size_t>(w);
+    }
+}
+
+void FileHandle::write(std::string_view s, const char *who) {
+    check(true, who);
+    if (out_.size() + s.size() > kFileChunk) {
+        flush(who);
+        if (s.size() >= kFileChunk) {
+            write_all(s.data(), s.size(), who);
+            return;
+        }
+    }
+    out_.append(s);
+}
+
+void FileHandle::flush(const char *who) {
+    if (fd_ < 0 || out_.empty())
+        return;
+    // dropped even when the write fails: a retry would repeat what got out
+    std::string pending = std::move(out_);
+    out_.clear();
+    write_all(pending.data(), pending.size(), who);
+}
+
+void FileHandle::close(const char *who) {
+    if (fd_ < 0)
+        return;
+    try {
+        flush(who);
+    } catch (...) {
+        ::close(std::exchange(fd_, -1));
+        throw;
+    }
+    ::close(std::exchange(fd_, -1));
+}
+
+auto as_file(const Value &v) noexcept -> FileHandle * {
+    return v && v.get_type() == THANDLE ? dynamic_cast<FileHandle *>(v.get_handle()) : nullptr;
+}
+
+// -------------------- lines --------------------
+
+namespace {
+
+// The lines of an open file, read through its buffer. The file is not
+// mapped: a file truncated while it is iterated simply ends early instead of
+// faulting on pages that are gone.
+class LineIterator : public ItemStream {
+  public:
+    LineIterator(State &S, Value file) : S(S), file_(std::move(file)) {}
+    [[nodiscard]] auto type_name() const -> const char * override { return "lines"; }
+
+    auto next(Value &out) -> bool override {
+        std::string_view line;
+        if (!as_file(file_)->read_line(line, "lines"))
+            return false;
+        out = S.make_string(std::string(line));
+        return true;
+    }
+
+  private:
+    State &S;
+    Value file_;
+};
+
+auto require_str(const Value &v, const char *who) -> std::string {
+    if (!v || v.get_type() != TSTRING)
+        throw std::runtime_error(std::string(who) + ": expected string, got " + type_name(v));
+    return std::string(v.get_string_view());
+}
+
+auto require_file(const Value &v, const char *who) -> FileHandle * {
+    FileHandle *f = as_file(v);
+    if (!f)
+        throw std::runtime_error(std::string(who) + " requires a file");
+    return f;
+}
+
+auto open_fd(const std::string &path, int flags, const char *who) -> int {
+    int fd = ::open(path.c_str(), flags | O_CLOEXEC, 0666);
+    if (fd < 0)
+        throw std::runtime_error(std::string(who) + ": " + path + ": " + std::strerror(errno));
+    return fd;
+}
+
+} // namespace
+
+auto open_lines(State &S, int fd, std::string path) -> Value {
+    Value file = S.make_handle(new FileHandle(fd, std::move(path), false));
+    return S.make_handle(new LineIterator(S, std::move(file)));
+}
+
+void register_files(State &S) {
+    // (open path [mode]): mode is "r" (default), "w" (truncate) or "a"
+    S.register_builtin("open", [](State &S, const Value &args) -> Value {
+        std::string path = require_str(pair_car(args), "open");
+        Value m = pair_car(pair_cdr(args));
+        std::string mode = m ? require_str(m, "open") : std::string("r");
+        int flags;
+        if (mode == "r")
+            flags = O_RDONLY;
+        else if (mode == "w")
+            flags = O_WRONLY | O_CREAT | O_TRUNC;
+        else if (mode == "a")
+            flags = O_WRONLY | O_CREAT | O_APPEND;
+        else
+            throw std::runtime_error("open: invalid mode " + mode);
+        int fd = open_fd(path, flags, "open");
+        return S.make_handle(new FileHandle(fd, std::move(path), mode != "r"));
+    });
+    // (close f): flush and close; closing again does nothing
+    S.register_builtin("close", [](State &, const Value &args) -> Value {
+        require_file(pair_car(args), "close")->close("close");
+        return {};
+    });
+    // (read-line f): the next line without its newline, nil at end of file;
+    // f is a file or a lines iterator
+    S.register_builtin("read-line", [](State &S, const Value &args) -> Value {
+        Value src = pair_car(args);
+        if (src && src.get_type() == THANDLE) {
+            if (auto *it = dynamic_cast<LineIterator *>(src.get_handle())) {
+                Value line;
+                return it->next(line) ? line : Value();
+            }
+        }
+        std::string_view line;
+        if (!require_file(src, "read-line")->read_line(line, "read-line"))
+            return {};
+        return S.make_string(std::string(line));
+    });
+    // (read-all f): the rest of the file ("" at end of file)
+    S.register_builtin("read-all", [](State &S, const Value &args) -> Value {
+        return S.make_string(require_file(pair_car(args), "read-all")->read_all("read-all"));
+    });
+    // (lines src): see files.hpp
+    S.register_builtin("lines", [](State &S, const Value &args) -> Value {
+        Value src = pair_car(args);
+        if (as_file(src))
+            return S.make_handle(new LineIterator(S, src));
+        std::string path = require_str(src, "lines");
+        int fd = open_fd(path, O_RDONLY, "lines");
+        return open_lines(S, fd, std::move(path));
+    });
+}
+
+} // namespace vdlisp
@@ -0,0 +1,66 @@
+#ifndef VDLISP__FILES_HPP
+#define VDLISP__FILES_HPP
+
+#include "nanbox.hpp"
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace vdlisp {
+
+class State;
+
+// FileHandle: a file opened by `open` (a THANDLE of type `file`), read and
+// written with blocking read(2) / write(2) through its own buffers. Closed by
+// `close` or when the last reference goes; pending writes are flushed first.
+class FileHandle : public HandleData {
+  public:
+    FileHandle(int fd, std::string path, bool writing) noexcept;
+    ~FileHandle() override;
+    [[nodiscard]] auto type_name() const -> const char * override { return "file"; }
+
+    // The next line without its '\n' in `line`, valid until the next read;
+    // false at end of file.
+    auto read_line(std::string_view &line, const char *who) -> bool;
+    // everything from the current position on
+    auto read_all(const char *who) -> std::string;
+    void write(std::string_view s, const char *who);
+    void flush(const char *who);
+    void close(const char *who);
+
+  private:
+    void check(bool want_writing, const char *who) const;
+    // Read more input after what is buffered; false at end of file.
+    auto fill(const char *who) -> bool;
+    void write_all(const char *p, size_t n, const char *who);
+    [[noreturn]] void fail(const char *who, int err) const;
+
+    int fd_;
+    std::string path_;
+    bool writing_;
+    std::string in_; // [pos_, end_) not yet consumed
+    size_t pos_ = 0;
+    size_t end_ = 0;
+    bool eof_ = false;
+    std::string out_;
+};
+
+// The FileHandle in `v`, or nullptr.
+[[nodiscard]] auto as_file(const Value &v) noexcept -> FileHandle *;
+
+// The lines of the file open for reading as `fd` (named `path` in errors),
+// as returned by `lines`: an ItemStream handle that owns (and closes) fd.
+[[nodiscard]] auto open_lines(State &S, int fd, std::string path) -> Value;
+
+// open / close / read-line / read-all / lines, and files as the first
+// argument of write / write-line (see output.hpp).
+//
+// (lines src): the lines of a file, one at a time, as a generator-like handle
+// that map / filter / fold / list->vector etc. iterate (read-line also takes
+// one). `src` is a path or an open file, read through the file's buffer, so a
+// file is never held in memory whole.
+void register_files(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__FILES_HPP
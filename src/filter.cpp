@@ -0,0 +1,126 @@
+#include "filter.hpp"
+#include "coroutine.hpp"
+#include "files.hpp"
+#include "helpers.hpp"
+#include "output.hpp"
+#include "vdlisp.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace vdlisp {
+
+namespace {
+
+struct Options {
+    std::string expr;
+    std::string begin;
+    std::string end;
+    bool each_line = false;  // -n / -p
+    bool print_line = false; // -p
+    std::vector<std::string> rest;
+};
+
+// Parse the options; false (after a message) on bad usage.
+auto parse_options(const std::vector<std::string> &args, Options &o) -> bool {
+    bool have_expr = false;
+    size_t i = 0;
+    for (; i < args.size(); ++i) {
+        const std::string &a = args[i];
+        if (a == "-n" || a == "-p") {
+            o.each_line = true;
+            o.print_line |= a == "-p";
+        } else if (a == "-e" || a == "--begin" || a == "--end") {
+            if (i + 1 == args.size()) {
+                std::cerr << "vdlisp: " << a << " requires an expression\n";
+                return false;
+            }
+            (a == "-e" ? o.expr : a == "--begin" ? o.begin : o.end) = args[++i];
+            have_expr |= a == "-e";
+        } else if (a == "--") {
+            ++i;
+            break;
+        } else {
+            break;
+        }
+    }
+    o.rest.assign(args.begin() + static_cast<std::ptrdiff_t>(i), args.end());
+    if (!have_expr && !o.print_line) {
+        std::cerr << "usage: vdlisp [-n | -p] [--begin EXPR] [-e EXPR] [--end EXPR] [FILE...]\n";
+        return false;
+    }
+    return true;
+}
+
+// Evaluate the program once per line of every input.
+void run_lines(State &S, const Options &o, const Value &prog) {
+    // slots of the global bindings, assigned directly per line (the map's
+    // elements stay put)
+    S.bind_global("line", Value());
+    S.bind_global("nr", Value());
+    Value *line = &S.global->map["line"];
+    Value *nr = &S.global->map["nr"];
+    std::vector<std::string> inputs = o.rest;
+    if (inputs.empty())
+        inputs.emplace_back("-");
+    double count = 0;
+    for (const std::string &name : inputs) {
+        int fd = name == "-" ? ::dup(0) : ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            throw std::runtime_error("could not open file: " + name + ": " + std::strerror(errno));
+        Value lines = open_lines(S, fd, name == "-" ? "(stdin)" : name);
+        auto *stream = static_cast<ItemStream *>(lines.get_handle());
+        Value v;
+        while (stream->next(v)) {
+            *line = std::move(v);
+            *nr = S.make_number(++count);
+            if (prog)
+                (void)S.do_list(prog, S.global);
+            if (o.print_line) {
+                write_display(S, *line);
+                S.write_out("\n");
+            }
+        }
+    }
+}
+
+} // namespace
+
+auto is_filter_option(const std::string &arg) -> bool {
+    return arg == "-e" || arg == "-n" || arg == "-p" || arg == "--begin" || arg == "--end";
+}
+
+auto filter_main(const std::vector<std::string> &args) -> int {
+    Options o;
+    if (!parse_options(args, o))
+        return 2;
+    State S;
+    S.bind_global("argv", S.make_string_list(o.rest.begin(), o.rest.end()));
+    load_lang_basics(S);
+    S.freeze_runtime();
+    try {
+        // everything is parsed before anything runs
+        Value begin = S.parse_all(o.begin, "--begin");
+        Value prog = S.parse_all(o.expr, "-e");
+        Value end = S.parse_all(o.end, "--end");
+        if (begin)
+            (void)S.do_list(begin, S.global);
+        if (o.each_line) {
+            run_lines(S, o, prog);
+        } else if (prog) {
+            Value r = S.do_list(prog, S.global);
+            S.write_out(S.to_string(r) + "\n");
+        }
+        if (end)
+            (void)S.do_list(end, S.global);
+    } catch (const std::exception &ex) {
+        report_exception(S, ex);
+        return 1;
+    }
+    return 0;
+}
+
+} // namespace vdlisp
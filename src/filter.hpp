@@ -0,0 +1,29 @@
+#ifndef VDLISP__FILTER_HPP
+#define VDLISP__FILTER_HPP
+
+#include <string>
+#include <vector>
+
+namespace vdlisp {
+
+// Command-line programs, awk / perl -n style:
+//
+//   vdlisp -e EXPR [ARGS...]            evaluate EXPR, print its value
+//   vdlisp -n -e EXPR [FILE...]         evaluate EXPR once per input line
+//   vdlisp -p [-e EXPR] [FILE...]       the same, then print `line`
+//
+// with `--begin EXPR` / `--end EXPR` run before the first and after the last
+// line. The input is the files in order, or stdin when there are none (or for
+// `-`); each line, without its newline, is bound to `line` and its number
+// (from 1, across files) to `nr`. EXPR may hold several forms and is parsed
+// once; output goes through the State's buffer. `argv` is bound to the
+// arguments after the options. The exit status is 1 after an error, 2 for bad
+// usage.
+auto filter_main(const std::vector<std::string> &args) -> int;
+
+// Whether `arg` (argv[1]) starts a filter_main command line.
+[[nodiscard]] auto is_filter_option(const std::string &arg) -> bool;
+
+} // namespace vdlisp
+
+#endif // VDLISP__FILTER_HPP
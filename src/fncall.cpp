@@ -0,0 +1,99 @@
+#include "fncall.hpp"
+#include "helpers.hpp"
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace vdlisp {
+
+// calls after which State::call compiles a function (see num_call_count)
+constexpr size_t kHotCalls = 4;
+
+FnCaller::FnCaller(State &S, const Value &fn, const char *who, size_t calls) : S(S), fn(fn), eager(calls >= kHotCalls) {
+    if (!fn || (fn.get_type() != TFUNC && fn.get_type() != TCFUNC))
+        throw std::runtime_error(std::string(who) + " requires a function");
+}
+
+auto FnCaller::native(const Value *args, int argc) -> JitFn {
+    if (fn.get_type() != TFUNC)
+        return nullptr;
+    for (int i = 0; i < argc; ++i)
+        if (args[i].get_type() != TNUMBER)
+            return nullptr;
+    FuncData *fd = fn.get_func();
+    if (!fd->compiled_code && (!eager || fd->jit_failed || !S.jit_compile(fd)))
+        return nullptr;
+    return reinterpret_cast<JitFn>(fd->compiled_code);
+}
+
+auto FnCaller::run(JitFn fptr, const Value *args, int argc) -> double {
+    double in[2];
+    for (int i = 0; i < argc; ++i)
+        in[i] = args[i].get_number();
+    // as in State::call: compiled code may call back into this State
+    State *prev_active = jit_active_state;
+    jit_active_state = &S;
+    double r = fptr(in, argc);
+    jit_active_state = prev_active;
+    if (!S.jit_error.empty()) {
+        std::string msg = std::move(S.jit_error);
+        S.jit_error.clear();
+        throw std::runtime_error(msg);
+    }
+    return r;
+}
+
+auto FnCaller::slow(const Value *args, int argc) -> Value {
+    Value list;
+    for (int i = argc; i-- > 0;)
+        list = S.make_pair(args[i], std::move(list));
+    if (fn.get_type() == TCFUNC)
+        return fn.get_cfunc()(S, list);
+    return S.call(fn, list);
+}
+
+auto FnCaller::truth(const Value &r) const noexcept -> bool {
+    if (r.get_type() == TNUMBER && fn.get_type() == TFUNC && fn.get_func()->compiled_code)
+        return r.get_number() != 0.0;
+    return static_cast<bool>(r);
+}
+
+auto FnCaller::operator()(const Value &a) -> Value {
+    if (JitFn fptr = native(&a, 1)) {
+        double r = run(fptr, &a, 1);
+        if (!std::isnan(r))
+            return S.make_number(r);
+    }
+    return slow(&a, 1);
+}
+
+auto FnCaller::operator()(const Value &a, const Value &b) -> Value {
+    const Value args[2] = {a, b};
+    if (JitFn fptr = native(args, 2)) {
+        double r = run(fptr, args, 2);
+        if (!std::isnan(r))
+            return S.make_number(r);
+    }
+    return slow(args, 2);
+}
+
+auto FnCaller::test(const Value &a) -> bool {
+    if (JitFn fptr = native(&a, 1)) {
+        double r = run(fptr, &a, 1);
+        if (!std::isnan(r))
+            return r != 0.0;
+    }
+    return truth(slow(&a, 1));
+}
+
+auto FnCaller::test(const Value &a, const Value &b) -> bool {
+    const Value args[2] = {a, b};
+    if (JitFn fptr = native(args, 2)) {
+        double r = run(fptr, args, 2);
+        if (!std::isnan(r))
+            return r != 0.0;
+    }
+    return truth(slow(args, 2));
+}
+
+} // namespace vdlisp
@@ -0,0 +1,48 @@
+#ifndef VDLISP__FNCALL_HPP
+#define VDLISP__FNCALL_HPP
+
+#include "vdlisp.hpp"
+#include <cstddef>
+
+namespace vdlisp {
+
+// FnCaller: calls one function value many times from a native loop (sort
+// comparators, list functions) with less overhead than State::call where the
+// function allows it:
+// - a builtin (TCFUNC) is called directly
+// - a user function given only numbers runs its machine code directly once
+//   compiled; a NaN result (the JIT's "not a number" signal) is redone
+//   through State::call. When the loop will call it often enough to make it
+//   hot anyway, it is compiled up front.
+// - anything else goes through State::call
+class FnCaller {
+  public:
+    // `who` names the builtin in the error raised when `fn` is not callable;
+    // `calls` is about how many calls the loop will make
+    FnCaller(State &S, const Value &fn, const char *who, size_t calls);
+
+    auto operator()(const Value &a) -> Value;
+    auto operator()(const Value &a, const Value &b) -> Value;
+    // The call as a truth value. Compiled code returns its comparisons as
+    // 1 / 0, so a 0 from a compiled function counts as false.
+    auto test(const Value &a) -> bool;
+    auto test(const Value &a, const Value &b) -> bool;
+
+  private:
+    using JitFn = double (*)(double *, int);
+
+    // the compiled entry point when all `argc` arguments are numbers
+    auto native(const Value *args, int argc) -> JitFn;
+    // run compiled code on `args`; NaN when it bailed out
+    auto run(JitFn fptr, const Value *args, int argc) -> double;
+    auto slow(const Value *args, int argc) -> Value;
+    auto truth(const Value &r) const noexcept -> bool;
+
+    State &S;
+    Value fn;
+    bool eager; // compile on the first numeric call
+};
+
+} // namespace vdlisp
+
+#endif // VDLISP__FNCALL_HPP
@@ -1,6 +1,17 @@
 #include "helpers.hpp"
+#include "bytes.hpp"
+#include "f64array.hpp"
+#include "persistent.hpp"
+#include "record.hpp"
+#include "strings.hpp"
+#include "table.hpp"
+#include <algorithm>
 #include <cctype>
+#include <cstdint>
+#include <cmath>
 #include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
@@ -236,6 +247,15 @@ void State::set_source_loc(const Value &v, const std::string &file, size_t line,
     loc.line = line;
     loc.col = col;
     src_map[v.identity_key()] = loc;
+    if (source_journal)
+        source_journal->push_back(v.identity_key());
+}
+
+void State::forget_sources(const std::vector<uint64_t> &keys) {
+    for (uint64_t k : keys) {
+        src_map.erase(k);
+        src_call_chain_map.erase(k);
+    }
 }
 
 auto State::get_source_loc(const Value &v, SourceLoc &out) const -> bool {
@@ -273,24 +293,24 @@ auto State::get_source_line(const std::string &file, size_t line, std::string &o
     return true;
 }
 
-void print_error_with_loc(const State &S, const State::SourceLoc &loc, const std::string &msg) {
-    bool color = isatty(fileno(stderr)) || getenv("VDLISP__COLOR");
+void print_error_with_loc(const State &S, const State::SourceLoc &loc, const std::string &msg, std::ostream &os) {
+    bool color = &os == &std::cerr && (isatty(fileno(stderr)) || getenv("VDLISP__COLOR"));
     const char *c_red = "\x1b[1;31m";
     const char *c_bold = "\x1b[1m";
     const char *c_reset = "\x1b[0m";
 
     if (color)
-        std::cerr << c_red;
-    std::cerr << "error: " << loc.file << ":" << loc.line << ":" << loc.col << ": " << msg << "\n";
+        os << c_red;
+    os << "error: " << loc.file << ":" << loc.line << ":" << loc.col << ": " << msg << "\n";
     if (color)
-        std::cerr << c_reset;
+        os << c_reset;
 
     std::string line;
     if (S.get_source_line(loc.file, loc.line, line)) {
         if (color)
-            std::cerr << c_bold << line << c_reset << "\n";
+            os << c_bold << line << c_reset << "\n";
         else
-            std::cerr << line << "\n";
+            os << line << "\n";
 
         size_t col_index = loc.col ? loc.col - 1 : 0;
         std::string caret_spaces;
@@ -298,9 +318,59 @@ void print_error_with_loc(const State &S, const State::SourceLoc &loc, const std
             caret_spaces.push_back((i < line.size() && line[i] == '\t') ? '\t' : ' ');
 
         if (color)
-            std::cerr << caret_spaces << c_red << "^" << c_reset << "\n";
+            os << caret_spaces << c_red << "^" << c_reset << "\n";
         else
-            std::cerr << caret_spaces << "^" << "\n";
+            os << caret_spaces << "^" << "\n";
+    }
+}
+
+static void print_call_chain(const State &S, const std::vector<State::SourceLoc> &chain, std::ostream &os) {
+    if (chain.empty())
+        return;
+    os << "Call chain:\n";
+    // deep recursion (a stack overflow) shows both ends of the chain only
+    constexpr size_t kEnds = 8;
+    for (size_t i = 0; i < chain.size(); ++i) {
+        if (i == kEnds && chain.size() > 3 * kEnds) {
+            os << "  ... " << chain.size() - 2 * kEnds << " more calls\n";
+            i = chain.size() - kEnds;
+        }
+        const auto &fr = chain[i];
+        os << "  at ";
+        if (!fr.label.empty())
+            os << fr.label << " ";
+        os << fr.file << ":" << fr.line << ":" << fr.col << "\n";
+        std::string line;
+        if (S.get_source_line(fr.file, fr.line, line)) {
+            os << "    " << line << "\n";
+            size_t col_index = fr.col ? fr.col - 1 : 0;
+            std::string caret_spaces;
+            for (size_t i = 0; i < col_index; ++i)
+                caret_spaces.push_back((i < line.size() && line[i] == '\t') ? '\t' : ' ');
+            os << "    " << caret_spaces << "^" << "\n";
+        }
+    }
+}
+
+void report_exception(State &S, const std::exception &ex, std::ostream &os) {
+    // what the script printed comes first
+    S.flush_out();
+    if (auto pe = dynamic_cast<const ParseError *>(&ex)) {
+        print_error_with_loc(S, pe->loc, pe->what(), os);
+        if (!pe->call_chain.empty())
+            print_call_chain(S, pe->call_chain, os);
+        return;
+    }
+    State::SourceLoc loc;
+    bool have_loc = S.get_source_loc(S.current_expr, loc);
+    if (have_loc) {
+        print_error_with_loc(S, loc, ex.what(), os);
+        auto it = S.src_call_chain_map.find(S.current_expr.identity_key());
+        if (it != S.src_call_chain_map.end()) {
+            print_call_chain(S, it->second, os);
+        }
+    } else {
+        os << "error: " << ex.what() << "\n";
     }
 }
 
@@ -320,9 +390,88 @@ void clear_closure_env(Value &v) noexcept {
             release_env(md->closure_env);
             md->closure_env = nullptr;
         }
+    } else if (v.get_type() == TVECTOR) {
+        // elements may close over the env holding the vector (or be the
+        // vector itself): take them out before clearing them
+        std::vector<Value> items;
+        items.swap(v.get_vector()->items);
+        for (Value &item : items)
+            clear_closure_env(item);
+    } else if (v.get_type() == TTABLE) {
+        std::vector<Value> values;
+        for (const auto &e : v.get_table()->entries())
+            if (e.live)
+                values.push_back(e.value);
+        v.get_table()->clear();
+        for (Value &item : values)
+            clear_closure_env(item);
+    } else if (v.get_type() == THASHMAP || v.get_type() == TPVECTOR) {
+        // versions are immutable, but their elements may still close over
+        // the env holding them: clear the elements, not the version
+        std::vector<Value> values;
+        if (v.get_type() == THASHMAP)
+            v.get_hash_map()->for_each([&values](const Value &, const Value &item) { values.push_back(item); });
+        else
+            v.get_pvector()->for_each([&values](const Value &item) { values.push_back(item); });
+        for (Value &item : values)
+            clear_closure_env(item);
+    } else if (v.get_type() == TRECORD) {
+        RecordData *r = v.get_record();
+        for (size_t i = 0; i < r->size(); ++i)
+            clear_closure_env(r->slots()[i]);
+    }
+}
+
+void load_lang_basics(State &S) noexcept {
+    try {
+        std::filesystem::path langfile("scripts/lang_basics.lisp");
+        if (std::filesystem::exists(langfile)) {
+            std::ifstream lf(langfile);
+            if (lf) {
+                std::ostringstream lss;
+                lss << lf.rdbuf();
+                Value le = S.parse_all(lss.str(), langfile.string());
+                if (le)
+                    (void)S.do_list(le, S.global);
+            }
+        }
+    } catch (...) {
+        // ignore failures to auto-load language file
     }
 }
 
+void trap_exit(State &S) {
+    S.register_builtin("exit", [](State &, const Value &args) -> Value {
+        Value code = pair_car(args);
+        throw ScriptExit{code ? static_cast<int>(require_number(code, "exit")) : 0};
+    });
+}
+
+auto index_error(const char *who, const char *what, double d, size_t size) -> std::string {
+    if (d != std::floor(d)) // also NaN
+        return std::string(who) + ": " + what + " must be an integer, got " + number_to_string(d);
+    return std::string(who) + ": " + what + " " + number_to_string(d) + " out of range for length " +
+           std::to_string(size);
+}
+
+auto require_index(const Value &v, size_t size, const char *who, bool end_ok) -> size_t {
+    double d = require_number(v, who);
+    double limit = static_cast<double>(size);
+    if (d != std::floor(d) || d < 0 || d > limit || (d == limit && !end_ok)) [[unlikely]]
+        throw std::runtime_error(index_error(who, "index", d, size));
+    return static_cast<size_t>(d);
+}
+
+auto require_length(const Value &v, size_t elem_size, const char *who) -> size_t {
+    double n = require_number(v, who);
+    if (n < 0 || n != std::floor(n))
+        throw std::runtime_error(std::string(who) + " requires a non-negative integer length");
+    size_t max = static_cast<size_t>(PTRDIFF_MAX) / elem_size;
+    if (n > static_cast<double>(max))
+        throw std::runtime_error(std::string(who) + ": length " + number_to_string(n) + " is too large");
+    return static_cast<size_t>(n);
+}
+
 auto value_equal(const Value &a, const Value &b) -> bool {
     if (a == b)
         return true;
@@ -334,7 +483,7 @@ auto value_equal(const Value &a, const Value &b) -> bool {
     case TNUMBER:
         return a.get_number() == b.get_number();
     case TSTRING:
-        return *a.get_string() == *b.get_string();
+        return a.get_string_view() == b.get_string_view();
     case TSYMBOL:
         return *a.get_symbol() == *b.get_symbol();
     case TPAIR: {
@@ -342,6 +491,73 @@ auto value_equal(const Value &a, const Value &b) -> bool {
         PairData *bp = b.get_pair();
         return value_equal(ap->car, bp->car) && value_equal(ap->cdr, bp->cdr);
     }
+    case TVECTOR: {
+        const auto &ai = a.get_vector()->items;
+        const auto &bi = b.get_vector()->items;
+        if (ai.size() != bi.size())
+            return false;
+        for (size_t i = 0; i < ai.size(); ++i)
+            if (!value_equal(ai[i], bi[i]))
+                return false;
+        return true;
+    }
+    case TTABLE: {
+        // same keys, equal values (order does not matter)
+        TableData *at = a.get_table();
+        TableData *bt = b.get_table();
+        if (at->size() != bt->size())
+            return false;
+        for (const auto &e : at->entries()) {
+            if (!e.live)
+                continue;
+            Value *bv = bt->find(e.key);
+            if (!bv || !value_equal(e.value, *bv))
+                return false;
+        }
+        return true;
+    }
+    case TF64ARRAY: {
+        const F64ArrayData *aa = a.get_f64array();
+        const F64ArrayData *ba = b.get_f64array();
+        return aa->size() == ba->size() && std::equal(aa->data(), aa->data() + aa->size(), ba->data());
+    }
+    case TBYTES: {
+        const BytesData *ab = a.get_bytes();
+        const BytesData *bb = b.get_bytes();
+        return ab->size() == bb->size() && std::equal(ab->data(), ab->data() + ab->size(), bb->data());
+    }
+    case THASHMAP: {
+        const HashMapData *am = a.get_hash_map();
+        const HashMapData *bm = b.get_hash_map();
+        if (am->size() != bm->size())
+            return false;
+        bool equal = true;
+        am->for_each([&](const Value &k, const Value &v) {
+            const Value *bv = equal ? bm->find(k) : nullptr;
+            equal = bv && value_equal(v, *bv);
+        });
+        return equal;
+    }
+    case TPVECTOR: {
+        const PVectorData *av = a.get_pvector();
+        const PVectorData *bv = b.get_pvector();
+        if (av->size() != bv->size())
+            return false;
+        for (size_t i = 0; i < av->size(); ++i)
+            if (!value_equal(av->at(i), bv->at(i)))
+                return false;
+        return true;
+    }
+    case TRECORD: {
+        const RecordData *ar = a.get_record();
+        const RecordData *br = b.get_record();
+        if (ar->shape() != br->shape())
+            return false;
+        for (size_t i = 0; i < ar->size(); ++i)
+            if (!value_equal(ar->slots()[i], br->slots()[i]))
+                return false;
+        return true;
+    }
     default:
         return a == b;
     }
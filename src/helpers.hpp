@@ -3,6 +3,7 @@
 
 #include "vdlisp.hpp"
 
+#include <iostream>
 #include <stdexcept>
 #include <utility>
 
@@ -18,7 +19,9 @@ struct ParseError : public std::runtime_error {
 };
 
 // helpers from the interpreter moved out into a separate translation unit
-void print_error_with_loc(const State &S, const State::SourceLoc &loc, const std::string &msg);
+void print_error_with_loc(const State &S, const State::SourceLoc &loc, const std::string &msg, std::ostream &os = std::cerr);
+// Print `ex` with the location of `S.current_expr` (or of the parse error) and its call chain.
+void report_exception(State &S, const std::exception &ex, std::ostream &os = std::cerr);
 
 [[nodiscard]] auto value_equal(const Value &a, const Value &b) -> bool;
 
@@ -56,6 +59,23 @@ void print_error_with_loc(const State &S, const State::SourceLoc &loc, const std
 [[nodiscard]] inline __attribute__((always_inline)) auto is_symbol(const Value &p, const std::string &name) -> bool {
     return p && p.get_type() == TSYMBOL && *p.get_symbol() == name;
 }
+// Mutating builtins call this on the object they change: values frozen by
+// `share` are read by several isolates at once.
+inline __attribute__((always_inline)) void require_mutable(const RcBase *obj, const char *who) {
+    if (obj->readonly()) [[unlikely]]
+        throw std::runtime_error(std::string(who) + ": cannot modify a shared value");
+}
+// The message for a bad index `d` into a sequence of `size` elements:
+// "who: <what> must be an integer" when `d` is not one, else "who: <what> <d>
+// out of range for length <size>", with `d` written as given.
+[[nodiscard]] auto index_error(const char *who, const char *what, double d, size_t size) -> std::string;
+// `v` as an index into a sequence of `size` elements; `end_ok` also allows
+// `size` (the end of a range).
+[[nodiscard]] auto require_index(const Value &v, size_t size, const char *who, bool end_ok = false) -> size_t;
+// `v` as the length of a new sequence of elements of `elem_size` bytes;
+// checked before it is converted, so no length wraps or overflows the size of
+// the allocation.
+[[nodiscard]] auto require_length(const Value &v, size_t elem_size, const char *who) -> size_t;
 inline __attribute__((always_inline)) void pair_set_car(const Value &p, const Value &v) noexcept {
     if (!p)
         return;
@@ -71,9 +91,23 @@ inline __attribute__((always_inline)) void pair_set_cdr(const Value &p, const Va
     p.get_pair()->cdr = v;
 }
 
-// Clear closure_env held by TFUNC/TMACRO Values: release the Env and null the pointer.
+// Clear closure_env held by TFUNC/TMACRO Values: release the Env and null the
+// pointer. Vectors and tables are emptied, clearing their elements the same way;
+// the elements of persistent collections and the fields of records are
+// cleared in place.
 void clear_closure_env(Value &v) noexcept;
 
+// Evaluate `scripts/lang_basics.lisp` (if present) into the global env of S.
+// Failures are ignored: the language helpers are optional.
+void load_lang_basics(State &S) noexcept;
+
+// Thrown by `exit` in a State set up with trap_exit: ends the running script
+// (a server request, a batch job) rather than the whole process.
+struct ScriptExit {
+    int code;
+};
+void trap_exit(State &S);
+
 } // namespace vdlisp
 
 #endif
\ No newline at end of file
@@ -37,10 +37,15 @@ JITCompiler::JITCompiler() {
 
 JITCompiler::~JITCompiler() noexcept = default;
 
-// Concrete global JIT instance used by the runtime
-JITCompiler global_jit;
+// Built on first use so that processes which never compile (e.g. the
+// `--client` side of the server) skip LLVM initialization.
+auto global_jit() -> JITCompiler & {
+    static JITCompiler jit;
+    return jit;
+}
 
 auto JITCompiler::compileFunctionFromBuilder(const std::function<llvm::Function *(llvm::Module &)> &builder) -> void * {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     std::string mname = "jit_module";
     auto m = std::make_unique<llvm::Module>(mname, context);
 
@@ -59,6 +64,24 @@ auto JITCompiler::compileFunctionFromBuilder(const std::function<llvm::Function
     if (llvm::Function *lookup = mptr->getFunction("VDLISP__jit_lookup_number")) {
         executionEngine->addGlobalMapping(lookup, reinterpret_cast<void *>(VDLISP__jit_lookup_number));
     }
+    if (llvm::Function *acquire = mptr->getFunction("VDLISP__jit_f64_acquire")) {
+        executionEngine->addGlobalMapping(acquire, reinterpret_cast<void *>(VDLISP__jit_f64_acquire));
+    }
+    if (llvm::Function *release = mptr->getFunction("VDLISP__jit_f64_release")) {
+        executionEngine->addGlobalMapping(release, reinterpret_cast<void *>(VDLISP__jit_f64_release));
+    }
+    if (llvm::Function *store_bail = mptr->getFunction("VDLISP__jit_store_bail")) {
+        executionEngine->addGlobalMapping(store_bail, reinterpret_cast<void *>(VDLISP__jit_store_bail));
+    }
+    if (llvm::Function *range = mptr->getFunction("VDLISP__jit_f64_range_error")) {
+        executionEngine->addGlobalMapping(range, reinterpret_cast<void *>(VDLISP__jit_f64_range_error));
+    }
+    if (llvm::Function *acquire = mptr->getFunction("VDLISP__jit_record_acquire")) {
+        executionEngine->addGlobalMapping(acquire, reinterpret_cast<void *>(VDLISP__jit_record_acquire));
+    }
+    if (llvm::Function *release = mptr->getFunction("VDLISP__jit_record_release")) {
+        executionEngine->addGlobalMapping(release, reinterpret_cast<void *>(VDLISP__jit_record_release));
+    }
 
     executionEngine->addModule(std::move(m));
     executionEngine->finalizeObject();
@@ -71,6 +94,7 @@ auto JITCompiler::compileFunctionFromBuilder(const std::function<llvm::Function
 void JITCompiler::releaseFunctionCode(void *fnPtr) noexcept {
     if (!fnPtr)
         return;
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     auto it = module_for_fn.find(fnPtr);
     if (it == module_for_fn.end())
         return;
@@ -137,6 +161,7 @@ auto JITCompiler::compileFuncData(vdlisp::FuncData *func) -> void * {
     if (!func)
         return nullptr;
     using namespace vdlisp;
+    std::lock_guard<std::recursive_mutex> lock(mutex);
 
     std::vector<FuncData *> to_compile;
     collect_called_funcs(func->body, to_compile, func->closure_env);
@@ -1,13 +1,18 @@
 #ifndef JIT_JIT_HPP
 #define JIT_JIT_HPP
 
+#include <cstdint>
 #include <functional>
 #include <limits>
 #include <llvm/IR/LLVMContext.h>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 
+#include "f64array.hpp"
+#include "helpers.hpp"
+#include "record.hpp"
 #include "vdlisp.hpp"
 
 namespace llvm {
@@ -20,6 +25,10 @@ namespace vdlisp {
 class FuncData;
 }
 
+// One JIT service is shared by every State in the process. LLVM's context and
+// execution engine are not thread-safe, so all compilation and code release
+// is serialized through `mutex`; the produced machine code itself is
+// immutable and may be executed concurrently from any thread.
 class JITCompiler {
   public:
     JITCompiler();
@@ -31,6 +40,8 @@ class JITCompiler {
     void releaseFunctionCode(void *fnPtr) noexcept;
 
   private:
+    // recursive: compileFuncData compiles callees before the caller
+    std::recursive_mutex mutex;
     llvm::LLVMContext context;
     std::unique_ptr<llvm::ExecutionEngine> executionEngine;
     std::unordered_map<void *, llvm::Module *> module_for_fn;
@@ -47,6 +58,8 @@ extern "C" [[nodiscard]] inline auto VDLISP__call_from_jit(void *funcdata_ptr, d
         auto *fd = reinterpret_cast<vdlisp::FuncData *>(funcdata_ptr);
         if (!fd)
             return std::numeric_limits<double>::quiet_NaN();
+        // the compiled caller only borrows `fd`; take a reference for the Value
+        fd->inc_ref();
         vdlisp::Value fptr = S->make_pooled_value(vdlisp::TFUNC);
         fptr.set_func(fd);
         vdlisp::Value head;
@@ -61,6 +74,15 @@ extern "C" [[nodiscard]] inline auto VDLISP__call_from_jit(void *funcdata_ptr, d
         if (!res || res.get_type() != vdlisp::TNUMBER)
             return std::numeric_limits<double>::quiet_NaN();
         return res.get_number();
+    } catch (const std::exception &ex) {
+        // an error in the callee (a stack overflow, ...) is raised by the
+        // outermost State::call instead of re-running the caller interpreted
+        try {
+            if (vdlisp::State *S = vdlisp::jit_active_state; S && S->jit_error.empty())
+                S->jit_error = ex.what();
+        } catch (...) {
+        }
+        return std::numeric_limits<double>::quiet_NaN();
     } catch (...) {
         return std::numeric_limits<double>::quiet_NaN();
     }
@@ -101,6 +123,113 @@ extern "C" [[nodiscard]] inline auto VDLISP__jit_lookup_number(void *env_ptr, co
     }
 }
 
-extern JITCompiler global_jit;
+// f64arrays indexed by compiled code: the prologue acquires each array the
+// body uses by free-variable name (a reference is held until the code returns,
+// so rebinding the name meanwhile cannot free it) and gets its element pointer
+// and length. Returns nullptr when the name is not bound to an f64array, when
+// the body stores into it (`write`) and it is read-only (shared), or when no
+// State is active (pool threads); the code then bails out to the interpreter
+// before doing anything, and there f64-set! raises the usual error.
+extern "C" [[nodiscard]] inline auto VDLISP__jit_f64_acquire(void *env_ptr, const char *name, int32_t write,
+                                                             double **data, int64_t *length) noexcept -> void * {
+    try {
+        vdlisp::State *S = vdlisp::jit_active_state;
+        if (!S || !name)
+            return nullptr;
+        vdlisp::Env *e = env_ptr ? reinterpret_cast<vdlisp::Env *>(env_ptr) : S->global;
+        const std::string key{name};
+        for (vdlisp::Env *cur = e; cur; cur = cur->parent) {
+            auto it = cur->map.find(key);
+            if (it == cur->map.end())
+                continue;
+            const vdlisp::Value &v = it->second;
+            if (!v || v.get_type() != vdlisp::TF64ARRAY)
+                return nullptr;
+            vdlisp::F64ArrayData *a = v.get_f64array();
+            if (write && a->readonly())
+                return nullptr;
+            a->inc_ref();
+            *data = a->data();
+            *length = static_cast<int64_t>(a->size());
+            return a;
+        }
+        return nullptr;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+// Compiled code that has stored into an f64array cannot hand the call back to
+// the interpreter: rerunning it would repeat the stores. When `failed` (it was
+// about to bail out or return NaN) this records an error instead, unless one
+// (an index out of range) is already recorded; State::call and FnCaller
+// throw it.
+extern "C" inline void VDLISP__jit_store_bail(int32_t failed) noexcept {
+    if (!failed)
+        return;
+    try {
+        if (vdlisp::State *S = vdlisp::jit_active_state; S && S->jit_error.empty())
+            S->jit_error = "f64-set!: compiled code met a value that is not a number after storing into an f64array";
+    } catch (...) {
+    }
+}
+
+extern "C" inline void VDLISP__jit_f64_release(void *array) noexcept {
+    if (!array)
+        return;
+    // adopt the reference taken by VDLISP__jit_f64_acquire and drop it
+    vdlisp::Value v(vdlisp::TF64ARRAY);
+    v.set_f64array(reinterpret_cast<vdlisp::F64ArrayData *>(array));
+}
+
+// Records whose fields compiled code reads, acquired like f64arrays: the
+// record bound to `name` when it has the shape numbered `shape_id`, with its
+// slots (raw NaN-boxed bits) in `slots`; nullptr otherwise.
+extern "C" [[nodiscard]] inline auto VDLISP__jit_record_acquire(void *env_ptr, const char *name, int64_t shape_id,
+                                                                uint64_t **slots) noexcept -> void * {
+    try {
+        vdlisp::State *S = vdlisp::jit_active_state;
+        if (!S || !name)
+            return nullptr;
+        vdlisp::Env *e = env_ptr ? reinterpret_cast<vdlisp::Env *>(env_ptr) : S->global;
+        const std::string key{name};
+        for (vdlisp::Env *cur = e; cur; cur = cur->parent) {
+            auto it = cur->map.find(key);
+            if (it == cur->map.end())
+                continue;
+            const vdlisp::Value &v = it->second;
+            if (!v || v.get_type() != vdlisp::TRECORD || v.get_record()->shape()->id != static_cast<uint64_t>(shape_id))
+                return nullptr;
+            vdlisp::RecordData *r = v.get_record();
+            r->inc_ref();
+            static_assert(sizeof(vdlisp::Value) == sizeof(uint64_t));
+            *slots = reinterpret_cast<uint64_t *>(r->slots());
+            return r;
+        }
+        return nullptr;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+extern "C" inline void VDLISP__jit_record_release(void *record) noexcept {
+    if (!record)
+        return;
+    // adopt the reference taken by VDLISP__jit_record_acquire and drop it
+    vdlisp::Value v(vdlisp::TRECORD);
+    v.set_record(reinterpret_cast<vdlisp::RecordData *>(record));
+}
+
+// Out-of-range index in compiled f64-ref / f64-set!: records the error the
+// builtin would raise; the code then returns and State::call throws it.
+extern "C" inline void VDLISP__jit_f64_range_error(const char *who, double index, int64_t length) noexcept {
+    try {
+        if (vdlisp::State *S = vdlisp::jit_active_state)
+            S->jit_error = vdlisp::index_error(who, "index", index, static_cast<size_t>(length));
+    } catch (...) {
+    }
+}
+
+[[nodiscard]] auto global_jit() -> JITCompiler &;
 
 #endif // JIT_JIT_HPP
@@ -25,10 +25,11 @@ auto build_func_ir(vdlisp::FuncData *func, llvm::Module &M, llvm::LLVMContext &c
     FunctionType *ft = FunctionType::get(llvm::Type::getDoubleTy(context), llvm::ArrayRef<llvm::Type *>(fparams.data(), fparams.size()), false);
     Function *F = Function::Create(ft, Function::ExternalLinkage, name, &M);
 
-    BasicBlock *BB = BasicBlock::Create(context, "entry", F);
-    IRBuilder<> entry_ir(BB);
+    BasicBlock::Create(context, "entry", F);
 
     JITIREmitter emitter(func, F, context);
+    if (!emitter.emitPrologue())
+        return nullptr;
 
     vdlisp::Value body = func->body;
     llvm::Value *lastv = nullptr;
@@ -42,19 +43,10 @@ auto build_func_ir(vdlisp::FuncData *func, llvm::Module &M, llvm::LLVMContext &c
     }
     if (!lastv)
         lastv = ConstantFP::get(llvm::Type::getDoubleTy(context), 0.0);
-    // If the value was produced in a block that does not yet have a
-    // terminator (e.g. the cond continuation block), emit the return
-    // there to avoid inserting a return into the entry block after
-    // a previously-created branch (which makes invalid IR).
-    if (auto inst = llvm::dyn_cast<llvm::Instruction>(lastv)) {
-        if (llvm::BasicBlock *parent = inst->getParent()) {
-            if (!parent->getTerminator()) {
-                llvm::IRBuilder<> bb_ir(parent);
-                bb_ir.CreateRet(lastv);
-                return emitter.finalize();
-            }
-        }
-    }
-    entry_ir.CreateRet(lastv);
+    // the emitter's insertion point is where control continues after the
+    // last form (e.g. the continuation block of a cond or while)
+    emitter.emitReturn(lastv);
+    if (llvm::verifyFunction(*F))
+        return nullptr;
     return emitter.finalize();
 }
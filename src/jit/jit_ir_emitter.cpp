@@ -2,6 +2,7 @@
 #include "jit/jit_ir_emitter.hpp"
 #include "helpers.hpp"
 #include "nanbox.hpp"
+#include "record.hpp"
 
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/Function.h>
@@ -9,6 +10,8 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
 
+#include <algorithm>
+
 using namespace vdlisp;
 using namespace llvm;
 
@@ -30,16 +33,215 @@ JITIREmitter::JITIREmitter(vdlisp::FuncData *func_, llvm::Function *F_, llvm::LL
     }
 }
 
+auto JITIREmitter::entry_alloca(llvm::Type *type) -> AllocaInst * {
+    llvm::IRBuilder<> tmp(&F->getEntryBlock(), F->getEntryBlock().begin());
+    return tmp.CreateAlloca(type);
+}
+
 auto JITIREmitter::ensure_local(const std::string &name) -> AllocaInst * {
     auto it = locals.find(name);
     if (it != locals.end())
         return it->second;
-    llvm::IRBuilder<> tmp(&F->getEntryBlock(), F->getEntryBlock().begin());
-    llvm::AllocaInst *a = tmp.CreateAlloca(llvm::Type::getDoubleTy(context));
+    llvm::AllocaInst *a = entry_alloca(llvm::Type::getDoubleTy(context));
     locals[name] = a;
     return a;
 }
 
+auto JITIREmitter::env_constant() -> llvm::Constant * {
+    uintptr_t env_addr = reinterpret_cast<uintptr_t>(func && func->closure_env ? func->closure_env : nullptr);
+    llvm::Constant *env_int = llvm::ConstantInt::get(llvm::Type::getInt64Ty(context), static_cast<uint64_t>(env_addr));
+    return llvm::ConstantExpr::getIntToPtr(env_int, llvm::PointerType::getUnqual(llvm::Type::getInt8Ty(context)));
+}
+
+auto JITIREmitter::resolve(const std::string &name) const -> vdlisp::Value {
+    Env *e = func->closure_env;
+    if (e)
+        retain_env(e);
+    vdlisp::Value found;
+    while (e) {
+        auto it = e->map.find(name);
+        if (it != e->map.end()) {
+            found = it->second;
+            break;
+        }
+        Env *next = e->parent;
+        if (next)
+            retain_env(next);
+        release_env(e);
+        e = next;
+    }
+    if (e)
+        release_env(e);
+    return found;
+}
+
+auto JITIREmitter::is_f64_builtin(const std::string &name) const -> bool {
+    if (name != "f64-ref" && name != "f64-set!" && name != "f64-length")
+        return false;
+    vdlisp::Value v = resolve(name);
+    return v && v.get_type() == vdlisp::TCFUNC;
+}
+
+// The f64arrays indexed by `expr`: first arguments of f64-ref, f64-set! and
+// f64-length; marked written when one is the target of an f64-set!.
+void JITIREmitter::collect_f64arrays(const vdlisp::Value &expr, std::vector<std::pair<std::string, bool>> &arrays) const {
+    if (!is_pair(expr))
+        return;
+    vdlisp::Value op = pair_car(expr);
+    if (op && op.get_type() == vdlisp::TSYMBOL && is_f64_builtin(*op.get_symbol())) {
+        vdlisp::Value arr = pair_car(pair_cdr(expr));
+        if (arr && arr.get_type() == vdlisp::TSYMBOL) {
+            const std::string &name = *arr.get_symbol();
+            bool write = *op.get_symbol() == "f64-set!";
+            auto it = std::find_if(arrays.begin(), arrays.end(), [&](const auto &a) { return a.first == name; });
+            if (it == arrays.end())
+                arrays.emplace_back(name, write);
+            else
+                it->second = it->second || write;
+        }
+    }
+    for (vdlisp::Value cur = expr; is_pair(cur); cur = pair_cdr(cur))
+        collect_f64arrays(pair_car(cur), arrays);
+}
+
+auto JITIREmitter::is_record_accessor(const std::string &name, uint32_t &shape_id, uint32_t &slot) const -> bool {
+    if (locals.count(name) || param_index.count(name))
+        return false;
+    return vdlisp::record_accessor(resolve(name), shape_id, slot);
+}
+
+auto JITIREmitter::collect_records(const vdlisp::Value &expr, std::vector<std::pair<std::string, uint32_t>> &vars) const -> bool {
+    if (!is_pair(expr))
+        return true;
+    vdlisp::Value op = pair_car(expr);
+    uint32_t shape_id, slot;
+    if (op && op.get_type() == vdlisp::TSYMBOL && is_record_accessor(*op.get_symbol(), shape_id, slot)) {
+        vdlisp::Value rec = pair_car(pair_cdr(expr));
+        if (rec && rec.get_type() == vdlisp::TSYMBOL) {
+            const std::string &name = *rec.get_symbol();
+            auto it = std::find_if(vars.begin(), vars.end(), [&](const auto &v) { return v.first == name; });
+            if (it == vars.end())
+                vars.emplace_back(name, shape_id);
+            else if (it->second != shape_id)
+                return false;
+        }
+    }
+    for (vdlisp::Value cur = expr; is_pair(cur); cur = pair_cdr(cur))
+        if (!collect_records(pair_car(cur), vars))
+            return false;
+    return true;
+}
+
+auto JITIREmitter::emitPrologue() -> bool {
+    llvm::Type *dblTy = llvm::Type::getDoubleTy(context);
+    llvm::Type *i64Ty = llvm::Type::getInt64Ty(context);
+    llvm::Type *i8ptr = llvm::PointerType::getUnqual(llvm::Type::getInt8Ty(context));
+    llvm::Type *dblPtr = llvm::PointerType::getUnqual(dblTy);
+
+    // missing arguments are left to the interpreter
+    llvm::Value *ok = ir.CreateICmpSGE(F->getArg(1), llvm::ConstantInt::get(llvm::Type::getInt32Ty(context), (int)param_index.size()));
+
+    std::vector<std::pair<std::string, bool>> arrays;
+    collect_f64arrays(func->body, arrays);
+    if (!arrays.empty()) {
+        llvm::Type *i32Ty = llvm::Type::getInt32Ty(context);
+        llvm::FunctionType *ft = llvm::FunctionType::get(i8ptr, {i8ptr, i8ptr, i32Ty, llvm::PointerType::getUnqual(dblPtr), llvm::PointerType::getUnqual(i64Ty)}, false);
+        llvm::FunctionCallee acquire = F->getParent()->getOrInsertFunction("VDLISP__jit_f64_acquire", ft);
+        for (const auto &[name, write] : arrays) {
+            // only free variables: parameters are numbers here
+            if (param_index.count(name))
+                return false;
+            llvm::AllocaInst *data_slot = entry_alloca(dblPtr);
+            llvm::AllocaInst *length_slot = entry_alloca(i64Ty);
+            llvm::Value *handle = ir.CreateCall(acquire, {env_constant(), ir.CreateGlobalStringPtr(name), llvm::ConstantInt::get(i32Ty, write ? 1 : 0), data_slot, length_slot});
+            f64arrays[name] = {handle, ir.CreateLoad(dblPtr, data_slot), ir.CreateLoad(i64Ty, length_slot)};
+            ok = ir.CreateAnd(ok, ir.CreateIsNotNull(handle));
+            if (write && !stored) {
+                stored = entry_alloca(ir.getInt1Ty());
+                ir.CreateStore(ir.getFalse(), stored);
+            }
+        }
+    }
+
+    std::vector<std::pair<std::string, uint32_t>> record_vars;
+    if (!collect_records(func->body, record_vars))
+        return false;
+    if (!record_vars.empty()) {
+        llvm::Type *slotsPtr = llvm::PointerType::getUnqual(i64Ty);
+        llvm::FunctionType *ft = llvm::FunctionType::get(i8ptr, {i8ptr, i8ptr, i64Ty, llvm::PointerType::getUnqual(slotsPtr)}, false);
+        llvm::FunctionCallee acquire = F->getParent()->getOrInsertFunction("VDLISP__jit_record_acquire", ft);
+        for (const auto &[name, shape_id] : record_vars) {
+            // only free variables: parameters are numbers here
+            if (param_index.count(name) || f64arrays.count(name))
+                return false;
+            llvm::AllocaInst *slots_slot = entry_alloca(slotsPtr);
+            llvm::Value *handle = ir.CreateCall(acquire, {env_constant(), ir.CreateGlobalStringPtr(name), llvm::ConstantInt::get(i64Ty, shape_id), slots_slot});
+            records[name] = {shape_id, handle, ir.CreateLoad(slotsPtr, slots_slot)};
+            ok = ir.CreateAnd(ok, ir.CreateIsNotNull(handle));
+        }
+    }
+
+    llvm::BasicBlock *bodyBB = llvm::BasicBlock::Create(context, "body", F);
+    ir.CreateCondBr(ok, bodyBB, bailBlock());
+    ir.SetInsertPoint(bodyBB);
+    // parameters live in locals so `set` can assign them
+    for (const auto &[name, i] : param_index) {
+        llvm::Value *idxv = llvm::ConstantInt::get(i64Ty, i);
+        llvm::Value *gep = ir.CreateInBoundsGEP(dblTy, F->getArg(0), {idxv});
+        ir.CreateStore(ir.CreateLoad(dblTy, gep), ensure_local(name));
+    }
+    return true;
+}
+
+void JITIREmitter::release_acquired() {
+    llvm::Type *i8ptr = llvm::PointerType::getUnqual(llvm::Type::getInt8Ty(context));
+    llvm::FunctionType *ft = llvm::FunctionType::get(llvm::Type::getVoidTy(context), {i8ptr}, false);
+    if (!f64arrays.empty()) {
+        llvm::FunctionCallee release = F->getParent()->getOrInsertFunction("VDLISP__jit_f64_release", ft);
+        for (const auto &kv : f64arrays)
+            ir.CreateCall(release, {kv.second.handle});
+    }
+    if (!records.empty()) {
+        llvm::FunctionCallee release = F->getParent()->getOrInsertFunction("VDLISP__jit_record_release", ft);
+        for (const auto &kv : records)
+            ir.CreateCall(release, {kv.second.handle});
+    }
+}
+
+void JITIREmitter::failAfterStore(llvm::Value *cond) {
+    if (!stored)
+        return;
+    llvm::FunctionType *ft = llvm::FunctionType::get(llvm::Type::getVoidTy(context), {ir.getInt32Ty()}, false);
+    llvm::FunctionCallee store_bail = F->getParent()->getOrInsertFunction("VDLISP__jit_store_bail", ft);
+    llvm::Value *after = ir.CreateLoad(ir.getInt1Ty(), stored);
+    ir.CreateCall(store_bail, {ir.CreateZExt(cond ? ir.CreateAnd(after, cond) : after, ir.getInt32Ty())});
+}
+
+auto JITIREmitter::bailBlock() -> llvm::BasicBlock * {
+    if (bail)
+        return bail;
+    bail = llvm::BasicBlock::Create(context, "bail", F);
+    llvm::IRBuilderBase::InsertPointGuard guard(ir);
+    ir.SetInsertPoint(bail);
+    failAfterStore(nullptr);
+    release_acquired();
+    ir.CreateRet(llvm::ConstantFP::getNaN(llvm::Type::getDoubleTy(context)));
+    return bail;
+}
+
+void JITIREmitter::bailIfNaN(llvm::Value *v) {
+    llvm::BasicBlock *numBB = llvm::BasicBlock::Create(context, "num", F);
+    ir.CreateCondBr(ir.CreateFCmpUNO(v, v), bailBlock(), numBB);
+    ir.SetInsertPoint(numBB);
+}
+
+void JITIREmitter::emitReturn(llvm::Value *v) {
+    // a NaN result also sends the call back to the interpreter
+    failAfterStore(ir.CreateFCmpUNO(v, v));
+    release_acquired();
+    ir.CreateRet(v);
+}
+
 auto JITIREmitter::compileCond(const vdlisp::Value &clauses) -> llvm::Value * {
     if (!clauses)
         return llvm::ConstantFP::get(llvm::Type::getDoubleTy(context), 0.0);
@@ -117,6 +319,10 @@ auto JITIREmitter::compileWhile(const vdlisp::Value &rest) -> llvm::Value * {
     llvm::BasicBlock *bodyBB = llvm::BasicBlock::Create(context, "loopbody", F);
     llvm::BasicBlock *contBB = llvm::BasicBlock::Create(context, "loopcont", F);
 
+    // value of the last iteration; NaN (no number: the interpreter's nil)
+    // when the body never runs
+    llvm::AllocaInst *result = entry_alloca(llvm::Type::getDoubleTy(context));
+    ir.CreateStore(llvm::ConstantFP::getNaN(llvm::Type::getDoubleTy(context)), result);
     ir.CreateBr(loopBB);
     ir.SetInsertPoint(loopBB);
     llvm::Value *condv = emitExpr(cond);
@@ -138,10 +344,11 @@ auto JITIREmitter::compileWhile(const vdlisp::Value &rest) -> llvm::Value * {
     }
     if (!last)
         last = llvm::ConstantFP::get(llvm::Type::getDoubleTy(context), 0.0);
+    ir.CreateStore(last, result);
     ir.CreateBr(loopBB);
 
     ir.SetInsertPoint(contBB);
-    return last;
+    return ir.CreateLoad(llvm::Type::getDoubleTy(context), result);
 }
 
 auto JITIREmitter::compileLet(const vdlisp::Value &rest) -> llvm::Value * {
@@ -153,7 +360,7 @@ auto JITIREmitter::compileLet(const vdlisp::Value &rest) -> llvm::Value * {
             vdlisp::Value pair = pair_car(b);
             vdlisp::Value name = pair_car(pair);
             vdlisp::Value val = pair_car(pair_cdr(pair));
-            if (!name || name.get_type() != vdlisp::TSYMBOL)
+            if (!name || name.get_type() != vdlisp::TSYMBOL || f64arrays.count(*name.get_symbol()) || records.count(*name.get_symbol()))
                 return nullptr;
             llvm::Value *v = emitExpr(val);
             if (!v)
@@ -165,7 +372,7 @@ auto JITIREmitter::compileLet(const vdlisp::Value &rest) -> llvm::Value * {
     } else {
         while (b) {
             vdlisp::Value name = pair_car(b);
-            if (!name || name.get_type() != vdlisp::TSYMBOL)
+            if (!name || name.get_type() != vdlisp::TSYMBOL || f64arrays.count(*name.get_symbol()) || records.count(*name.get_symbol()))
                 return nullptr;
             vdlisp::Value next = pair_cdr(b);
             if (!next)
@@ -193,6 +400,96 @@ auto JITIREmitter::compileLet(const vdlisp::Value &rest) -> llvm::Value * {
         last = llvm::ConstantFP::get(llvm::Type::getDoubleTy(context), 0.0);
     return last;
 }
+
+// (set name v) on a parameter or let local; other names are not compiled
+auto JITIREmitter::compileSet(const vdlisp::Value &rest) -> llvm::Value * {
+    vdlisp::Value name = pair_car(rest);
+    if (!name || name.get_type() != vdlisp::TSYMBOL)
+        return nullptr;
+    auto it = locals.find(*name.get_symbol());
+    if (it == locals.end())
+        return nullptr;
+    llvm::Value *v = emitExpr(pair_car(pair_cdr(rest)));
+    if (!v)
+        return nullptr;
+    ir.CreateStore(v, it->second);
+    return v;
+}
+
+// f64-ref / f64-set! / f64-length on an array acquired by the prologue:
+// direct loads and stores behind the same index check as the builtins.
+auto JITIREmitter::compileF64Op(const std::string &opname, const vdlisp::Value &rest) -> llvm::Value * {
+    vdlisp::Value arr = pair_car(rest);
+    if (!arr || arr.get_type() != vdlisp::TSYMBOL)
+        return nullptr;
+    auto it = f64arrays.find(*arr.get_symbol());
+    if (it == f64arrays.end())
+        return nullptr;
+    const F64Array &a = it->second;
+    llvm::Type *dblTy = llvm::Type::getDoubleTy(context);
+    llvm::Type *i64Ty = llvm::Type::getInt64Ty(context);
+    if (opname == "f64-length")
+        return ir.CreateSIToFP(a.length, dblTy);
+
+    vdlisp::Value args = pair_cdr(rest);
+    llvm::Value *idx = emitExpr(pair_car(args));
+    if (!idx)
+        return nullptr;
+    llvm::Value *x = nullptr;
+    if (opname == "f64-set!") {
+        x = emitExpr(pair_car(pair_cdr(args)));
+        if (!x)
+            return nullptr;
+    }
+
+    // 0 <= idx < length (false for NaN), then integral
+    llvm::BasicBlock *intBB = llvm::BasicBlock::Create(context, "f64_int", F);
+    llvm::BasicBlock *okBB = llvm::BasicBlock::Create(context, "f64_ok", F);
+    llvm::BasicBlock *errBB = llvm::BasicBlock::Create(context, "f64_range", F);
+    llvm::Value *zero = llvm::ConstantFP::get(dblTy, 0.0);
+    llvm::Value *in_range = ir.CreateAnd(ir.CreateFCmpOGE(idx, zero), ir.CreateFCmpOLT(idx, ir.CreateSIToFP(a.length, dblTy)));
+    ir.CreateCondBr(in_range, intBB, errBB);
+    ir.SetInsertPoint(intBB);
+    llvm::Value *i = ir.CreateFPToSI(idx, i64Ty);
+    ir.CreateCondBr(ir.CreateFCmpOEQ(ir.CreateSIToFP(i, dblTy), idx), okBB, errBB);
+
+    ir.SetInsertPoint(errBB);
+    llvm::Type *i8ptr = llvm::PointerType::getUnqual(llvm::Type::getInt8Ty(context));
+    llvm::FunctionType *ft = llvm::FunctionType::get(llvm::Type::getVoidTy(context), {i8ptr, dblTy, i64Ty}, false);
+    llvm::FunctionCallee range_error = F->getParent()->getOrInsertFunction("VDLISP__jit_f64_range_error", ft);
+    ir.CreateCall(range_error, {ir.CreateGlobalStringPtr(opname), idx, a.length});
+    ir.CreateBr(bailBlock());
+
+    ir.SetInsertPoint(okBB);
+    llvm::Value *ptr = ir.CreateInBoundsGEP(dblTy, a.data, {i});
+    if (x) {
+        ir.CreateStore(x, ptr);
+        ir.CreateStore(ir.getTrue(), stored);
+        return x;
+    }
+    return ir.CreateLoad(dblTy, ptr);
+}
+
+// (accessor r) on a record acquired by the prologue: a load of the field,
+// which has to hold a number (anything else bails out).
+auto JITIREmitter::compileRecordRef(uint32_t slot, const vdlisp::Value &rest) -> llvm::Value * {
+    vdlisp::Value rec = pair_car(rest);
+    if (!rec || rec.get_type() != vdlisp::TSYMBOL || pair_cdr(rest))
+        return nullptr;
+    auto it = records.find(*rec.get_symbol());
+    if (it == records.end())
+        return nullptr;
+    llvm::Type *i64Ty = llvm::Type::getInt64Ty(context);
+    llvm::Value *ptr = ir.CreateInBoundsGEP(i64Ty, it->second.slots, {llvm::ConstantInt::get(i64Ty, slot)});
+    llvm::Value *bits = ir.CreateLoad(i64Ty, ptr);
+    // a number unless all exponent bits are set (see Value::get_type)
+    llvm::Value *nan_mask = llvm::ConstantInt::get(i64Ty, vdlisp::Value::kNaNMask);
+    llvm::BasicBlock *numBB = llvm::BasicBlock::Create(context, "field_num", F);
+    ir.CreateCondBr(ir.CreateICmpEQ(ir.CreateAnd(bits, nan_mask), nan_mask), bailBlock(), numBB);
+    ir.SetInsertPoint(numBB);
+    return ir.CreateBitCast(bits, llvm::Type::getDoubleTy(context));
+}
+
 auto JITIREmitter::emitExpr(const vdlisp::Value &expr) -> llvm::Value * {
     if (!expr)
         return llvm::ConstantFP::get(llvm::Type::getDoubleTy(context), 0.0);
@@ -206,35 +503,23 @@ auto JITIREmitter::emitExpr(const vdlisp::Value &expr) -> llvm::Value * {
         if (*expr.get_symbol() == "#t") {
             return llvm::ConstantFP::get(llvm::Type::getDoubleTy(context), 1.0);
         }
-        auto it = param_index.find(*expr.get_symbol());
-        if (it != param_index.end()) {
-            int i = it->second;
-            llvm::Value *argptr = F->getArg(0);
-            llvm::Value *idxv = llvm::ConstantInt::get(llvm::Type::getInt64Ty(context), i);
-            llvm::Value *gep = ir.CreateInBoundsGEP(llvm::Type::getDoubleTy(context), argptr, {idxv});
-            return ir.CreateLoad(llvm::Type::getDoubleTy(context), gep);
-        }
         auto lit = locals.find(*expr.get_symbol());
         if (lit != locals.end()) {
             return ir.CreateLoad(llvm::Type::getDoubleTy(context), lit->second);
         }
 
         // Free variable: try runtime lookup from closure env chain.
-        // Returns NaN if unbound or non-numeric; the caller will then fall back.
+        // Returns NaN if unbound or non-numeric; the interpreter then takes over.
         llvm::Module *M = F->getParent();
         llvm::Type *dblTy = llvm::Type::getDoubleTy(context);
         llvm::Type *i8ptr = llvm::PointerType::getUnqual(llvm::Type::getInt8Ty(context));
         llvm::FunctionType *ft = llvm::FunctionType::get(dblTy, {i8ptr, i8ptr}, false);
         llvm::FunctionCallee callee = M->getOrInsertFunction("VDLISP__jit_lookup_number", ft);
 
-        auto env_ptr_ty = i8ptr;
-        auto env_bits_ty = llvm::Type::getInt64Ty(context);
-        uintptr_t env_addr = reinterpret_cast<uintptr_t>(func && func->closure_env ? func->closure_env : nullptr);
-        llvm::Constant *env_int = llvm::ConstantInt::get(env_bits_ty, static_cast<uint64_t>(env_addr));
-        llvm::Constant *env_ptr = llvm::ConstantExpr::getIntToPtr(env_int, env_ptr_ty);
-
         llvm::Value *name_ptr = ir.CreateGlobalStringPtr(*expr.get_symbol());
-        return ir.CreateCall(callee, {env_ptr, name_ptr});
+        llvm::Value *v = ir.CreateCall(callee, {env_constant(), name_ptr});
+        bailIfNaN(v);
+        return v;
     }
     if (expr.get_type() == vdlisp::TPAIR) {
         vdlisp::PairData *pd = expr.get_pair();
@@ -250,6 +535,13 @@ auto JITIREmitter::emitExpr(const vdlisp::Value &expr) -> llvm::Value * {
             return compileWhile(rest);
         if (opname == "let")
             return compileLet(rest);
+        if (opname == "set")
+            return compileSet(rest);
+        if (is_f64_builtin(opname))
+            return compileF64Op(opname, rest);
+        uint32_t shape_id, slot;
+        if (is_record_accessor(opname, shape_id, slot))
+            return compileRecordRef(slot, rest);
 
         std::vector<llvm::Value *> vals;
         vdlisp::Value a = rest;
@@ -297,25 +589,7 @@ auto JITIREmitter::emitExpr(const vdlisp::Value &expr) -> llvm::Value * {
                 cmp = ir.CreateFCmpOEQ(L, R);
             return ir.CreateSelect(cmp, llvm::ConstantFP::get(llvm::Type::getDoubleTy(context), 1.0), llvm::ConstantFP::get(llvm::Type::getDoubleTy(context), 0.0));
         } // TODO >2 vals???
-        const std::string *nm_ptr = op.get_symbol();
-        Env *e = func->closure_env;
-        if (e)
-            retain_env(e);
-        vdlisp::Value found;
-        while (e) {
-            auto it = e->map.find(*nm_ptr);
-            if (it != e->map.end()) {
-                found = it->second;
-                break;
-            }
-            Env *next = e->parent;
-            if (next)
-                retain_env(next);
-            release_env(e);
-            e = next;
-        }
-        if (e)
-            release_env(e);
+        vdlisp::Value found = resolve(opname);
         if (found && found.get_type() == vdlisp::TFUNC) {
             vdlisp::FuncData *callee_fd = found.get_func();
             if (!callee_fd)
@@ -345,6 +619,7 @@ auto JITIREmitter::emitExpr(const vdlisp::Value &expr) -> llvm::Value * {
             if (callee_fd->compiled_code) {
                 llvm::FunctionCallee fc = M->getOrInsertFunction(callee_name, native_ft);
                 llvm::Value *callv = ir.CreateCall(fc, {argArrayPtr, argcV});
+                bailIfNaN(callv);
                 return callv;
             }
 
@@ -354,6 +629,7 @@ auto JITIREmitter::emitExpr(const vdlisp::Value &expr) -> llvm::Value * {
             llvm::Constant *fd_c = llvm::ConstantInt::get(llvm::Type::getInt64Ty(context), (uint64_t)callee_fd);
             llvm::Constant *fd_ptr = llvm::ConstantExpr::getIntToPtr(fd_c, i8ptr);
             llvm::Value *callv = ir.CreateCall(bridge, {fd_ptr, argArrayPtr, argcV});
+            bailIfNaN(callv);
             return callv;
         }
 
@@ -2,11 +2,15 @@
 #define JIT_JIT_IR_EMITTER_HPP
 
 #include <llvm/IR/IRBuilder.h>
+#include <cstdint>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace llvm {
 class AllocaInst;
+class BasicBlock;
 class Function;
 class LLVMContext;
 class Value;
@@ -21,10 +25,20 @@ class PairData;
 class JITIREmitter {
   public:
     JITIREmitter(vdlisp::FuncData *func, llvm::Function *F, llvm::LLVMContext &context);
+    // Entry block: acquire the f64arrays the body indexes and the records
+    // whose fields it reads, bail out when one is missing or arguments are,
+    // then copy the parameters into locals.
+    // False when the body cannot be compiled.
+    auto emitPrologue() -> bool;
     auto emitExpr(const vdlisp::Value &expr) -> llvm::Value *;
     auto compileCond(const vdlisp::Value &clauses) -> llvm::Value *;
     auto compileWhile(const vdlisp::Value &rest) -> llvm::Value *;
     auto compileLet(const vdlisp::Value &rest) -> llvm::Value *;
+    auto compileSet(const vdlisp::Value &rest) -> llvm::Value *;
+    auto compileF64Op(const std::string &opname, const vdlisp::Value &rest) -> llvm::Value *;
+    auto compileRecordRef(uint32_t slot, const vdlisp::Value &rest) -> llvm::Value *;
+    // Release the acquired f64arrays and records and return `v`.
+    void emitReturn(llvm::Value *v);
     auto finalize() -> llvm::Function *;
 
   private:
@@ -34,8 +48,46 @@ class JITIREmitter {
     llvm::IRBuilder<> ir;
     std::unordered_map<std::string, llvm::AllocaInst *> locals;
     std::unordered_map<std::string, int> param_index;
+    struct F64Array {
+        llvm::Value *handle; // reference taken by VDLISP__jit_f64_acquire
+        llvm::Value *data;
+        llvm::Value *length; // i64
+    };
+    std::unordered_map<std::string, F64Array> f64arrays;
+    struct Record {
+        uint32_t shape_id;
+        llvm::Value *handle = nullptr; // reference taken by VDLISP__jit_record_acquire
+        llvm::Value *slots = nullptr;  // i64*: the NaN-boxed fields
+    };
+    std::unordered_map<std::string, Record> records;
+    llvm::BasicBlock *bail = nullptr;
+    // i1, set once the body has stored into an f64array (null when it never
+    // does): from then on the call cannot be redone by the interpreter
+    llvm::AllocaInst *stored = nullptr;
 
+    auto entry_alloca(llvm::Type *type) -> llvm::AllocaInst *;
     auto ensure_local(const std::string &name) -> llvm::AllocaInst *;
+    // The closure environment as a constant pointer (null: the global env).
+    auto env_constant() -> llvm::Constant *;
+    // Value bound to `name` in the closure environment chain (nil if unbound).
+    auto resolve(const std::string &name) const -> vdlisp::Value;
+    auto is_f64_builtin(const std::string &name) const -> bool;
+    // f64arrays indexed by `expr`, each with whether the body stores into it.
+    void collect_f64arrays(const vdlisp::Value &expr, std::vector<std::pair<std::string, bool>> &arrays) const;
+    // When `name` is bound to an accessor made by defrecord, its shape and slot.
+    auto is_record_accessor(const std::string &name, uint32_t &shape_id, uint32_t &slot) const -> bool;
+    // Records read by `expr`: the symbol arguments of accessor calls, with
+    // the shape each accessor expects; false when one name is read with two.
+    auto collect_records(const vdlisp::Value &expr, std::vector<std::pair<std::string, uint32_t>> &vars) const -> bool;
+    void release_acquired();
+    // When `cond` holds after a store, record the error that replaces the
+    // interpreter's rerun of the call (see VDLISP__jit_store_bail).
+    void failAfterStore(llvm::Value *cond);
+    // Block returning NaN (the interpreter takes over) after releasing the arrays
+    // and records.
+    auto bailBlock() -> llvm::BasicBlock *;
+    // Continue only when `v` is a number; NaN from a callee bails out.
+    void bailIfNaN(llvm::Value *v);
 };
 
 #endif // JIT_JIT_IR_EMITTER_HPP
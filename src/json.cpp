@@ -0,0 +1,612 @@
+#include "json.hpp"
+#include "f64array.hpp"
+#include "files.hpp"
+#include "helpers.hpp"
+#include "persistent.hpp"
+#include "record.hpp"
+#include "table.hpp"
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#define VDLISP__JSON_X86 1
+#include <immintrin.h>
+#endif
+
+namespace vdlisp {
+
+namespace {
+
+// deeper nesting is an error (both ways: parsing recurses, and emitting a
+// table that contains itself would never end)
+constexpr int kMaxDepth = 512;
+// distinct object keys shared between objects of one parse
+constexpr size_t kKeyCache = 1024;
+
+// -------------------- string scanning --------------------
+
+// Offset of the first '"', '\\' or control byte in [i, n) of `p`, or n.
+using ScanFn = size_t (*)(const char *p, size_t i, size_t n) noexcept;
+
+auto plain_byte(char c) noexcept -> bool {
+    return c != '"' && c != '\\' && static_cast<unsigned char>(c) >= 0x20;
+}
+
+auto scan_scalar(const char *p, size_t i, size_t n) noexcept -> size_t {
+    while (i < n && plain_byte(p[i]))
+        ++i;
+    return i;
+}
+
+#if VDLISP__JSON_X86
+__attribute__((target("avx2"))) auto scan_avx2(const char *p, size_t i, size_t n) noexcept -> size_t {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1f);
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i));
+        // v <= 0x1f (unsigned) exactly when max(v, 0x1f) == 0x1f
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                                      _mm256_cmpeq_epi8(_mm256_max_epu8(v, control), control));
+        if (auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit)))
+            return i + static_cast<size_t>(__builtin_ctz(mask));
+    }
+    return scan_scalar(p, i, n);
+}
+#endif
+
+auto pick_scan() noexcept -> ScanFn {
+#if VDLISP__JSON_X86
+    const char *env = std::getenv("VDLISP__SIMD");
+    __builtin_cpu_init();
+    if (!(env && std::strcmp(env, "scalar") == 0) && __builtin_cpu_supports("avx2"))
+        return scan_avx2;
+#endif
+    return scan_scalar;
+}
+
+void put_utf8(std::string &out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xc0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xe0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    } else {
+        out += static_cast<char>(0xf0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (cp & 0x3f));
+    }
+}
+
+// -------------------- parsing --------------------
+
+// Recursive descent over `text`, making each Value as soon as it is read.
+class Parser {
+  public:
+    Parser(State &S, const Value &text, bool lists)
+        : S(S), text_(text), p_(text.get_string_view().data()), n_(text.get_string_view().size()), lists_(lists),
+          true_(S.get_bound("#t", S.global)) {}
+
+    auto parse() -> Value {
+        Value v = value(0);
+        skip_blank();
+        if (i_ < n_)
+            fail("unexpected text after the value");
+        return v;
+    }
+
+  private:
+    [[noreturn]] void fail(const std::string &what) const {
+        size_t line = 1, col = 1;
+        for (size_t k = 0; k < i_ && k < n_; ++k) {
+            if (p_[k] == '\n') {
+                ++line;
+                col = 1;
+            } else {
+                ++col;
+            }
+        }
+        throw std::runtime_error("json-parse: line " + std::to_string(line) + " column " + std::to_string(col) + ": " +
+                                 what);
+    }
+
+    void skip_blank() noexcept {
+        while (i_ < n_ && (p_[i_] == ' ' || p_[i_] == '\n' || p_[i_] == '\r' || p_[i_] == '\t'))
+            ++i_;
+    }
+
+    void expect(char c) {
+        skip_blank();
+        if (i_ >= n_ || p_[i_] != c)
+            fail(std::string("expected '") + c + "'");
+        ++i_;
+    }
+
+    void literal(std::string_view word) {
+        if (word.compare(0, word.size(), p_ + i_, std::min(word.size(), n_ - i_)) != 0)
+            fail("invalid literal");
+        i_ += word.size();
+    }
+
+    auto value(int depth) -> Value {
+        skip_blank();
+        if (i_ >= n_)
+            fail("unexpected end of input");
+        switch (p_[i_]) {
+        case '{':
+            return object(depth + 1);
+        case '[':
+            return array(depth + 1);
+        case '"':
+            return string_value();
+        case 't':
+            literal("true");
+            return true_;
+        case 'f':
+            literal("false");
+            return {};
+        case 'n':
+            literal("null");
+            return {};
+        default:
+            return number();
+        }
+    }
+
+    auto object(int depth) -> Value {
+        if (depth > kMaxDepth)
+            fail("nesting too deep");
+        ++i_;
+        Value table = lists_ ? Value() : S.make_table();
+        Value head;
+        Value *last = &head;
+        skip_blank();
+        if (i_ < n_ && p_[i_] == '}') {
+            ++i_;
+            return lists_ ? head : table;
+        }
+        for (;;) {
+            skip_blank();
+            if (i_ >= n_ || p_[i_] != '"')
+                fail("expected a string key");
+            Value key = key_value();
+            expect(':');
+            Value v = value(depth);
+            if (lists_) {
+                *last = S.make_pair(S.make_pair(std::move(key), std::move(v)), Value());
+                last = &last->get_pair()->cdr;
+            } else {
+                table.get_table()->set(key, std::move(v));
+            }
+            skip_blank();
+            if (i_ < n_ && p_[i_] == ',') {
+                ++i_;
+                continue;
+            }
+            expect('}');
+            return lists_ ? head : table;
+        }
+    }
+
+    auto array(int depth) -> Value {
+        if (depth > kMaxDepth)
+            fail("nesting too deep");
+        ++i_;
+        std::vector<Value> items;
+        Value head;
+        Value *last = &head;
+        skip_blank();
+        if (i_ < n_ && p_[i_] == ']') {
+            ++i_;
+            return lists_ ? head : S.make_vector();
+        }
+        for (;;) {
+            Value v = value(depth);
+            if (lists_) {
+                *last = S.make_pair(std::move(v), Value());
+                last = &last->get_pair()->cdr;
+            } else {
+                items.push_back(std::move(v));
+            }
+            skip_blank();
+            if (i_ < n_ && p_[i_] == ',') {
+                ++i_;
+                continue;
+            }
+            expect(']');
+            return lists_ ? head : S.make_vector(std::move(items));
+        }
+    }
+
+    // The string at i_ (on its opening quote): [start, i_) of the input when
+    // it has no escapes (true is returned), else its text in `out`.
+    auto read_string(size_t &start, std::string &out) -> bool {
+        static const ScanFn scan = pick_scan();
+        start = ++i_;
+        i_ = scan(p_, i_, n_);
+        if (i_ < n_ && p_[i_] == '"')
+            return true;
+        out.assign(p_ + start, i_ - start);
+        for (;;) {
+            if (i_ >= n_)
+                fail("unterminated string");
+            char c = p_[i_];
+            if (c == '"')
+                return false;
+            if (c != '\\')
+                fail("control character in string");
+            if (++i_ >= n_)
+                fail("unterminated string");
+            switch (p_[i_++]) {
+            case '"':
+                out += '"';
+                break;
+            case '\\':
+                out += '\\';
+                break;
+            case '/':
+                out += '/';
+                break;
+            case 'b':
+                out += '\b';
+                break;
+            case 'f':
+                out += '\f';
+                break;
+            case 'n':
+                out += '\n';
+                break;
+            case 'r':
+                out += '\r';
+                break;
+            case 't':
+                out += '\t';
+                break;
+            case 'u': {
+                uint32_t cp = hex4();
+                if (cp >= 0xd800 && cp < 0xdc00) {
+                    // a high surrogate must be followed by a low one: alone it
+                    // has no UTF-8 encoding
+                    if (i_ + 1 >= n_ || p_[i_] != '\\' || p_[i_ + 1] != 'u')
+                        fail("unpaired surrogate");
+                    i_ += 2;
+                    uint32_t lo = hex4();
+                    if (lo < 0xdc00 || lo >= 0xe000)
+                        fail("invalid surrogate pair");
+                    cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                } else if (cp >= 0xdc00 && cp < 0xe000) {
+                    fail("unpaired surrogate");
+                }
+                put_utf8(out, cp);
+                break;
+            }
+            default:
+                --i_;
+                fail("invalid escape");
+            }
+            size_t from = i_;
+            i_ = scan(p_, i_, n_);
+            out.append(p_ + from, i_ - from);
+        }
+    }
+
+    auto hex4() -> uint32_t {
+        if (n_ - i_ < 4)
+            fail("invalid \\u escape");
+        uint32_t cp = 0;
+        auto res = std::from_chars(p_ + i_, p_ + i_ + 4, cp, 16);
+        if (res.ec != std::errc() || res.ptr != p_ + i_ + 4)
+            fail("invalid \\u escape");
+        i_ += 4;
+        return cp;
+    }
+
+    auto string_value() -> Value {
+        size_t start;
+        std::string s;
+        bool plain = read_string(start, s);
+        size_t end = i_++;
+        return plain ? S.make_string_slice(text_, start, end - start) : S.make_string(std::move(s));
+    }
+
+    // Keys repeat across the objects of an array: one string per distinct key.
+    auto key_value() -> Value {
+        size_t start;
+        std::string s;
+        bool plain = read_string(start, s);
+        size_t end = i_++;
+        std::string_view k = plain ? std::string_view(p_ + start, end - start) : std::string_view(s);
+        if (auto it = keys_.find(k); it != keys_.end())
+            return it->second;
+        Value v = plain ? S.make_string_slice(text_, start, end - start) : S.make_string(std::move(s));
+        if (keys_.size() < kKeyCache)
+            keys_.emplace(v.get_string_view(), v);
+        return v;
+    }
+
+    // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+    auto number() -> Value {
+        size_t start = i_;
+        auto digits = [this] {
+            size_t from = i_;
+            while (i_ < n_ && p_[i_] >= '0' && p_[i_] <= '9')
+                ++i_;
+            return i_ > from;
+        };
+        if (i_ < n_ && p_[i_] == '-')
+            ++i_;
+        if (i_ < n_ && p_[i_] == '0')
+            ++i_;
+        else if (!digits())
+            fail(start == i_ ? "unexpected character" : "invalid number");
+        if (i_ < n_ && p_[i_] == '.') {
+            ++i_;
+            if (!digits())
+                fail("invalid number");
+        }
+        if (i_ < n_ && (p_[i_] == 'e' || p_[i_] == 'E')) {
+            ++i_;
+            if (i_ < n_ && (p_[i_] == '+' || p_[i_] == '-'))
+                ++i_;
+            if (!digits())
+                fail("invalid number");
+        }
+        double x = 0;
+        auto res = std::from_chars(p_ + start, p_ + i_, x);
+        if (res.ec == std::errc::result_out_of_range) {
+            // from_chars reports underflow the same way and leaves `x` alone;
+            // strtod tells them apart (the text is copied: `p_` is not
+            // terminated after the number)
+            x = std::strtod(std::string(p_ + start, i_ - start).c_str(), nullptr);
+            if (std::isinf(x))
+                fail("number out of range");
+        }
+        return S.make_number(x);
+    }
+
+    State &S;
+    Value text_;
+    const char *p_;
+    size_t n_;
+    size_t i_ = 0;
+    bool lists_;
+    Value true_;
+    std::unordered_map<std::string_view, Value> keys_;
+};
+
+// -------------------- emitting --------------------
+
+// Appends JSON text for Values to `out`.
+class Emitter {
+  public:
+    explicit Emitter(std::string &out) : out_(out) {}
+
+    void value(const Value &v, int depth) {
+        if (depth > kMaxDepth)
+            throw std::runtime_error("json-emit: nesting too deep");
+        switch (v.get_type()) {
+        case TNIL:
+            out_ += "null";
+            return;
+        case TNUMBER:
+            number(v.get_number());
+            return;
+        case TSTRING:
+            string(v.get_string_view());
+            return;
+        case TSYMBOL:
+            if (*v.get_symbol() == "#t")
+                out_ += "true";
+            else if (*v.get_symbol() == "false")
+                out_ += "false";
+            else
+                string(*v.get_symbol());
+            return;
+        case TPAIR:
+            list(v, depth);
+            return;
+        case TVECTOR: {
+            out_ += '[';
+            bool first = true;
+            for (const Value &x : v.get_vector()->items)
+                element(x, first, depth);
+            out_ += ']';
+            return;
+        }
+        case TPVECTOR: {
+            out_ += '[';
+            bool first = true;
+            v.get_pvector()->for_each([&](const Value &x) { element(x, first, depth); });
+            out_ += ']';
+            return;
+        }
+        case TF64ARRAY: {
+            const F64ArrayData *a = v.get_f64array();
+            out_ += '[';
+            for (size_t i = 0; i < a->size(); ++i) {
+                if (i)
+                    out_ += ',';
+                number(a->data()[i]);
+            }
+            out_ += ']';
+            return;
+        }
+        case TTABLE: {
+            out_ += '{';
+            bool first = true;
+            for (const TableData::Entry &e : v.get_table()->entries())
+                if (e.live)
+                    member(e.key, e.value, first, depth);
+            out_ += '}';
+            return;
+        }
+        case THASHMAP: {
+            out_ += '{';
+            bool first = true;
+            v.get_hash_map()->for_each([&](const Value &k, const Value &x) { member(k, x, first, depth); });
+            out_ += '}';
+            return;
+        }
+        case TRECORD: {
+            const RecordData *r = v.get_record();
+            out_ += '{';
+            for (size_t i = 0; i < r->size(); ++i) {
+                if (i)
+                    out_ += ',';
+                string(r->shape()->fields[i]);
+                out_ += ':';
+                value(r->slots()[i], depth + 1);
+            }
+            out_ += '}';
+            return;
+        }
+        default:
+            throw std::runtime_error("json-emit: cannot encode " + type_name(v));
+        }
+    }
+
+  private:
+    void number(double x) {
+        if (!std::isfinite(x)) {
+            out_ += "null";
+            return;
+        }
+        char buf[32];
+        auto res = std::to_chars(buf, buf + sizeof buf, x);
+        out_.append(buf, res.ptr);
+    }
+
+    void string(std::string_view s) {
+        static const ScanFn scan = pick_scan();
+        static const char hex[] = "0123456789abcdef";
+        out_ += '"';
+        for (size_t i = 0; i < s.size();) {
+            size_t j = scan(s.data(), i, s.size());
+            out_.append(s.data() + i, j - i);
+            if (j == s.size())
+                break;
+            char c = s[j];
+            switch (c) {
+            case '"':
+                out_ += "\\\"";
+                break;
+            case '\\':
+                out_ += "\\\\";
+                break;
+            case '\n':
+                out_ += "\\n";
+                break;
+            case '\r':
+                out_ += "\\r";
+                break;
+            case '\t':
+                out_ += "\\t";
+                break;
+            case '\b':
+                out_ += "\\b";
+                break;
+            case '\f':
+                out_ += "\\f";
+                break;
+            default:
+                out_ += "\\u00";
+                out_ += hex[(c >> 4) & 0xf];
+                out_ += hex[c & 0xf];
+            }
+            i = j + 1;
+        }
+        out_ += '"';
+    }
+
+    void element(const Value &x, bool &first, int depth) {
+        if (!first)
+            out_ += ',';
+        first = false;
+        value(x, depth + 1);
+    }
+
+    void member(const Value &key, const Value &x, bool &first, int depth) {
+        if (!first)
+            out_ += ',';
+        first = false;
+        if (key && key.get_type() == TSTRING) {
+            string(key.get_string_view());
+        } else if (key && key.get_type() == TSYMBOL) {
+            string(*key.get_symbol());
+        } else if (key && key.get_type() == TNUMBER) {
+            out_ += '"';
+            number(key.get_number());
+            out_ += '"';
+        } else {
+            throw std::runtime_error("json-emit: cannot use " + type_name(key) + " as an object key");
+        }
+        out_ += ':';
+        value(x, depth + 1);
+    }
+
+    // An alist (every element a pair with a string or symbol car) is an
+    // object, any other list an array.
+    // An alist of dotted pairs ((key . atom) ...) is an object; any other
+    // list, including one of proper lists such as (("a" 1) ("b" 2)), is an
+    // array.
+    void list(const Value &v, int depth) {
+        bool alist = true;
+        for (Value cur = v; cur && alist; cur = pair_cdr(cur)) {
+            Value e = pair_car(cur);
+            alist = is_pair(e) && pair_car(e) &&
+                    (pair_car(e).get_type() == TSTRING || pair_car(e).get_type() == TSYMBOL) && pair_cdr(e) &&
+                    !is_pair(pair_cdr(e));
+        }
+        bool first = true;
+        out_ += alist ? '{' : '[';
+        for (Value cur = v; cur; cur = pair_cdr(cur)) {
+            if (alist)
+                member(pair_car(pair_car(cur)), pair_cdr(pair_car(cur)), first, depth);
+            else
+                element(pair_car(cur), first, depth);
+        }
+        out_ += alist ? '}' : ']';
+    }
+
+    std::string &out_;
+};
+
+} // namespace
+
+void register_json(State &S) {
+    // (json-parse text [lists]): see json.hpp
+    S.register_builtin("json-parse", [](State &S, const Value &args) -> Value {
+        Value text = pair_car(args);
+        if (!text || text.get_type() != TSTRING)
+            throw std::runtime_error("json-parse: expected string, got " + type_name(text));
+        return Parser(S, text, static_cast<bool>(pair_car(pair_cdr(args)))).parse();
+    });
+    // (json-emit v [file]): see json.hpp
+    S.register_builtin("json-emit", [](State &S, const Value &args) -> Value {
+        Value dest = pair_car(pair_cdr(args));
+        FileHandle *f = as_file(dest);
+        if (dest && !f)
+            throw std::runtime_error("json-emit: expected a file, got " + type_name(dest));
+        std::string out;
+        Emitter(out).value(pair_car(args), 0);
+        if (!f)
+            return S.make_string(std::move(out));
+        f->write(out, "json-emit");
+        return {};
+    });
+}
+
+} // namespace vdlisp
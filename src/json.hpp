@@ -0,0 +1,32 @@
+#ifndef VDLISP__JSON_HPP
+#define VDLISP__JSON_HPP
+
+namespace vdlisp {
+
+class State;
+
+// (json-parse text [lists]): the JSON value in the string `text`. Objects
+// become tables (keys are strings, in document order; a repeated key keeps
+// its last value) and arrays vectors; with `lists` true, objects become
+// alists ((key . value) ...) and arrays lists instead. Numbers are numbers
+// (one too large for a double is an error), true is #t, false and null are
+// nil (so is {} with `lists`), and all of them are emitted back as null. A \u escape of an unpaired
+// surrogate is an error. Strings without escapes share the bytes of `text`.
+// The parser builds Values as it reads (no intermediate tree); string bodies
+// are scanned 32 bytes at a time with AVX2 when the CPU has it (see
+// VDLISP__SIMD) and numbers are read with from_chars.
+//
+// (json-emit v [file]): `v` as compact JSON text, returned as a string or
+// written to an open file. Tables, hash-maps and records become objects
+// (keys must be strings, symbols or numbers), vectors, pvectors, f64arrays
+// and lists arrays (a list of dotted pairs (key . atom) with string or symbol
+// keys is an object; so an alist read with `lists` whose values are lists or
+// nil comes back as an array),
+// nil null, #t true, the symbol false false and other symbols strings.
+// Numbers use the shortest text that reads back exactly; NaN and infinities
+// become null.
+void register_json(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__JSON_HPP
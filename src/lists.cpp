@@ -0,0 +1,176 @@
+#include "lists.hpp"
+#include "coroutine.hpp"
+#include "fncall.hpp"
+#include "helpers.hpp"
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace vdlisp {
+
+namespace {
+
+// Builds a list front to back: each element is linked to the last pair, so
+// no reverse pass is needed.
+class ListBuilder {
+  public:
+    explicit ListBuilder(State &S) noexcept : S(S) {}
+
+    void push(Value v) {
+        Value p = S.make_pair(std::move(v), Value());
+        if (head)
+            pair_set_cdr(tail, p);
+        else
+            head = p;
+        tail = std::move(p);
+    }
+    // the list, with `rest` as the final cdr
+    auto finish(Value rest = Value()) -> Value {
+        if (!head)
+            return rest;
+        pair_set_cdr(tail, rest);
+        return std::move(head);
+    }
+
+  private:
+    State &S;
+    Value head;
+    Value tail;
+};
+
+// The pairs of `list` up to its end; throws on an improper tail.
+template <class Fn>
+void for_each_pair(const Value &list, const char *who, Fn &&fn) {
+    Value cur = list;
+    while (is_pair(cur)) {
+        if (fn(cur))
+            return;
+        cur = cur.get_pair()->cdr;
+    }
+    if (cur)
+        throw std::runtime_error(std::string(who) + ": expected list, got " + (list ? list.type_name() : std::string("nil")));
+}
+
+// About how many calls a loop over `seq` will make, counting a list only as
+// far as FnCaller needs to tell a hot loop from a short one.
+auto size_hint(const Value &seq) noexcept -> size_t {
+    if (seq.get_type() == TVECTOR)
+        return seq.get_vector()->items.size();
+    if (seq.get_type() == TPVECTOR)
+        return seq.get_pvector()->size();
+    size_t n = 0;
+    for (Value cur = seq; is_pair(cur) && n < 16; cur = pair_cdr(cur))
+        ++n;
+    return n;
+}
+
+auto second(const Value &args) noexcept -> Value { return pair_car(pair_cdr(args)); }
+
+} // namespace
+
+void register_lists(State &S) {
+    S.register_builtin("length", [](State &S, const Value &args) -> Value {
+        size_t n = 0;
+        for_each_item(pair_car(args), "length", [&n](const Value &) { ++n; });
+        return S.make_number(static_cast<double>(n));
+    });
+    S.register_builtin("reverse", [](State &S, const Value &args) -> Value {
+        Value out;
+        for_each_item(pair_car(args), "reverse", [&](const Value &v) { out = S.make_pair(v, std::move(out)); });
+        return out;
+    });
+    // (append list ...): copies every list but the last, which is shared
+    S.register_builtin("append", [](State &S, const Value &args) -> Value {
+        ListBuilder out(S);
+        Value cur = args;
+        for (; is_pair(pair_cdr(cur)); cur = pair_cdr(cur))
+            for_each_pair(pair_car(cur), "append", [&out](const Value &p) {
+                out.push(pair_car(p));
+                return false;
+            });
+        return out.finish(pair_car(cur));
+    });
+    // (map f seq): (f x) for each element
+    S.register_builtin("map", [](State &S, const Value &args) -> Value {
+        Value seq = second(args);
+        FnCaller f(S, pair_car(args), "map", size_hint(seq));
+        ListBuilder out(S);
+        for_each_item(seq, "map", [&](const Value &v) { out.push(f(v)); });
+        return out.finish();
+    });
+    // (filter pred seq): the elements for which (pred x) is true
+    S.register_builtin("filter", [](State &S, const Value &args) -> Value {
+        Value seq = second(args);
+        FnCaller pred(S, pair_car(args), "filter", size_hint(seq));
+        ListBuilder out(S);
+        for_each_item(seq, "filter", [&](const Value &v) {
+            if (pred.test(v))
+                out.push(v);
+        });
+        return out.finish();
+    });
+    // (fold f init seq): (f (f (f init x0) x1) x2) ...
+    S.register_builtin("fold", [](State &S, const Value &args) -> Value {
+        Value seq = pair_car(pair_cdr(pair_cdr(args)));
+        FnCaller f(S, pair_car(args), "fold", size_hint(seq));
+        Value acc = second(args);
+        for_each_item(seq, "fold", [&](const Value &v) { acc = f(acc, v); });
+        return acc;
+    });
+    // (nth list i): element i, counting from 0
+    S.register_builtin("nth", [](State &, const Value &args) -> Value {
+        Value list = pair_car(args);
+        double d = require_number(second(args), "nth");
+        if (d != std::floor(d))
+            throw std::runtime_error(index_error("nth", "index", d, 0));
+        // a negative or huge index matches no element and is reported below
+        size_t i = d < 0 || d >= 0x1p64 ? SIZE_MAX : static_cast<size_t>(d);
+        size_t n = 0;
+        Value found;
+        for_each_pair(list, "nth", [&](const Value &p) {
+            if (n++ != i)
+                return false;
+            found = pair_car(p);
+            return true;
+        });
+        if (n <= i)
+            throw std::runtime_error(index_error("nth", "index", d, n));
+        return found;
+    });
+    // (last list): the final element; nil for an empty list
+    S.register_builtin("last", [](State &, const Value &args) -> Value {
+        Value found;
+        for_each_pair(pair_car(args), "last", [&found](const Value &p) {
+            found = pair_car(p);
+            return false;
+        });
+        return found;
+    });
+    // (member x list): the tail of list starting at the first element = x
+    S.register_builtin("member", [](State &, const Value &args) -> Value {
+        Value x = pair_car(args);
+        Value found;
+        for_each_pair(second(args), "member", [&](const Value &p) {
+            if (!value_equal(pair_car(p), x))
+                return false;
+            found = p;
+            return true;
+        });
+        return found;
+    });
+    // (assoc key alist): the first pair of alist whose car = key
+    S.register_builtin("assoc", [](State &, const Value &args) -> Value {
+        Value key = pair_car(args);
+        Value found;
+        for_each_pair(second(args), "assoc", [&](const Value &p) {
+            Value entry = pair_car(p);
+            if (!is_pair(entry) || !value_equal(pair_car(entry), key))
+                return false;
+            found = std::move(entry);
+            return true;
+        });
+        return found;
+    });
+}
+
+} // namespace vdlisp
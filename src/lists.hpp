@@ -0,0 +1,20 @@
+#ifndef VDLISP__LISTS_HPP
+#define VDLISP__LISTS_HPP
+
+namespace vdlisp {
+
+class State;
+
+// List library: iterative loops over the pairs, so long lists cost no eval /
+// Env per element and cannot overflow the stack. Functions passed to map /
+// filter / fold are called through FnCaller (builtins directly, compiled
+// user functions as machine code). map / filter / fold / length / reverse
+// also take vectors, pvectors and generators; the results are lists.
+//
+// length / reverse / append / map / filter / fold / nth / last / member /
+// assoc
+void register_lists(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__LISTS_HPP
@@ -1,4 +1,7 @@
+#include "batch.hpp"
+#include "filter.hpp"
 #include "helpers.hpp"
+#include "server.hpp"
 #include "vdlisp.hpp"
 #include <cstdlib>
 #include <filesystem>
@@ -12,47 +15,6 @@ using namespace vdlisp;
 
 namespace {
 
-static void print_call_chain(const State &S, const std::vector<State::SourceLoc> &chain) {
-    if (chain.empty())
-        return;
-    std::cerr << "Call chain:\n";
-    for (const auto &fr : chain) {
-        std::cerr << "  at ";
-        if (!fr.label.empty())
-            std::cerr << fr.label << " ";
-        std::cerr << fr.file << ":" << fr.line << ":" << fr.col << "\n";
-        std::string line;
-        if (S.get_source_line(fr.file, fr.line, line)) {
-            std::cerr << "    " << line << "\n";
-            size_t col_index = fr.col ? fr.col - 1 : 0;
-            std::string caret_spaces;
-            for (size_t i = 0; i < col_index; ++i)
-                caret_spaces.push_back((i < line.size() && line[i] == '\t') ? '\t' : ' ');
-            std::cerr << "    " << caret_spaces << "^" << "\n";
-        }
-    }
-}
-
-static void report_exception(State &S, const std::exception &ex) {
-    if (auto pe = dynamic_cast<const ParseError *>(&ex)) {
-        print_error_with_loc(S, pe->loc, pe->what());
-        if (!pe->call_chain.empty())
-            print_call_chain(S, pe->call_chain);
-        return;
-    }
-    State::SourceLoc loc;
-    bool have_loc = S.get_source_loc(S.current_expr, loc);
-    if (have_loc) {
-        print_error_with_loc(S, loc, ex.what());
-        auto it = S.src_call_chain_map.find(S.current_expr.identity_key());
-        if (it != S.src_call_chain_map.end()) {
-            print_call_chain(S, it->second);
-        }
-    } else {
-        std::cerr << "error: " << ex.what() << "\n";
-    }
-}
-
 static void repl(State &S) {
     const char *home = getenv("HOME");
     std::string histfile;
@@ -76,7 +38,9 @@ static void repl(State &S) {
             if (!e)
                 continue;
             Value r = S.eval(e, S.global);
-            std::cout << S.to_string(r) << "\n";
+            S.write_out(S.to_string(r) + "\n");
+            S.flush_out();
+            rc_safepoint();
         } catch (const std::exception &ex) {
             report_exception(S, ex);
         }
@@ -105,32 +69,24 @@ auto main(int argc, char **argv) -> int {
         return 1;
     }
 
+    // resident server / its client: see server.hpp
+    if (argc >= 3 && std::string(argv[1]) == "--serve")
+        return serve_main(argv[2]);
+    if (argc >= 3 && std::string(argv[1]) == "--client")
+        return client_main(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+    if (argc >= 2 && std::string(argv[1]) == "--batch")
+        return batch_main(std::vector<std::string>(argv + 2, argv + argc));
+    // -e / -n / -p command-line programs: see filter.hpp
+    if (argc >= 2 && is_filter_option(argv[1]))
+        return filter_main(std::vector<std::string>(argv + 1, argv + argc));
+
+    // `~State` returns pooled memory on normal exit (helps leak checkers).
     State S;
-    // Ensure we return pooled memory on normal exit (helps leak checkers).
-    struct ShutdownGuard {
-        State &S;
-        ~ShutdownGuard() {
-            S.shutdown_and_purge_pools();
-        }
-    } guard{S};
     // bind argv as a list of strings into the global environment
     S.bind_global("argv", S.make_string_list(argc, argv, 1));
     // Auto-load core language helpers implemented in Lisp if supplied.
-    try {
-        std::filesystem::path langfile("scripts/lang_basics.lisp");
-        if (std::filesystem::exists(langfile)) {
-            std::ifstream lf(langfile);
-            if (lf) {
-                std::ostringstream lss;
-                lss << lf.rdbuf();
-                Value le = S.parse_all(lss.str(), langfile.string());
-                if (le)
-                    (void)S.do_list(le, S.global);
-            }
-        }
-    } catch (...) {
-        // ignore failures to auto-load language file
-    }
+    load_lang_basics(S);
+    S.freeze_runtime();
     if (argc < 2) {
         repl(S);
         return 0;
@@ -147,7 +103,7 @@ auto main(int argc, char **argv) -> int {
         Value e = S.parse_all(ss.str(), argv[1]);
         if (e) {
             Value r = S.do_list(e, S.global);
-            std::cout << S.to_string(r) << "\n";
+            S.write_out(S.to_string(r) + "\n");
         }
     } catch (const std::exception &ex) {
         report_exception(S, ex);
@@ -1,7 +1,14 @@
 #include "nanbox.hpp"
+#include "bytes.hpp"
+#include "f64array.hpp"
 #include "jit/jit.hpp"
+#include "persistent.hpp"
+#include "record.hpp"
+#include "table.hpp"
 #include <iostream>
+#include <mutex>
 #include <sstream>
+#include <sys/mman.h>
 #include <unordered_map>
 #include <vector>
 
@@ -14,8 +21,8 @@ Env::~Env() noexcept {
     }
 }
 
-// JIT compiler instance is provided by `global_jit` declared in the JIT header.
-// The concrete `JITCompiler global_jit` definition lives in `src/jit/jit.cpp`.
+// JIT compiler instance is provided by `global_jit()` declared in the JIT header.
+// The lazily built `JITCompiler` instance lives in `src/jit/jit.cpp`.
 
 // -------------------- Value implementation --------------------
 
@@ -48,6 +55,30 @@ Value::Value(Type t) {
     case TCFUNC:
         bits = kTagCFunc;
         break;
+    case THANDLE:
+        bits = kTagHandle;
+        break;
+    case TVECTOR:
+        bits = kTagVector;
+        break;
+    case TTABLE:
+        bits = kTagTable;
+        break;
+    case TF64ARRAY:
+        bits = kTagF64Array;
+        break;
+    case TBYTES:
+        bits = kTagBytes;
+        break;
+    case THASHMAP:
+        bits = kTagHashMap;
+        break;
+    case TPVECTOR:
+        bits = kTagPVector;
+        break;
+    case TRECORD:
+        bits = kTagRecord;
+        break;
     default:
         bits = kTagNil;
         break;
@@ -107,42 +138,478 @@ auto Value::operator=(std::nullptr_t) noexcept -> Value & {
 //   implementation should generate proper IR that matches the function body
 //   and calling convention.
 
+// -------------------- StringData --------------------
+
+StringData::StringData(const Value &of, size_t offset, size_t n) noexcept
+    : owner_(of.get_string_data()->owner() ? of.get_string_data()->owner() : of),
+      data_(of.get_string_view().data() + offset), size_(n) {}
+
+auto StringData::mapped(void *map, size_t n) -> StringData * {
+    auto *sd = new StringData();
+    sd->data_ = static_cast<const char *>(map);
+    sd->size_ = n;
+    sd->mapped_ = true;
+    return sd;
+}
+
+StringData::~StringData() {
+    if (mapped_)
+        ::munmap(const_cast<char *>(data_), size_);
+}
+
+void StringData::materialize() {
+    value_.assign(data_, size_);
+    // a mapping stays valid while this string lives (slices may point into
+    // it, and view() keeps reading it); a slice no longer needs its owner
+    if (!mapped_) {
+        data_ = nullptr;
+        owner_ = nullptr;
+    }
+}
+
+// Freeing a pair releases its cdr, which frees the next pair, and so on: a
+// long list would recurse once per element. Pairs freed while one is being
+// freed are queued instead and freed by the outermost call, one at a time.
+static thread_local bool pairs_draining = false;
+static thread_local std::vector<PairData *> pairs_pending;
+
+static void destroy_pair(RcBase *p) noexcept {
+    auto *pd = static_cast<PairData *>(p);
+    if (pairs_draining) {
+        pairs_pending.push_back(pd);
+        return;
+    }
+    pairs_draining = true;
+    delete pd;
+    while (!pairs_pending.empty()) {
+        pd = pairs_pending.back();
+        pairs_pending.pop_back();
+        delete pd;
+    }
+    pairs_draining = false;
+}
+static void destroy_string(RcBase *p) noexcept {
+    delete static_cast<StringData *>(p);
+}
+static void destroy_func(RcBase *p) noexcept {
+    auto *fd = static_cast<FuncData *>(p);
+    if (fd->compiled_code) {
+        global_jit().releaseFunctionCode(fd->compiled_code);
+        fd->compiled_code = nullptr;
+    }
+    if (fd->closure_env) {
+        release_env(fd->closure_env);
+        fd->closure_env = nullptr;
+    }
+    delete fd;
+}
+static void destroy_macro(RcBase *p) noexcept {
+    delete static_cast<MacroData *>(p);
+}
+static void destroy_handle(RcBase *p) noexcept {
+    delete static_cast<HandleData *>(p);
+}
+static void destroy_vector(RcBase *p) noexcept {
+    delete static_cast<VectorData *>(p);
+}
+static void destroy_table(RcBase *p) noexcept {
+    delete static_cast<TableData *>(p);
+}
+static void destroy_f64array(RcBase *p) noexcept {
+    delete static_cast<F64ArrayData *>(p);
+}
+static void destroy_bytes(RcBase *p) noexcept {
+    delete static_cast<BytesData *>(p);
+}
+static void destroy_hash_map(RcBase *p) noexcept {
+    delete static_cast<HashMapData *>(p);
+}
+static void destroy_pvector(RcBase *p) noexcept {
+    delete static_cast<PVectorData *>(p);
+}
+static void destroy_record(RcBase *p) noexcept {
+    RecordData::destroy(static_cast<RecordData *>(p));
+}
+static void destroy_none(RcBase *) noexcept {}
+
+// Indexed by Type; only refcounted types have a real destroy function.
+static constexpr RcDestroy kDestroy[] = {
+    /*TNIL*/ destroy_none,
+    /*TPAIR*/ destroy_pair,
+    /*TNUMBER*/ destroy_none,
+    /*TSTRING*/ destroy_string,
+    /*TSYMBOL*/ destroy_string,
+    /*TFUNC*/ destroy_func,
+    /*TMACRO*/ destroy_macro,
+    /*TPRIM*/ destroy_none,
+    /*TCFUNC*/ destroy_none,
+    /*THANDLE*/ destroy_handle,
+    /*TVECTOR*/ destroy_vector,
+    /*TTABLE*/ destroy_table,
+    /*TF64ARRAY*/ destroy_f64array,
+    /*TBYTES*/ destroy_bytes,
+    /*THASHMAP*/ destroy_hash_map,
+    /*TPVECTOR*/ destroy_pvector,
+    /*TRECORD*/ destroy_record};
+
 void Value::release_payload(Type t, void *p) noexcept {
     if (!p)
         return;
-    auto *rc = static_cast<RcBase *>(p);
-    if (rc->dec_ref() != 0)
+    auto idx = static_cast<size_t>(t);
+    if (idx >= sizeof(kDestroy) / sizeof(kDestroy[0]))
         return;
+    static_cast<RcBase *>(p)->release(kDestroy[idx]);
+}
 
-    switch (t) {
-    case TPAIR:
-        delete static_cast<PairData *>(p);
-        break;
-    case TSTRING:
-        delete static_cast<StringData *>(p);
-        break;
-    case TSYMBOL:
-        delete static_cast<StringData *>(p);
-        break;
-    case TFUNC: {
-        auto *fd = static_cast<FuncData *>(p);
-        if (fd->compiled_code) {
-            global_jit.releaseFunctionCode(fd->compiled_code);
-            fd->compiled_code = nullptr;
+#if VDLISP__BIASED_RC
+thread_local RcOwner *vdlisp::rc_owner = nullptr;
+
+namespace {
+// Retires the thread's owner record when the thread exits.
+struct RcOwnerExit {
+    ~RcOwnerExit() {
+        if (rc_owner)
+            rc_owner->retire();
+    }
+};
+thread_local RcOwnerExit rc_owner_exit;
+// Every owner record ever created (keeps them reachable for leak checkers).
+std::atomic<RcOwner *> all_owners{nullptr};
+} // namespace
+
+auto RcOwner::create() noexcept -> RcOwner * {
+    rc_owner = new RcOwner();
+    rc_owner->next_owner = all_owners.load(std::memory_order_relaxed);
+    while (!all_owners.compare_exchange_weak(rc_owner->next_owner, rc_owner, std::memory_order_release))
+        ;
+    (void)&rc_owner_exit; // registers the exit hook for this thread
+    return rc_owner;
+}
+
+void RcOwner::defer(RcBase *p, RcDestroy destroy, bool merge) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!dead) {
+            items.push_back(Item{p, destroy, merge});
+            pending.store(true, std::memory_order_release);
+            return;
+        }
+    }
+    // the owner has exited: nothing else touches the owner-side count
+    if (merge)
+        p->merge_queued(destroy);
+    else
+        destroy(p);
+}
+
+void RcOwner::run(std::vector<Item> &batch) noexcept {
+    for (const Item &it : batch) {
+        if (it.merge)
+            it.p->merge_queued(it.destroy);
+        else
+            it.destroy(it.p);
+    }
+    batch.clear();
+}
+
+void RcOwner::drain() noexcept {
+    std::vector<Item> batch;
+    // freeing may release more objects owned by other threads, which queue
+    // back here; loop until quiet
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (items.empty()) {
+                pending.store(false, std::memory_order_relaxed);
+                return;
+            }
+            batch.swap(items);
         }
-        if (fd->closure_env) {
+        run(batch);
+    }
+}
+
+void RcOwner::retire() noexcept {
+    drain();
+    std::vector<Item> batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        dead = true;
+        batch.swap(items);
+        pending.store(false, std::memory_order_relaxed);
+    }
+    run(batch);
+}
+
+// Owner count hit zero: fold it into `shared_` and free if nobody else holds
+// a reference. A queued object is freed by the pending merge instead.
+void RcBase::release_biased(RcDestroy destroy) noexcept {
+    merged_ = true;
+    int64_t old = shared_.fetch_add(kMerged, std::memory_order_acq_rel);
+    if ((old >> 2) == 0 && !(old & kQueued))
+        destroy(this);
+}
+
+void RcBase::release_shared(RcDestroy destroy) noexcept {
+    int64_t old = shared_.fetch_sub(kOne, std::memory_order_acq_rel);
+    int64_t count = (old >> 2) - 1;
+    if (old & kMerged) {
+        if (count != 0 || (old & kQueued))
+            return;
+        if (home_ == rc_owner)
+            destroy(this);
+        else
+            home_->defer(this, destroy, false);
+        return;
+    }
+    // The owner still holds references this thread dropped: ask it to merge
+    // (once; later decrements see the flag).
+    if (count < 0 && !(old & kQueued)) {
+        int64_t prev = shared_.fetch_or(kQueued, std::memory_order_acq_rel);
+        if (!(prev & kQueued))
+            home_->defer(this, destroy, true);
+    }
+}
+
+void RcBase::merge_queued(RcDestroy destroy) noexcept {
+    // frozen while the merge was queued: the counts no longer matter
+    if (immortal())
+        return;
+    int64_t add = 0;
+    if (!merged_) {
+        add = static_cast<int64_t>(biased_) * kOne + kMerged;
+        biased_ = 0;
+        merged_ = true;
+    }
+    int64_t cur = shared_.fetch_add(add, std::memory_order_acq_rel) + add;
+    while (true) {
+        if ((cur >> 2) == 0) {
+            destroy(this);
+            return;
+        }
+        // clear the flag so the thread dropping the last reference frees it
+        if (shared_.compare_exchange_weak(cur, cur & ~kQueued, std::memory_order_acq_rel))
+            return;
+    }
+}
+#endif
+
+// -------------------- immortal objects --------------------
+
+namespace {
+// Every immortal object, so leak checkers still see the shells as reachable
+// after their State let go (boxed Values hide pointers from them);
+// intentionally never freed.
+std::mutex immortal_mutex;
+std::vector<RcBase *> *immortal_objects = new std::vector<RcBase *>();
+
+// Freeze `p` unless already done (the flag doubles as the visited mark);
+// returns true when its children still have to be walked.
+auto freeze(RcBase *p, std::vector<RcBase *> &frozen) -> bool {
+    if (!p || p->immortal() || !p->set_immortal())
+        return false;
+    frozen.push_back(p);
+    return true;
+}
+
+void freeze_all(std::vector<Value> values, std::vector<Env *> envs, ImmortalSet *set) {
+    std::vector<RcBase *> frozen;
+    auto visit = [&](const Value &v) {
+        switch (v.get_type()) {
+        case TPAIR:
+        case TFUNC:
+        case TMACRO:
+        case TVECTOR:
+        case TTABLE:
+        case THASHMAP:
+        case TPVECTOR:
+        case TRECORD:
+            values.push_back(v);
+            break;
+        case TSTRING:
+            // other threads read immortal strings, so a borrowed one copies
+            // its bytes now rather than lazily (and lets go of its owner)
+            (void)v.get_string();
+            [[fallthrough]];
+        case TSYMBOL:
+        case TF64ARRAY:
+            // leaves: StringData starts with its RcBase, like every payload
+            freeze(reinterpret_cast<RcBase *>(v.identity_key() & Value::kPayloadMask), frozen);
+            break;
+        case TBYTES:
+            // a view and the buffer it shares; that one is never a view itself
+            freeze(v.get_bytes(), frozen);
+            if (v.get_bytes()->owner())
+                freeze(v.get_bytes()->owner().get_bytes(), frozen);
+            break;
+        default:
+            break;
+        }
+    };
+    while (!values.empty() || !envs.empty()) {
+        if (!envs.empty()) {
+            Env *e = envs.back();
+            envs.pop_back();
+            if (!freeze(e, frozen))
+                continue;
+            if (set)
+                set->envs.push_back(e);
+            for (auto &kv : e->map)
+                visit(kv.second);
+            if (e->parent)
+                envs.push_back(e->parent);
+            continue;
+        }
+        Value v = std::move(values.back());
+        values.pop_back();
+        switch (v.get_type()) {
+        case TPAIR: {
+            PairData *pd = v.get_pair();
+            if (!freeze(pd, frozen))
+                continue;
+            visit(pd->car);
+            visit(pd->cdr);
+            break;
+        }
+        case TFUNC: {
+            FuncData *fd = v.get_func();
+            if (!freeze(fd, frozen))
+                continue;
+            visit(fd->params);
+            visit(fd->body);
+            if (fd->closure_env)
+                envs.push_back(fd->closure_env);
+            break;
+        }
+        case TMACRO: {
+            MacroData *md = v.get_macro();
+            if (!freeze(md, frozen))
+                continue;
+            visit(md->params);
+            visit(md->body);
+            if (md->closure_env)
+                envs.push_back(md->closure_env);
+            break;
+        }
+        case TVECTOR: {
+            VectorData *vd = v.get_vector();
+            if (!freeze(vd, frozen))
+                continue;
+            for (const Value &item : vd->items)
+                visit(item);
+            break;
+        }
+        case TTABLE: {
+            TableData *td = v.get_table();
+            if (!freeze(td, frozen))
+                continue;
+            for (const auto &e : td->entries()) {
+                visit(e.key);
+                visit(e.value);
+            }
+            break;
+        }
+        case THASHMAP: {
+            // the shell only: trie nodes are shared with mortal versions
+            HashMapData *hm = v.get_hash_map();
+            if (!freeze(hm, frozen))
+                continue;
+            hm->for_each([&](const Value &k, const Value &val) {
+                visit(k);
+                visit(val);
+            });
+            break;
+        }
+        case TPVECTOR: {
+            PVectorData *pv = v.get_pvector();
+            if (!freeze(pv, frozen))
+                continue;
+            pv->for_each(visit);
+            break;
+        }
+        case TRECORD: {
+            RecordData *r = v.get_record();
+            if (!freeze(r, frozen))
+                continue;
+            for (size_t i = 0; i < r->size(); ++i)
+                visit(r->slots()[i]);
+            break;
+        }
+        default:
+            continue;
+        }
+        if (set)
+            set->values.push_back(std::move(v));
+    }
+    if (frozen.empty())
+        return;
+    std::lock_guard<std::mutex> lock(immortal_mutex);
+    immortal_objects->insert(immortal_objects->end(), frozen.begin(), frozen.end());
+}
+} // namespace
+
+void vdlisp::make_immortal(const Value &v, ImmortalSet *set) {
+    freeze_all({v}, {}, set);
+}
+
+void vdlisp::make_immortal(Env *e, ImmortalSet *set) {
+    freeze_all({}, {e}, set);
+}
+
+void ImmortalSet::clear_references() noexcept {
+    for (Value &v : values) {
+        switch (v.get_type()) {
+        case TPAIR: {
+            PairData *pd = v.get_pair();
+            pd->car = Value();
+            pd->cdr = Value();
+            break;
+        }
+        case TFUNC: {
+            FuncData *fd = v.get_func();
+            fd->params = Value();
+            fd->body = Value();
             release_env(fd->closure_env);
             fd->closure_env = nullptr;
+            break;
+        }
+        case TMACRO: {
+            MacroData *md = v.get_macro();
+            md->params = Value();
+            md->body = Value();
+            release_env(md->closure_env);
+            md->closure_env = nullptr;
+            break;
+        }
+        case TVECTOR:
+            v.get_vector()->items.clear();
+            break;
+        case TTABLE:
+            v.get_table()->clear();
+            break;
+        case THASHMAP:
+            v.get_hash_map()->clear();
+            break;
+        case TPVECTOR:
+            v.get_pvector()->clear();
+            break;
+        case TRECORD: {
+            RecordData *r = v.get_record();
+            for (size_t i = 0; i < r->size(); ++i)
+                r->slots()[i] = nullptr;
+            break;
+        }
+        default:
+            break;
         }
-        delete fd;
-        break;
     }
-    case TMACRO:
-        delete static_cast<MacroData *>(p);
-        break;
-    default:
-        break;
+    for (Env *e : envs) {
+        e->map.clear();
+        release_env(e->parent);
+        e->parent = nullptr;
     }
+    values.clear();
+    envs.clear();
 }
 
 // High-level helpers centralized on Value
@@ -169,6 +636,24 @@ auto Value::type_name() const -> std::string {
         return "prim";
     case TCFUNC:
         return "cfunction";
+    case THANDLE: {
+        HandleData *h = get_handle();
+        return h ? h->type_name() : "handle";
+    }
+    case TVECTOR:
+        return "vector";
+    case TTABLE:
+        return "table";
+    case TF64ARRAY:
+        return "f64array";
+    case TBYTES:
+        return "bytes";
+    case THASHMAP:
+        return "hash-map";
+    case TPVECTOR:
+        return "pvector";
+    case TRECORD:
+        return get_record()->shape()->name;
     default:
         return "?";
     }
@@ -182,7 +667,7 @@ auto Value::to_repr(State &S) const -> std::string {
     }
     switch (get_type()) {
     case TSTRING:
-        return *get_string();
+        return std::string(get_string_view());
     case TSYMBOL:
         return *get_symbol();
     case TPAIR: {
@@ -216,6 +701,89 @@ auto Value::to_repr(State &S) const -> std::string {
         auto *fd = reinterpret_cast<FuncData *>(bits & kPayloadMask);
         return (fd && fd->compiled_code) ? "<jit_func>" : "<function>";
     }
+    case THANDLE:
+        return "<" + type_name() + ">";
+    case TVECTOR: {
+        std::string s = "#(";
+        const auto &items = get_vector()->items;
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (i)
+                s += " ";
+            s += items[i] ? items[i].to_repr(S) : std::string("nil");
+        }
+        s += ")";
+        return s;
+    }
+    case TTABLE: {
+        std::string s = "#table(";
+        bool first = true;
+        for (const auto &e : get_table()->entries()) {
+            if (!e.live)
+                continue;
+            if (!first)
+                s += " ";
+            first = false;
+            s += "(" + (e.key ? e.key.to_repr(S) : std::string("nil")) + " . " +
+                 (e.value ? e.value.to_repr(S) : std::string("nil")) + ")";
+        }
+        s += ")";
+        return s;
+    }
+    case TF64ARRAY: {
+        std::ostringstream ss;
+        ss << "#f64(";
+        const F64ArrayData *a = get_f64array();
+        for (size_t i = 0; i < a->size(); ++i)
+            ss << (i ? " " : "") << a->data()[i];
+        ss << ")";
+        return ss.str();
+    }
+    case TBYTES: {
+        std::string s = "#u8(";
+        const BytesData *b = get_bytes();
+        for (size_t i = 0; i < b->size(); ++i) {
+            if (i)
+                s += " ";
+            s += std::to_string(b->data()[i]);
+        }
+        s += ")";
+        return s;
+    }
+    case THASHMAP: {
+        std::string s = "#hash-map(";
+        bool first = true;
+        get_hash_map()->for_each([&](const Value &k, const Value &v) {
+            if (!first)
+                s += " ";
+            first = false;
+            s += "(" + (k ? k.to_repr(S) : std::string("nil")) + " . " + (v ? v.to_repr(S) : std::string("nil")) + ")";
+        });
+        s += ")";
+        return s;
+    }
+    case TPVECTOR: {
+        std::string s = "#pvector(";
+        bool first = true;
+        get_pvector()->for_each([&](const Value &item) {
+            if (!first)
+                s += " ";
+            first = false;
+            s += item ? item.to_repr(S) : std::string("nil");
+        });
+        s += ")";
+        return s;
+    }
+    case TRECORD: {
+        const RecordData *r = get_record();
+        std::string s = "#" + r->shape()->name + "(";
+        for (size_t i = 0; i < r->size(); ++i) {
+            if (i)
+                s += " ";
+            s += r->slots()[i] ? r->slots()[i].to_repr(S) : std::string("nil");
+        }
+        s += ")";
+        return s;
+    }
     default:
         return "<?>";
     }
@@ -4,16 +4,32 @@
 #include <bit>
 #include <cstdint>
 #include <cstring>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+#if VDLISP__BIASED_RC
+#include <atomic>
+#include <mutex>
+#endif
 
 namespace vdlisp {
 
 class Value;
 class PairData;
+class VectorData;
+class TableData;
+class F64ArrayData;
+class BytesData;
+class HashMapData;
+class PVectorData;
+class RecordData;
 class StringData;
 class FuncData;
 class MacroData;
+class HandleData;
 class State;
 class Env;
 // using Value = Value;
@@ -32,7 +48,15 @@ enum Type {
     TFUNC,  // user function
     TMACRO, // macro
     TPRIM,  // special form (unevaluated args)
-    TCFUNC  // c++ builtin
+    TCFUNC, // c++ builtin
+    THANDLE, // native object (future, ...), see HandleData
+    TVECTOR, // growable array of Values, see VectorData
+    TTABLE,  // hash map keyed by Value, see TableData (table.hpp)
+    TF64ARRAY, // fixed-length array of raw doubles, see F64ArrayData (f64array.hpp)
+    TBYTES,    // mutable byte buffer or view of one, see BytesData (bytes.hpp)
+    THASHMAP,  // persistent hash map, see HashMapData (persistent.hpp)
+    TPVECTOR,  // persistent vector, see PVectorData (persistent.hpp)
+    TRECORD    // instance of a defrecord type, see RecordData (record.hpp)
 };
 
 // Forward declarations needed for the implementation
@@ -41,25 +65,163 @@ inline constexpr auto double_to_bits(double value) noexcept -> uint64_t { return
 inline constexpr auto bits_to_double(uint64_t bits) noexcept -> double { return std::bit_cast<double>(bits); }
 } // namespace detail
 
+struct RcBase;
+// Frees an object whose count reached zero (type-specific `delete`).
+using RcDestroy = void (*)(RcBase *);
+
+#if VDLISP__BIASED_RC
+// Biased reference counting (configure with -DVDLISP_BIASED_RC=ON).
+//
+// Every object is owned by the thread that allocated it. The owner counts in
+// a plain `biased_` field; any other thread counts in the atomic `shared_`
+// (count << 2 | flags). When the owner's count drops to zero the two are
+// merged and the object is counted atomically from then on. A non-owner that
+// drives `shared_` negative, or drops the last reference of a merged object,
+// does not touch owner-side state: it queues the object on the owner's
+// RcOwner, which merges / frees it at its next safepoint (rc_safepoint).
+// Values created by one State can therefore be read from other threads; they
+// must not be mutated concurrently.
+class RcOwner {
+  public:
+    [[nodiscard]] static inline auto current() noexcept -> RcOwner *;
+    // Queue `p` for the owner: a count merge (`merge`) or a plain free.
+    void defer(RcBase *p, RcDestroy destroy, bool merge);
+    // Process queued objects; owner thread only.
+    void drain() noexcept;
+    // Thread exit: drain and let later requests run on the caller's thread.
+    void retire() noexcept;
+
+    std::atomic<bool> pending{false};
+
+  private:
+    struct Item {
+        RcBase *p;
+        RcDestroy destroy;
+        bool merge;
+    };
+    static auto create() noexcept -> RcOwner *;
+    void run(std::vector<Item> &batch) noexcept;
+
+    std::mutex mutex;
+    std::vector<Item> items;
+    bool dead = false;
+    RcOwner *next_owner = nullptr; // process-wide list of every record
+};
+
+// Owner record of the calling thread; records are never freed because other
+// threads may still queue objects on them after the thread exits.
+extern thread_local RcOwner *rc_owner;
+
+inline auto RcOwner::current() noexcept -> RcOwner * {
+    return rc_owner ? rc_owner : create();
+}
+
+// Run deferred merges / frees queued for this thread by other threads.
+inline void rc_safepoint() noexcept {
+    if (rc_owner && rc_owner->pending.load(std::memory_order_acquire))
+        rc_owner->drain();
+}
+
 struct RcBase {
   protected:
-    RcBase(size_t init = 1) noexcept : refs_{init} {}
+    RcBase(size_t init = 1) noexcept : home_{RcOwner::current()}, biased_{init} {}
     ~RcBase() noexcept = default;
 
   private:
-    size_t refs_{1};
+    static constexpr int64_t kMerged = 1;
+    static constexpr int64_t kQueued = 2;
+    static constexpr int64_t kOne = 4;
+
+    RcOwner *home_;
+    size_t biased_;       // owner thread only
+    bool merged_ = false; // owner thread only (or after the owner exited)
+    std::atomic<bool> immortal_{false};
+    std::atomic<bool> readonly_{false};
+    std::atomic<int64_t> shared_{0};
+
+    [[nodiscard]] inline __attribute__((always_inline)) auto owned() const noexcept -> bool { return home_ == rc_owner && !merged_; }
+    void release_biased(RcDestroy destroy) noexcept;
+    void release_shared(RcDestroy destroy) noexcept;
+    void merge_queued(RcDestroy destroy) noexcept;
+    friend class RcOwner;
 
   public:
-    inline __attribute__((always_inline)) void inc_ref() noexcept { ++refs_; }
-    inline __attribute__((always_inline)) size_t dec_ref() noexcept { return --refs_; }
-    inline __attribute__((always_inline)) size_t ref_count() const noexcept { return refs_; }
+    inline __attribute__((always_inline)) void inc_ref() noexcept {
+        if (immortal()) [[unlikely]]
+            return;
+        if (owned()) [[likely]]
+            ++biased_;
+        else
+            shared_.fetch_add(kOne, std::memory_order_relaxed);
+    }
+    // Drop a reference; `destroy` runs (here or on the owner) once none are left.
+    inline __attribute__((always_inline)) void release(RcDestroy destroy) noexcept {
+        if (immortal()) [[unlikely]]
+            return;
+        if (owned()) [[likely]] {
+            if (--biased_ == 0)
+                release_biased(destroy);
+        } else {
+            release_shared(destroy);
+        }
+    }
+    // Approximate while other threads hold references.
+    inline __attribute__((always_inline)) size_t ref_count() const noexcept {
+        return biased_ + static_cast<size_t>(shared_.load(std::memory_order_relaxed) >> 2);
+    }
+    [[nodiscard]] inline __attribute__((always_inline)) auto immortal() const noexcept -> bool {
+        return immortal_.load(std::memory_order_relaxed);
+    }
+    // Stop counting (see make_immortal); false when another thread owns it.
+    auto set_immortal() noexcept -> bool {
+        if (home_ != rc_owner)
+            return false;
+        immortal_.store(true, std::memory_order_relaxed);
+        return true;
+    }
+    // Reachable from a `share`d value: isolates read it concurrently, so the
+    // mutating builtins refuse it (see require_mutable). Never cleared.
+    [[nodiscard]] inline __attribute__((always_inline)) auto readonly() const noexcept -> bool {
+        return readonly_.load(std::memory_order_relaxed);
+    }
+    void set_readonly() noexcept { readonly_.store(true, std::memory_order_relaxed); }
 };
+#else
+inline void rc_safepoint() noexcept {}
+
+struct RcBase {
+  protected:
+    RcBase(size_t init = 1) noexcept : refs_{init} {}
+    ~RcBase() noexcept = default;
+
+  private:
+    // the top bit marks an immortal object, whose count is frozen
+    static constexpr size_t kImmortal = size_t(1) << (sizeof(size_t) * 8 - 1);
+    size_t refs_{1};
 
-class StringData : public RcBase {
   public:
-    explicit StringData(const std::string &s) : value(s) {}
-    std::string value;
+    inline __attribute__((always_inline)) void inc_ref() noexcept {
+        if (!(refs_ & kImmortal)) [[likely]]
+            ++refs_;
+    }
+    // Drop a reference; `destroy` runs once none are left.
+    inline __attribute__((always_inline)) void release(RcDestroy destroy) noexcept {
+        if (refs_ & kImmortal) [[unlikely]]
+            return;
+        if (--refs_ == 0)
+            destroy(this);
+    }
+    inline __attribute__((always_inline)) size_t ref_count() const noexcept { return refs_ & ~kImmortal; }
+    [[nodiscard]] inline __attribute__((always_inline)) auto immortal() const noexcept -> bool { return refs_ & kImmortal; }
+    // Stop counting (see make_immortal).
+    auto set_immortal() noexcept -> bool {
+        refs_ |= kImmortal;
+        return true;
+    }
+    // `share` needs biased refcounts: nothing is read-only in this build.
+    [[nodiscard]] static constexpr auto readonly() noexcept -> bool { return false; }
 };
+#endif
 
 class Env : public RcBase {
   public:
@@ -73,11 +235,29 @@ inline __attribute__((always_inline)) void retain_env(Env *e) noexcept {
     if (e)
         e->inc_ref();
 }
+inline void destroy_env(RcBase *p) noexcept {
+    delete static_cast<Env *>(p);
+}
 inline __attribute__((always_inline)) void release_env(Env *e) noexcept {
-    if (e && e->dec_ref() == 0)
-        delete e;
+    if (e)
+        e->release(destroy_env);
 }
 
+// Immortal objects: make `v` (or `e`) and everything reachable from it skip
+// reference counting from now on; they are never freed. Meant for data that
+// lives as long as the process anyway (builtins' symbols, the global
+// environment, loaded modules): retain/release on them become a flag test
+// instead of a counter write that dirties the object's cache line (and, with
+// biased RC, an atomic operation on other threads). Handles are left alone.
+//
+// Rebinding an immortal global leaks the old value, and a mortal value stored
+// into an immortal pair (`setcar`) lives until the references are cleared
+// (ImmortalSet): only freeze data that stays put. In biased-RC builds only
+// objects owned by the calling thread are frozen.
+struct ImmortalSet;
+void make_immortal(const Value &v, ImmortalSet *set = nullptr);
+void make_immortal(Env *e, ImmortalSet *set = nullptr);
+
 // RAII guard that owns a temporary Env* reference and releases it on destruction.
 struct EnvGuard {
     explicit EnvGuard(Env *e = nullptr) noexcept : e_{e} {}
@@ -127,6 +307,14 @@ class Value {
     static constexpr uint64_t kTagMacro = kNaNMask | 0x0005000000000000ULL;
     static constexpr uint64_t kTagPrim = kNaNMask | 0x0006000000000000ULL;
     static constexpr uint64_t kTagCFunc = kNaNMask | 0x0007000000000000ULL;
+    static constexpr uint64_t kTagHandle = kNaNMask | 0x0008000000000000ULL;
+    static constexpr uint64_t kTagVector = kNaNMask | 0x0009000000000000ULL;
+    static constexpr uint64_t kTagTable = kNaNMask | 0x000A000000000000ULL;
+    static constexpr uint64_t kTagF64Array = kNaNMask | 0x000B000000000000ULL;
+    static constexpr uint64_t kTagBytes = kNaNMask | 0x000C000000000000ULL;
+    static constexpr uint64_t kTagHashMap = kNaNMask | 0x000D000000000000ULL;
+    static constexpr uint64_t kTagPVector = kNaNMask | 0x000E000000000000ULL;
+    static constexpr uint64_t kTagRecord = kNaNMask | 0x000F000000000000ULL;
 
     Value() : bits(kTagNil) {}
     explicit Value(Type t);
@@ -153,19 +341,31 @@ class Value {
         constexpr Type kTagMap[16] = {
             /*0*/ TNIL, /*1*/ TPAIR, /*2*/ TSTRING, /*3*/ TSYMBOL,
             /*4*/ TFUNC, /*5*/ TMACRO, /*6*/ TPRIM, /*7*/ TCFUNC,
-            /*8*/ TNIL, /*9*/ TNIL, /*10*/ TNIL, /*11*/ TNIL,
-            /*12*/ TNIL, /*13*/ TNIL, /*14*/ TNIL, /*15*/ TNIL};
+            /*8*/ THANDLE, /*9*/ TVECTOR, /*10*/ TTABLE, /*11*/ TF64ARRAY,
+            /*12*/ TBYTES, /*13*/ THASHMAP, /*14*/ TPVECTOR, /*15*/ TRECORD};
         uint8_t idx = static_cast<uint8_t>((bits >> 48) & 0xF);
         return kTagMap[idx];
     }
     [[nodiscard]] auto get_number() const noexcept -> double;
     [[nodiscard]] auto get_pair() const noexcept -> PairData *;
-    [[nodiscard]] auto get_string() const noexcept -> std::string *;
+    // (copies the bytes of a slice into the string once, see StringData)
+    [[nodiscard]] auto get_string() const -> std::string *;
+    // the bytes without materializing a slice
+    [[nodiscard]] auto get_string_view() const noexcept -> std::string_view;
+    [[nodiscard]] auto get_string_data() const noexcept -> StringData *;
     [[nodiscard]] auto get_symbol() const noexcept -> std::string *;
     [[nodiscard]] auto get_func() const noexcept -> FuncData *;
     [[nodiscard]] auto get_macro() const noexcept -> MacroData *;
     [[nodiscard]] Prim get_prim() const noexcept;
     [[nodiscard]] CFunc get_cfunc() const noexcept;
+    [[nodiscard]] auto get_handle() const noexcept -> HandleData *;
+    [[nodiscard]] auto get_vector() const noexcept -> VectorData *;
+    [[nodiscard]] auto get_table() const noexcept -> TableData *;
+    [[nodiscard]] auto get_f64array() const noexcept -> F64ArrayData *;
+    [[nodiscard]] auto get_bytes() const noexcept -> BytesData *;
+    [[nodiscard]] auto get_hash_map() const noexcept -> HashMapData *;
+    [[nodiscard]] auto get_pvector() const noexcept -> PVectorData *;
+    [[nodiscard]] auto get_record() const noexcept -> RecordData *;
 
     //[[nodiscard]] inline auto operator->() -> Value* { return this; }
     //[[nodiscard]] inline auto operator->() const -> const Value* { return this; }
@@ -192,6 +392,14 @@ class Value {
     void set_macro(MacroData *ptr) noexcept;
     void set_prim(Prim fn) noexcept;
     void set_cfunc(CFunc fn) noexcept;
+    void set_handle(HandleData *ptr) noexcept;
+    void set_vector(VectorData *ptr) noexcept;
+    void set_table(TableData *ptr) noexcept;
+    void set_f64array(F64ArrayData *ptr) noexcept;
+    void set_bytes(BytesData *ptr) noexcept;
+    void set_hash_map(HashMapData *ptr) noexcept;
+    void set_pvector(PVectorData *ptr) noexcept;
+    void set_record(RecordData *ptr) noexcept;
 
   private:
     void retain() const noexcept;
@@ -220,6 +428,49 @@ class Value {
     uint64_t bits;
 };
 
+// StringData: the bytes of a string or symbol. Strings never change once
+// made, so a string may borrow its bytes instead of owning them in `value_`:
+// - a slice (substring, string-split) points into the bytes of the string
+//   that owns them and keeps that one alive; slices of a slice share the
+//   same owner
+// - a mapped string (read-file) points into a read-only file mapping that
+//   is unmapped with it
+// view() reads either kind in place. str(), for callers that need a
+// std::string, copies borrowed bytes into `value_` once; a slice then lets go
+// of its owner.
+class StringData : public RcBase {
+  public:
+    explicit StringData(std::string s) : value_(std::move(s)) {}
+    // slice [offset, offset + n) of the TSTRING value `of`
+    StringData(const Value &of, size_t offset, size_t n) noexcept;
+    // the `n` bytes mapped at `map` (mmap); takes over the mapping
+    [[nodiscard]] static auto mapped(void *map, size_t n) -> StringData *;
+    ~StringData();
+    StringData(const StringData &) = delete;
+    StringData &operator=(const StringData &) = delete;
+
+    [[nodiscard]] inline __attribute__((always_inline)) auto view() const noexcept -> std::string_view {
+        return data_ ? std::string_view(data_, size_) : std::string_view(value_);
+    }
+    [[nodiscard]] inline __attribute__((always_inline)) auto str() -> std::string & {
+        if (data_ && value_.size() != size_) [[unlikely]]
+            materialize();
+        return value_;
+    }
+    // the string owning the bytes of a slice (nil for any other string)
+    [[nodiscard]] auto owner() const noexcept -> const Value & { return owner_; }
+
+  private:
+    StringData() = default;
+    void materialize();
+
+    std::string value_;
+    Value owner_;
+    const char *data_ = nullptr; // borrowed bytes (nullptr: `value_` holds them)
+    size_t size_ = 0;
+    bool mapped_ = false;
+};
+
 // Inline short Value methods for performance
 inline auto Value::get_number() const noexcept -> double {
     double result;
@@ -267,15 +518,20 @@ inline void Value::set_fn_raw(Fn fn) noexcept {
 inline __attribute__((always_inline)) auto Value::get_pair() const noexcept -> PairData * { return get_payload_raw<kTagPair, PairData>(); }
 inline void Value::set_pair(PairData *ptr) noexcept { set_payload_raw<kTagPair, PairData>(ptr); }
 
-inline __attribute__((always_inline)) auto Value::get_string() const noexcept -> std::string * {
+inline __attribute__((always_inline)) auto Value::get_string() const -> std::string * {
     auto *sd = get_payload_raw<kTagString, StringData>();
-    return sd ? &sd->value : nullptr;
+    return sd ? &sd->str() : nullptr;
 }
+inline __attribute__((always_inline)) auto Value::get_string_view() const noexcept -> std::string_view {
+    auto *sd = get_payload_raw<kTagString, StringData>();
+    return sd ? sd->view() : std::string_view();
+}
+inline auto Value::get_string_data() const noexcept -> StringData * { return get_payload_raw<kTagString, StringData>(); }
 inline void Value::set_string(StringData *ptr) noexcept { set_payload_raw<kTagString, StringData>(ptr); }
 
 inline __attribute__((always_inline)) auto Value::get_symbol() const noexcept -> std::string * {
     auto *sd = get_payload_raw<kTagSymbol, StringData>();
-    return sd ? &sd->value : nullptr;
+    return sd ? &sd->str() : nullptr;
 }
 inline void Value::set_symbol(StringData *ptr) noexcept { set_payload_raw<kTagSymbol, StringData>(ptr); }
 
@@ -291,6 +547,7 @@ inline void Value::set_prim(Prim fn) noexcept { set_fn_raw<kTagPrim, Prim>(fn);
 inline CFunc Value::get_cfunc() const noexcept { return get_fn_raw<kTagCFunc, CFunc>(); }
 inline void Value::set_cfunc(CFunc fn) noexcept { set_fn_raw<kTagCFunc, CFunc>(fn); }
 
+
 inline __attribute__((always_inline)) void Value::retain() const noexcept {
     Type t = get_type();
     if (!is_refcounted(t))
@@ -318,7 +575,15 @@ inline auto Value::is_refcounted(Type t) noexcept -> bool {
         /*TFUNC*/ true,
         /*TMACRO*/ true,
         /*TPRIM*/ false,
-        /*TCFUNC*/ false};
+        /*TCFUNC*/ false,
+        /*THANDLE*/ true,
+        /*TVECTOR*/ true,
+        /*TTABLE*/ true,
+        /*TF64ARRAY*/ true,
+        /*TBYTES*/ true,
+        /*THASHMAP*/ true,
+        /*TPVECTOR*/ true,
+        /*TRECORD*/ true};
     size_t idx = static_cast<size_t>(t);
     return idx < (sizeof(kIsRefcounted) / sizeof(kIsRefcounted[0])) ? kIsRefcounted[idx] : false;
 }
@@ -328,6 +593,14 @@ inline __attribute__((always_inline)) void Value::retain_payload(Type t, void *p
         static_cast<RcBase *>(p)->inc_ref();
 }
 
+// Containers frozen by make_immortal, so their owner can drop what they
+// reference when it shuts down; the shells themselves stay allocated.
+struct ImmortalSet {
+    std::vector<Value> values; // pairs, functions, macros, vectors, tables, persistent collections and records
+    std::vector<Env *> envs;
+    void clear_references() noexcept;
+};
+
 class PairData : public RcBase {
   public:
     Value car;
@@ -362,6 +635,53 @@ class MacroData : public RcBase {
     Env *closure_env = nullptr;
 };
 
+// VectorData: contiguous elements of a vector (O(1) indexing, amortized O(1)
+// push at the end).
+class VectorData : public RcBase {
+  public:
+    std::vector<Value> items;
+};
+
+// HandleData: base for native objects outside the core data model (futures,
+// ...). Deleted through the virtual destructor on the last release.
+//
+// - type_name: name reported by `type` and printed as `<name>`
+// - detach: handles that wrap a thread-safe shared object may return a
+//           factory that rebuilds an equivalent handle in another isolate;
+//           an empty function means the handle cannot leave its State.
+class HandleData : public RcBase {
+  public:
+    virtual ~HandleData() = default;
+    [[nodiscard]] virtual auto type_name() const -> const char * = 0;
+    [[nodiscard]] virtual auto detach() const -> std::function<HandleData *()> { return {}; }
+};
+
+// The vtable pointer places the RcBase subobject after offset 0, so handles are
+// boxed as RcBase* (what retain/release expect) and downcast on access.
+inline auto Value::get_handle() const noexcept -> HandleData * { return static_cast<HandleData *>(get_payload_raw<kTagHandle, RcBase>()); }
+inline void Value::set_handle(HandleData *ptr) noexcept { set_payload_raw<kTagHandle, RcBase>(ptr); }
+
+inline auto Value::get_vector() const noexcept -> VectorData * { return get_payload_raw<kTagVector, VectorData>(); }
+inline void Value::set_vector(VectorData *ptr) noexcept { set_payload_raw<kTagVector, VectorData>(ptr); }
+
+inline auto Value::get_table() const noexcept -> TableData * { return get_payload_raw<kTagTable, TableData>(); }
+inline void Value::set_table(TableData *ptr) noexcept { set_payload_raw<kTagTable, TableData>(ptr); }
+
+inline auto Value::get_f64array() const noexcept -> F64ArrayData * { return get_payload_raw<kTagF64Array, F64ArrayData>(); }
+inline void Value::set_f64array(F64ArrayData *ptr) noexcept { set_payload_raw<kTagF64Array, F64ArrayData>(ptr); }
+
+inline auto Value::get_bytes() const noexcept -> BytesData * { return get_payload_raw<kTagBytes, BytesData>(); }
+inline void Value::set_bytes(BytesData *ptr) noexcept { set_payload_raw<kTagBytes, BytesData>(ptr); }
+
+inline auto Value::get_hash_map() const noexcept -> HashMapData * { return get_payload_raw<kTagHashMap, HashMapData>(); }
+inline void Value::set_hash_map(HashMapData *ptr) noexcept { set_payload_raw<kTagHashMap, HashMapData>(ptr); }
+
+inline auto Value::get_pvector() const noexcept -> PVectorData * { return get_payload_raw<kTagPVector, PVectorData>(); }
+inline void Value::set_pvector(PVectorData *ptr) noexcept { set_payload_raw<kTagPVector, PVectorData>(ptr); }
+
+inline auto Value::get_record() const noexcept -> RecordData * { return get_payload_raw<kTagRecord, RecordData>(); }
+inline void Value::set_record(RecordData *ptr) noexcept { set_payload_raw<kTagRecord, RecordData>(ptr); }
+
 } // namespace vdlisp
 
 #endif // VDLISP__NANBOX_HPP
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "output.hpp"
+#include "files.hpp"
+#include "helpers.hpp"
+#include "vdlisp.hpp"
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace vdlisp {
+
+namespace {
+
+// Write all of [p, p + n) to fd 1. Output that cannot be written (a closed
+// pipe) is dropped, as std::cout would.
+void write_stdout(const char *p, size_t n) noexcept {
+    while (n > 0) {
+        ssize_t w = ::write(1, p, n);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        p += w;
+        n -= static_cast<size_t>(w);
+    }
+}
+
+auto stdout_is_tty() noexcept -> bool {
+    static const bool tty = isatty(1) != 0;
+    return tty;
+}
+
+// Pass [p, p + n) on to `out`.
+void emit(std::ostream *out, const char *p, size_t n) noexcept {
+    if (out == &std::cout) {
+        // keep anything written through std::cout itself in order
+        std::cout.flush();
+        write_stdout(p, n);
+        return;
+    }
+    try {
+        out->write(p, static_cast<std::streamsize>(n));
+    } catch (...) {
+    }
+}
+
+// Pass the display form of `v` to `sink`, formatting strings and numbers
+// without building a std::string.
+template <class Sink>
+void display(State &S, const Value &v, Sink &&sink) {
+    if (v && v.get_type() == TSTRING) {
+        sink(v.get_string_view());
+        return;
+    }
+    if (v && v.get_type() == TNUMBER) {
+        // as `ss << d` in to_repr (%g), without a stream
+        char buf[32];
+        auto res = std::to_chars(buf, buf + sizeof buf, v.get_number(), std::chars_format::general, 6);
+        sink(std::string_view(buf, static_cast<size_t>(res.ptr - buf)));
+        return;
+    }
+    sink(S.to_string(v));
+}
+
+// write / write-line: to the file given first, else to the output buffer
+auto write_args(State &S, const Value &args, bool newline, const char *who) -> Value {
+    Value last;
+    if (FileHandle *f = as_file(pair_car(args))) {
+        for (Value cur = pair_cdr(args); cur; cur = pair_cdr(cur)) {
+            last = pair_car(cur);
+            display(S, last, [f, who](std::string_view s) { f->write(s, who); });
+        }
+        if (newline)
+            f->write("\n", who);
+        return last;
+    }
+    for (Value cur = args; cur; cur = pair_cdr(cur)) {
+        last = pair_car(cur);
+        write_display(S, last);
+    }
+    if (newline)
+        S.write_out("\n");
+    return last;
+}
+
+} // namespace
+
+void State::write_out(std::string_view s) {
+    if (out_buffer.size() + s.size() > out_capacity) {
+        flush_out();
+        if (s.size() >= out_capacity) {
+            emit(out, s.data(), s.size());
+            return;
+        }
+    }
+    out_buffer.append(s);
+    if (out == &std::cout && stdout_is_tty() && s.find('\n') != std::string_view::npos)
+        flush_out();
+}
+
+void State::flush_out() noexcept {
+    if (out_buffer.empty())
+        return;
+    emit(out, out_buffer.data(), out_buffer.size());
+    out_buffer.clear();
+}
+
+void write_display(State &S, const Value &v) {
+    display(S, v, [&S](std::string_view s) { S.write_out(s); });
+}
+
+void register_output(State &S) {
+    S.register_builtin("write", [](State &S, const Value &args) -> Value { return write_args(S, args, false, "write"); });
+    S.register_builtin("write-line", [](State &S, const Value &args) -> Value {
+        return write_args(S, args, true, "write-line");
+    });
+    S.register_builtin("flush", [](State &S, const Value &args) -> Value {
+        if (FileHandle *f = as_file(pair_car(args)))
+            f->flush("flush");
+        else
+            S.flush_out();
+        return {};
+    });
+    S.register_builtin("output-buffer-size", [](State &S, const Value &args) -> Value {
+        if (args) {
+            double n = require_number(pair_car(args), "output-buffer-size");
+            if (n < 0 || n != std::floor(n))
+                throw std::runtime_error("output-buffer-size requires a non-negative integer");
+            S.flush_out();
+            S.out_capacity = static_cast<size_t>(n);
+        }
+        return S.make_number(static_cast<double>(S.out_capacity));
+    });
+}
+
+} // namespace vdlisp
@@ -0,0 +1,26 @@
+#ifndef VDLISP__OUTPUT_HPP
+#define VDLISP__OUTPUT_HPP
+
+namespace vdlisp {
+
+class State;
+class Value;
+
+// Buffered output (State::write_out / flush_out). Bound for std::cout, the
+// buffer goes straight to fd 1 with write(2), bypassing iostreams, and is
+// passed on after every line when fd 1 is a terminal; a redirected `out`
+// (server request, batch job) gets it with one stream write.
+//
+// (write x ...): the display form of each x (strings without quotes), no
+// separators; (write-line x ...): the same and a newline; (flush);
+// (output-buffer-size [n]): the buffer size in bytes, set to n (0 writes
+// through). Given a file (see files.hpp) first, write / write-line / flush
+// go to that file instead.
+void register_output(State &S);
+
+// Append the display form of `v` (what `print` shows) to the output buffer.
+void write_display(State &S, const Value &v);
+
+} // namespace vdlisp
+
+#endif // VDLISP__OUTPUT_HPP
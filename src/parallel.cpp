@@ -0,0 +1,336 @@
+#include "coroutine.hpp"
+#include "helpers.hpp"
+#include "transfer.hpp"
+#include "workers.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace vdlisp {
+
+namespace {
+
+using JitFn = double (*)(double *, int);
+
+// below this many elements the sequence is processed on the calling thread
+constexpr size_t kParallelMin = 32;
+// numeric kernels are cheap per element: only split large inputs
+constexpr size_t kNativeMin = 4096;
+
+enum class Op { Map, ForEach, Reduce };
+
+// A batch of chunks shared by the caller and the helper tasks it submits.
+// Chunks are claimed through `next`, so a helper that starts after the caller
+// has drained everything finds no work and returns without touching the
+// caller's data; the caller only waits for chunks already in progress.
+struct Batch {
+    Batch(size_t chunks, std::function<void(State &, size_t, bool)> work)
+        : chunks(chunks), work(std::move(work)), errors(chunks) {}
+
+    const size_t chunks;
+    // work(S, chunk, local): `local` is true on the calling thread
+    std::function<void(State &, size_t, bool)> work;
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t finished = 0;
+    std::vector<std::string> errors;
+
+    void drain(State &S, bool local) {
+        Value expr = S.current_expr;
+        for (size_t c; (c = next.fetch_add(1, std::memory_order_relaxed)) < chunks;) {
+            std::string error;
+            try {
+                work(S, c, local);
+            } catch (const std::exception &ex) {
+                error = ex.what();
+                if (error.empty())
+                    error = "parallel task failed";
+            } catch (...) {
+                error = "parallel task failed";
+            }
+            // a failed eval leaves current_expr on the copied code, which has
+            // no source location: report the error at the call instead
+            if (!error.empty())
+                S.current_expr = expr;
+            if (!local)
+                S.flush_out();
+            std::lock_guard<std::mutex> lock(mutex);
+            errors[c] = std::move(error);
+            if (++finished == chunks)
+                cv.notify_all();
+        }
+    }
+};
+
+// Run every chunk of `b` on the pool and the calling thread; rethrow the
+// first error in chunk order.
+void run_batch(State &S, const std::shared_ptr<Batch> &b) {
+    WorkerPool &pool = WorkerPool::instance();
+    size_t helpers = std::min(pool.size(), b->chunks - 1);
+    S.flush_out();
+    for (size_t i = 0; i < helpers; ++i)
+        pool.submit([b](State &W) { b->drain(W, false); });
+    b->drain(S, true);
+    {
+        std::unique_lock<std::mutex> lock(b->mutex);
+        b->cv.wait(lock, [&b] { return b->finished == b->chunks; });
+    }
+    rc_safepoint();
+    for (const auto &e : b->errors)
+        if (!e.empty())
+            throw std::runtime_error(e);
+}
+
+auto list1(State &S, const Value &a) -> Value {
+    return S.make_pair(a, Value());
+}
+
+auto list2(State &S, const Value &a, const Value &b) -> Value {
+    return S.make_pair(a, S.make_pair(b, Value()));
+}
+
+// Elements of a list or the values yielded by a generator.
+auto collect(const Value &seq, const char *who) -> std::vector<Value> {
+    std::vector<Value> items;
+    for_each_item(seq, who, [&items](const Value &v) { items.push_back(v); });
+    return items;
+}
+
+auto build_list(State &S, const std::vector<Value> &items) -> Value {
+    Value head;
+    Value *last = &head;
+    for (const auto &v : items) {
+        *last = S.make_pair(v, Value());
+        last = &last->get_pair()->cdr;
+    }
+    return head;
+}
+
+auto chunk_count(size_t n, size_t chunk) -> size_t {
+    return (n + chunk - 1) / chunk;
+}
+
+// Compiled entry point for `fn` when it is a numeric function of exactly
+// `arity` parameters, every element is a number and the code runs without
+// calling back into the interpreter (probed on the first element with no
+// active State, which is how pool threads run it). nullptr otherwise.
+auto native_kernel(State &S, const Value &fn, int arity, const std::vector<Value> &items) -> JitFn {
+    if (fn.get_type() != TFUNC || items.size() < kNativeMin)
+        return nullptr;
+    FuncData *fd = fn.get_func();
+    int count = 0;
+    for (Value p = fd->params; p; p = pair_cdr(p)) {
+        if (p.get_type() != TPAIR || pair_car(p).get_type() != TSYMBOL)
+            return nullptr;
+        ++count;
+    }
+    if (count != arity)
+        return nullptr;
+    for (const auto &v : items)
+        if (v.get_type() != TNUMBER)
+            return nullptr;
+    if (!S.jit_compile(fd))
+        return nullptr;
+    auto fptr = reinterpret_cast<JitFn>(fd->compiled_code);
+    double probe[2] = {items[0].get_number(), items[1].get_number()};
+    State *prev_active = jit_active_state;
+    jit_active_state = nullptr;
+    double r = fptr(probe, arity);
+    jit_active_state = prev_active;
+    return std::isnan(r) ? nullptr : fptr;
+}
+
+// pmap / pfor-each / preduce over numbers with a compiled kernel. Elements
+// whose result comes back as NaN (the JIT's "not a number" signal) are
+// recomputed through the interpreter on the calling thread.
+auto run_native(State &S, Op op, JitFn fptr, const Value &fn, const Value &init, const std::vector<Value> &items) -> Value {
+    size_t n = items.size();
+    size_t chunk = std::max<size_t>(1024, n / (WorkerPool::instance().size() * 4));
+    size_t chunks = chunk_count(n, chunk);
+    std::vector<double> in(n);
+    for (size_t i = 0; i < n; ++i)
+        in[i] = items[i].get_number();
+    std::vector<double> out(op == Op::Reduce ? chunks : n);
+    auto b = std::make_shared<Batch>(chunks, [&, chunk](State &, size_t c, bool) {
+        State *prev_active = jit_active_state;
+        jit_active_state = nullptr;
+        size_t lo = c * chunk;
+        size_t hi = std::min(n, lo + chunk);
+        if (op == Op::Reduce) {
+            double acc = in[lo];
+            for (size_t i = lo + 1; i < hi && !std::isnan(acc); ++i) {
+                double a[2] = {acc, in[i]};
+                acc = fptr(a, 2);
+            }
+            out[c] = acc;
+        } else {
+            for (size_t i = lo; i < hi; ++i)
+                out[i] = fptr(&in[i], 1);
+        }
+        jit_active_state = prev_active;
+    });
+    run_batch(S, b);
+
+    if (op == Op::Reduce) {
+        Value acc = init;
+        for (size_t c = 0; c < chunks; ++c) {
+            Value part = S.make_number(out[c]);
+            if (std::isnan(out[c])) {
+                size_t lo = c * chunk;
+                size_t hi = std::min(n, lo + chunk);
+                part = items[lo];
+                for (size_t i = lo + 1; i < hi; ++i)
+                    part = S.call(fn, list2(S, part, items[i]));
+            }
+            acc = S.call(fn, list2(S, acc, part));
+        }
+        return acc;
+    }
+    std::vector<Value> results(op == Op::Map ? n : 0);
+    for (size_t i = 0; i < n; ++i) {
+        Value r = std::isnan(out[i]) ? S.call(fn, list1(S, items[i])) : Value();
+        if (op == Op::Map)
+            results[i] = std::isnan(out[i]) ? r : S.make_number(out[i]);
+    }
+    return op == Op::Map ? build_list(S, results) : Value();
+}
+
+// Run one chunk in State `W`: map / for-each / fold `fn` over `items`.
+auto run_chunk(State &W, Op op, const Value &fn, const Value &items) -> Value {
+    if (op == Op::Reduce) {
+        Value acc = pair_car(items);
+        for (Value cur = pair_cdr(items); cur; cur = pair_cdr(cur))
+            acc = W.call(fn, list2(W, acc, pair_car(cur)));
+        return acc;
+    }
+    Value head;
+    Value *last = &head;
+    for (Value cur = items; cur; cur = pair_cdr(cur)) {
+        Value r = W.call(fn, list1(W, pair_car(cur)));
+        if (op == Op::Map) {
+            *last = W.make_pair(r, Value());
+            last = &last->get_pair()->cdr;
+        }
+    }
+    return head;
+}
+
+// General path: chunks are deep-copied into worker isolates, processed there
+// and the results copied back. Chunks claimed by the calling thread, and the
+// final fold of preduce, work on copies thawed into the caller, so what `fn`
+// does to the globals and captured values it sees never reaches the caller,
+// whichever thread ran the element.
+auto run_isolated(State &S, Op op, const Value &fn, const Value &init, const std::vector<Value> &items) -> Value {
+    size_t n = items.size();
+    size_t chunk = std::max<size_t>(8, n / (WorkerPool::instance().size() * 4));
+    size_t chunks = chunk_count(n, chunk);
+    auto slice = [&](size_t c) {
+        size_t lo = c * chunk;
+        return std::vector<Value>(items.begin() + lo, items.begin() + std::min(n, lo + chunk));
+    };
+    Frozen frozen_fn = Frozen::freeze(S, fn);
+    std::vector<Frozen> frozen_in(chunks);
+    for (size_t c = 0; c < chunks; ++c)
+        frozen_in[c] = Frozen::freeze(S, build_list(S, slice(c)));
+    std::vector<Frozen> frozen_out(chunks);
+    std::vector<Value> local_out(chunks);
+    std::vector<char> local(chunks, 0);
+    Value local_fn; // touched by the calling thread only
+
+    auto b = std::make_shared<Batch>(chunks, [&](State &W, size_t c, bool is_local) {
+        if (is_local) {
+            if (!local_fn)
+                local_fn = thaw_tracked(W, frozen_fn);
+            local_out[c] = run_chunk(W, op, local_fn, thaw_tracked(W, frozen_in[c]));
+            local[c] = 1;
+            return;
+        }
+        std::vector<Env *> envs;
+        try {
+            Value wfn = frozen_fn.thaw(W, &envs);
+            Value r = run_chunk(W, op, wfn, frozen_in[c].thaw(W, &envs));
+            if (op != Op::ForEach)
+                frozen_out[c] = Frozen::freeze(W, r);
+        } catch (...) {
+            purge_thawed_envs(envs);
+            throw;
+        }
+        purge_thawed_envs(envs);
+    });
+    run_batch(S, b);
+
+    if (op == Op::ForEach)
+        return {};
+    if (op == Op::Reduce) {
+        if (!local_fn)
+            local_fn = thaw_tracked(S, frozen_fn);
+        Value acc = init;
+        for (size_t c = 0; c < chunks; ++c)
+            acc = S.call(local_fn, list2(S, acc, local[c] ? local_out[c] : thaw_tracked(S, frozen_out[c])));
+        return acc;
+    }
+    std::vector<Value> results;
+    results.reserve(n);
+    for (size_t c = 0; c < chunks; ++c) {
+        Value part = local[c] ? local_out[c] : thaw_tracked(S, frozen_out[c]);
+        for (; part; part = pair_cdr(part))
+            results.push_back(pair_car(part));
+    }
+    return build_list(S, results);
+}
+
+// Short sequences: one pass on the calling thread, over copies of `fn` and
+// the elements like every chunk of run_isolated.
+auto run_sequential(State &S, Op op, const Value &fn, const Value &init, const std::vector<Value> &items) -> Value {
+    Value copy = thaw_tracked(S, Frozen::freeze(S, fn));
+    Value list = thaw_tracked(S, Frozen::freeze(S, build_list(S, items)));
+    if (op != Op::Reduce)
+        return run_chunk(S, op, copy, list);
+    Value acc = init;
+    for (; list; list = pair_cdr(list))
+        acc = S.call(copy, list2(S, acc, pair_car(list)));
+    return acc;
+}
+
+auto parallel(State &S, Op op, const char *who, const Value &fn, const Value &init, const Value &seq) -> Value {
+    if (!fn || (fn.get_type() != TFUNC && fn.get_type() != TCFUNC))
+        throw std::runtime_error(std::string(who) + " requires a function");
+    std::vector<Value> items = collect(seq, who);
+    if (items.size() < kParallelMin)
+        return run_sequential(S, op, fn, init, items);
+    if (JitFn fptr = native_kernel(S, fn, op == Op::Reduce ? 2 : 1, items))
+        return run_native(S, op, fptr, fn, init, items);
+    return run_isolated(S, op, fn, init, items);
+}
+
+} // namespace
+
+void parallel_chunks(State &S, size_t chunks, const std::function<void(size_t)> &work) {
+    if (chunks == 0)
+        return;
+    run_batch(S, std::make_shared<Batch>(chunks, [work](State &, size_t c, bool) { work(c); }));
+}
+
+void register_parallel(State &S) {
+    // (pmap f list): like map, with the list split into chunks processed on
+    // worker isolates. Results keep the input order.
+    S.register_builtin("pmap", [](State &S, const Value &args) -> Value {
+        return parallel(S, Op::Map, "pmap", pair_car(args), Value(), pair_car(pair_cdr(args)));
+    });
+    // (pfor-each f list): call f on every element in parallel; returns nil.
+    // f and the elements are copies wherever they run, so side effects on
+    // them stay there (use a channel to report back).
+    S.register_builtin("pfor-each", [](State &S, const Value &args) -> Value {
+        return parallel(S, Op::ForEach, "pfor-each", pair_car(args), Value(), pair_car(pair_cdr(args)));
+    });
+    // (preduce f init list): fold with an associative f. Each chunk is folded
+    // from its first element, then init is folded over the chunk results.
+    S.register_builtin("preduce", [](State &S, const Value &args) -> Value {
+        Value rest = pair_cdr(args);
+        return parallel(S, Op::Reduce, "preduce", pair_car(args), pair_car(rest), pair_car(pair_cdr(rest)));
+    });
+}
+
+} // namespace vdlisp
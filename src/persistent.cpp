@@ -0,0 +1,527 @@
+#include "persistent.hpp"
+#include "coroutine.hpp"
+#include "helpers.hpp"
+#include "table.hpp"
+#include <bit>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace vdlisp {
+
+// -------------------- hash-map --------------------
+
+namespace {
+
+using MapRef = NodeRef<HashMapNode>;
+
+constexpr unsigned kHashBits = 64;
+
+// slot bit of `hash` at the level that starts at bit `shift`
+auto fragment(uint64_t hash, unsigned shift) noexcept -> uint32_t { return uint32_t(1) << ((hash >> shift) & 31); }
+// dense index of slot `bit` among the slots set in `bitmap`
+auto dense(uint32_t bitmap, uint32_t bit) noexcept -> size_t { return std::popcount(bitmap & (bit - 1)); }
+
+// Fresh copy of `n` (the children are shared, not copied).
+auto copy_node(const HashMapNode *n) -> MapRef {
+    auto *c = new HashMapNode();
+    c->datamap = n->datamap;
+    c->nodemap = n->nodemap;
+    c->entries = n->entries;
+    c->children = n->children;
+    return MapRef::adopt(c);
+}
+
+// Node holding the entries `a` and `b` (different keys) at level `shift`.
+auto merge(HashMapEntry a, HashMapEntry b, unsigned shift) -> MapRef {
+    auto *n = new HashMapNode();
+    MapRef r = MapRef::adopt(n);
+    if (shift >= kHashBits) {
+        n->entries.push_back(std::move(a));
+        n->entries.push_back(std::move(b));
+        return r;
+    }
+    uint32_t ba = fragment(a.hash, shift);
+    uint32_t bb = fragment(b.hash, shift);
+    if (ba == bb) {
+        n->nodemap = ba;
+        n->children.push_back(merge(std::move(a), std::move(b), shift + 5));
+        return r;
+    }
+    n->datamap = ba | bb;
+    if (ba > bb)
+        std::swap(a, b);
+    n->entries.push_back(std::move(a));
+    n->entries.push_back(std::move(b));
+    return r;
+}
+
+auto lookup(const HashMapNode *n, const Value &key, uint64_t hash) noexcept -> const Value * {
+    for (unsigned shift = 0;; shift += 5) {
+        if (shift >= kHashBits) {
+            for (const HashMapEntry &e : n->entries)
+                if (table_key_equal(e.key, key))
+                    return &e.value;
+            return nullptr;
+        }
+        uint32_t bit = fragment(hash, shift);
+        if (n->datamap & bit) {
+            const HashMapEntry &e = n->entries[dense(n->datamap, bit)];
+            return e.hash == hash && table_key_equal(e.key, key) ? &e.value : nullptr;
+        }
+        if (!(n->nodemap & bit))
+            return nullptr;
+        n = n->children[dense(n->nodemap, bit)].get();
+    }
+}
+
+// `n` with `e` added or replacing the entry of its key; null when the key is
+// already bound to the identical value. `added` is set for a new key.
+auto assoc(const HashMapNode *n, HashMapEntry &e, unsigned shift, bool &added) -> MapRef {
+    if (shift >= kHashBits) {
+        for (size_t i = 0; i < n->entries.size(); ++i) {
+            if (!table_key_equal(n->entries[i].key, e.key))
+                continue;
+            if (n->entries[i].value == e.value)
+                return {};
+            MapRef c = copy_node(n);
+            c->entries[i].value = std::move(e.value);
+            return c;
+        }
+        MapRef c = copy_node(n);
+        c->entries.push_back(std::move(e));
+        added = true;
+        return c;
+    }
+    uint32_t bit = fragment(e.hash, shift);
+    if (n->datamap & bit) {
+        size_t i = dense(n->datamap, bit);
+        const HashMapEntry &cur = n->entries[i];
+        if (cur.hash == e.hash && table_key_equal(cur.key, e.key)) {
+            if (cur.value == e.value)
+                return {};
+            MapRef c = copy_node(n);
+            c->entries[i].value = std::move(e.value);
+            return c;
+        }
+        // two keys in one slot: push both down a level
+        MapRef c = copy_node(n);
+        HashMapEntry old = std::move(c->entries[i]);
+        c->entries.erase(c->entries.begin() + static_cast<ptrdiff_t>(i));
+        c->datamap ^= bit;
+        c->nodemap |= bit;
+        c->children.insert(c->children.begin() + static_cast<ptrdiff_t>(dense(c->nodemap, bit)),
+                           merge(std::move(old), std::move(e), shift + 5));
+        added = true;
+        return c;
+    }
+    if (n->nodemap & bit) {
+        size_t j = dense(n->nodemap, bit);
+        MapRef sub = assoc(n->children[j].get(), e, shift + 5, added);
+        if (!sub)
+            return {};
+        MapRef c = copy_node(n);
+        c->children[j] = std::move(sub);
+        return c;
+    }
+    MapRef c = copy_node(n);
+    c->datamap |= bit;
+    c->entries.insert(c->entries.begin() + static_cast<ptrdiff_t>(dense(c->datamap, bit)), std::move(e));
+    added = true;
+    return c;
+}
+
+// `n` without `key`; `found` tells whether it was there. A null result with
+// `found` set means the node became empty. A child left with a single entry
+// is inlined into its parent, so equal maps always have the same shape.
+auto dissoc(const HashMapNode *n, const Value &key, uint64_t hash, unsigned shift, bool &found) -> MapRef {
+    if (shift >= kHashBits) {
+        for (size_t i = 0; i < n->entries.size(); ++i) {
+            if (!table_key_equal(n->entries[i].key, key))
+                continue;
+            found = true;
+            if (n->entries.size() == 1)
+                return {};
+            MapRef c = copy_node(n);
+            c->entries.erase(c->entries.begin() + static_cast<ptrdiff_t>(i));
+            return c;
+        }
+        return {};
+    }
+    uint32_t bit = fragment(hash, shift);
+    if (n->datamap & bit) {
+        size_t i = dense(n->datamap, bit);
+        const HashMapEntry &cur = n->entries[i];
+        if (cur.hash != hash || !table_key_equal(cur.key, key))
+            return {};
+        found = true;
+        if (n->entries.size() == 1 && n->children.empty())
+            return {};
+        MapRef c = copy_node(n);
+        c->entries.erase(c->entries.begin() + static_cast<ptrdiff_t>(i));
+        c->datamap ^= bit;
+        return c;
+    }
+    if (!(n->nodemap & bit))
+        return {};
+    size_t j = dense(n->nodemap, bit);
+    MapRef sub = dissoc(n->children[j].get(), key, hash, shift + 5, found);
+    if (!found)
+        return {};
+    if (sub && (!sub->children.empty() || sub->entries.size() > 1)) {
+        MapRef c = copy_node(n);
+        c->children[j] = std::move(sub);
+        return c;
+    }
+    if (!sub && n->children.size() == 1 && n->entries.empty())
+        return {};
+    MapRef c = copy_node(n);
+    c->children.erase(c->children.begin() + static_cast<ptrdiff_t>(j));
+    c->nodemap ^= bit;
+    if (sub) {
+        c->datamap |= bit;
+        c->entries.insert(c->entries.begin() + static_cast<ptrdiff_t>(dense(c->datamap, bit)), sub->entries[0]);
+    }
+    return c;
+}
+
+} // namespace
+
+auto HashMapData::find(const Value &key) const noexcept -> const Value * {
+    return root_ ? lookup(root_.get(), key, value_hash(key)) : nullptr;
+}
+
+auto HashMapData::with(const Value &key, Value value) const -> HashMapData * {
+    HashMapEntry e{value_hash(key), key, std::move(value)};
+    bool added = false;
+    MapRef root;
+    if (root_) {
+        root = assoc(root_.get(), e, 0, added);
+        if (!root)
+            return nullptr;
+    } else {
+        auto *n = new HashMapNode();
+        root = MapRef::adopt(n);
+        n->datamap = fragment(e.hash, 0);
+        n->entries.push_back(std::move(e));
+        added = true;
+    }
+    return new HashMapData(std::move(root), count_ + (added ? 1 : 0));
+}
+
+auto HashMapData::without(const Value &key) const -> HashMapData * {
+    if (!root_)
+        return nullptr;
+    bool found = false;
+    MapRef root = dissoc(root_.get(), key, value_hash(key), 0, found);
+    if (!found)
+        return nullptr;
+    return new HashMapData(std::move(root), count_ - 1);
+}
+
+// -------------------- pvector --------------------
+
+namespace {
+
+using VecRef = NodeRef<PVectorNode>;
+
+auto copy_node(const PVectorNode *n) -> VecRef {
+    auto *c = new PVectorNode();
+    c->items = n->items;
+    c->children = n->children;
+    return VecRef::adopt(c);
+}
+
+auto branch(std::vector<VecRef> children) -> VecRef {
+    auto *n = new PVectorNode();
+    n->children = std::move(children);
+    return VecRef::adopt(n);
+}
+
+// chain of single-child branches from `level` down to `leaf`
+auto new_path(unsigned level, VecRef leaf) -> VecRef {
+    if (level == 0)
+        return leaf;
+    return branch({new_path(level - 5, std::move(leaf))});
+}
+
+// `n` (a branch at `level`) with element i replaced
+auto assoc_path(const PVectorNode *n, unsigned level, size_t i, Value v) -> VecRef {
+    VecRef c = copy_node(n);
+    if (level == 0)
+        c->items[i & 31] = std::move(v);
+    else {
+        size_t sub = (i >> level) & 31;
+        c->children[sub] = assoc_path(n->children[sub].get(), level - 5, i, std::move(v));
+    }
+    return c;
+}
+
+// `n` (a branch at `level`) with `leaf` appended as its last leaf
+auto push_leaf(const PVectorNode *n, unsigned level, size_t last, VecRef leaf) -> VecRef {
+    VecRef c = copy_node(n);
+    size_t sub = (last >> level) & 31;
+    if (level == 5)
+        c->children.push_back(std::move(leaf));
+    else if (sub < n->children.size())
+        c->children[sub] = push_leaf(n->children[sub].get(), level - 5, last, std::move(leaf));
+    else
+        c->children.push_back(new_path(level - 5, std::move(leaf)));
+    return c;
+}
+
+// `n` (a branch at `level`) without its last leaf, which holds element
+// `last`; null when nothing is left
+auto pop_leaf(const PVectorNode *n, unsigned level, size_t last) -> VecRef {
+    size_t sub = (last >> level) & 31;
+    if (level > 5) {
+        VecRef child = pop_leaf(n->children[sub].get(), level - 5, last);
+        if (!child && sub == 0)
+            return {};
+        VecRef c = copy_node(n);
+        if (child)
+            c->children[sub] = std::move(child);
+        else
+            c->children.pop_back();
+        return c;
+    }
+    if (sub == 0)
+        return {};
+    VecRef c = copy_node(n);
+    c->children.pop_back();
+    return c;
+}
+
+} // namespace
+
+PVectorData::PVectorData() : root_(VecRef::adopt(new PVectorNode())), tail_(VecRef::adopt(new PVectorNode())) {}
+
+PVectorData::PVectorData(std::vector<Value> items) : count_(items.size()) {
+    size_t toff = tail_offset();
+    std::vector<VecRef> level;
+    level.reserve(toff / 32);
+    for (size_t off = 0; off < toff; off += 32) {
+        auto *leaf = new PVectorNode();
+        level.push_back(VecRef::adopt(leaf));
+        leaf->items.assign(std::make_move_iterator(items.begin() + static_cast<ptrdiff_t>(off)),
+                           std::make_move_iterator(items.begin() + static_cast<ptrdiff_t>(off + 32)));
+    }
+    auto *tail = new PVectorNode();
+    tail_ = VecRef::adopt(tail);
+    tail->items.assign(std::make_move_iterator(items.begin() + static_cast<ptrdiff_t>(toff)),
+                       std::make_move_iterator(items.end()));
+    // a root at shift s holds up to 2^s leaves (what push keeps too)
+    while (level.size() > 32) {
+        std::vector<VecRef> up;
+        for (size_t i = 0; i < level.size(); i += 32)
+            up.push_back(branch(std::vector<VecRef>(std::make_move_iterator(level.begin() + static_cast<ptrdiff_t>(i)),
+                                                    std::make_move_iterator(level.begin() + static_cast<ptrdiff_t>(std::min(i + 32, level.size()))))));
+        level = std::move(up);
+        shift_ += 5;
+    }
+    root_ = branch(std::move(level));
+}
+
+PVectorData::PVectorData(NodeRef<PVectorNode> root, NodeRef<PVectorNode> tail, size_t count, unsigned shift) noexcept
+    : root_(std::move(root)), tail_(std::move(tail)), count_(count), shift_(shift) {}
+
+auto PVectorData::leaf_for(size_t i) const noexcept -> const NodeRef<PVectorNode> & {
+    if (i >= tail_offset())
+        return tail_;
+    const VecRef *n = &root_;
+    for (unsigned level = shift_; level > 0; level -= 5)
+        n = &(*n)->children[(i >> level) & 31];
+    return *n;
+}
+
+auto PVectorData::set(size_t i, Value v) const -> PVectorData * {
+    if (i >= tail_offset()) {
+        VecRef tail = copy_node(tail_.get());
+        tail->items[i & 31] = std::move(v);
+        return new PVectorData(root_, std::move(tail), count_, shift_);
+    }
+    return new PVectorData(assoc_path(root_.get(), shift_, i, std::move(v)), tail_, count_, shift_);
+}
+
+auto PVectorData::push(Value v) const -> PVectorData * {
+    if (count_ - tail_offset() < 32) {
+        VecRef tail = copy_node(tail_.get());
+        tail->items.push_back(std::move(v));
+        return new PVectorData(root_, std::move(tail), count_ + 1, shift_);
+    }
+    // the full tail moves into the trie, growing a level when the root is full
+    VecRef root;
+    unsigned shift = shift_;
+    if ((count_ >> 5) > (size_t(1) << shift_)) {
+        root = branch({root_, new_path(shift_, tail_)});
+        shift += 5;
+    } else {
+        root = push_leaf(root_.get(), shift_, count_ - 1, tail_);
+    }
+    auto *tail = new PVectorNode();
+    VecRef tref = VecRef::adopt(tail);
+    tail->items.push_back(std::move(v));
+    return new PVectorData(std::move(root), std::move(tref), count_ + 1, shift);
+}
+
+auto PVectorData::pop() const -> PVectorData * {
+    if (count_ == 1)
+        return new PVectorData();
+    if (count_ - tail_offset() > 1) {
+        VecRef tail = copy_node(tail_.get());
+        tail->items.pop_back();
+        return new PVectorData(root_, std::move(tail), count_ - 1, shift_);
+    }
+    // the last leaf of the trie becomes the tail
+    VecRef tail = leaf_for(count_ - 2);
+    VecRef root = pop_leaf(root_.get(), shift_, count_ - 2);
+    unsigned shift = shift_;
+    if (!root)
+        root = branch({});
+    if (shift > 5 && root->children.size() == 1) {
+        VecRef only = root->children[0];
+        root = std::move(only);
+        shift -= 5;
+    }
+    return new PVectorData(std::move(root), std::move(tail), count_ - 1, shift);
+}
+
+// -------------------- builtins --------------------
+
+namespace {
+
+auto require_hash_map(const Value &v, const char *who) -> HashMapData * {
+    if (!v || v.get_type() != THASHMAP)
+        throw std::runtime_error(std::string(who) + " requires a hash-map");
+    return v.get_hash_map();
+}
+
+auto require_pvector(const Value &v, const char *who) -> PVectorData * {
+    if (!v || v.get_type() != TPVECTOR)
+        throw std::runtime_error(std::string(who) + " requires a pvector");
+    return v.get_pvector();
+}
+
+// `next` as a new value, or `cur` itself when the update changed nothing
+auto version(State &S, const Value &cur, HashMapData *next) -> Value { return next ? S.make_hash_map(next) : cur; }
+
+} // namespace
+
+void register_persistent(State &S) {
+    // (hash-map [k v ...]): a map with the given pairs (later ones win)
+    S.register_builtin("hash-map", [](State &S, const Value &args) -> Value {
+        Value m = S.make_hash_map(new HashMapData());
+        for (Value cur = args; cur; cur = pair_cdr(pair_cdr(cur))) {
+            if (!pair_cdr(cur))
+                throw std::runtime_error("hash-map requires an even number of arguments");
+            m = version(S, m, m.get_hash_map()->with(pair_car(cur), pair_car(pair_cdr(cur))));
+        }
+        return m;
+    });
+    // (hash-map-get m k [default]): value under k, else default (nil)
+    S.register_builtin("hash-map-get", [](State &, const Value &args) -> Value {
+        HashMapData *m = require_hash_map(pair_car(args), "hash-map-get");
+        Value rest = pair_cdr(args);
+        if (const Value *v = m->find(pair_car(rest)))
+            return *v;
+        return pair_car(pair_cdr(rest));
+    });
+    // (hash-map-set m k v): m with k bound to v; m itself is unchanged
+    S.register_builtin("hash-map-set", [](State &S, const Value &args) -> Value {
+        Value m = pair_car(args);
+        Value rest = pair_cdr(args);
+        return version(S, m, require_hash_map(m, "hash-map-set")->with(pair_car(rest), pair_car(pair_cdr(rest))));
+    });
+    // (hash-map-del m k): m without k
+    S.register_builtin("hash-map-del", [](State &S, const Value &args) -> Value {
+        Value m = pair_car(args);
+        return version(S, m, require_hash_map(m, "hash-map-del")->without(pair_car(pair_cdr(args))));
+    });
+    S.register_builtin("hash-map-has?", [](State &S, const Value &args) -> Value {
+        HashMapData *m = require_hash_map(pair_car(args), "hash-map-has?");
+        return m->find(pair_car(pair_cdr(args))) ? S.get_bound("#t", S.global) : Value();
+    });
+    S.register_builtin("hash-map-count", [](State &S, const Value &args) -> Value {
+        return S.make_number(static_cast<double>(require_hash_map(pair_car(args), "hash-map-count")->size()));
+    });
+    // (hash-map-keys m) / (hash-map-values m): lists in hash order
+    S.register_builtin("hash-map-keys", [](State &S, const Value &args) -> Value {
+        Value head;
+        Value *last = &head;
+        require_hash_map(pair_car(args), "hash-map-keys")->for_each([&](const Value &k, const Value &) {
+            *last = S.make_pair(k, Value());
+            last = &last->get_pair()->cdr;
+        });
+        return head;
+    });
+    S.register_builtin("hash-map-values", [](State &S, const Value &args) -> Value {
+        Value head;
+        Value *last = &head;
+        require_hash_map(pair_car(args), "hash-map-values")->for_each([&](const Value &, const Value &v) {
+            *last = S.make_pair(v, Value());
+            last = &last->get_pair()->cdr;
+        });
+        return head;
+    });
+    // (hash-map-for-each m f): call (f k v) for every pair; returns nil
+    S.register_builtin("hash-map-for-each", [](State &S, const Value &args) -> Value {
+        // hold the version: f may drop the last other reference to it
+        Value m = pair_car(args);
+        Value fn = pair_car(pair_cdr(args));
+        HashMapData *hm = require_hash_map(m, "hash-map-for-each");
+        if (!fn || (fn.get_type() != TFUNC && fn.get_type() != TCFUNC))
+            throw std::runtime_error("hash-map-for-each requires a function");
+        hm->for_each([&](const Value &k, const Value &v) { (void)S.call(fn, S.make_pair(k, S.make_pair(v, Value()))); });
+        return {};
+    });
+
+    // (pvector a b ...): a pvector of the arguments
+    S.register_builtin("pvector", [](State &S, const Value &args) -> Value {
+        std::vector<Value> items;
+        for (Value cur = args; cur; cur = pair_cdr(cur))
+            items.push_back(pair_car(cur));
+        return S.make_pvector(new PVectorData(std::move(items)));
+    });
+    S.register_builtin("pvector-ref", [](State &, const Value &args) -> Value {
+        PVectorData *v = require_pvector(pair_car(args), "pvector-ref");
+        return v->at(require_index(pair_car(pair_cdr(args)), v->size(), "pvector-ref"));
+    });
+    // (pvector-set v i x): v with element i replaced by x
+    S.register_builtin("pvector-set", [](State &S, const Value &args) -> Value {
+        PVectorData *v = require_pvector(pair_car(args), "pvector-set");
+        Value rest = pair_cdr(args);
+        size_t i = require_index(pair_car(rest), v->size(), "pvector-set");
+        return S.make_pvector(v->set(i, pair_car(pair_cdr(rest))));
+    });
+    // (pvector-push v x): v with x appended
+    S.register_builtin("pvector-push", [](State &S, const Value &args) -> Value {
+        return S.make_pvector(require_pvector(pair_car(args), "pvector-push")->push(pair_car(pair_cdr(args))));
+    });
+    // (pvector-pop v): v without its last element
+    S.register_builtin("pvector-pop", [](State &S, const Value &args) -> Value {
+        PVectorData *v = require_pvector(pair_car(args), "pvector-pop");
+        if (v->size() == 0)
+            throw std::runtime_error("pvector-pop: empty pvector");
+        return S.make_pvector(v->pop());
+    });
+    S.register_builtin("pvector-length", [](State &S, const Value &args) -> Value {
+        return S.make_number(static_cast<double>(require_pvector(pair_car(args), "pvector-length")->size()));
+    });
+    // (list->pvector seq): elements of a list, vector or generator
+    S.register_builtin("list->pvector", [](State &S, const Value &args) -> Value {
+        std::vector<Value> items;
+        for_each_item(pair_car(args), "list->pvector", [&items](const Value &v) { items.push_back(v); });
+        return S.make_pvector(new PVectorData(std::move(items)));
+    });
+    S.register_builtin("pvector->list", [](State &S, const Value &args) -> Value {
+        Value head;
+        Value *last = &head;
+        require_pvector(pair_car(args), "pvector->list")->for_each([&](const Value &v) {
+            *last = S.make_pair(v, Value());
+            last = &last->get_pair()->cdr;
+        });
+        return head;
+    });
+}
+
+} // namespace vdlisp
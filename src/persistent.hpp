@@ -0,0 +1,177 @@
+#ifndef VDLISP__PERSISTENT_HPP
+#define VDLISP__PERSISTENT_HPP
+
+#include "nanbox.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace vdlisp {
+
+class State;
+
+// Persistent (immutable) collections: an update returns a new version that
+// shares every untouched trie node with the old one. Nodes are refcounted
+// like Values, so a node lives as long as some version reaches it.
+
+// Owning pointer to a trie node.
+template <class T>
+class NodeRef {
+  public:
+    NodeRef() noexcept = default;
+    // takes over the initial reference of a freshly allocated node
+    [[nodiscard]] static auto adopt(T *p) noexcept -> NodeRef {
+        NodeRef r;
+        r.p_ = p;
+        return r;
+    }
+    NodeRef(const NodeRef &o) noexcept : p_(o.p_) {
+        if (p_)
+            p_->inc_ref();
+    }
+    NodeRef(NodeRef &&o) noexcept : p_(std::exchange(o.p_, nullptr)) {}
+    ~NodeRef() { reset(); }
+    auto operator=(NodeRef o) noexcept -> NodeRef & {
+        std::swap(p_, o.p_);
+        return *this;
+    }
+    void reset() noexcept {
+        if (p_)
+            std::exchange(p_, nullptr)->release(destroy);
+    }
+    [[nodiscard]] auto get() const noexcept -> T * { return p_; }
+    [[nodiscard]] auto operator->() const noexcept -> T * { return p_; }
+    [[nodiscard]] explicit operator bool() const noexcept { return p_ != nullptr; }
+
+  private:
+    static void destroy(RcBase *p) noexcept { delete static_cast<T *>(p); }
+    T *p_ = nullptr;
+};
+
+// -------------------- hash-map (HAMT) --------------------
+
+struct HashMapEntry {
+    uint64_t hash; // value_hash(key)
+    Value key;
+    Value value;
+};
+
+// Node of a hash array mapped trie in the CHAMP layout: each level consumes 5
+// bits of the hash, and the two bitmaps say which of the 32 slots hold an
+// entry inline and which a child node. Both are stored densely in slot order,
+// so a lookup is a popcount and an index. Below the last level (all 64 hash
+// bits used) a node is a collision list: bitmaps 0, entries unordered.
+class HashMapNode : public RcBase {
+  public:
+    uint32_t datamap = 0;
+    uint32_t nodemap = 0;
+    std::vector<HashMapEntry> entries;
+    std::vector<NodeRef<HashMapNode>> children;
+};
+
+// HashMapData: immutable map keyed by Value (THASHMAP), printed as
+// `#hash-map((k . v) ...)`. Keys compare like table keys (value_hash /
+// table_key_equal); iteration follows hash order.
+class HashMapData : public RcBase {
+  public:
+    HashMapData() = default;
+    HashMapData(NodeRef<HashMapNode> root, size_t count) noexcept : root_(std::move(root)), count_(count) {}
+
+    [[nodiscard]] auto find(const Value &key) const noexcept -> const Value *;
+    // New version with `key` bound to `value`; nullptr when this one already
+    // binds it to the identical value.
+    [[nodiscard]] auto with(const Value &key, Value value) const -> HashMapData *;
+    // New version without `key`; nullptr when it is absent.
+    [[nodiscard]] auto without(const Value &key) const -> HashMapData *;
+    [[nodiscard]] auto size() const noexcept -> size_t { return count_; }
+
+    template <class Fn>
+    void for_each(Fn &&fn) const {
+        if (root_)
+            walk(root_.get(), fn);
+    }
+
+    // Drop the contents (shutdown purge of an immortal shell only: versions
+    // are otherwise never modified).
+    void clear() noexcept {
+        NodeRef<HashMapNode> old = std::move(root_);
+        count_ = 0;
+    }
+
+  private:
+    template <class Fn>
+    static void walk(const HashMapNode *n, Fn &fn) {
+        for (const HashMapEntry &e : n->entries)
+            fn(e.key, e.value);
+        for (const auto &c : n->children)
+            walk(c.get(), fn);
+    }
+
+    NodeRef<HashMapNode> root_;
+    size_t count_ = 0;
+};
+
+// -------------------- pvector --------------------
+
+// Node of a persistent vector trie: a leaf holds up to 32 elements in
+// `items`, a branch up to 32 `children`.
+class PVectorNode : public RcBase {
+  public:
+    std::vector<Value> items;
+    std::vector<NodeRef<PVectorNode>> children;
+};
+
+// PVectorData: immutable vector (TPVECTOR), printed as `#pvector(a b c)`. A
+// radix-balanced 32-way trie of leaves plus a separate tail leaf, as in
+// Clojure: indexing walks log32(n) branches, set copies one path and push
+// usually copies only the tail.
+class PVectorData : public RcBase {
+  public:
+    PVectorData();
+    // all of `items`, built bottom-up without intermediate versions
+    explicit PVectorData(std::vector<Value> items);
+
+    [[nodiscard]] auto size() const noexcept -> size_t { return count_; }
+    [[nodiscard]] auto at(size_t i) const noexcept -> const Value & { return leaf_for(i)->items[i & 31]; }
+    [[nodiscard]] auto set(size_t i, Value v) const -> PVectorData *;
+    [[nodiscard]] auto push(Value v) const -> PVectorData *;
+    // requires a non-empty vector
+    [[nodiscard]] auto pop() const -> PVectorData *;
+
+    template <class Fn>
+    void for_each(Fn &&fn) const {
+        for (size_t i = 0; i < count_; i += 32) {
+            for (const Value &v : leaf_for(i)->items)
+                fn(v);
+        }
+    }
+
+    // see HashMapData::clear
+    void clear() noexcept {
+        NodeRef<PVectorNode> root = std::move(root_);
+        NodeRef<PVectorNode> tail = std::move(tail_);
+        count_ = 0;
+        shift_ = 5;
+    }
+
+  private:
+    [[nodiscard]] auto tail_offset() const noexcept -> size_t { return count_ < 32 ? 0 : ((count_ - 1) >> 5) << 5; }
+    [[nodiscard]] auto leaf_for(size_t i) const noexcept -> const NodeRef<PVectorNode> &;
+    PVectorData(NodeRef<PVectorNode> root, NodeRef<PVectorNode> tail, size_t count, unsigned shift) noexcept;
+
+    NodeRef<PVectorNode> root_; // branch at level shift_ (empty while count_ <= 32)
+    NodeRef<PVectorNode> tail_; // last 1..32 elements (empty when count_ == 0)
+    size_t count_ = 0;
+    unsigned shift_ = 5;
+};
+
+// hash-map / hash-map-get / hash-map-set / hash-map-del / hash-map-has? /
+// hash-map-count / hash-map-keys / hash-map-values / hash-map-for-each /
+// pvector / pvector-ref / pvector-set / pvector-push / pvector-pop /
+// pvector-length / list->pvector / pvector->list
+void register_persistent(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__PERSISTENT_HPP
@@ -0,0 +1,170 @@
+#include "record.hpp"
+#include "helpers.hpp"
+#include <deque>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace vdlisp {
+
+// -------------------- shapes --------------------
+
+namespace {
+
+std::mutex shape_mutex;
+// by id; a deque so shapes never move
+std::deque<RecordShape> *shapes = new std::deque<RecordShape>();
+// name and fields, NUL-separated -> shape
+std::unordered_map<std::string, const RecordShape *> *shape_index = new std::unordered_map<std::string, const RecordShape *>();
+
+} // namespace
+
+auto intern_record_shape(const std::string &name, const std::vector<std::string> &fields) -> const RecordShape * {
+    std::string key = name;
+    for (const std::string &f : fields) {
+        key += '\0';
+        key += f;
+    }
+    std::lock_guard<std::mutex> lock(shape_mutex);
+    auto it = shape_index->find(key);
+    if (it != shape_index->end())
+        return it->second;
+    shapes->push_back(RecordShape{static_cast<uint32_t>(shapes->size()), name, fields});
+    const RecordShape *shape = &shapes->back();
+    shape_index->emplace(std::move(key), shape);
+    return shape;
+}
+
+auto record_shape(uint32_t id) noexcept -> const RecordShape * {
+    std::lock_guard<std::mutex> lock(shape_mutex);
+    return id < shapes->size() ? &(*shapes)[id] : nullptr;
+}
+
+// -------------------- RecordData --------------------
+
+auto RecordData::make(const RecordShape *shape) -> RecordData * {
+    size_t n = shape->fields.size();
+    void *mem = ::operator new(sizeof(RecordData) + n * sizeof(Value));
+    auto *r = new (mem) RecordData(shape);
+    Value *slots = r->slots();
+    for (size_t i = 0; i < n; ++i)
+        new (slots + i) Value();
+    return r;
+}
+
+void RecordData::destroy(RecordData *r) noexcept {
+    Value *slots = r->slots();
+    for (size_t i = r->size(); i-- > 0;)
+        slots[i].~Value();
+    r->~RecordData();
+    ::operator delete(r);
+}
+
+// -------------------- defrecord --------------------
+
+namespace {
+
+auto require_count(const Value &id, const char *who) -> uint32_t {
+    return static_cast<uint32_t>(require_number(id, who));
+}
+
+// The builtins the functions made by defrecord call, with the shape id (and
+// slot) as constant arguments and the caller's argument list last:
+// (record-new id args), (record-ref id slot args), (record-is id args)
+Value record_new(State &S, const Value &args) {
+    const RecordShape *shape = record_shape(require_count(pair_car(args), "defrecord"));
+    Value fields = pair_car(pair_cdr(args));
+    RecordData *r = RecordData::make(shape);
+    Value v = S.make_record(r);
+    size_t n = 0;
+    for (Value cur = fields; cur; cur = pair_cdr(cur), ++n) {
+        if (n < shape->fields.size())
+            r->slots()[n] = pair_car(cur);
+    }
+    if (n != shape->fields.size())
+        throw std::runtime_error(shape->name + ": expected " + std::to_string(shape->fields.size()) + " fields, got " +
+                                 std::to_string(n));
+    return v;
+}
+
+Value record_ref(State &, const Value &args) {
+    uint32_t id = require_count(pair_car(args), "defrecord");
+    uint32_t slot = require_count(pair_car(pair_cdr(args)), "defrecord");
+    Value rest = pair_car(pair_cdr(pair_cdr(args)));
+    Value r = pair_car(rest);
+    if (!r || r.get_type() != TRECORD || r.get_record()->shape()->id != id || pair_cdr(rest)) {
+        const RecordShape *shape = record_shape(id);
+        throw std::runtime_error(shape->name + "-" + shape->fields[slot] + " requires a " + shape->name);
+    }
+    return r.get_record()->slots()[slot];
+}
+
+Value record_is(State &S, const Value &args) {
+    uint32_t id = require_count(pair_car(args), "defrecord");
+    Value v = pair_car(pair_car(pair_cdr(args)));
+    return v && v.get_type() == TRECORD && v.get_record()->shape()->id == id ? S.get_bound("#t", S.global) : Value();
+}
+
+// (fn args (op consts... args)): a function passing all its arguments to the
+// builtin `op`. The operator is the builtin itself, not a name, so rebinding
+// names cannot break it, and the function closes over nothing. Never
+// JIT-compiled on its own (its arguments are records); compiled callers load
+// record fields directly instead (see record_accessor).
+Value make_shape_fn(State &S, CFunc op, std::vector<Value> consts) {
+    Value args = S.make_symbol("args");
+    Value call = S.make_pair(args, Value());
+    for (size_t i = consts.size(); i-- > 0;)
+        call = S.make_pair(std::move(consts[i]), std::move(call));
+    call = S.make_pair(S.make_cfunc(op), std::move(call));
+    Value fn = S.make_function(std::move(args), S.make_pair(std::move(call), Value()), nullptr);
+    fn.get_func()->jit_failed = true;
+    return fn;
+}
+
+} // namespace
+
+auto record_accessor(const Value &fn, uint32_t &shape_id, uint32_t &slot) noexcept -> bool {
+    if (!fn || fn.get_type() != TFUNC)
+        return false;
+    // body: ((record_ref id slot args))
+    const Value &body = fn.get_func()->body;
+    if (!is_pair(body) || pair_cdr(body))
+        return false;
+    Value call = pair_car(body);
+    if (!is_pair(call) || pair_car(call).get_type() != TCFUNC || pair_car(call).get_cfunc() != record_ref)
+        return false;
+    Value id = pair_car(pair_cdr(call));
+    Value n = pair_car(pair_cdr(pair_cdr(call)));
+    shape_id = static_cast<uint32_t>(id.get_number());
+    slot = static_cast<uint32_t>(n.get_number());
+    return true;
+}
+
+void register_records(State &S) {
+    // (defrecord name field ...)
+    S.register_prim("defrecord", [](State &S, const Value &args, Env *env) -> Value {
+        Value name = pair_car(args);
+        if (!name || name.get_type() != TSYMBOL)
+            throw std::runtime_error("defrecord requires a record name");
+        std::vector<std::string> fields;
+        for (Value cur = pair_cdr(args); cur; cur = pair_cdr(cur)) {
+            Value f = pair_car(cur);
+            if (!f || f.get_type() != TSYMBOL)
+                throw std::runtime_error("defrecord: field names must be symbols");
+            fields.push_back(*f.get_symbol());
+        }
+        const RecordShape *shape = intern_record_shape(*name.get_symbol(), fields);
+        Value id = S.make_number(shape->id);
+        (void)S.set(name, make_shape_fn(S, record_new, {id}), env);
+        for (size_t i = 0; i < fields.size(); ++i)
+            (void)S.set(S.make_symbol(shape->name + "-" + fields[i]),
+                  make_shape_fn(S, record_ref, {id, S.make_number(static_cast<double>(i))}), env);
+        (void)S.set(S.make_symbol(shape->name + "?"), make_shape_fn(S, record_is, {id}), env);
+        return name;
+    });
+}
+
+} // namespace vdlisp
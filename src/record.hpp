@@ -0,0 +1,62 @@
+#ifndef VDLISP__RECORD_HPP
+#define VDLISP__RECORD_HPP
+
+#include "nanbox.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace vdlisp {
+
+class State;
+
+// RecordShape: the layout of a record type made by defrecord. Shapes are
+// interned process-wide by name and field names, so isolates running the same
+// defrecord agree on the id (records keep their shape across spawn / send),
+// and are never freed. Redefining a name with other fields makes a new shape.
+struct RecordShape {
+    uint32_t id;
+    std::string name;
+    std::vector<std::string> fields;
+};
+
+// The shape `name` with `fields`, made on first use.
+[[nodiscard]] auto intern_record_shape(const std::string &name, const std::vector<std::string> &fields)
+    -> const RecordShape *;
+// The shape numbered `id`; nullptr when there is none.
+[[nodiscard]] auto record_shape(uint32_t id) noexcept -> const RecordShape *;
+
+// RecordData: instance of a record type (TRECORD), printed as `#point(1 2)`.
+// The slots follow the header in the same allocation, one per field, so a
+// field access is a load at a fixed offset. Records are immutable once made.
+class RecordData : public RcBase {
+  public:
+    // a record of `shape` with nil slots
+    [[nodiscard]] static auto make(const RecordShape *shape) -> RecordData *;
+    static void destroy(RecordData *r) noexcept;
+
+    [[nodiscard]] auto shape() const noexcept -> const RecordShape * { return shape_; }
+    [[nodiscard]] auto size() const noexcept -> size_t { return shape_->fields.size(); }
+    [[nodiscard]] auto slots() noexcept -> Value * { return reinterpret_cast<Value *>(this + 1); }
+    [[nodiscard]] auto slots() const noexcept -> const Value * { return reinterpret_cast<const Value *>(this + 1); }
+
+  private:
+    explicit RecordData(const RecordShape *shape) noexcept : shape_(shape) {}
+    ~RecordData() = default;
+
+    const RecordShape *shape_;
+};
+static_assert(sizeof(RecordData) % alignof(Value) == 0);
+
+// When `fn` is an accessor made by defrecord, its shape id and slot index.
+[[nodiscard]] auto record_accessor(const Value &fn, uint32_t &shape_id, uint32_t &slot) noexcept -> bool;
+
+// defrecord (special form): (defrecord point x y) binds the constructor
+// (point x y), the accessors (point-x p) / (point-y p) and the predicate
+// (point? v) in the current environment
+void register_records(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__RECORD_HPP
@@ -64,10 +64,29 @@ inline __attribute__((always_inline)) void register_require(State &S) {
             std::ostringstream ss;
             ss << f.rdbuf();
             Value e = S.parse_all(ss.str(), key);
+            // a frozen runtime also freezes what the module defines or rebinds
+            bool track = S.runtime_frozen || S.module_journal;
+            std::unordered_map<std::string, uint64_t> before;
+            if (track)
+                for (auto &kv : S.global->map)
+                    before.emplace(kv.first, kv.second.identity_key());
             Value r;
             if (e)
                 r = S.do_list(e, S.global);
             S.loaded_modules[key] = r;
+            if (S.runtime_frozen)
+                make_immortal(r, &S.immortals);
+            if (track) {
+                for (auto &kv : S.global->map) {
+                    auto it = before.find(kv.first);
+                    if (it != before.end() && it->second == kv.second.identity_key())
+                        continue;
+                    if (S.runtime_frozen)
+                        make_immortal(kv.second, &S.immortals);
+                    if (S.module_journal)
+                        S.module_journal->emplace_back(kv.first, kv.second);
+                }
+            }
             return r;
         }
 
@@ -0,0 +1,276 @@
+#include "server.hpp"
+#include "helpers.hpp"
+#include "transfer.hpp"
+#include "vdlisp.hpp"
+#include "wire.hpp"
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <poll.h>
+#include <pthread.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+namespace vdlisp {
+
+using namespace wire;
+
+namespace {
+
+class Server {
+  public:
+    Server(int listen_fd, int stop_fd, int idle_ms) : listen_fd(listen_fd), stop_fd(stop_fd), idle_ms(idle_ms) {}
+
+    // Thread body: own one State and serve connections until stopped.
+    void run() {
+        State S;
+        S.bind_global("argv", Value());
+        load_lang_basics(S);
+        // `exit` must not take the whole server down
+        trap_exit(S);
+        S.freeze_runtime();
+        // the globals every request starts from
+        GlobalsSnapshot clean(S);
+        for (;;) {
+            int fd = accept_next();
+            if (fd < 0)
+                break;
+            // the server runs requests as its own user: nobody else may send any
+            if (!peer_is_owner(fd)) {
+                (void)write_frame(fd, refusal());
+                ::close(fd);
+                continue;
+            }
+            // a client that goes quiet gives the State back to the others
+            std::string req;
+            while (read_frame(fd, req, stop_fd, idle_ms))
+                if (!write_frame(fd, handle(S, clean, req)))
+                    break;
+            ::close(fd);
+        }
+    }
+
+  private:
+    // Next connection, or -1 once the server stops.
+    auto accept_next() -> int {
+        for (;;) {
+            pollfd fds[2] = {{listen_fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+            if (::poll(fds, 2, -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            if (fds[1].revents)
+                return -1;
+            // another thread may have taken it: the socket is non-blocking
+            int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0)
+                return fd;
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+                return -1;
+        }
+    }
+
+    // Whether the client on `fd` runs as the user the server runs as.
+    static auto peer_is_owner(int fd) -> bool {
+        ucred cred{};
+        socklen_t len = sizeof cred;
+        return ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == ::geteuid();
+    }
+
+    static auto response(int status, const std::string &out, const std::string &err) -> std::string {
+        std::string body(1, static_cast<char>(status));
+        put_u32(body, static_cast<uint32_t>(out.size()));
+        body += out;
+        body += err;
+        return body;
+    }
+
+    // The reply to a peer running as another user.
+    static auto refusal() -> std::string {
+        return response(2, "", "error: only the user running the server can send it requests\n");
+    }
+
+    // Evaluate one request in `S`; returns the response body.
+    auto handle(State &S, GlobalsSnapshot &clean, const std::string &req) -> std::string {
+        std::ostringstream out;
+        std::ostringstream err;
+        int status = 0;
+        if (req.empty()) {
+            err << "error: empty request\n";
+            status = 2;
+        } else if (req[0] == 'q') {
+            ::kill(::getpid(), SIGTERM);
+        } else {
+            status = evaluate(S, clean, req, out, err);
+        }
+        return response(status, out.str(), err.str());
+    }
+
+    auto evaluate(State &S, GlobalsSnapshot &clean, const std::string &req, std::ostringstream &out,
+                  std::ostringstream &err) -> int {
+        std::string name = "(eval)";
+        std::string src;
+        std::vector<std::string> argv;
+        if (req[0] == 'f') {
+            size_t pos = 1;
+            while (pos <= req.size()) {
+                size_t end = req.find('\0', pos);
+                if (end == std::string::npos)
+                    end = req.size();
+                argv.push_back(req.substr(pos, end - pos));
+                pos = end + 1;
+            }
+            name = argv[0];
+            std::ifstream f(name);
+            if (!f) {
+                err << "could not open file: " << name << "\n";
+                return 1;
+            }
+            std::ostringstream ss;
+            ss << f.rdbuf();
+            src = ss.str();
+        } else if (req[0] == 'e') {
+            src = req.substr(1);
+        } else {
+            err << "error: unknown request\n";
+            return 2;
+        }
+
+        size_t modules = S.loaded_modules.size();
+        std::vector<uint64_t> journal;
+        S.source_journal = &journal;
+        std::vector<std::pair<std::string, Value>> module_globals;
+        S.module_journal = &module_globals;
+        S.out = &out;
+        Env *env = S.make_env(S.global);
+        EnvGuard eg(env);
+        env->map["argv"] = S.make_string_list(argv.begin(), argv.end());
+        int status = 0;
+        try {
+            Value e = S.parse_all(src, name);
+            if (e) {
+                Value r = S.do_list(e, env);
+                S.write_out(S.to_string(r) + "\n");
+            }
+        } catch (const ScriptExit &ex) {
+            status = ex.code;
+        } catch (const std::exception &ex) {
+            report_exception(S, ex, err);
+            status = 1;
+        } catch (...) {
+            err << "error: request failed\n";
+            status = 1;
+        }
+        S.flush_out();
+        S.out = &std::cout;
+        S.current_expr = Value();
+        // break closure <-> environment cycles of the request's definitions
+        env->map.clear();
+        // undo what the request did to the globals, keeping what the modules
+        // it loaded defined
+        S.module_journal = nullptr;
+        clean.adopt(S, module_globals);
+        clean.restore(S);
+        S.source_journal = nullptr;
+        // code of modules loaded by this request stays in use: keep its locations
+        if (S.loaded_modules.size() == modules) {
+            S.forget_sources(journal);
+            S.sources.erase(name);
+        }
+        rc_safepoint();
+        return status;
+    }
+
+    int listen_fd;
+    int stop_fd;
+    int idle_ms;
+};
+
+auto server_threads() -> size_t {
+    if (const char *env = std::getenv("VDLISP__SERVE_STATES")) {
+        long n = std::strtol(env, nullptr, 10);
+        if (n > 0)
+            return static_cast<size_t>(n);
+    }
+    unsigned hw = std::thread::hardware_concurrency();
+    return hw ? hw : 1;
+}
+
+// How long a connection may wait between requests before it is closed.
+auto idle_timeout_ms() -> int {
+    if (const char *env = std::getenv("VDLISP__SERVE_IDLE_MS")) {
+        long n = std::strtol(env, nullptr, 10);
+        if (n > 0 && n <= INT32_MAX)
+            return static_cast<int>(n);
+    }
+    return 30000;
+}
+
+} // namespace
+
+auto serve_main(const std::string &path) -> int {
+    sockaddr_un addr{};
+    if (!unix_address(path, addr)) {
+        std::cerr << "vdlisp: invalid socket path: " << path << "\n";
+        return 1;
+    }
+    struct stat st{};
+    if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        ::unlink(path.c_str());
+    int listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    // the socket is only for the server's user (connecting needs write
+    // permission on it); requests from others are refused as well
+    if (listen_fd < 0 || ::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) < 0 ||
+        ::chmod(path.c_str(), 0600) < 0 || ::listen(listen_fd, 128) < 0) {
+        std::cerr << "vdlisp: cannot listen on " << path << ": " << std::strerror(errno) << "\n";
+        if (listen_fd >= 0)
+            ::close(listen_fd);
+        return 1;
+    }
+    int stop[2];
+    if (::pipe2(stop, O_CLOEXEC) < 0) {
+        std::cerr << "vdlisp: pipe: " << std::strerror(errno) << "\n";
+        ::close(listen_fd);
+        return 1;
+    }
+
+    // Signals are taken by sigwait below; the serving threads inherit the mask.
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &sigs, nullptr);
+
+    Server server(listen_fd, stop[0], idle_timeout_ms());
+    std::vector<std::thread> threads;
+    size_t n = server_threads();
+    for (size_t i = 0; i < n; ++i)
+        threads.emplace_back([&server] { server.run(); });
+
+    int sig = 0;
+    while (sigwait(&sigs, &sig) != 0) {
+    }
+    // the stop pipe stays readable from now on, which wakes every thread
+    char c = 0;
+    (void)!::write(stop[1], &c, 1);
+    for (auto &t : threads)
+        t.join();
+    ::close(listen_fd);
+    ::close(stop[0]);
+    ::close(stop[1]);
+    ::unlink(path.c_str());
+    return 0;
+}
+
+} // namespace vdlisp
@@ -0,0 +1,43 @@
+#ifndef VDLISP__SERVER_HPP
+#define VDLISP__SERVER_HPP
+
+#include <string>
+#include <vector>
+
+namespace vdlisp {
+
+// Resident evaluation server (`vdlisp --serve SOCK`) and its thin client
+// (`vdlisp --client SOCK ...`).
+//
+// The server keeps a pool of initialized States (builtins, lang_basics,
+// shared JIT), one per thread, whose module cache and compiled code persist
+// across requests. Each thread accepts connections on the Unix socket and
+// answers requests on them in order.
+//
+// Wire format: every message is a frame `u32 length (little endian) | body`.
+// Request bodies start with a kind byte:
+//   'e' source           evaluate source text
+//   'f' path\0arg\0...   run a file with `argv` bound to (path args...)
+//   'q'                  stop the server
+// Response body: `u8 exit status | u32 stdout length | stdout | stderr`.
+// stdout carries what the request printed followed by the printed result.
+//
+// Requests evaluate in a fresh environment whose parent is the global one.
+// Afterwards the globals of the State are put back as they were before it,
+// so neither new definitions nor a `set` of an existing global (even of a
+// builtin) reach later requests; only modules loaded with `require` stay,
+// cached, together with the globals they define.
+//
+// Requests run as the server's user, so only that user may send them: the
+// socket is created with mode 0600 and a peer with another uid
+// (SO_PEERCRED) gets an error reply and is disconnected. A connection that
+// sends nothing for VDLISP__SERVE_IDLE_MS milliseconds (30000 by default)
+// is closed, freeing its State for other clients.
+auto serve_main(const std::string &path) -> int;
+
+// Send one request (`-e expr`, `--stop` or `file args...`) and relay the reply.
+auto client_main(const std::string &path, const std::vector<std::string> &args) -> int;
+
+} // namespace vdlisp
+
+#endif // VDLISP__SERVER_HPP
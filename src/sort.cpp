@@ -0,0 +1,147 @@
+#include "sort.hpp"
+#include "fncall.hpp"
+#include "helpers.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace vdlisp {
+
+namespace {
+
+// below this, std::sort beats the radix passes
+constexpr size_t kRadixMin = 64;
+
+// `d` as an unsigned key with the same order: flip every bit of a negative,
+// only the sign bit of a positive. -0 sorts before +0.
+auto radix_key(double d) noexcept -> uint64_t {
+    uint64_t bits;
+    std::memcpy(&bits, &d, sizeof bits);
+    return bits & 0x8000000000000000ull ? ~bits : bits | 0x8000000000000000ull;
+}
+
+// Sort numbers ascending: LSD radix over the 8 key bytes, skipping a byte
+// that is the same in every key (the high bytes of small integers, say).
+void sort_numbers(std::vector<double> &nums) {
+    size_t n = nums.size();
+    if (n < kRadixMin) {
+        std::sort(nums.begin(), nums.end(), [](double a, double b) { return radix_key(a) < radix_key(b); });
+        return;
+    }
+    std::vector<uint64_t> keys(n), tmp(n);
+    size_t counts[8][256] = {};
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = radix_key(nums[i]);
+        for (int b = 0; b < 8; ++b)
+            ++counts[b][(keys[i] >> (b * 8)) & 0xff];
+    }
+    for (int b = 0; b < 8; ++b) {
+        size_t *count = counts[b];
+        if (count[(keys[0] >> (b * 8)) & 0xff] == n)
+            continue;
+        size_t pos = 0;
+        for (size_t d = 0; d < 256; ++d)
+            pos += std::exchange(count[d], pos);
+        for (uint64_t k : keys)
+            tmp[count[(k >> (b * 8)) & 0xff]++] = k;
+        keys.swap(tmp);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t k = keys[i];
+        uint64_t bits = k & 0x8000000000000000ull ? k & ~0x8000000000000000ull : ~k;
+        std::memcpy(&nums[i], &bits, sizeof bits);
+    }
+}
+
+// `items` as numbers, when they all are
+auto all_numbers(const std::vector<Value> &items, std::vector<double> &nums) -> bool {
+    nums.reserve(items.size());
+    for (const Value &v : items) {
+        if (v.get_type() != TNUMBER)
+            return false;
+        nums.push_back(v.get_number());
+    }
+    return true;
+}
+
+auto all_strings(const std::vector<Value> &items) -> bool {
+    return std::all_of(items.begin(), items.end(), [](const Value &v) { return v && v.get_type() == TSTRING; });
+}
+
+// Reorder `items` by byte order of their strings. Sorting views keeps the
+// comparisons off the Values; equal strings keep their order.
+void sort_strings(std::vector<Value> &items) {
+    std::vector<std::pair<std::string_view, size_t>> keys;
+    keys.reserve(items.size());
+    for (size_t i = 0; i < items.size(); ++i)
+        keys.emplace_back(items[i].get_string_view(), i);
+    std::sort(keys.begin(), keys.end());
+    std::vector<Value> sorted;
+    sorted.reserve(items.size());
+    for (const auto &k : keys)
+        sorted.push_back(std::move(items[k.second]));
+    items.swap(sorted);
+}
+
+// The elements of a list or vector.
+auto collect(const Value &seq) -> std::vector<Value> {
+    std::vector<Value> items;
+    if (seq && seq.get_type() == TVECTOR)
+        return seq.get_vector()->items;
+    if (seq && seq.get_type() != TPAIR)
+        throw std::runtime_error("sort requires a list or vector");
+    for (Value cur = seq; cur; cur = pair_cdr(cur))
+        items.push_back(pair_car(cur));
+    return items;
+}
+
+} // namespace
+
+void register_sort(State &S) {
+    S.register_builtin("sort", [](State &S, const Value &args) -> Value {
+        Value seq = pair_car(args);
+        Value less = pair_car(pair_cdr(args));
+        std::vector<Value> items = collect(seq);
+        std::vector<double> nums;
+        // the builtin < or > on numbers sorts like no comparator
+        bool descending = false;
+        bool numeric = !less;
+        if (less && less.get_type() == TCFUNC) {
+            CFunc f = less.get_cfunc();
+            Value lt = S.get_bound("<", S.global);
+            Value gt = S.get_bound(">", S.global);
+            descending = gt && gt.get_type() == TCFUNC && f == gt.get_cfunc();
+            numeric = descending || (lt && lt.get_type() == TCFUNC && f == lt.get_cfunc());
+        }
+        if (numeric && all_numbers(items, nums)) {
+            sort_numbers(nums);
+            if (descending)
+                std::reverse(nums.begin(), nums.end());
+            for (size_t i = 0; i < nums.size(); ++i)
+                items[i] = S.make_number(nums[i]);
+        } else if (!less) {
+            if (!all_strings(items))
+                throw std::runtime_error("sort: without a comparator, elements must be all numbers or all strings");
+            sort_strings(items);
+        } else {
+            size_t n = items.size();
+            FnCaller call(S, less, "sort", n * static_cast<size_t>(std::log2(n + 1)));
+            // stable_sort stays in bounds even when `less` is not a strict order
+            std::stable_sort(items.begin(), items.end(),
+                             [&call](const Value &a, const Value &b) { return call.test(a, b); });
+        }
+        if (seq && seq.get_type() == TVECTOR)
+            return S.make_vector(std::move(items));
+        Value head;
+        for (size_t i = items.size(); i-- > 0;)
+            head = S.make_pair(std::move(items[i]), std::move(head));
+        return head;
+    });
+}
+
+} // namespace vdlisp
@@ -0,0 +1,17 @@
+#ifndef VDLISP__SORT_HPP
+#define VDLISP__SORT_HPP
+
+namespace vdlisp {
+
+class State;
+
+// (sort seq [less]): the elements of a list or vector in ascending order, as a
+// new sequence of the same kind. Without `less` the elements must be all
+// numbers (radix sort on their bits) or all strings (byte order); with it, a
+// stable merge sort calling (less a b). The builtins < and > on numbers take
+// the radix path too.
+void register_sort(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__SORT_HPP
@@ -0,0 +1,317 @@
+#include "strings.hpp"
+#include "coroutine.hpp"
+#include "helpers.hpp"
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#define VDLISP__STRINGS_X86 1
+#include <immintrin.h>
+#endif
+
+namespace vdlisp {
+
+namespace {
+
+// Searches of needles of two or more bytes over [from, n - m]; both return
+// the position or npos.
+
+auto find_scalar(const char *hay, size_t n, const char *needle, size_t m, size_t from) noexcept -> size_t {
+    const char *p = hay + from;
+    const char *last = hay + (n - m);
+    while (p <= last) {
+        p = static_cast<const char *>(std::memchr(p, needle[0], static_cast<size_t>(last - p) + 1));
+        if (!p)
+            return std::string_view::npos;
+        if (std::memcmp(p + 1, needle + 1, m - 1) == 0)
+            return static_cast<size_t>(p - hay);
+        ++p;
+    }
+    return std::string_view::npos;
+}
+
+#if VDLISP__STRINGS_X86
+// 32 candidate positions per step: a position survives when both the first
+// and the last needle byte match there, and only survivors are compared in
+// full. Rare byte pairs make most steps a pair of compares and a test.
+__attribute__((target("avx2"))) auto find_avx2(const char *hay, size_t n, const char *needle, size_t m,
+                                              size_t from) noexcept -> size_t {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = from;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(hay + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(hay + i + m - 1));
+        auto mask = static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last))));
+        while (mask) {
+            size_t k = i + static_cast<size_t>(__builtin_ctz(mask));
+            if (std::memcmp(hay + k + 1, needle + 1, m - 2) == 0)
+                return k;
+            mask &= mask - 1;
+        }
+    }
+    return i + m <= n ? find_scalar(hay, n, needle, m, i) : std::string_view::npos;
+}
+#endif
+
+using FindFn = size_t (*)(const char *, size_t, const char *, size_t, size_t) noexcept;
+
+auto pick_find() noexcept -> FindFn {
+#if VDLISP__STRINGS_X86
+    const char *env = std::getenv("VDLISP__SIMD");
+    __builtin_cpu_init();
+    if (!(env && std::strcmp(env, "scalar") == 0) && __builtin_cpu_supports("avx2"))
+        return find_avx2;
+#endif
+    return find_scalar;
+}
+
+} // namespace
+
+auto find_substring(std::string_view hay, std::string_view needle, size_t from) noexcept -> size_t {
+    size_t n = hay.size(), m = needle.size();
+    if (from > n || m > n - from)
+        return std::string_view::npos;
+    if (m == 0)
+        return from;
+    if (m == 1) {
+        const void *p = std::memchr(hay.data() + from, needle[0], n - from);
+        return p ? static_cast<size_t>(static_cast<const char *>(p) - hay.data()) : std::string_view::npos;
+    }
+    static const FindFn find = pick_find();
+    return find(hay.data(), n, needle.data(), m, from);
+}
+
+auto number_to_string(double x) -> std::string {
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof buf, x);
+    return std::string(buf, res.ptr);
+}
+
+// -------------------- builtins --------------------
+
+namespace {
+
+// the bytes of a string, read in place (a slice stays a slice)
+auto require_str(const Value &v, const char *who) -> std::string_view {
+    if (!v || v.get_type() != TSTRING)
+        throw std::runtime_error(std::string(who) + ": expected string, got " + type_name(v));
+    return v.get_string_view();
+}
+
+// `v` as a position in [0, size]
+auto require_pos(const Value &v, size_t size, const char *who) -> size_t { return require_index(v, size, who, true); }
+
+// Text appended for `v` by string-builder-append!
+void append_text(std::string &out, const Value &v, const char *who) {
+    if (v && v.get_type() == TNUMBER)
+        out += number_to_string(v.get_number());
+    else
+        out += require_str(v, who);
+}
+
+// A mutable string growing in place (amortized O(1) appends); stays in the
+// State that made it.
+class StringBuilder : public HandleData {
+  public:
+    [[nodiscard]] auto type_name() const -> const char * override { return "string-builder"; }
+
+    std::string text;
+};
+
+auto require_builder(const Value &v, const char *who) -> StringBuilder * {
+    auto *b = v && v.get_type() == THANDLE ? dynamic_cast<StringBuilder *>(v.get_handle()) : nullptr;
+    if (!b)
+        throw std::runtime_error(std::string(who) + " requires a string-builder");
+    return b;
+}
+
+} // namespace
+
+auto read_file(State &S, const std::string &path, const char *who, bool map) -> Value {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error(std::string(who) + ": could not open " + path + ": " + std::strerror(errno));
+    struct stat st{};
+    bool regular = ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (map && regular && static_cast<size_t>(st.st_size) >= kMapFileMin) {
+        Value v = map_file(S, fd, static_cast<size_t>(st.st_size));
+        int err = errno;
+        ::close(fd);
+        if (!v)
+            throw std::runtime_error(std::string(who) + ": could not map " + path + ": " + std::strerror(err));
+        return v;
+    }
+    std::string text;
+    if (regular)
+        text.reserve(static_cast<size_t>(st.st_size));
+    char buf[65536];
+    for (;;) {
+        ssize_t r = ::read(fd, buf, sizeof(buf));
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0) {
+            int err = errno;
+            ::close(fd);
+            throw std::runtime_error(std::string(who) + ": could not read " + path + ": " + std::strerror(err));
+        }
+        if (r == 0)
+            break;
+        text.append(buf, static_cast<size_t>(r));
+    }
+    ::close(fd);
+    return S.make_string(std::move(text));
+}
+
+auto map_file(State &S, int fd, size_t n) -> Value {
+    void *map = ::mmap(nullptr, n, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return {};
+    Value v = S.make_pooled_value(TSTRING);
+    v.set_string(StringData::mapped(map, n));
+    return v;
+}
+
+void register_strings(State &S) {
+    S.register_builtin("string-length", [](State &S, const Value &args) -> Value {
+        return S.make_number(static_cast<double>(require_str(pair_car(args), "string-length").size()));
+    });
+    // (string-append s ...): one allocation for the result
+    S.register_builtin("string-append", [](State &S, const Value &args) -> Value {
+        size_t total = 0;
+        for (Value cur = args; cur; cur = pair_cdr(cur))
+            total += require_str(pair_car(cur), "string-append").size();
+        std::string out;
+        out.reserve(total);
+        for (Value cur = args; cur; cur = pair_cdr(cur))
+            out += pair_car(cur).get_string_view();
+        return S.make_string(std::move(out));
+    });
+    // (substring s start [end]): bytes [start, end), end defaults to the
+    // length; shares the bytes of s (see State::make_string_slice)
+    S.register_builtin("substring", [](State &S, const Value &args) -> Value {
+        std::string_view s = require_str(pair_car(args), "substring");
+        Value rest = pair_cdr(args);
+        size_t start = require_pos(pair_car(rest), s.size(), "substring");
+        Value e = pair_car(pair_cdr(rest));
+        size_t end = e ? require_pos(e, s.size(), "substring") : s.size();
+        if (end < start)
+            throw std::runtime_error("substring: start " + std::to_string(start) + " is after end " +
+                                     std::to_string(end));
+        return S.make_string_slice(pair_car(args), start, end - start);
+    });
+    // (string-find s needle [start]): position of the first needle at or
+    // after start, nil when there is none
+    S.register_builtin("string-find", [](State &S, const Value &args) -> Value {
+        std::string_view s = require_str(pair_car(args), "string-find");
+        Value rest = pair_cdr(args);
+        std::string_view needle = require_str(pair_car(rest), "string-find");
+        Value from = pair_car(pair_cdr(rest));
+        size_t pos = find_substring(s, needle, from ? require_pos(from, s.size(), "string-find") : 0);
+        return pos == std::string_view::npos ? Value() : S.make_number(static_cast<double>(pos));
+    });
+    // (string-split s sep): the pieces between occurrences of sep, as a
+    // list of slices of s
+    S.register_builtin("string-split", [](State &S, const Value &args) -> Value {
+        Value whole = pair_car(args);
+        std::string_view s = require_str(whole, "string-split");
+        std::string_view sep = require_str(pair_car(pair_cdr(args)), "string-split");
+        if (sep.empty())
+            throw std::runtime_error("string-split: empty separator");
+        std::vector<std::pair<size_t, size_t>> pieces; // offset, length
+        size_t start = 0;
+        for (size_t pos; (pos = find_substring(s, sep, start)) != std::string_view::npos; start = pos + sep.size())
+            pieces.emplace_back(start, pos - start);
+        pieces.emplace_back(start, s.size() - start);
+        Value head;
+        for (size_t i = pieces.size(); i-- > 0;)
+            head = S.make_pair(S.make_string_slice(whole, pieces[i].first, pieces[i].second), std::move(head));
+        return head;
+    });
+    // (read-file path ['mapped]): the whole file as a string; with 'mapped a
+    // large file is mapped instead of read (see read_file)
+    S.register_builtin("read-file", [](State &S, const Value &args) -> Value {
+        Value mode = pair_car(pair_cdr(args));
+        if (mode && !is_symbol(mode, "mapped"))
+            throw std::runtime_error("read-file: the mode must be 'mapped");
+        return read_file(S, std::string(require_str(pair_car(args), "read-file")), "read-file", static_cast<bool>(mode));
+    });
+    // (string-copy s): s in a string of its own, so a slice no longer keeps
+    // the string it was cut from alive
+    S.register_builtin("string-copy", [](State &S, const Value &args) -> Value {
+        return S.make_string(std::string(require_str(pair_car(args), "string-copy")));
+    });
+    // (string-join seq [sep]): the strings of a list, vector or generator
+    // with sep (default "") between them
+    S.register_builtin("string-join", [](State &S, const Value &args) -> Value {
+        Value sv = pair_car(pair_cdr(args));
+        std::string_view sep = sv ? require_str(sv, "string-join") : std::string_view();
+        std::vector<Value> items;
+        size_t total = 0;
+        for_each_item(pair_car(args), "string-join", [&](const Value &v) {
+            total += require_str(v, "string-join").size() + sep.size();
+            items.push_back(v);
+        });
+        std::string out;
+        out.reserve(total);
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (i)
+                out += sep;
+            out += items[i].get_string_view();
+        }
+        return S.make_string(std::move(out));
+    });
+    // (string->number s): nil unless all of s (surrounding blanks aside) is a
+    // finite number; from_chars also reads "nan" and "inf", which a number
+    // Value cannot hold
+    S.register_builtin("string->number", [](State &S, const Value &args) -> Value {
+        std::string_view s = require_str(pair_car(args), "string->number");
+        const char *b = s.data(), *e = s.data() + s.size();
+        while (b < e && (*b == ' ' || *b == '\t' || *b == '\n' || *b == '\r'))
+            ++b;
+        while (e > b && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\n' || e[-1] == '\r'))
+            --e;
+        if (b < e && *b == '+')
+            ++b;
+        double x;
+        auto res = std::from_chars(b, e, x);
+        if (b == e || res.ec != std::errc() || res.ptr != e || !std::isfinite(x))
+            return {};
+        return S.make_number(x);
+    });
+    S.register_builtin("number->string", [](State &S, const Value &args) -> Value {
+        return S.make_string(number_to_string(require_number(pair_car(args), "number->string")));
+    });
+
+    // (make-string-builder)
+    S.register_builtin("make-string-builder", [](State &S, const Value &) -> Value {
+        return S.make_handle(new StringBuilder());
+    });
+    // (string-builder-append! sb x ...): append strings and numbers; returns sb
+    S.register_builtin("string-builder-append!", [](State &, const Value &args) -> Value {
+        Value sb = pair_car(args);
+        StringBuilder *b = require_builder(sb, "string-builder-append!");
+        for (Value cur = pair_cdr(args); cur; cur = pair_cdr(cur))
+            append_text(b->text, pair_car(cur), "string-builder-append!");
+        return sb;
+    });
+    S.register_builtin("string-builder-length", [](State &S, const Value &args) -> Value {
+        return S.make_number(static_cast<double>(require_builder(pair_car(args), "string-builder-length")->text.size()));
+    });
+    // (string-builder->string sb): the text so far; sb keeps it
+    S.register_builtin("string-builder->string", [](State &S, const Value &args) -> Value {
+        return S.make_string(require_builder(pair_car(args), "string-builder->string")->text);
+    });
+}
+
+} // namespace vdlisp
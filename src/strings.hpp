@@ -0,0 +1,48 @@
+#ifndef VDLISP__STRINGS_HPP
+#define VDLISP__STRINGS_HPP
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace vdlisp {
+
+class State;
+class Value;
+
+// Position of the first `needle` in `hay` at or after `from`, or npos. Uses
+// AVX2 (first and last byte of the needle compared 32 positions at a time)
+// when the CPU has it and `VDLISP__SIMD` does not cap it to scalar, else
+// memchr on the first byte.
+[[nodiscard]] auto find_substring(std::string_view hay, std::string_view needle, size_t from = 0) noexcept -> size_t;
+
+// Shortest text that reads back as `x` ("42", "0.1", "1e+21").
+[[nodiscard]] auto number_to_string(double x) -> std::string;
+
+// Files at least this large are mapped rather than read by lines and by
+// (read-file path 'mapped).
+constexpr size_t kMapFileMin = 64 * 1024;
+
+// The first `n` bytes of the open file `fd` as a string mapped read-only
+// (see StringData); nil when the file cannot be mapped. `fd` stays open.
+[[nodiscard]] auto map_file(State &S, int fd, size_t n) -> Value;
+
+// The contents of the file at `path`, read into the string. With `map`, a
+// regular file of kMapFileMin bytes or more is mapped read-only instead (pages
+// load on first touch; slices of it share the mapping): the string then
+// changes if the file is rewritten, and touching it after the file shrinks
+// raises SIGBUS. Errors name `who`.
+[[nodiscard]] auto read_file(State &S, const std::string &path, const char *who, bool map = false) -> Value;
+
+// Strings are byte strings: lengths and positions count bytes.
+//
+// string-length / string-append / substring / string-find / string-split /
+// string-join / string-copy / string->number / number->string / read-file, and
+// string builders:
+// make-string-builder / string-builder-append! / string-builder-length /
+// string-builder->string
+void register_strings(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__STRINGS_HPP
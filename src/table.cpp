@@ -0,0 +1,308 @@
+#include "table.hpp"
+#include "helpers.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string_view>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace vdlisp {
+
+namespace {
+
+constexpr int8_t kEmpty = -128; // 0b10000000
+constexpr int8_t kDeleted = -2; // 0b11111110
+
+// murmur3 finalizer: spreads pointer and double bits over the whole word
+auto mix(uint64_t x) noexcept -> uint64_t {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+auto h1(uint64_t hash) noexcept -> size_t { return static_cast<size_t>(hash >> 7); }
+auto h2(uint64_t hash) noexcept -> int8_t { return static_cast<int8_t>(hash & 0x7F); }
+
+// Control bytes of one probe group; match* return a bit per matching slot.
+class Group {
+  public:
+    explicit Group(const int8_t *ctrl) noexcept {
+#if defined(__SSE2__)
+        bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl));
+#else
+        std::memcpy(bytes, ctrl, sizeof bytes);
+#endif
+    }
+    [[nodiscard]] auto match(int8_t h) const noexcept -> uint32_t {
+#if defined(__SSE2__)
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(h))));
+#else
+        uint32_t m = 0;
+        for (int i = 0; i < 16; ++i)
+            m |= uint32_t(bytes[i] == h) << i;
+        return m;
+#endif
+    }
+    [[nodiscard]] auto match_empty() const noexcept -> uint32_t { return match(kEmpty); }
+    // empty or deleted: the only control bytes with the top bit set
+    [[nodiscard]] auto match_free() const noexcept -> uint32_t {
+#if defined(__SSE2__)
+        return static_cast<uint32_t>(_mm_movemask_epi8(bytes));
+#else
+        uint32_t m = 0;
+        for (int i = 0; i < 16; ++i)
+            m |= uint32_t(bytes[i] < 0) << i;
+        return m;
+#endif
+    }
+
+  private:
+#if defined(__SSE2__)
+    __m128i bytes;
+#else
+    int8_t bytes[16];
+#endif
+};
+
+} // namespace
+
+auto value_hash(const Value &v) noexcept -> uint64_t {
+    switch (v.get_type()) {
+    case TNUMBER: {
+        double d = v.get_number();
+        if (d == 0)
+            d = 0; // -0.0 == 0.0
+        return mix(std::bit_cast<uint64_t>(d));
+    }
+    case TSTRING:
+        return mix(std::hash<std::string_view>{}(v.get_string_view()));
+    default:
+        return mix(v.identity_key());
+    }
+}
+
+auto table_key_equal(const Value &a, const Value &b) noexcept -> bool {
+    if (a == b)
+        return true;
+    if (a.get_type() != b.get_type())
+        return false;
+    switch (a.get_type()) {
+    case TNUMBER:
+        return a.get_number() == b.get_number();
+    case TSTRING:
+        return a.get_string_view() == b.get_string_view();
+    default:
+        return false;
+    }
+}
+
+// -------------------- TableData --------------------
+
+auto TableData::find_slot(const Value &key, uint64_t hash) const noexcept -> size_t {
+    if (!capacity_)
+        return capacity_;
+    size_t groups_mask = capacity_ / kGroup - 1;
+    size_t g = h1(hash) & groups_mask;
+    // triangular probing visits every group of a power-of-two table
+    for (size_t step = 1;; ++step) {
+        Group grp(&ctrl_[g * kGroup]);
+        for (uint32_t m = grp.match(h2(hash)); m; m &= m - 1) {
+            size_t slot = g * kGroup + std::countr_zero(m);
+            const Entry &e = entries_[slots_[slot]];
+            if (e.hash == hash && table_key_equal(e.key, key))
+                return slot;
+        }
+        if (grp.match_empty())
+            return capacity_;
+        g = (g + step) & groups_mask;
+    }
+}
+
+auto TableData::find(const Value &key) noexcept -> Value * {
+    size_t slot = find_slot(key, value_hash(key));
+    return slot == capacity_ ? nullptr : &entries_[slots_[slot]].value;
+}
+
+// Claim the first free slot on the probe sequence of `hash` for `entry`.
+void TableData::place(size_t entry, uint64_t hash) noexcept {
+    size_t groups_mask = capacity_ / kGroup - 1;
+    size_t g = h1(hash) & groups_mask;
+    for (size_t step = 1;; ++step) {
+        if (uint32_t m = Group(&ctrl_[g * kGroup]).match_free()) {
+            size_t slot = g * kGroup + std::countr_zero(m);
+            if (ctrl_[slot] == kEmpty)
+                ++used_;
+            ctrl_[slot] = h2(hash);
+            slots_[slot] = static_cast<uint32_t>(entry);
+            return;
+        }
+        g = (g + step) & groups_mask;
+    }
+}
+
+void TableData::set(const Value &key, Value value) {
+    uint64_t hash = value_hash(key);
+    size_t slot = find_slot(key, hash);
+    if (slot != capacity_) {
+        entries_[slots_[slot]].value = std::move(value);
+        return;
+    }
+    // keep the load (full + deleted slots) under 7/8, and the dead entries
+    // bounded by the capacity
+    if ((used_ + 1) * 8 > capacity_ * 7 || entries_.size() >= capacity_)
+        rehash((live_ + 1) * 16 > capacity_ * 7 ? std::max(capacity_ * 2, kGroup) : capacity_);
+    entries_.push_back(Entry{hash, key, std::move(value), true});
+    place(entries_.size() - 1, hash);
+    ++live_;
+}
+
+auto TableData::erase(const Value &key) noexcept -> bool {
+    size_t slot = find_slot(key, value_hash(key));
+    if (slot == capacity_)
+        return false;
+    Entry &e = entries_[slots_[slot]];
+    e.key = Value();
+    e.value = Value();
+    e.live = false;
+    --live_;
+    // A group that still has an empty slot was never full, so no probe went
+    // past it: the slot can become empty again instead of a tombstone.
+    if (Group(&ctrl_[slot / kGroup * kGroup]).match_empty()) {
+        ctrl_[slot] = kEmpty;
+        --used_;
+    } else {
+        ctrl_[slot] = kDeleted;
+    }
+    return true;
+}
+
+void TableData::clear() noexcept {
+    std::vector<Entry> old;
+    old.swap(entries_);
+    ctrl_.reset();
+    slots_.reset();
+    capacity_ = live_ = used_ = 0;
+    // values may reference this table: release them once it is consistent
+    old.clear();
+}
+
+void TableData::rehash(size_t capacity) {
+    // drop dead entries
+    size_t n = 0;
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        if (!entries_[i].live)
+            continue;
+        if (i != n)
+            entries_[n] = std::move(entries_[i]);
+        ++n;
+    }
+    entries_.resize(n);
+    entries_.reserve(capacity);
+    if (capacity != capacity_) {
+        ctrl_ = std::make_unique<int8_t[]>(capacity);
+        slots_ = std::make_unique<uint32_t[]>(capacity);
+        capacity_ = capacity;
+    }
+    std::memset(ctrl_.get(), kEmpty, capacity_);
+    used_ = 0;
+    for (size_t i = 0; i < n; ++i)
+        place(i, entries_[i].hash);
+}
+
+// -------------------- builtins --------------------
+
+namespace {
+
+auto require_table(const Value &v, const char *who) -> TableData * {
+    if (!v || v.get_type() != TTABLE)
+        throw std::runtime_error(std::string(who) + " requires a table");
+    return v.get_table();
+}
+
+} // namespace
+
+void register_tables(State &S) {
+    // (make-table [k v ...]): a table with the given pairs
+    S.register_builtin("make-table", [](State &S, const Value &args) -> Value {
+        Value t = S.make_table();
+        for (Value cur = args; cur; cur = pair_cdr(pair_cdr(cur))) {
+            if (!pair_cdr(cur))
+                throw std::runtime_error("make-table requires an even number of arguments");
+            t.get_table()->set(pair_car(cur), pair_car(pair_cdr(cur)));
+        }
+        return t;
+    });
+    // (table-get t k [default]): value under k, else default (nil)
+    S.register_builtin("table-get", [](State &, const Value &args) -> Value {
+        TableData *t = require_table(pair_car(args), "table-get");
+        Value rest = pair_cdr(args);
+        if (Value *v = t->find(pair_car(rest)))
+            return *v;
+        return pair_car(pair_cdr(rest));
+    });
+    // (table-set t k v): store v under k; returns v
+    S.register_builtin("table-set", [](State &, const Value &args) -> Value {
+        TableData *t = require_table(pair_car(args), "table-set");
+        Value rest = pair_cdr(args);
+        Value v = pair_car(pair_cdr(rest));
+        t->set(pair_car(rest), v);
+        return v;
+    });
+    // (table-del t k): #t when k was present
+    S.register_builtin("table-del", [](State &S, const Value &args) -> Value {
+        TableData *t = require_table(pair_car(args), "table-del");
+        return t->erase(pair_car(pair_cdr(args))) ? S.get_bound("#t", S.global) : Value();
+    });
+    S.register_builtin("table-has?", [](State &S, const Value &args) -> Value {
+        TableData *t = require_table(pair_car(args), "table-has?");
+        return t->find(pair_car(pair_cdr(args))) ? S.get_bound("#t", S.global) : Value();
+    });
+    S.register_builtin("table-count", [](State &S, const Value &args) -> Value {
+        return S.make_number(static_cast<double>(require_table(pair_car(args), "table-count")->size()));
+    });
+    // (table-keys t) / (table-values t): lists in insertion order
+    S.register_builtin("table-keys", [](State &S, const Value &args) -> Value {
+        const auto &entries = require_table(pair_car(args), "table-keys")->entries();
+        Value head;
+        for (size_t i = entries.size(); i-- > 0;)
+            if (entries[i].live)
+                head = S.make_pair(entries[i].key, std::move(head));
+        return head;
+    });
+    S.register_builtin("table-values", [](State &S, const Value &args) -> Value {
+        const auto &entries = require_table(pair_car(args), "table-values")->entries();
+        Value head;
+        for (size_t i = entries.size(); i-- > 0;)
+            if (entries[i].live)
+                head = S.make_pair(entries[i].value, std::move(head));
+        return head;
+    });
+    // (table-for-each t f): call (f k v) for every pair in insertion order, on
+    // a snapshot taken first (f may modify the table); returns nil
+    S.register_builtin("table-for-each", [](State &S, const Value &args) -> Value {
+        const auto &entries = require_table(pair_car(args), "table-for-each")->entries();
+        Value fn = pair_car(pair_cdr(args));
+        if (!fn || (fn.get_type() != TFUNC && fn.get_type() != TCFUNC))
+            throw std::runtime_error("table-for-each requires a function");
+        std::vector<Value> snapshot;
+        snapshot.reserve(entries.size() * 2);
+        for (const auto &e : entries) {
+            if (!e.live)
+                continue;
+            snapshot.push_back(e.key);
+            snapshot.push_back(e.value);
+        }
+        for (size_t i = 0; i < snapshot.size(); i += 2)
+            (void)S.call(fn, S.make_pair(snapshot[i], S.make_pair(snapshot[i + 1], Value())));
+        return {};
+    });
+}
+
+} // namespace vdlisp
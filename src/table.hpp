@@ -0,0 +1,70 @@
+#ifndef VDLISP__TABLE_HPP
+#define VDLISP__TABLE_HPP
+
+#include "nanbox.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace vdlisp {
+
+class State;
+
+// Hash of a table key: numbers and strings hash by content (0.0 and -0.0
+// alike), everything else (symbols, which are interned per State, pairs,
+// vectors, functions, ...) by identity.
+[[nodiscard]] auto value_hash(const Value &v) noexcept -> uint64_t;
+// Key equality matching value_hash.
+[[nodiscard]] auto table_key_equal(const Value &a, const Value &b) noexcept -> bool;
+
+// TableData: open-addressing hash map keyed by Value (SwissTable layout).
+//
+// Slots are probed a group of 16 at a time: each slot has a control byte that
+// is kEmpty, kDeleted or the low 7 bits of the key's hash (h2), so one SSE2
+// compare finds the candidates of a group and a probe stops at the first
+// group with an empty slot. Slots hold indexes into `entries`, which keeps
+// the pairs in insertion order (the iteration order); erased entries stay
+// there as dead records until the next rehash compacts them.
+class TableData : public RcBase {
+  public:
+    struct Entry {
+        uint64_t hash;
+        Value key;
+        Value value;
+        bool live;
+    };
+
+    // Value stored under `key`, or nullptr.
+    [[nodiscard]] auto find(const Value &key) noexcept -> Value *;
+    void set(const Value &key, Value value);
+    // Remove `key`; false when it was not present.
+    auto erase(const Value &key) noexcept -> bool;
+    void clear() noexcept;
+    [[nodiscard]] auto size() const noexcept -> size_t { return live_; }
+    // Entries in insertion order, dead ones included (check `live`).
+    [[nodiscard]] auto entries() const noexcept -> const std::vector<Entry> & { return entries_; }
+
+  private:
+    static constexpr size_t kGroup = 16;
+
+    // Slot holding `key`, or capacity_ when absent.
+    [[nodiscard]] auto find_slot(const Value &key, uint64_t hash) const noexcept -> size_t;
+    void rehash(size_t capacity);
+    void place(size_t entry, uint64_t hash) noexcept;
+
+    std::vector<Entry> entries_;
+    std::unique_ptr<int8_t[]> ctrl_;
+    std::unique_ptr<uint32_t[]> slots_;
+    size_t capacity_ = 0; // power of two, multiple of kGroup (0: nothing allocated)
+    size_t live_ = 0;
+    size_t used_ = 0; // full and deleted slots
+};
+
+// make-table / table-get / table-set / table-del / table-has? / table-count /
+// table-keys / table-values / table-for-each
+void register_tables(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__TABLE_HPP
@@ -0,0 +1,615 @@
+#include "transfer.hpp"
+#include "bytes.hpp"
+#include "f64array.hpp"
+#include "helpers.hpp"
+#include "persistent.hpp"
+#include "record.hpp"
+#include "table.hpp"
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace vdlisp {
+
+// -------------------- freeze --------------------
+
+class Freezer {
+  public:
+    Freezer(State &S, Frozen &out) : S(S), out(out) {}
+
+    auto node(const Value &v) -> uint32_t {
+        switch (v.get_type()) {
+        case TNIL:
+            return push(Frozen::Node{});
+        case TNUMBER: {
+            Frozen::Node n;
+            n.type = TNUMBER;
+            n.bits = std::bit_cast<uint64_t>(v.get_number());
+            return push(std::move(n));
+        }
+        case TPRIM: {
+            Frozen::Node n;
+            n.type = TPRIM;
+            n.bits = reinterpret_cast<uint64_t>(v.get_prim());
+            return push(std::move(n));
+        }
+        case TCFUNC: {
+            Frozen::Node n;
+            n.type = TCFUNC;
+            n.bits = reinterpret_cast<uint64_t>(v.get_cfunc());
+            return push(std::move(n));
+        }
+        default:
+            break;
+        }
+        auto it = memo.find(v.identity_key());
+        if (it != memo.end())
+            return it->second;
+        switch (v.get_type()) {
+        case TSTRING:
+        case TSYMBOL: {
+            Frozen::Node n;
+            n.type = v.get_type();
+            n.text = v.get_type() == TSTRING ? std::string(v.get_string_view()) : *v.get_symbol();
+            return remember(v, push(std::move(n)));
+        }
+        case TPAIR:
+            return pair(v);
+        case TVECTOR: {
+            Frozen::Node n;
+            n.type = TVECTOR;
+            uint32_t idx = remember(v, push(std::move(n)));
+            const auto &items = v.get_vector()->items;
+            for (size_t i = 0; i < items.size(); ++i) {
+                uint32_t vi = node(items[i]);
+                out.nodes[idx].items.push_back(vi);
+            }
+            return idx;
+        }
+        case TTABLE: {
+            Frozen::Node n;
+            n.type = TTABLE;
+            uint32_t idx = remember(v, push(std::move(n)));
+            for (const auto &e : v.get_table()->entries()) {
+                if (!e.live)
+                    continue;
+                uint32_t ki = node(e.key);
+                uint32_t vi = node(e.value);
+                out.nodes[idx].items.push_back(ki);
+                out.nodes[idx].items.push_back(vi);
+            }
+            return idx;
+        }
+        case THASHMAP: {
+            Frozen::Node n;
+            n.type = THASHMAP;
+            uint32_t idx = remember(v, push(std::move(n)));
+            v.get_hash_map()->for_each([&](const Value &k, const Value &val) {
+                uint32_t ki = node(k);
+                uint32_t vi = node(val);
+                out.nodes[idx].items.push_back(ki);
+                out.nodes[idx].items.push_back(vi);
+            });
+            return idx;
+        }
+        case TPVECTOR: {
+            Frozen::Node n;
+            n.type = TPVECTOR;
+            uint32_t idx = remember(v, push(std::move(n)));
+            v.get_pvector()->for_each([&](const Value &item) {
+                uint32_t vi = node(item);
+                out.nodes[idx].items.push_back(vi);
+            });
+            return idx;
+        }
+        case TRECORD: {
+            // shapes are process-wide: the id means the same in every isolate
+            const RecordData *r = v.get_record();
+            Frozen::Node n;
+            n.type = TRECORD;
+            n.a = r->shape()->id;
+            uint32_t idx = remember(v, push(std::move(n)));
+            for (size_t k = 0; k < r->size(); ++k) {
+                uint32_t vi = node(r->slots()[k]);
+                out.nodes[idx].items.push_back(vi);
+            }
+            return idx;
+        }
+        case TF64ARRAY: {
+            Frozen::Node n;
+            n.type = TF64ARRAY;
+            const F64ArrayData *a = v.get_f64array();
+            n.numbers.assign(a->data(), a->data() + a->size());
+            return remember(v, push(std::move(n)));
+        }
+        case TBYTES: {
+            // a view arrives as a buffer of its own
+            Frozen::Node n;
+            n.type = TBYTES;
+            const BytesData *b = v.get_bytes();
+            n.text.assign(reinterpret_cast<const char *>(b->data()), b->size());
+            return remember(v, push(std::move(n)));
+        }
+        case TFUNC: {
+            FuncData *fd = v.get_func();
+            return closure(v, TFUNC, fd->params, fd->body, fd->closure_env);
+        }
+        case TMACRO: {
+            MacroData *md = v.get_macro();
+            return closure(v, TMACRO, md->params, md->body, md->closure_env);
+        }
+        case THANDLE: {
+            Frozen::Node n;
+            n.type = THANDLE;
+            if (auto *sh = dynamic_cast<SharedHandle *>(v.get_handle())) {
+                n.shared = sh->value;
+                return remember(v, push(std::move(n)));
+            }
+            n.attach = v.get_handle()->detach();
+            if (!n.attach)
+                throw std::runtime_error(std::string("cannot transfer a ") + v.type_name() + " between isolates");
+            return remember(v, push(std::move(n)));
+        }
+        default:
+            throw std::runtime_error("cannot transfer a " + v.type_name() + " between isolates");
+        }
+    }
+
+    // Copy all non-builtin global bindings into the global frame.
+    void globals() {
+        int32_t gf = global();
+        out.global_env = gf;
+        for (auto &kv : S.global->map)
+            global_names.insert(kv.first);
+        for (auto &kv : S.global->map) {
+            if (kv.second.get_type() == TPRIM || kv.second.get_type() == TCFUNC)
+                continue;
+            uint32_t vi = node(kv.second);
+            out.envs[gf].bindings.emplace_back(kv.first, vi);
+        }
+    }
+
+  private:
+    State &S;
+    Frozen &out;
+    std::unordered_map<uint64_t, uint32_t> memo;
+    std::unordered_map<Env *, int32_t> env_memo;
+    int32_t global_frame = -1;
+    std::unordered_set<std::string> global_names;
+
+    auto push(Frozen::Node &&n) -> uint32_t {
+        out.nodes.push_back(std::move(n));
+        return static_cast<uint32_t>(out.nodes.size() - 1);
+    }
+    auto remember(const Value &v, uint32_t idx) -> uint32_t {
+        memo[v.identity_key()] = idx;
+        return idx;
+    }
+
+    // Lists are walked iteratively along the cdr so long lists do not recurse.
+    auto pair(const Value &v) -> uint32_t {
+        uint32_t first = 0;
+        uint32_t prev = 0;
+        bool have_prev = false;
+        Value cur = v;
+        while (cur.get_type() == TPAIR && memo.find(cur.identity_key()) == memo.end()) {
+            Frozen::Node n;
+            n.type = TPAIR;
+            uint32_t idx = remember(cur, push(std::move(n)));
+            if (have_prev)
+                out.nodes[prev].b = idx;
+            else
+                first = idx;
+            uint32_t car = node(cur.get_pair()->car);
+            out.nodes[idx].a = car;
+            prev = idx;
+            have_prev = true;
+            cur = cur.get_pair()->cdr;
+        }
+        uint32_t tail = node(cur);
+        if (!have_prev)
+            return tail;
+        out.nodes[prev].b = tail;
+        return first;
+    }
+
+    auto closure(const Value &v, Type t, const Value &params, const Value &body, Env *e) -> uint32_t {
+        Frozen::Node n;
+        n.type = t;
+        uint32_t idx = remember(v, push(std::move(n)));
+        uint32_t p = node(params);
+        out.nodes[idx].a = p;
+        uint32_t b = node(body);
+        out.nodes[idx].b = b;
+        int32_t fe = env(e);
+        out.nodes[idx].env = fe;
+        capture_globals(body);
+        return idx;
+    }
+
+    auto env(Env *e) -> int32_t {
+        // A missing closure env means "evaluate in the global env" (see State::call).
+        if (!e || e == S.global)
+            return global();
+        auto it = env_memo.find(e);
+        if (it != env_memo.end())
+            return it->second;
+        out.envs.emplace_back();
+        auto idx = static_cast<int32_t>(out.envs.size() - 1);
+        env_memo[e] = idx;
+        int32_t parent = env(e->parent);
+        out.envs[idx].parent = parent;
+        for (auto &kv : e->map) {
+            uint32_t vi = node(kv.second);
+            out.envs[idx].bindings.emplace_back(kv.first, vi);
+        }
+        return idx;
+    }
+
+    auto global() -> int32_t {
+        if (global_frame < 0) {
+            out.envs.emplace_back();
+            global_frame = static_cast<int32_t>(out.envs.size() - 1);
+        }
+        return global_frame;
+    }
+
+    // Copy the sender's global bindings named anywhere in `body`. Builtins are
+    // skipped: every State registers the same ones.
+    void capture_globals(const Value &body) {
+        std::vector<Value> work{body};
+        std::unordered_set<uint64_t> seen;
+        while (!work.empty()) {
+            Value cur = std::move(work.back());
+            work.pop_back();
+            while (cur.get_type() == TPAIR && seen.insert(cur.identity_key()).second) {
+                work.push_back(cur.get_pair()->car);
+                cur = cur.get_pair()->cdr;
+            }
+            if (cur.get_type() != TSYMBOL || !S.global)
+                continue;
+            const std::string &name = *cur.get_symbol();
+            if (global_names.count(name))
+                continue;
+            auto it = S.global->map.find(name);
+            if (it == S.global->map.end())
+                continue;
+            global_names.insert(name);
+            Value gv = it->second;
+            if (gv.get_type() == TPRIM || gv.get_type() == TCFUNC)
+                continue;
+            int32_t gf = global();
+            uint32_t vi = node(gv);
+            out.envs[gf].bindings.emplace_back(name, vi);
+        }
+    }
+};
+
+auto Frozen::freeze(State &S, const Value &v) -> Frozen {
+    Frozen out;
+    Freezer fz(S, out);
+    out.root = fz.node(v);
+    return out;
+}
+
+auto Frozen::freeze_globals(State &S) -> Frozen {
+    Frozen out;
+    Freezer fz(S, out);
+    out.root = fz.node(Value());
+    fz.globals();
+    return out;
+}
+
+// -------------------- thaw --------------------
+
+class Thawer {
+  public:
+    Thawer(State &S, const Frozen &in) : S(S), in(in), made(in.nodes.size()), done(in.nodes.size(), false), envs(in.envs.size(), nullptr) {}
+    ~Thawer() {
+        for (Env *e : envs)
+            if (e)
+                release_env(e);
+    }
+    Thawer(const Thawer &) = delete;
+    Thawer &operator=(const Thawer &) = delete;
+
+    void bind_globals() {
+        for (const auto &b : in.envs[in.global_env].bindings)
+            S.global->map[b.first] = value(b.second);
+    }
+
+    void collect(std::vector<Env *> &out) {
+        for (Env *&e : envs) {
+            if (e)
+                out.push_back(e);
+            e = nullptr;
+        }
+    }
+
+    auto value(uint32_t i) -> Value {
+        if (done[i])
+            return made[i];
+        const Frozen::Node &n = in.nodes[i];
+        switch (n.type) {
+        case TNIL:
+            return {};
+        case TNUMBER:
+            return S.make_number(std::bit_cast<double>(n.bits));
+        case TPRIM:
+            return S.make_prim(reinterpret_cast<Prim>(n.bits));
+        case TCFUNC:
+            return S.make_cfunc(reinterpret_cast<CFunc>(n.bits));
+        case TSTRING:
+            return remember(i, S.make_string(n.text));
+        case TSYMBOL:
+            return remember(i, S.make_symbol(n.text));
+        case TPAIR:
+            return pair(i);
+        case TVECTOR: {
+            Value v = remember(i, S.make_vector());
+            auto &items = v.get_vector()->items;
+            items.reserve(n.items.size());
+            for (uint32_t item : n.items)
+                items.push_back(value(item));
+            return v;
+        }
+        case TTABLE: {
+            // keys are rehashed: symbols hash by identity in this State
+            Value v = remember(i, S.make_table());
+            for (size_t k = 0; k < n.items.size(); k += 2)
+                v.get_table()->set(value(n.items[k]), value(n.items[k + 1]));
+            return v;
+        }
+        case THASHMAP: {
+            // built from its elements, so only remembered afterwards: an
+            // element may reach this map again through a closure env
+            Value v = S.make_hash_map(new HashMapData());
+            for (size_t k = 0; k < n.items.size(); k += 2) {
+                Value key = value(n.items[k]);
+                Value val = value(n.items[k + 1]);
+                if (HashMapData *next = v.get_hash_map()->with(key, std::move(val)))
+                    v = S.make_hash_map(next);
+            }
+            return done[i] ? made[i] : remember(i, std::move(v));
+        }
+        case TPVECTOR: {
+            std::vector<Value> items;
+            items.reserve(n.items.size());
+            for (uint32_t item : n.items)
+                items.push_back(value(item));
+            return done[i] ? made[i] : remember(i, S.make_pvector(new PVectorData(std::move(items))));
+        }
+        case TRECORD: {
+            Value v = remember(i, S.make_record(RecordData::make(record_shape(n.a))));
+            for (size_t k = 0; k < n.items.size(); ++k)
+                v.get_record()->slots()[k] = value(n.items[k]);
+            return v;
+        }
+        case TF64ARRAY: {
+            Value v = remember(i, S.make_f64array(n.numbers.size()));
+            std::copy(n.numbers.begin(), n.numbers.end(), v.get_f64array()->data());
+            return v;
+        }
+        case TBYTES: {
+            Value v = remember(i, S.make_bytes(n.text.size()));
+            std::copy(n.text.begin(), n.text.end(), v.get_bytes()->data());
+            return v;
+        }
+        case TFUNC: {
+            Value v = remember(i, S.make_function(Value(), Value(), nullptr));
+            FuncData *fd = v.get_func();
+            fd->params = value(n.a);
+            fd->body = value(n.b);
+            fd->closure_env = env(n.env);
+            retain_env(fd->closure_env);
+            return v;
+        }
+        case TMACRO: {
+            Value v = remember(i, S.make_macro(Value(), Value(), nullptr));
+            MacroData *md = v.get_macro();
+            md->params = value(n.a);
+            md->body = value(n.b);
+            md->closure_env = env(n.env);
+            retain_env(md->closure_env);
+            return v;
+        }
+        case THANDLE:
+            if (!n.attach)
+                return remember(i, n.shared);
+            return remember(i, S.make_handle(n.attach()));
+        default:
+            return {};
+        }
+    }
+
+  private:
+    State &S;
+    const Frozen &in;
+    std::vector<Value> made;
+    std::vector<bool> done;
+    std::vector<Env *> envs;
+
+    auto remember(uint32_t i, Value v) -> Value {
+        made[i] = v;
+        done[i] = true;
+        return v;
+    }
+
+    auto pair(uint32_t i) -> Value {
+        Value head = remember(i, S.make_pair(Value(), Value()));
+        uint32_t cur = i;
+        PairData *pd = head.get_pair();
+        while (true) {
+            pd->car = value(in.nodes[cur].a);
+            uint32_t next = in.nodes[cur].b;
+            if (in.nodes[next].type != TPAIR || done[next]) {
+                pd->cdr = value(next);
+                break;
+            }
+            pd->cdr = remember(next, S.make_pair(Value(), Value()));
+            pd = pd->cdr.get_pair();
+            cur = next;
+        }
+        return head;
+    }
+
+    auto env(int32_t i) -> Env * {
+        if (i < 0 || i == in.global_env)
+            return S.global;
+        if (envs[i])
+            return envs[i];
+        const Frozen::EnvNode &fe = in.envs[i];
+        Env *e = S.make_env(env(fe.parent));
+        envs[i] = e;
+        for (const auto &b : fe.bindings)
+            e->map[b.first] = value(b.second);
+        return e;
+    }
+};
+
+auto Frozen::thaw(State &S, std::vector<Env *> *out_envs) const -> Value {
+    if (nodes.empty())
+        return {};
+    Thawer th(S, *this);
+    Value v = th.value(root);
+    if (out_envs)
+        th.collect(*out_envs);
+    return v;
+}
+
+void Frozen::thaw_globals(State &S) const {
+    if (global_env < 0)
+        return;
+    Thawer th(S, *this);
+    th.bind_globals();
+}
+
+void purge_thawed_envs(std::vector<Env *> &envs) noexcept {
+    for (Env *e : envs)
+        e->map.clear();
+    for (Env *e : envs)
+        release_env(e);
+    envs.clear();
+}
+
+namespace {
+
+// A tracked group is collected when at least this many have piled up since
+// the last collection (and as many as survived it).
+constexpr size_t kCollectThawed = 16;
+
+auto bound_closure(const Value &v, Env *&closure) noexcept -> const RcBase * {
+    if (v.get_type() == TFUNC) {
+        closure = v.get_func()->closure_env;
+        return v.get_func();
+    }
+    if (v.get_type() == TMACRO) {
+        closure = v.get_macro()->closure_env;
+        return v.get_macro();
+    }
+    return nullptr;
+}
+
+// Trial deletion: whether every reference to the group's Envs, and to the
+// functions bound directly in them, comes from inside the group. Anything
+// else holding one of them (a closure kept by the program, a call frame,
+// data that contains a closure) keeps the whole group.
+auto group_garbage(const std::vector<Env *> &group) -> bool {
+    std::unordered_map<const RcBase *, long> outside;
+    std::vector<Env *> closures;
+    for (Env *e : group) {
+        if (e->immortal())
+            return false;
+        outside[e] = static_cast<long>(e->ref_count()) - 1; // the group's own reference
+    }
+    for (Env *e : group) {
+        for (const auto &kv : e->map) {
+            Env *closure = nullptr;
+            const RcBase *fn = bound_closure(kv.second, closure);
+            if (!fn)
+                continue;
+            if (fn->immortal())
+                return false;
+            if (outside.emplace(fn, static_cast<long>(fn->ref_count())).second)
+                closures.push_back(closure);
+        }
+    }
+    auto drop = [&outside](const RcBase *p) {
+        if (auto it = outside.find(p); it != outside.end())
+            --it->second;
+    };
+    for (Env *e : group) {
+        drop(e->parent);
+        for (const auto &kv : e->map) {
+            Env *closure = nullptr;
+            drop(bound_closure(kv.second, closure));
+        }
+    }
+    for (Env *closure : closures)
+        drop(closure);
+    for (const auto &kv : outside)
+        if (kv.second > 0)
+            return false;
+    return true;
+}
+
+} // namespace
+
+auto thaw_tracked(State &S, const Frozen &fz) -> Value {
+    std::vector<Env *> envs;
+    Value v = fz.thaw(S, &envs);
+    if (envs.empty())
+        return v;
+    if (S.thawed_envs.size() >= 2 * S.thawed_envs_kept + kCollectThawed)
+        collect_thawed_envs(S);
+    S.thawed_envs.push_back(std::move(envs));
+    return v;
+}
+
+void collect_thawed_envs(State &S) {
+    auto &groups = S.thawed_envs;
+    size_t kept = 0;
+    for (size_t i = 0; i < groups.size(); ++i) {
+        if (group_garbage(groups[i]))
+            purge_thawed_envs(groups[i]);
+        else if (kept++ != i)
+            groups[kept - 1] = std::move(groups[i]);
+    }
+    groups.resize(kept);
+    S.thawed_envs_kept = kept;
+}
+
+// -------------------- GlobalsSnapshot --------------------
+
+GlobalsSnapshot::GlobalsSnapshot(const State &S) : globals_(S.global->map), modules_(S.loaded_modules) {}
+
+void GlobalsSnapshot::restore(State &S) const {
+    auto undo = [](std::unordered_map<std::string, Value> &now, const std::unordered_map<std::string, Value> &then) {
+        for (auto it = now.begin(); it != now.end();) {
+            auto old = then.find(it->first);
+            if (old == then.end()) {
+                it = now.erase(it);
+                continue;
+            }
+            if (it->second.identity_key() != old->second.identity_key())
+                it->second = old->second;
+            ++it;
+        }
+        if (now.size() != then.size())
+            for (const auto &kv : then)
+                now.emplace(kv.first, kv.second);
+    };
+    undo(S.global->map, globals_);
+    undo(S.loaded_modules, modules_);
+}
+
+void GlobalsSnapshot::adopt(const State &S, const std::vector<std::pair<std::string, Value>> &module_globals) {
+    for (const auto &kv : module_globals)
+        globals_[kv.first] = kv.second;
+    for (const auto &kv : S.loaded_modules)
+        modules_.emplace(kv.first, kv.second);
+}
+
+} // namespace vdlisp
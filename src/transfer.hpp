@@ -0,0 +1,118 @@
+#ifndef VDLISP__TRANSFER_HPP
+#define VDLISP__TRANSFER_HPP
+
+#include "vdlisp.hpp"
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace vdlisp {
+
+// Frozen: an isolate-independent deep copy of a Value graph.
+//
+// Values cannot cross State boundaries (refcounts are not atomic and symbols
+// are interned per State), so anything handed to another isolate is first
+// frozen on the sending thread into plain C++ data and later thawed into the
+// receiving State's heap. Shared substructure and cycles are preserved.
+//
+// Functions and macros carry their closure environment: local frames are
+// copied whole, while the sender's global frame is reduced to the bindings the
+// copied code actually names (transitively). On thaw that reduced frame becomes
+// a child of the receiver's global env, so builtins resolve to the receiver's.
+class Frozen {
+  public:
+    Frozen() = default;
+
+    // Throws std::runtime_error for values that cannot leave their State.
+    [[nodiscard]] static auto freeze(State &S, const Value &v) -> Frozen;
+
+    // Rebuild the value in S. When `envs` is given, every Env created for
+    // thawed closures is retained into it so the caller can purge them (and
+    // break closure <-> env cycles) once the value is no longer needed.
+    [[nodiscard]] auto thaw(State &S, std::vector<Env *> *envs = nullptr) const -> Value;
+
+    [[nodiscard]] auto empty() const noexcept -> bool { return nodes.empty(); }
+
+    // Snapshot of every global binding of S except builtins, for cloning an
+    // initialized State. thaw_globals binds them straight into the receiver's
+    // global env, and closures over the sender's globals close over the
+    // receiver's.
+    [[nodiscard]] static auto freeze_globals(State &S) -> Frozen;
+    void thaw_globals(State &S) const;
+
+  private:
+    friend class Freezer;
+    friend class Thawer;
+
+    struct Node {
+        Type type = TNIL;
+        uint64_t bits = 0;      // TNUMBER / TPRIM / TCFUNC payload
+        std::string text;       // TSTRING / TSYMBOL, TBYTES contents
+        uint32_t a = 0, b = 0;  // TPAIR car/cdr, TFUNC/TMACRO params/body, TRECORD shape id
+        int32_t env = -1;       // TFUNC/TMACRO closure frame (index into envs)
+        std::vector<uint32_t> items; // TVECTOR/TPVECTOR elements, TTABLE/THASHMAP keys and values interleaved, TRECORD fields
+        std::vector<double> numbers; // TF64ARRAY elements
+        std::function<HandleData *()> attach; // THANDLE
+        Value shared;                         // THANDLE from `share`: passed by reference
+    };
+    struct EnvNode {
+        int32_t parent = -1; // -1: the receiver's global env
+        std::vector<std::pair<std::string, uint32_t>> bindings;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<EnvNode> envs;
+    uint32_t root = 0;
+    int32_t global_env = -1; // freeze_globals: the frame that is the receiver's global env
+};
+
+// Wrapper made by `(share v)`: Frozen passes the wrapped value by reference
+// instead of copying it (requires biased refcounts, see RcBase).
+class SharedHandle : public HandleData {
+  public:
+    explicit SharedHandle(Value v) : value(std::move(v)) {}
+    [[nodiscard]] auto type_name() const -> const char * override { return "shared"; }
+    [[nodiscard]] auto detach() const -> std::function<HandleData *()> override {
+        Value v = value;
+        return [v]() -> HandleData * { return new SharedHandle(v); };
+    }
+
+    Value value;
+};
+
+// Release Envs collected by Frozen::thaw after clearing their bindings.
+void purge_thawed_envs(std::vector<Env *> &envs) noexcept;
+
+// Thaw `fz` into S for a value that stays there (await, recv, pmap results).
+// The Envs made for thawed closures are kept on S (State::thawed_envs) and
+// freed by collect_thawed_envs once nothing outside them refers to them:
+// refcounting alone never frees a closure bound in its own frame.
+[[nodiscard]] auto thaw_tracked(State &S, const Frozen &fz) -> Value;
+// Free the tracked groups of Envs that are only reachable from each other.
+void collect_thawed_envs(State &S);
+
+// GlobalsSnapshot: the global bindings and loaded modules of a State at one
+// point, to undo what code run on it later defines or rebinds (a worker
+// isolate between tasks, a server State between requests).
+class GlobalsSnapshot {
+  public:
+    explicit GlobalsSnapshot(const State &S);
+    // Drop bindings and modules added since the snapshot and rebind the
+    // changed ones to their old values.
+    void restore(State &S) const;
+    // Make the given bindings (made by modules loaded since, see
+    // State::module_journal) and every module loaded since part of the
+    // snapshot, so restore keeps them.
+    void adopt(const State &S, const std::vector<std::pair<std::string, Value>> &module_globals);
+
+  private:
+    std::unordered_map<std::string, Value> globals_;
+    std::unordered_map<std::string, Value> modules_;
+};
+
+} // namespace vdlisp
+
+#endif // VDLISP__TRANSFER_HPP
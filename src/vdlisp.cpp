@@ -1,4 +1,5 @@
 #include "vdlisp.hpp"
+#include <algorithm>
 #include <cctype>
 #include <cmath>
 #include <cstdlib>
@@ -6,6 +7,7 @@
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <pthread.h>
 #include <readline/history.h>
 #include <readline/readline.h>
 #include <sstream>
@@ -19,11 +21,17 @@ using namespace vdlisp;
 
 // make_string_list helper removed; templated member implemented in `vdlisp.hpp`
 
+#include "bytes.hpp"
 #include "core.hpp"
+#include "event.hpp"
+#include "f64array.hpp"
 #include "helpers.hpp"
+#include "persistent.hpp"
+#include "table.hpp"
+#include "transfer.hpp"
 #include "jit/jit.hpp"
 
-State::State() {
+State::State() : out(&std::cout) {
     // Pre-reserve common containers to reduce hash-table rehashing
     symbol_intern.reserve(256);
     loaded_modules.reserve(64);
@@ -34,10 +42,14 @@ State::State() {
     // Note: do not bind 'else' globally; use `#t` for cond default branch
 }
 
+State::~State() {
+    shutdown_and_purge_pools();
+}
+
 // -------------------- State allocators --------------------
 
-auto State::alloc_string(const std::string &s) -> StringData * {
-    return new StringData(s);
+auto State::alloc_string(std::string s) -> StringData * {
+    return new StringData(std::move(s));
 }
 
 auto State::alloc_pair(Value &&car, Value &&cdr) -> PairData * {
@@ -97,6 +109,13 @@ auto State::make_env(Env *parent) -> Env * {
 }
 
 void State::shutdown_and_purge_pools() {
+    flush_out();
+    // Pending I/O tasks hold coroutines of this State: cancel them first.
+    event_loop.reset();
+    for (auto &group : thawed_envs)
+        purge_thawed_envs(group);
+    thawed_envs.clear();
+    thawed_envs_kept = 0;
     // Release runtime references so reference-counted objects can be reclaimed.
     // First: break common cycles that refcounting cannot solve (closures <-> envs).
     // Clear closure envs held by functions/macros in the intern table.
@@ -150,6 +169,8 @@ void State::shutdown_and_purge_pools() {
     for (auto &kv : loaded_modules)
         kv.second = Value();
     loaded_modules.clear();
+    // immortal objects are never freed; free what they still point to
+    immortals.clear_references();
 
     sources.clear();
     src_call_chain_map.clear();
@@ -157,11 +178,47 @@ void State::shutdown_and_purge_pools() {
 
     symbol_intern.clear();
     current_expr = Value();
+    // objects released by other threads and queued for this one
+    rc_safepoint();
 }
 
-// global used by JIT bridge to access the interpreter State when native
-// code needs to fall back to the interpreter.
-vdlisp::State *vdlisp::jit_active_state = nullptr;
+void State::freeze_runtime() {
+    make_immortal(global, &immortals);
+    for (auto &kv : symbol_intern)
+        make_immortal(kv.second, &immortals);
+    for (auto &kv : loaded_modules)
+        make_immortal(kv.second, &immortals);
+    runtime_frozen = true;
+}
+
+// per-thread pointer used by the JIT bridge to access the interpreter State
+// when native code needs to fall back to the interpreter.
+thread_local vdlisp::State *vdlisp::jit_active_state = nullptr;
+
+thread_local uintptr_t vdlisp::stack_limit = UINTPTR_MAX;
+
+auto vdlisp::stack_limit_of(const void *lo, size_t size) noexcept -> uintptr_t {
+    // room left for builtins, the JIT and unwinding after the check fires
+    size_t margin = std::min<size_t>(256 * 1024, size / 4);
+    return reinterpret_cast<uintptr_t>(lo) + margin;
+}
+
+// Slow path of the check in eval: the first eval of a thread reads its stack
+// bounds; afterwards only an overflow gets here.
+[[gnu::noinline]] static void check_stack(uintptr_t sp) {
+    if (stack_limit == UINTPTR_MAX) {
+        pthread_attr_t attr;
+        void *lo = nullptr;
+        size_t size = 0;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            (void)pthread_attr_getstack(&attr, &lo, &size);
+            pthread_attr_destroy(&attr);
+        }
+        stack_limit = lo ? stack_limit_of(lo, size) : 0;
+    }
+    if (sp < stack_limit)
+        throw std::runtime_error("stack overflow");
+}
 
 auto State::make_nil() noexcept -> Value {
     return {};
@@ -171,9 +228,23 @@ auto State::make_number(double n) noexcept -> Value {
     v.set_number(n);
     return v;
 }
-auto State::make_string(const std::string &s) -> Value {
+auto State::make_string(std::string s) -> Value {
     Value v = make_pooled_value(TSTRING);
-    v.set_string(alloc_string(s));
+    v.set_string(alloc_string(std::move(s)));
+    return v;
+}
+// longest string worth copying instead of slicing: libstdc++ keeps up to 15
+// bytes inline in the std::string
+static constexpr size_t kStringSliceMin = 15;
+
+auto State::make_string_slice(const Value &of, size_t offset, size_t n) -> Value {
+    std::string_view whole = of.get_string_view();
+    if (offset == 0 && n == whole.size())
+        return of;
+    if (n <= kStringSliceMin)
+        return make_string(std::string(whole.substr(offset, n)));
+    Value v = make_pooled_value(TSTRING);
+    v.set_string(new StringData(of, offset, n));
     return v;
 }
 auto State::make_symbol(const std::string &s) -> Value {
@@ -182,6 +253,8 @@ auto State::make_symbol(const std::string &s) -> Value {
         return it->second;
     Value v = make_pooled_value(TSYMBOL);
     v.set_symbol(alloc_string(s));
+    if (runtime_frozen)
+        make_immortal(v, &immortals);
     symbol_intern[s] = v;
     return v;
 }
@@ -224,6 +297,58 @@ auto State::make_macro(Value &&params, Value &&body, Env *env) -> Value {
     return v;
 }
 
+auto State::make_handle(HandleData *h) noexcept -> Value {
+    Value v = make_pooled_value(THANDLE);
+    v.set_handle(h);
+    return v;
+}
+
+auto State::make_vector(std::vector<Value> items) -> Value {
+    auto *vd = new VectorData();
+    vd->items = std::move(items);
+    Value v = make_pooled_value(TVECTOR);
+    v.set_vector(vd);
+    return v;
+}
+
+auto State::make_table() -> Value {
+    Value v = make_pooled_value(TTABLE);
+    v.set_table(new TableData());
+    return v;
+}
+
+auto State::make_f64array(size_t n) -> Value {
+    auto *a = new F64ArrayData(n);
+    Value v = make_pooled_value(TF64ARRAY);
+    v.set_f64array(a);
+    return v;
+}
+
+auto State::make_bytes(size_t n) -> Value {
+    auto *b = new BytesData(n);
+    Value v = make_pooled_value(TBYTES);
+    v.set_bytes(b);
+    return v;
+}
+
+auto State::make_hash_map(HashMapData *m) noexcept -> Value {
+    Value v = make_pooled_value(THASHMAP);
+    v.set_hash_map(m);
+    return v;
+}
+
+auto State::make_pvector(PVectorData *pv) noexcept -> Value {
+    Value v = make_pooled_value(TPVECTOR);
+    v.set_pvector(pv);
+    return v;
+}
+
+auto State::make_record(RecordData *r) noexcept -> Value {
+    Value v = make_pooled_value(TRECORD);
+    v.set_record(r);
+    return v;
+}
+
 auto State::make_string_list(int argc, char **argv, int start) -> Value {
     return make_string_list(argv + start, argv + argc);
 }
@@ -390,6 +515,8 @@ auto State::eval(const Value &expr, Env *env) -> Value {
 
     if (!expr)
         return {};
+    if (auto sp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0)); sp < stack_limit) [[unlikely]]
+        check_stack(sp);
     if (!env)
         env = global;
     switch (expr.get_type()) {
@@ -460,6 +587,8 @@ auto State::eval(const Value &expr, Env *env) -> Value {
                 }
                 // record a transient mapping for the call expression itself
                 src_call_chain_map[expr.identity_key()] = call_chain_entry;
+                if (source_journal)
+                    source_journal->push_back(expr.identity_key());
             }
 
             Value res = with_call_chain(*this, have_call_loc, call_loc, call_chain_entry, [&]() -> Value {
@@ -480,6 +609,8 @@ auto State::eval(const Value &expr, Env *env) -> Value {
                         new_chain.insert(new_chain.end(), it->second.begin(), it->second.end());
                     }
                     src_call_chain_map[v.identity_key()] = new_chain;
+                    if (source_journal)
+                        source_journal->push_back(v.identity_key());
                     if (is_pair(v)) {
                         propagate(pair_car(v));
                         propagate(pair_cdr(v));
@@ -507,6 +638,9 @@ auto State::call(const Value &fn, const Value &args, Env *env) -> Value {
     (void)env;
     if (!fn) [[unlikely]]
         throw std::runtime_error("attempt to call nil");
+    // compiled code recurses through here without going through eval
+    if (auto sp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0)); sp < stack_limit) [[unlikely]]
+        check_stack(sp);
     if (fn.get_type() == TCFUNC) {
         return fn.get_cfunc()(*this, args);
     } else if (fn.get_type() == TFUNC) {
@@ -531,25 +665,17 @@ auto State::call(const Value &fn, const Value &args, Env *env) -> Value {
         if (numeric) {
             fd->num_call_count++; // Increment the numeric call count
             // Simple hot-path heuristic: if the function becomes hot with numeric calls, try to compile it.
-            if (fd->num_call_count > 3 && !fd->compiled_code && !fd->jit_failed) {
-                try {
-                    void *c = global_jit.compileFuncData(fd);
-                    if (c) {
-                        fd->compiled_code = c;
-                    } else {
-                        fd->jit_failed = true;
-                    }
-                } catch (...) {
-                    fd->jit_failed = true;
-                }
-            }
+            if (fd->num_call_count > 3 && !fd->compiled_code && !fd->jit_failed)
+                (void)jit_compile(fd);
         }
 
         if (fd && fd->compiled_code && numeric) {
             using JitFn = double (*)(double *, int);
             auto fptr = reinterpret_cast<JitFn>(fd->compiled_code);
             // set active state so JIT-compiled code can call back into the
-            // interpreter when necessary.
+            // interpreter when necessary; restore the outer one afterwards
+            // (the bridge may re-enter `call` from native code).
+            State *prev_active = jit_active_state;
             jit_active_state = this;
             double res = 0.0;
             bool jit_threw = false;
@@ -559,7 +685,12 @@ auto State::call(const Value &fn, const Value &args, Env *env) -> Value {
                 jit_threw = true;
                 res = std::numeric_limits<double>::quiet_NaN();
             }
-            jit_active_state = nullptr;
+            jit_active_state = prev_active;
+            if (!jit_error.empty()) {
+                std::string msg = std::move(jit_error);
+                jit_error.clear();
+                throw std::runtime_error(msg);
+            }
             if (std::isnan(res)) {
                 // Deopt: callee returned a non-number (signaled as NaN).
                 // This can happen transiently (e.g. a free variable becomes non-numeric).
@@ -603,6 +734,24 @@ auto State::call(const Value &fn, const Value &args, Env *env) -> Value {
     throw std::runtime_error("not a function");
 }
 
+auto State::jit_compile(FuncData *fd) noexcept -> bool {
+    if (fd->compiled_code)
+        return true;
+    if (fd->jit_failed)
+        return false;
+    try {
+        void *c = global_jit().compileFuncData(fd);
+        if (c) {
+            fd->compiled_code = c;
+        } else {
+            fd->jit_failed = true;
+        }
+    } catch (...) {
+        fd->jit_failed = true;
+    }
+    return fd->compiled_code != nullptr;
+}
+
 auto State::do_list(const Value &body, Env *env) -> Value {
     const Value *walk = &body;
     Value res;
@@ -4,26 +4,51 @@
 #include "nanbox.hpp"
 #include <cstddef>
 #include <initializer_list>
+#include <iosfwd>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 namespace vdlisp {
 
+class EventLoop;
+
+// A State is a fully isolated interpreter instance ("isolate"): it owns its
+// global environment, symbol table, module cache and source maps. Values are
+// never shared between States, so the non-atomic refcounts in `RcBase` stay
+// safe as long as each State is only driven by one thread at a time. Several
+// States may run concurrently on different threads.
 class State {
   public:
     Env *global = nullptr;
     std::unordered_map<std::string, Value> symbol_intern;
 
     State();
+    ~State();
+    State(const State &) = delete;
+    State &operator=(const State &) = delete;
 
     // Release runtime references (best-effort).
     void shutdown_and_purge_pools();
 
+    // Make the startup runtime immortal (see make_immortal): the global
+    // environment with everything bound in it, interned symbols and loaded
+    // modules. From then on new symbols and what `require` defines are frozen
+    // as they appear. For States that live as long as their thread.
+    void freeze_runtime();
+    bool runtime_frozen = false;
+    // what this State froze; emptied by shutdown_and_purge_pools
+    ImmortalSet immortals;
+
     // factory helpers
     [[nodiscard]] auto make_nil() noexcept -> Value;
     [[nodiscard]] auto make_number(double n) noexcept -> Value;
-    [[nodiscard]] auto make_string(const std::string &s) -> Value;
+    [[nodiscard]] auto make_string(std::string s) -> Value;
+    // [offset, offset + n) of the TSTRING value `of`, sharing its bytes when
+    // that saves a copy (see StringData)
+    [[nodiscard]] auto make_string_slice(const Value &of, size_t offset, size_t n) -> Value;
     [[nodiscard]] auto make_symbol(const std::string &s) -> Value;
     [[nodiscard]] auto make_pair(const Value &car, const Value &cdr) -> Value;
     // Overload taking rvalue refs to avoid an extra move when caller can provide temporaries
@@ -35,6 +60,19 @@ class State {
     [[nodiscard]] auto make_prim(const Prim &fn) noexcept -> Value;
     [[nodiscard]] auto make_macro(const Value &params, const Value &body, Env *env) -> Value;
     [[nodiscard]] auto make_macro(Value &&params, Value &&body, Env *env) -> Value;
+    // takes ownership of the initial reference held by `h`
+    [[nodiscard]] auto make_handle(HandleData *h) noexcept -> Value;
+    [[nodiscard]] auto make_vector(std::vector<Value> items = {}) -> Value;
+    [[nodiscard]] auto make_table() -> Value;
+    // `n` uninitialized elements
+    [[nodiscard]] auto make_f64array(size_t n) -> Value;
+    // `n` zero bytes
+    [[nodiscard]] auto make_bytes(size_t n) -> Value;
+    // take ownership of the initial reference held by the new version
+    [[nodiscard]] auto make_hash_map(HashMapData *m) noexcept -> Value;
+    [[nodiscard]] auto make_pvector(PVectorData *v) noexcept -> Value;
+    // takes ownership of the initial reference held by `r`
+    [[nodiscard]] auto make_record(RecordData *r) noexcept -> Value;
 
     // pooled helpers
     [[nodiscard]] auto make_pooled_value(Type t) noexcept -> Value;
@@ -61,6 +99,13 @@ class State {
     [[nodiscard]] auto eval(const Value &expr, Env *env) -> Value;
     [[nodiscard]] auto call(const Value &fn, const Value &args, Env *env = nullptr) -> Value;
     [[nodiscard]] auto do_list(const Value &body, Env *env) -> Value;
+    // Compile `fd` with the shared JIT unless it already is (or failed before).
+    // Returns true when `fd->compiled_code` is usable.
+    auto jit_compile(FuncData *fd) noexcept -> bool;
+    // error raised by compiled code (an f64array index out of range, or one
+    // thrown by a function it called); `call` throws it once the code has
+    // returned
+    std::string jit_error;
 
     // source location helpers
     struct SourceLoc {
@@ -84,12 +129,41 @@ class State {
     std::unordered_map<std::string, std::string> sources;
     // cache for required modules: maps canonical filename to result value
     std::unordered_map<std::string, Value> loaded_modules;
+    // While set, require appends the globals each module it loads defines or
+    // rebinds, with their values when the module is done, so a caller that
+    // rolls the globals back can keep them (see GlobalsSnapshot::adopt).
+    std::vector<std::pair<std::string, Value>> *module_journal = nullptr;
     // return the indicated line (1-based) from a source file; returns false if not available
     [[nodiscard]] auto get_source_line(const std::string &file, size_t line, std::string &out) const -> bool;
+    // While set, the keys added to src_map / src_call_chain_map are appended
+    // here, so a caller evaluating throwaway code can drop them afterwards
+    // with forget_sources (the maps otherwise only grow).
+    std::vector<uint64_t> *source_journal = nullptr;
+    void forget_sources(const std::vector<uint64_t> &keys);
+
+    // destination of `print` (std::cout unless redirected, e.g. per server request)
+    std::ostream *out;
+    // Output to `out` is buffered (see output.hpp): write_out collects bytes
+    // in out_buffer and passes them on once out_capacity is reached, at
+    // flush_out and at shutdown. Whoever redirects `out` or writes to the
+    // stream directly flushes first.
+    void write_out(std::string_view s);
+    void flush_out() noexcept;
+    std::string out_buffer;
+    size_t out_capacity = 64 * 1024;
+
+    // Envs of closures thawed into this State from other isolates, one group
+    // per value, and how many groups the last collection kept (see
+    // thaw_tracked in transfer.hpp); released by shutdown_and_purge_pools
+    std::vector<std::vector<Env *>> thawed_envs;
+    size_t thawed_envs_kept = 0;
+
+    // I/O event loop of this isolate, created by the first I/O builtin (see event.hpp)
+    std::unique_ptr<EventLoop> event_loop;
 
   private:
     // Allocation helpers
-    [[nodiscard]] auto alloc_string(const std::string &s) -> StringData *;
+    [[nodiscard]] auto alloc_string(std::string s) -> StringData *;
     // Allocation helpers take rvalue references to avoid an extra move
     [[nodiscard]] auto alloc_pair(Value &&car, Value &&cdr) -> PairData *;
     [[nodiscard]] auto alloc_func(Value &&params, Value &&body, Env *env) -> FuncData *;
@@ -109,9 +183,20 @@ class State {
     [[nodiscard]] auto set(const Value &sym, Value v, Env *env) -> Value;
 };
 
-// Pointer to the currently active State while executing JIT code.
-// Set by `State::call` before entering native JIT code and cleared after.
-extern State *jit_active_state;
+// Pointer to the State that is executing JIT code on the current thread.
+// Set by `State::call` before entering native JIT code and restored after, so
+// nested native -> interpreter -> native calls and concurrent isolates on
+// other threads each see their own State.
+extern thread_local State *jit_active_state;
+
+// Stack-depth guard: eval throws "stack overflow" once the stack pointer of
+// the calling thread is below `stack_limit`, some way above the end of the
+// stack, instead of faulting on the guard page. The limit of a thread is
+// found on its first eval (it is UINTPTR_MAX until then); coroutines swap in
+// the limit of their own stack while they run.
+extern thread_local uintptr_t stack_limit;
+// The limit for a stack occupying [lo, lo + size).
+[[nodiscard]] auto stack_limit_of(const void *lo, size_t size) noexcept -> uintptr_t;
 
 // utility
 [[nodiscard]] auto list_of(State &S, std::initializer_list<Value> items) -> Value;
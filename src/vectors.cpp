@@ -0,0 +1,73 @@
+#include "vectors.hpp"
+#include "coroutine.hpp"
+#include "helpers.hpp"
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+namespace vdlisp {
+
+namespace {
+
+auto require_vector(const Value &v, const char *who) -> VectorData * {
+    if (!v || v.get_type() != TVECTOR)
+        throw std::runtime_error(std::string(who) + " requires a vector");
+    return v.get_vector();
+}
+
+} // namespace
+
+void register_vectors(State &S) {
+    // (make-vector n [fill]): n elements, all `fill` (default nil)
+    S.register_builtin("make-vector", [](State &S, const Value &args) -> Value {
+        size_t n = require_length(pair_car(args), sizeof(Value), "make-vector");
+        return S.make_vector(std::vector<Value>(n, pair_car(pair_cdr(args))));
+    });
+    // (vector a b ...): a vector of the arguments
+    S.register_builtin("vector", [](State &S, const Value &args) -> Value {
+        std::vector<Value> items;
+        for (Value cur = args; cur; cur = pair_cdr(cur))
+            items.push_back(pair_car(cur));
+        return S.make_vector(std::move(items));
+    });
+    S.register_builtin("vector-ref", [](State &, const Value &args) -> Value {
+        VectorData *vd = require_vector(pair_car(args), "vector-ref");
+        return vd->items[require_index(pair_car(pair_cdr(args)), vd->items.size(), "vector-ref")];
+    });
+    // (vector-set! v i x): store x at i; returns x
+    S.register_builtin("vector-set!", [](State &, const Value &args) -> Value {
+        VectorData *vd = require_vector(pair_car(args), "vector-set!");
+        require_mutable(vd, "vector-set!");
+        Value rest = pair_cdr(args);
+        size_t i = require_index(pair_car(rest), vd->items.size(), "vector-set!");
+        Value x = pair_car(pair_cdr(rest));
+        vd->items[i] = x;
+        return x;
+    });
+    S.register_builtin("vector-length", [](State &S, const Value &args) -> Value {
+        return S.make_number(static_cast<double>(require_vector(pair_car(args), "vector-length")->items.size()));
+    });
+    // (vector-push v x): append x in place; returns v
+    S.register_builtin("vector-push", [](State &, const Value &args) -> Value {
+        Value v = pair_car(args);
+        VectorData *vd = require_vector(v, "vector-push");
+        require_mutable(vd, "vector-push");
+        vd->items.push_back(pair_car(pair_cdr(args)));
+        return v;
+    });
+    // (list->vector seq): elements of a list (or values of a generator)
+    S.register_builtin("list->vector", [](State &S, const Value &args) -> Value {
+        std::vector<Value> items;
+        for_each_item(pair_car(args), "list->vector", [&items](const Value &v) { items.push_back(v); });
+        return S.make_vector(std::move(items));
+    });
+    S.register_builtin("vector->list", [](State &S, const Value &args) -> Value {
+        const auto &items = require_vector(pair_car(args), "vector->list")->items;
+        Value head;
+        for (size_t i = items.size(); i-- > 0;)
+            head = S.make_pair(items[i], std::move(head));
+        return head;
+    });
+}
+
+} // namespace vdlisp
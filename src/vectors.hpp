@@ -0,0 +1,18 @@
+#ifndef VDLISP__VECTORS_HPP
+#define VDLISP__VECTORS_HPP
+
+namespace vdlisp {
+
+class State;
+
+// Vectors (TVECTOR, see VectorData): contiguous arrays of Values printed as
+// `#(a b c)`, with O(1) indexing and push at the end. Indexes are integral
+// numbers in [0, length).
+//
+// make-vector / vector / vector-ref / vector-set! / vector-length /
+// vector-push / list->vector / vector->list
+void register_vectors(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__VECTORS_HPP
@@ -0,0 +1,102 @@
+#ifndef VDLISP__WIRE_HPP
+#define VDLISP__WIRE_HPP
+
+// Framing shared by the evaluation server and its client (see server.hpp):
+// each message is `u32 length (little endian) | body`.
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace vdlisp::wire {
+
+// largest frame either side accepts
+constexpr uint32_t kMaxFrame = 64u << 20;
+
+inline auto unix_address(const std::string &path, sockaddr_un &addr) -> bool {
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        return false;
+    std::memcpy(addr.sun_path, path.data(), path.size());
+    return true;
+}
+
+inline auto write_all(int fd, const char *p, size_t n) -> bool {
+    while (n) {
+        ssize_t w = ::send(fd, p, n, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += w;
+        n -= static_cast<size_t>(w);
+    }
+    return true;
+}
+
+inline void put_u32(std::string &s, uint32_t v) {
+    for (int i = 0; i < 4; ++i)
+        s.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+inline auto get_u32(const char *p) -> uint32_t {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i)
+        v |= static_cast<uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+    return v;
+}
+
+inline auto write_frame(int fd, const std::string &body) -> bool {
+    std::string head;
+    put_u32(head, static_cast<uint32_t>(body.size()));
+    return write_all(fd, head.data(), head.size()) && write_all(fd, body.data(), body.size());
+}
+
+// Read exactly `n` bytes. With `stop_fd` >= 0 the wait also ends (false)
+// once the server is stopping, and with `timeout_ms` >= 0 when no byte
+// arrives for that long.
+inline auto read_exact(int fd, char *p, size_t n, int stop_fd, int timeout_ms = -1) -> bool {
+    while (n) {
+        if (stop_fd >= 0 || timeout_ms >= 0) {
+            pollfd fds[2] = {{fd, POLLIN, 0}, {stop_fd, POLLIN, 0}};
+            int ready = ::poll(fds, stop_fd >= 0 ? 2 : 1, timeout_ms);
+            if (ready < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            if (ready == 0 || fds[1].revents)
+                return false;
+        }
+        ssize_t r = ::read(fd, p, n);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return false;
+        p += r;
+        n -= static_cast<size_t>(r);
+    }
+    return true;
+}
+
+inline auto read_frame(int fd, std::string &body, int stop_fd, int timeout_ms = -1) -> bool {
+    char head[4];
+    if (!read_exact(fd, head, 4, stop_fd, timeout_ms))
+        return false;
+    uint32_t n = get_u32(head);
+    if (n > kMaxFrame)
+        return false;
+    body.resize(n);
+    return read_exact(fd, body.data(), n, stop_fd, timeout_ms);
+}
+
+} // namespace vdlisp::wire
+
+#endif // VDLISP__WIRE_HPP
@@ -0,0 +1,298 @@
+#include "workers.hpp"
+#include "bytes.hpp"
+#include "f64array.hpp"
+#include "helpers.hpp"
+#include "persistent.hpp"
+#include "record.hpp"
+#include "transfer.hpp"
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <unordered_set>
+
+namespace vdlisp {
+
+static thread_local State *current_worker = nullptr;
+static thread_local size_t current_index = 0;
+
+static auto default_pool_size() -> size_t {
+    if (const char *env = getenv("VDLISP__WORKERS")) {
+        long n = strtol(env, nullptr, 10);
+        if (n > 0)
+            return static_cast<size_t>(n);
+    }
+    unsigned hw = std::thread::hardware_concurrency();
+    return hw ? hw : 1;
+}
+
+auto WorkerPool::instance() -> WorkerPool & {
+    static WorkerPool pool(default_pool_size());
+    return pool;
+}
+
+auto WorkerPool::current() noexcept -> State * {
+    return current_worker;
+}
+
+WorkerPool::WorkerPool(size_t n) {
+    workers.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+        workers.push_back(std::make_unique<Worker>());
+    for (size_t i = 0; i < n; ++i)
+        workers[i]->thread = std::thread([this, i] { run(i); });
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    sleep_cv.notify_all();
+    for (auto &w : workers) {
+        // `exit` called from a task tears the pool down on a worker thread
+        if (w->thread.get_id() == std::this_thread::get_id())
+            w->thread.detach();
+        else if (w->thread.joinable())
+            w->thread.join();
+    }
+}
+
+void WorkerPool::submit(WorkerTask task) {
+    size_t target = current_worker ? current_index : next.fetch_add(1, std::memory_order_relaxed) % workers.size();
+    {
+        // counted first (so a concurrent take never underflows) and under the
+        // sleep lock so a worker between its empty check and its wait cannot miss us
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        queued.fetch_add(1, std::memory_order_relaxed);
+    }
+    {
+        std::lock_guard<std::mutex> lock(workers[target]->mutex);
+        workers[target]->tasks.push_back(std::move(task));
+    }
+    sleep_cv.notify_one();
+}
+
+// Own deque from the back, then steal from the front of the others.
+auto WorkerPool::take(size_t self, WorkerTask &out) -> bool {
+    {
+        Worker &w = *workers[self];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.tasks.empty()) {
+            out = std::move(w.tasks.back());
+            w.tasks.pop_back();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    for (size_t k = 1; k < workers.size(); ++k) {
+        Worker &w = *workers[(self + k) % workers.size()];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.tasks.empty()) {
+            out = std::move(w.tasks.front());
+            w.tasks.pop_front();
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+auto WorkerPool::help() -> bool {
+    State *S = current_worker;
+    if (!S)
+        return false;
+    WorkerTask task;
+    if (!take(current_index, task))
+        return false;
+    task(*S);
+    return true;
+}
+
+void WorkerPool::run(size_t self) {
+    State S;
+    load_lang_basics(S);
+    S.freeze_runtime();
+    current_worker = &S;
+    current_index = self;
+    // every task starts from the globals of a fresh worker
+    GlobalsSnapshot fresh(S);
+    while (true) {
+        WorkerTask task;
+        if (take(self, task)) {
+            task(S);
+            fresh.restore(S);
+            rc_safepoint();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        sleep_cv.wait(lock, [this] { return stopping || queued.load(std::memory_order_relaxed) > 0; });
+        if (stopping && queued.load(std::memory_order_relaxed) == 0)
+            break;
+    }
+    current_worker = nullptr;
+}
+
+// -------------------- futures --------------------
+
+struct FutureCore {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool done = false;
+    Frozen result;
+    std::string error;
+};
+
+class FutureHandle : public HandleData {
+  public:
+    explicit FutureHandle(std::shared_ptr<FutureCore> core) : core(std::move(core)) {}
+    [[nodiscard]] auto type_name() const -> const char * override { return "future"; }
+    [[nodiscard]] auto detach() const -> std::function<HandleData *()> override {
+        auto c = core;
+        return [c]() -> HandleData * { return new FutureHandle(c); };
+    }
+
+    std::shared_ptr<FutureCore> core;
+    // result thawed into the owning State by the first await
+    Value value;
+    bool resolved = false;
+};
+
+static auto await_future(State &S, FutureHandle *fh) -> Value {
+    if (fh->resolved)
+        return fh->value;
+    FutureCore &fc = *fh->core;
+    {
+        std::unique_lock<std::mutex> lock(fc.mutex);
+        WorkerPool::instance().wait(lock, fc.cv, [&fc] { return fc.done; });
+    }
+    rc_safepoint();
+    if (!fc.error.empty())
+        throw std::runtime_error(fc.error);
+    fh->value = thaw_tracked(S, fc.result);
+    fh->resolved = true;
+    return fh->value;
+}
+
+void register_workers(State &S) {
+    // (spawn f args...): run (f args...) on a worker isolate. The function, its
+    // captured values and the arguments are deep-copied into the worker.
+    S.register_builtin("spawn", [](State &S, const Value &args) -> Value {
+        Value fn = pair_car(args);
+        if (!fn || (fn.get_type() != TFUNC && fn.get_type() != TCFUNC))
+            throw std::runtime_error("spawn requires a function");
+        // freeze function and arguments together so shared structure survives
+        auto job = std::make_shared<Frozen>(Frozen::freeze(S, args));
+        auto core = std::make_shared<FutureCore>();
+        // output before the spawn comes before the task's
+        S.flush_out();
+        WorkerPool::instance().submit([job, core](State &W) {
+            std::vector<Env *> envs;
+            Frozen result;
+            std::string error;
+            try {
+                Value call = job->thaw(W, &envs);
+                Value r = W.call(pair_car(call), pair_cdr(call));
+                result = Frozen::freeze(W, r);
+            } catch (const std::exception &ex) {
+                error = ex.what();
+                if (error.empty())
+                    error = "spawned task failed";
+            } catch (...) {
+                error = "spawned task failed";
+            }
+            purge_thawed_envs(envs);
+            // the output is out before await returns
+            W.flush_out();
+            {
+                std::lock_guard<std::mutex> lock(core->mutex);
+                core->result = std::move(result);
+                core->error = std::move(error);
+                core->done = true;
+            }
+            core->cv.notify_all();
+        });
+        return S.make_handle(new FutureHandle(core));
+    });
+    // (share v): wrap pure data (lists, vectors, f64arrays, bytes, strings,
+    // symbols, numbers, pvectors, records and hash-maps with number or string
+    // keys) so spawn / send pass it by reference instead of copying it into
+    // every isolate. Everything reachable from v becomes read-only for good,
+    // in this isolate too: setcar, vector-set!, f64-set!, bytes-set! and the
+    // other mutators refuse it (pvectors, hash-maps and records are immutable).
+    S.register_builtin("share", [](State &S, const Value &args) -> Value {
+#if VDLISP__BIASED_RC
+        Value v = pair_car(args);
+        std::vector<Value> work{v};
+        std::unordered_set<uint64_t> seen;
+        while (!work.empty()) {
+            Value cur = std::move(work.back());
+            work.pop_back();
+            while (cur.get_type() == TPAIR && seen.insert(cur.identity_key()).second) {
+                cur.get_pair()->set_readonly();
+                work.push_back(cur.get_pair()->car);
+                cur = cur.get_pair()->cdr;
+            }
+            if (cur.get_type() == TVECTOR) {
+                if (seen.insert(cur.identity_key()).second) {
+                    cur.get_vector()->set_readonly();
+                    for (const Value &item : cur.get_vector()->items)
+                        work.push_back(item);
+                }
+                continue;
+            }
+            if (cur.get_type() == TPVECTOR) {
+                if (seen.insert(cur.identity_key()).second)
+                    cur.get_pvector()->for_each([&work](const Value &item) { work.push_back(item); });
+                continue;
+            }
+            if (cur.get_type() == TRECORD) {
+                if (seen.insert(cur.identity_key()).second)
+                    for (size_t i = 0; i < cur.get_record()->size(); ++i)
+                        work.push_back(cur.get_record()->slots()[i]);
+                continue;
+            }
+            if (cur.get_type() == THASHMAP) {
+                // keys must hash the same in every isolate (not symbols)
+                if (seen.insert(cur.identity_key()).second)
+                    cur.get_hash_map()->for_each([&work](const Value &k, const Value &item) {
+                        if (k && k.get_type() != TNUMBER && k.get_type() != TSTRING)
+                            throw std::runtime_error("share: hash-map keys must be numbers or strings, got " + k.type_name());
+                        work.push_back(k);
+                        work.push_back(item);
+                    });
+                continue;
+            }
+            Type t = cur.get_type();
+            if (t != TPAIR && t != TNIL && t != TNUMBER && t != TSTRING && t != TSYMBOL && t != TF64ARRAY &&
+                t != TBYTES)
+                throw std::runtime_error("share: cannot share a " + cur.type_name());
+            // a string slice (or mapped file) copies its bytes now, not
+            // lazily on a read racing with other isolates
+            if (t == TSTRING)
+                (void)cur.get_string();
+            if (t == TF64ARRAY)
+                cur.get_f64array()->set_readonly();
+            if (t == TBYTES) {
+                // views of the same storage elsewhere must not write either
+                cur.get_bytes()->set_readonly();
+                if (cur.get_bytes()->owner())
+                    cur.get_bytes()->owner().get_bytes()->set_readonly();
+            }
+        }
+        return S.make_handle(new SharedHandle(v));
+#else
+        throw std::runtime_error("share: requires a build with VDLISP_BIASED_RC");
+#endif
+    });
+    // (await fut): block until the spawned task finishes and return its
+    // result copied into this isolate; errors raised by the task are rethrown.
+    S.register_builtin("await", [](State &S, const Value &args) -> Value {
+        Value f = pair_car(args);
+        auto *fh = f.get_type() == THANDLE ? dynamic_cast<FutureHandle *>(f.get_handle()) : nullptr;
+        if (!fh)
+            throw std::runtime_error("await requires a future");
+        return await_future(S, fh);
+    });
+}
+
+} // namespace vdlisp
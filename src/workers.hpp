@@ -0,0 +1,96 @@
+#ifndef VDLISP__WORKERS_HPP
+#define VDLISP__WORKERS_HPP
+
+#include "vdlisp.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vdlisp {
+
+// A unit of work executed on a worker thread with that worker's own State.
+using WorkerTask = std::function<void(State &)>;
+
+// Process-wide pool of worker isolates. Each worker thread owns a State that
+// is initialized once (builtins + `scripts/lang_basics.lisp`) and reused for
+// every task it runs; after each task its global bindings (and loaded
+// modules) are put back as they were after initialization, so a `set` of a
+// global in one task is not seen by the next. The pool is started on first use; its size is taken
+// from `VDLISP__WORKERS` or the hardware concurrency.
+//
+// Scheduling is work-stealing: every worker has its own deque. Tasks
+// submitted from a worker go to the back of its deque and are popped LIFO
+// (good locality for nested parallelism); idle workers steal from the front
+// of other deques. Tasks submitted from outside the pool are dealt round-robin.
+class WorkerPool {
+  public:
+    [[nodiscard]] static auto instance() -> WorkerPool &;
+    // State of the worker running on the calling thread, nullptr off-pool.
+    [[nodiscard]] static auto current() noexcept -> State *;
+
+    void submit(WorkerTask task);
+    // Run one queued task on the calling worker thread. Workers that block on
+    // a result call this so nested spawns cannot starve the pool.
+    auto help() -> bool;
+    [[nodiscard]] auto size() const noexcept -> size_t { return workers.size(); }
+
+    // Block on `cv` until `done()` holds. On a worker thread the wait keeps
+    // running queued tasks instead of sleeping.
+    template <class Pred>
+    void wait(std::unique_lock<std::mutex> &lock, std::condition_variable &cv, Pred done) {
+        if (!current()) {
+            cv.wait(lock, done);
+            return;
+        }
+        while (!done()) {
+            lock.unlock();
+            bool ran = help();
+            lock.lock();
+            if (!ran && !done())
+                cv.wait_for(lock, std::chrono::milliseconds(1));
+        }
+    }
+
+    ~WorkerPool();
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+  private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<WorkerTask> tasks;
+        std::thread thread;
+    };
+
+    explicit WorkerPool(size_t n);
+    void run(size_t self);
+    auto take(size_t self, WorkerTask &out) -> bool;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> next{0};
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+    bool stopping = false;
+};
+
+// Run work(chunk) for every chunk in [0, chunks) on the pool and the calling
+// thread, as pmap does, and rethrow the first error in chunk order. `work` is
+// native code: on pool threads it must not touch the caller's Values.
+void parallel_chunks(State &S, size_t chunks, const std::function<void(size_t)> &work);
+
+// spawn / await builtins
+void register_workers(State &S);
+// pmap / pfor-each / preduce builtins
+void register_parallel(State &S);
+
+} // namespace vdlisp
+
+#endif // VDLISP__WORKERS_HPP
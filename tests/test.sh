@@ -25,6 +25,9 @@ VDLISP__BIN=${VDLISP__BIN:-build/vdlisp}
   fi
 }
 
+# Shared prelude for the tests that need it: (rng n) builds (0 1 ... n-1).
+RNG=$'(set rng (fn (n) (let (acc nil) (while (> n 0) (set n (- n 1)) (set acc (cons n acc))) acc)))\n'
+
 # Test cases: each item is "<expr>" "<expected>".
 # If expected starts with 'err:' we assert the interpreter prints an error
 # containing the substring after 'err:'. For error cases we also assert the
@@ -64,6 +67,9 @@ TESTS=(
   # Modules / require
   $'(require "tests/mod.lisp")\n(type __req_test)' 'number'
   '(require "no-such-file-123.lisp")' 'err:could not open file'
+  # module bindings and argv are immortal: rebinding / mutating them still works
+  $'(require "tests/mod.lisp")\n(set __req_test (+ __req_test 1))\n(require "tests/mod.lisp")\n__req_test' '43'
+  $'(setcar argv (list 1 2))\n(car argv)' '(1 2)'
 
   # Quote, fn, macro
   "'(1 2 3)" '(1 2 3)'
@@ -121,6 +127,200 @@ TESTS=(
   # JIT with external numeric variable (free var lookup)
   $'(set y 10)\n(set f (fn (x) (+ x y)))\n(f 1)\n(f 1)\n(f 1)\n(f 1)\n(f 1)\n(type f)' 'jit_func'
 
+  # Worker isolates: spawn / await
+  $'(set sq (fn (x) (* x x)))\n(await (spawn sq 7))' '49'
+  $'(set addk (let (k 10) (fn (x) (+ x k))))\n(await (spawn addk 5))' '15'
+  $'(set fib (fn (n) (cond ((< n 2) n) (#t (+ (fib (- n 1)) (fib (- n 2)))))))\n(set fs (list (spawn fib 15) (spawn fib 16)))\n(+ (await (car fs)) (await (car (cdr fs))))' '1597'
+  $'(set f (fn (n) (list n "x" (quote y))))\n(await (spawn f 3))' '(3 x y)'
+  $'(set g (fn (n) (await (spawn + n 1))))\n(await (spawn g 41))' '42'
+  '(await (spawn (fn () (/ 1 0))))' 'err:division by zero'
+  '(spawn 1)' 'err:spawn requires a function'
+  '(share (list 1))' 'err:share: requires a build with VDLISP_BIASED_RC'
+  $'(set i 0)\n(while (< i 8) (await (spawn (fn () (set car 5)))) (set i (+ i 1)))\n(await (spawn (fn () (car (list 1 2)))))' '1'
+  $'(set rss (fn () (let (s (read-file "/proc/self/status") at (string-find s "VmRSS:")) (string->number (substring s (+ at 6) (string-find s " kB" at))))))\n(set a (make-f64array 100000))\n(set g (fn (n) (cond ((< n 1) (f64-length a)) (#t (g (- n 1))))))\n(set before (rss))\n(set i 0)\n(while (< i 300) (set f (await (spawn (fn () g)))) (set i (+ i 1)))\n(list (f 3) (< (- (rss) before) 100000))' '(100000 #t)'
+
+  # Channels between isolates (capacity 4 forces back-pressure)
+  $'(set c (make-chan 4))\n(set prod (fn (ch n) (let (i 0) (while (< i n) (send ch i) (set i (+ i 1)))) (close-chan ch) n))\n(set f (spawn prod c 100))\n(set s 0)\n(set v (recv c))\n(while v (set s (+ s v)) (set v (recv c)))\n(list s (await f))' '(4950 100)'
+  $'(set c (make-chan 2))\n(send c (list 1 "a"))\n(list (try-recv c) (try-recv c))' '((1 a) nil)'
+  $'(set c (make-chan 1))\n(list (try-send c 1) (try-send c 2) (try-recv c) (try-send c 3))' '(#t nil 1 #t)'
+  $'(set c (make-chan 3))\n(list (try-send c 1) (try-send c 2) (try-send c 3) (try-send c 4))' '(#t #t #t nil)'
+  $'(set c (make-chan 2))\n(send c nil)\n(close-chan c)\n(list (recv c (quote done)) (recv c (quote done)) (try-recv c 0))' '(nil done 0)'
+  # every value a sender managed to queue is received, even when the close
+  # lands while sends are in flight
+  $'(set c (make-chan 1000000))\n(set push (fn (ch) (let (n 1) (while (try-send ch n) (set n (+ n 1))) (- n 1))))\n(set ts (list (spawn push c) (spawn push c) (spawn push c)))\n(sleep 5)\n(close-chan c)\n(set got 0)\n(while (recv c) (set got (+ got 1)))\n(set sent (fold + 0 (map await ts)))\n(list (= got sent) (> sent 0))' '(#t #t)'
+  '(type (make-chan))' 'chan'
+  '(send (let (c (make-chan)) (close-chan c) c) 1)' 'err:channel is closed'
+
+  # Parallel pmap / pfor-each / preduce
+  '(pmap (fn (x) (* x x)) (list 1 2 3))' '(1 4 9)'
+  "$RNG"$'(preduce + 0 (rng 1000))' '499500'
+  "$RNG"$'(set k "k")\n(car (cdr (pmap (fn (x) (list x k)) (rng 100))))' '(1 k)'
+  "$RNG"$'(set c (make-chan 128))\n(pfor-each (fn (x) (send c x)) (rng 100))\n(set s 0)\n(while (try-recv c) (set s (+ s 1)))\ns' '100'
+  "$RNG"$'(preduce (fn (a b) (+ a b)) 0 (pmap (fn (x) (* x 2)) (rng 5000)))' '2.4995e+07'
+  # f runs on copies wherever it runs: globals and elements of the caller are untouched
+  "$RNG"$'(set n 0)\n(set l (list (list 1)))\n(pfor-each (fn (x) (set n (+ n 1))) (rng 100))\n(pfor-each (fn (x) (set n (+ n 1)) (setcar x 9)) l)\n(list n l (preduce (fn (a b) (set n 5) (+ a b)) 0 (rng 100)) n)' '(0 ((1)) 4950 0)'
+  '(pmap (fn (x) (/ x 0)) (list 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30 31 32 33))' 'err:division by zero'
+  '(pmap 1 (list 1))' 'err:pmap requires a function'
+
+  # Coroutines / generators (gen yields 0..n-1, then returns done)
+  $'(set r (fn (n) (cond ((< n 1) 0) (#t (+ 1 (r (- n 1)))))))\n(list (r 2000) (resume (coroutine (fn () (r 2000)))) (await (spawn r 2000)))' '(2000 2000 2000)'
+  '(let (r nil) (set r (fn (n) (cons n (r (+ n 1))))) (r 0))' 'err:stack overflow'
+  '(resume (coroutine (fn () (let (r nil) (set r (fn (n) (+ 1 (r (+ n 1))))) (r 0)))))' 'err:stack overflow'
+  $'(set gen (fn (n) (coroutine (fn () (let (i 0) (while (< i n) (yield i) (set i (+ i 1)))) (quote done)))))\n(set g (gen 3))\n(list (resume g) (resume g) (resume g) (coroutine-done? g) (resume g) (coroutine-done? g))' '(0 1 2 nil done #t)'
+  $'(set echo (coroutine (fn (a) (let (b (yield (+ a 1))) (yield (+ b 1))))))\n(list (resume echo 10) (resume echo 20))' '(11 21)'
+  $'(set gen (fn (n) (coroutine (fn () (let (i 0) (while (< i n) (yield i) (set i (+ i 1))))))))\n(list (preduce + 0 (gen 100)) (pmap (fn (x) (* x x)) (gen 4)))' '(4950 (0 1 4 9))'
+  $'(set gen (fn (n) (coroutine (fn () (let (i 0) (while (< i n) (yield (list i)) (set i (+ i 1))))))))\n(set i 0)\n(while (< i 1000) (set g (gen 10)) (resume g) (set i (+ i 1)))\ni' '1000'
+  '(resume (coroutine (fn () (/ 1 0))))' 'err:division by zero'
+  '(yield 1)' 'err:yield outside of a coroutine'
+  $'(let (c (coroutine (fn () 1))) (resume c) (resume c))' 'err:coroutine is dead'
+
+  # Vectors
+  $'(set v (make-vector 3 0))\n(vector-set! v 1 (list 1 2))\n(vector-push v 9)\n(list (vector-length v) (vector-ref v 1) (type v))' '(4 (1 2) vector)'
+  '(vector 1 "a" (vector 2))' '#(1 a #(2))'
+  '(list (= (vector 1 (list 2)) (vector 1 (list 2))) (= (vector 1) (vector 2)))' '(#t nil)'
+  '(vector->list (list->vector (list 1 2 3)))' '(1 2 3)'
+  $'(set v (make-vector 40 2))\n(list (preduce + 0 v) (car (pmap (fn (x) (list x)) v)))' '(80 (2))'
+  $'(set l (list 2 3))\n(set v (vector l l))\n(await (spawn (fn (x) (setcar (vector-ref x 0) 9) (vector-ref x 1)) v))' '(9 3)'
+  '(vector-ref (vector 1 2) 2)' 'err:vector-ref: index 2 out of range for length 2'
+  '(vector-ref (vector 1 2) 1.5)' 'err:vector-ref: index must be an integer, got 1.5'
+  '(vector-ref (vector 1 2) 1e300)' 'err:vector-ref: index 1e+300 out of range for length 2'
+  '(make-vector 1e20)' 'err:make-vector: length 1e+20 is too large'
+  '(vector-set! (list 1) 0 1)' 'err:vector-set! requires a vector'
+  '(make-vector -1)' 'err:make-vector requires a non-negative integer length'
+
+  # Tables (insertion-ordered; strings and numbers compare by content)
+  $'(set t (make-table "a" 1 (quote b) 2))\n(table-set t 3 "c")\n(list (table-get t "a") (table-get t (quote b)) (table-get t 3) (table-get t 4 0) (table-count t) (type t))' '(1 2 c 0 3 table)'
+  $'(set t (make-table 1 2 "x" 3))\n(table-set t -0 4)\n(list (table-del t 1) (table-del t 1) (table-has? t "x") (table-get t 0) t)' '(#t nil #t 4 #table((x . 3) (-0 . 4)))'
+  $'(set t (make-table))\n(set i 0)\n(while (< i 5000) (table-set t i i) (set i (+ i 1)))\n(set i 0)\n(while (< i 5000) (table-del t i) (set i (+ i 2)))\n(list (table-count t) (car (table-keys t)) (car (table-values t)))' '(2500 1 1)'
+  $'(set t (make-table 1 10 2 20))\n(set s 0)\n(table-for-each t (fn (k v) (table-del t k) (set s (+ s (+ k v)))))\n(list s (table-count t))' '(33 0)'
+  '(list (= (make-table 1 2 3 (list 4)) (make-table 3 (list 4) 1 2)) (= (make-table 1 2) (make-table 1 3)))' '(#t nil)'
+  $'(set t (make-table (quote k) (vector 1)))\n(await (spawn (fn (x) (table-get x (quote k))) t))' '#(1)'
+  '(table-get (list 1) 1)' 'err:table-get requires a table'
+  '(make-table 1)' 'err:make-table requires an even number of arguments'
+  # f64arrays (elementwise kernels: SIMD_TESTS below)
+  '(list (f64array 1 2.5) (type (f64array)) (f64-length (make-f64array 3 7)) (f64array->list (list->f64array (vector 1 2))))' '(#f64(1 2.5) f64array 3 (1 2))'
+  $'(set a (make-f64array 2))\n(f64-set! a 1 4)\n(list a (f64-ref a 1) (= a (f64array 0 4)))' '(#f64(0 4) 4 #t)'
+  '(list (await (spawn (fn (a) (f64-sum a)) (f64array 1 2 3))) (await (spawn (fn () (f64array 1 2)))))' '(6 #f64(1 2))'
+  # compiled while loops index free-variable f64arrays directly
+  $'(set xs (make-f64array 100 0))\n(set fill (fn (k) (let (i 0) (while (< i (f64-length xs)) (f64-set! xs i (* i k)) (set i (+ i 1))) k)))\n(set total (fn (n) (let (i 0 s 0) (while (< i n) (set s (+ s (f64-ref xs i))) (set i (+ i 1))) s)))\n(fill 1)\n(fill 1)\n(fill 1)\n(fill 1)\n(fill 2)\n(list (total 100) (total 100) (total 100) (total 100) (total 100) (type fill) (type total))' '(9900 9900 9900 9900 9900 jit_func jit_func)'
+  '(let (xs (make-f64array 2) f (fn (n) (f64-ref xs n))) (f 0) (f 0) (f 0) (f 0) (f 5))' 'err:f64-ref: index 5 out of range for length 2'
+  '(f64-ref (f64array 1) 1)' 'err:f64-ref: index 1 out of range for length 1'
+  '(let (xs (make-f64array 2) f (fn (n) (f64-ref xs n))) (f 0) (f 0) (f 0) (f 0) (f -1e30))' 'err:f64-ref: index -1e+30 out of range for length 2'
+  '(set a (f64array 10 10)) (set r 1) (set g (fn () r)) (set bump (fn (i) (f64-set! a i (+ (f64-ref a i) 1)) (g))) (bump 1) (bump 1) (bump 1) (bump 1) (bump 1) (set r "x") (bump 0)' 'err:f64-set!: compiled code met a value that is not a number after storing'
+  '(set a (f64array 10 10)) (set r 1) (set g (fn () r)) (set bump (fn (i) (f64-set! a i (+ (f64-ref a i) 1)) (g))) (map bump (list 1 1 1 1 1)) (set r "x") (map bump (list 0))' 'err:f64-set!: compiled code met a value that is not a number after storing'
+  $'(set a (f64array 10 10))\n(set bump (fn (i) (f64-set! a i (+ (f64-ref a i) 1))))\n(map bump (list 1 1 1 1 1))\n(list (type bump) (map bump (list 0 0)) a)' '(jit_func (11 12) #f64(12 15))'
+  '(make-f64array 2305843009213694464)' 'err:make-f64array: length 2305843009213694464 is too large'
+  '(make-f64array 1e20)' 'err:make-f64array: length 1e+20 is too large'
+  '(f64-add (f64array 1) (f64array 1 2))' 'err:f64-add: length mismatch (1 vs 2)'
+  '(f64-min (f64array))' 'err:f64-min requires a non-empty f64array'
+  '(f64-sum (list 1))' 'err:f64-sum requires an f64array'
+
+  # bytes
+  '(list (bytes 1 255) (type (bytes)) (make-bytes 3 7) (bytes->string (string->bytes "hello") 1 4))' '(#u8(1 255) bytes #u8(7 7 7) ell)'
+  $'(set b (make-bytes 8))\n(bytes-u16-set! b 0 258 \'big)\n(bytes-s32-set! b 4 -2)\n(list b (bytes-u16-ref b 0) (bytes-u16-ref b 0 \'big) (bytes-s32-ref b 4) (bytes-u16-ref b 4 \'big))' '(#u8(1 2 0 0 254 255 255 255) 513 258 -2 65279)'
+  $'(set b (make-bytes 8))\n(bytes-f64-set! b 0 1.5 \'big)\n(list b (bytes-f64-ref b 0 \'big) (bytes-f32-ref (bytes-slice b 4) 0) (bytes-s64-ref (bytes 255 255 255 255 255 255 255 255) 0))' '(#u8(63 248 0 0 0 0 0 0) 1.5 0 -1)'
+  # slices share their owner's bytes, also when sliced again
+  $'(set b (bytes 1 2 3 4 5 6))\n(set v (bytes-slice b 1 5))\n(bytes-fill! v 7)\n(bytes-set! (bytes-slice v 2) 0 9)\n(list b v (bytes-length v) (= v (bytes 7 7 9 7)))' '(#u8(1 7 7 9 7 6) #u8(7 7 9 7) 4 #t)'
+  $'(set c (bytes 1 2 3 4 5))\n(bytes-copy! c 1 c 0 4)\n(list c (bytes-copy c 3) (bytes-copy! (make-bytes 3) 1 c 3))' '(#u8(1 1 2 3 4) #u8(3 4) #u8(0 3 4))'
+  '(list (await (spawn (fn (b) (bytes-ref b 1)) (bytes-slice (bytes 1 2 3) 1))) (await (spawn (fn () (bytes 4 5)))))' '(3 #u8(4 5))'
+  '(bytes-ref (make-bytes 2) 2)' 'err:bytes-ref: index 2 out of range for length 2'
+  '(make-bytes 1e20)' 'err:make-bytes: length 1e+20 is too large'
+  '(bytes 256)' 'err:bytes: byte value must be an integer in 0..255'
+  '(bytes-u16-set! (make-bytes 4) 0 70000)' 'err:bytes-u16-set!: 70000 out of range'
+  '(bytes-u32-ref (make-bytes 4) 1)' 'err:bytes-u32-ref: offset 1 out of range for length 4'
+  $'(bytes-u16-ref (make-bytes 2) 0 \'middle)' $'err:bytes-u16-ref: byte order must be \'little or \'big'
+  '(bytes-slice (make-bytes 4) 3 2)' 'err:bytes-slice: start 3 is after end 2'
+  '(bytes-copy! (make-bytes 2) 1 (make-bytes 4))' 'err:bytes-copy!: 4 bytes do not fit at 1 in length 2'
+  '(bytes-length "ab")' 'err:bytes-length requires bytes'
+
+  # persistent collections: updates return new versions, the old ones are unchanged
+  $'(set m (hash-map "a" 1 "b" 2))\n(set m2 (hash-map-set (hash-map-del m "a") 3 "c"))\n(list m (hash-map-get m2 "a" 0) (hash-map-get m2 3) (hash-map-count m2) (hash-map-has? m "a") (type m))' '(#hash-map((a . 1) (b . 2)) 0 c 2 #t hash-map)'
+  $'(set m (hash-map))\n(set i 0)\n(while (< i 3000) (set m (hash-map-set m i (* i 2))) (set i (+ i 1)))\n(set o m)\n(set i 0)\n(while (< i 3000) (set m (hash-map-del m i)) (set i (+ i 3)))\n(list (hash-map-count o) (hash-map-count m) (hash-map-get o 2997) (hash-map-get m 2997) (hash-map-get m 2998))' '(3000 2000 5994 nil 5996)'
+  $'(set v (pvector))\n(set i 0)\n(while (< i 1100) (set v (pvector-push v i)) (set i (+ i 1)))\n(set w (pvector-set v 40 "x"))\n(set u v)\n(while (> (pvector-length u) 3) (set u (pvector-pop u)))\n(list (pvector-ref v 40) (pvector-ref w 40) (pvector-ref w 1099) u (= v (list->pvector (pvector->list v))) (type v))' '(40 x 1099 #pvector(0 1 2) #t pvector)'
+  '(list (= (hash-map 1 (list 2) 3 4) (hash-map 3 4 1 (list 2))) (preduce + 0 (list->pvector (make-vector 40 2))) (await (spawn (fn (m v) (list (hash-map-get m "k") (pvector-ref v 1))) (hash-map "k" 1) (pvector 1 2))))' '(#t 80 (1 2))'
+  '(pvector-ref (pvector 1 2) 2)' 'err:pvector-ref: index 2 out of range for length 2'
+  '(pvector-pop (pvector))' 'err:pvector-pop: empty pvector'
+  # records (defrecord)
+  $'(defrecord point x y)\n(set p (point 1 (list 2)))\n(list p (point-x p) (point-y p) (point? p) (point? (list 1 2)) (type p) (= p (point 1 (list 2))) (= p (point 1 3)))' '(#point(1 (2)) 1 (2) #t nil point #t nil)'
+  $'(defrecord point x y)\n(set p (point 3 4))\n(set g (fn (n) (let (i 0 s 0) (while (< i n) (set s (+ s (* (point-x p) (point-y p)))) (set i (+ i 1))) s)))\n(list (g 1) (g 2) (g 3) (g 4) (g 5) (type g) (g 1000) (let (p (point 1 1)) (g 10)))' '(12 24 36 48 60 jit_func 12000 120)'
+  $'(defrecord seg a b)\n(set s (seg (list 1) "x"))\n(await (spawn (fn (r) (list (seg? r) (seg-a r) (seg-b r))) s))' '(#t (1) x)'
+  '(list (defrecord point x y) (point 1))' 'err:point: expected 2 fields, got 1'
+  '(list (defrecord point x y) (defrecord size w h) (point-x (size 1 2)))' 'err:point-x requires a point'
+  '(defrecord point 1)' 'err:defrecord: field names must be symbols'
+  '(hash-map 1)' 'err:hash-map requires an even number of arguments'
+  '(hash-map-get (make-table) 1)' 'err:hash-map-get requires a hash-map'
+  # list library
+  '(list (length (list 1 2 3)) (length nil) (length (vector 1 2)) (reverse (list 1 2 3)) (append (list 1 2) nil (list 3) (list 4 5)) (append) (append (list 1) 2))' '(3 0 2 (3 2 1) (1 2 3 4 5) nil (1 . 2))'
+  '(list (map (fn (x) (* x x)) (list 1 2 3)) (map car (vector (list 1) (list 2))) (filter (fn (x) (> x 2)) (list 1 5 2 7)) (fold + 0 (list 1 2 3 4)) (fold (fn (a x) (cons x a)) nil (list 1 2 3)))' '((1 4 9) (1 2) (5 7) 10 (3 2 1))'
+  '(list (nth (list 1 2 3) 2) (last (list 1 2 3)) (last nil) (member 2 (list 1 2 3)) (member "b" (list "a" "b")) (member 9 (list 1)) (assoc "b" (list (cons "a" 1) (cons "b" 2))) (assoc 3 nil))' '(3 3 nil (2 3) (b) nil (b . 2) nil)'
+  $'(set sq (fn (x) (* x x)))\n(list (map sq (list 1 2 3 4 5)) (type sq) (fold (fn (a x) (+ a x)) 0 (list 1 2 3 4 5 6)))' '((1 4 9 16 25) jit_func 21)'
+  $'(set big (vector->list (make-vector 1000000 1)))\n(list (= (length big) 1000000) (fold + 0 (filter (fn (x) (= x 1)) big)) (= (length (reverse (append big (list 2)))) 1000001) (last (map (fn (x) (+ x 1)) big)))' '(#t 1e+06 #t 2)'
+  '(nth (list 1 2) 2)' 'err:nth: index 2 out of range for length 2'
+  '(nth (list 1 2) 0.5)' 'err:nth: index must be an integer, got 0.5'
+  '(length 5)' 'err:length: expected list, got number'
+  '(map 1 (list 1))' 'err:map requires a function'
+  '(append (cons 1 2) (list 3))' 'err:append: expected list, got pair'
+  # sort
+  '(list (sort (list 3 -1 2.5 0 -7 10)) (sort (vector "pear" "apple" "fig" "apple")) (sort (list 1 5 3) >) (sort nil) (sort (vector)))' '((-7 -1 0 2.5 3 10) #(apple apple fig pear) (5 3 1) nil #())'
+  $'(set v (make-vector 300 0))\n(let (i 0) (while (< i 300) (vector-set! v i (* (- i 100.5) (- i 150))) (set i (+ i 1))))\n(set s (sort v))\n(set ok #t)\n(let (i 1) (while (< i 300) (cond ((> (vector-ref s (- i 1)) (vector-ref s i)) (set ok nil))) (set i (+ i 1))))\n(list ok (vector-ref s 0) (vector-ref s 299) (vector-length s))' '(#t -612.5 29576.5 300)'
+  $'(set desc (fn (a b) (> a b)))\n(list (sort (list 4 1 3 2 5 9 7) desc) (type desc) (sort (list (list 2 "b") (list 1 "a") (list 2 "c") (list 1 "d")) (fn (a b) (< (car a) (car b)))))' '((9 7 5 4 3 2 1) jit_func ((1 a) (1 d) (2 b) (2 c)))'
+  '(sort (list 1 "a"))' 'err:sort: without a comparator, elements must be all numbers or all strings'
+  '(sort (list 1 2) 5)' 'err:sort requires a function'
+  '(sort 5)' 'err:sort requires a list or vector'
+  '(output-buffer-size -1)' 'err:output-buffer-size requires a non-negative integer'
+
+  # strings (substring search: SIMD_TESTS below)
+  '(list (string-append "ab" "" "cd") (string-length "hello") (substring "hello" 1 3) (substring "hello" 2))' '(abcd 5 el llo)'
+  '(list (string-find "hello world" "o") (string-find "hello world" "o" 5) (string-find "hello" "xyz") (string-find "abc" ""))' '(4 7 nil 0)'
+  '(list (string-split "a,b,,c" ",") (string-join (list "a" "b" "c") ", ") (string-join (vector "x" "y")) (string-join (string-split "a::b" "::") "-"))' '((a b  c) a, b, c xy a-b)'
+  '(list (string->number "42") (string->number " -1.5e3 ") (string->number "+7") (string->number "12abc") (string->number ""))' '(42 -1500 7 nil nil)'
+  '(list (string->number "nan") (string->number "inf") (string->number "-inf") (string->number "infinity") (string->number "1e400"))' '(nil nil nil nil nil)'
+  '(list (number->string 42) (number->string 0.1) (number->string -2.5) (= (string->number (number->string 0.1234567891234)) 0.1234567891234))' '(42 0.1 -2.5 #t)'
+  $'(set sb (make-string-builder))\n(set i 0)\n(while (< i 3) (string-builder-append! sb "x" i ",") (set i (+ i 1)))\n(list (string-builder->string sb) (string-builder-length sb) (type sb))' '(x0,x1,x2, 9 string-builder)'
+  '(substring "abc" 2 5)' 'err:substring: index 5 out of range for length 3'
+  '(substring "abc" 2 1)' 'err:substring: start 2 is after end 1'
+  '(string-split "abc" "")' 'err:string-split: empty separator'
+  '(string-append "a" 1)' 'err:string-append: expected string, got number'
+  '(string-builder-append! "sb" "x")' 'err:string-builder-append! requires a string-builder'
+  # slices share the bytes of the string they were cut from
+  $'(set s "the quick brown fox jumps over the lazy dog")\n(set t (substring s 4 39))\n(set u (substring t 6 26))\n(set tb (make-table))\n(table-set tb u 1)\n(list u (string-length u) (= u (string-copy u)) (table-get tb "brown fox jumps over") (string-split t " jumps "))' '(brown fox jumps over 20 #t 1 (quick brown fox over the lazy))'
+  $'(set sb (make-string-builder))\n(set i 0)\n(while (< i 10000) (string-builder-append! sb "line " i "\n") (set i (+ i 1)))\n(set f (fd-open "/tmp/vdlisp-read-file-test.txt" "w"))\n(fd-write f (string-builder->string sb))\n(fd-close f)\n(set text (read-file "/tmp/vdlisp-read-file-test.txt"))\n(set lines (string-split text "\n"))\n(list (string-length text) (car lines) (substring text 98880 98889) (= text (string-builder->string sb)))' '(98890 line 0 line 9999 #t)'
+  '(read-file "/nonexistent/vdlisp")' 'err:read-file: could not open /nonexistent/vdlisp'
+  $'(set sb (make-string-builder))\n(set i 0)\n(while (< i 20000) (string-builder-append! sb "line " i "\n") (set i (+ i 1)))\n(set f (fd-open "/tmp/vdlisp-truncate-test.txt" "w"))\n(fd-write f (string-builder->string sb))\n(fd-close f)\n(set text (read-file "/tmp/vdlisp-truncate-test.txt"))\n(set ls (list->vector (lines "/tmp/vdlisp-truncate-test.txt")))\n(set f (open "/tmp/vdlisp-truncate-test.txt" "w"))\n(write-line f "short")\n(close f)\n(list (substring text 100001 100011) (vector-ref ls 19999) (string-length (read-file "/tmp/vdlisp-truncate-test.txt" \'mapped)))' '(line 10101 line 19999 6)'
+  $'(read-file "/tmp/vdlisp-truncate-test.txt" \'mmap)' "err:read-file: the mode must be 'mapped"
+  $'(set sb (make-string-builder))\n(set i 0)\n(while (< i 20000) (string-builder-append! sb "line " i "\\n") (set i (+ i 1)))\n(set f (open "/tmp/vdlisp-truncate-test.txt" "w"))\n(write f (string-builder->string sb))\n(close f)\n(set ls (lines "/tmp/vdlisp-truncate-test.txt"))\n(set first (read-line ls))\n(set f (open "/tmp/vdlisp-truncate-test.txt" "w"))\n(write-line f "short")\n(close f)\n(list first (read-line ls) (< (length ls) 20000))' '(line 0 line 1 #t)'
+  # files (open / read-line / lines)
+  $'(set f (open "/tmp/vdlisp-files-test.txt" "w"))\n(write f "a" 1 " ")\n(write-line f "b")\n(write-line f "second")\n(write f "no newline")\n(close f)\n(close f)\n(set g (open "/tmp/vdlisp-files-test.txt"))\n(list (read-line g) (read-line g) (read-all g) (read-all g) (read-line g) (close g) (list->vector (lines "/tmp/vdlisp-files-test.txt")) (type g))' '(a1 b second no newline  nil nil #(a1 b second no newline) file)'
+  $'(set f (open "/tmp/vdlisp-lines-test.txt" "w"))\n(set i 0)\n(while (< i 20000) (write-line f "line " i) (set i (+ i 1)))\n(close f)\n(set it (lines "/tmp/vdlisp-lines-test.txt"))\n(list (read-line it) (read-line it) (length it) (fold + 0 (map string-length (lines "/tmp/vdlisp-lines-test.txt"))) (length (lines (open "/tmp/vdlisp-lines-test.txt"))) (last (vector->list (list->vector (lines "/tmp/vdlisp-lines-test.txt")))) (type it))' '(line 0 line 1 19998 188890 20000 line 19999 lines)'
+  '(open "/nonexistent/vdlisp")' 'err:open: /nonexistent/vdlisp: No such file or directory'
+  '(open "/tmp/vdlisp-files-test.txt" "rw")' 'err:open: invalid mode rw'
+  '(let (f (open "/tmp/vdlisp-files-test.txt")) (close f) (read-line f))' 'err:read-line: file is closed'
+  '(write-line (open "/tmp/vdlisp-files-test.txt") 1)' 'err:write-line: file is not open for writing'
+  '(read-line 5)' 'err:read-line requires a file'
+
+  # read-csv
+  $'(set f (open "/tmp/vdlisp-csv-test.csv" "w"))\n(write f "name,x,y\\r\\nann,1,2.5\\r\\n\\"bo \\"\\"b\\"\\", jr\\",+3,\\r\\n\\r\\n\\"two\\nlines\\",,7\\ncy,4\\n")\n(close f)\n(set t (read-csv "/tmp/vdlisp-csv-test.csv"))\n(list (table-keys t) (vector-ref (table-get t "name") 1) (string-length (vector-ref (table-get t "name") 2)) (table-get t "x") (table-get t "y") (table-get (read-csv "/tmp/vdlisp-csv-test.csv" "," nil) 1))' '((name x y) bo "b", jr 9 #f64(1 3 nan 4) #f64(2.5 nan 7 nan) #(x 1 +3  4))'
+  $'(set f (open "/tmp/vdlisp-csv-big.tsv" "w"))\n(write-line f "id\\tv\\tname")\n(set i 0)\n(while (< i 300000) (write-line f i "\\t" (* i 0.5) "\\tn" i) (set i (+ i 1)))\n(close f)\n(set t (read-csv "/tmp/vdlisp-csv-big.tsv"))\n(list (f64-length (table-get t "id")) (f64-sum (table-get t "id")) (f64-sum (table-get t "v")) (vector-ref (table-get t "name") 299999))' '(300000 4.49998e+10 2.24999e+10 n299999)'
+  '(let (f (open "/tmp/vdlisp-csv-bad.csv" "w")) (write f "a,b\n1,2\n3,4,5\n") (close f) (read-csv "/tmp/vdlisp-csv-bad.csv"))' 'err:read-csv: /tmp/vdlisp-csv-bad.csv: line 3: 3 fields, expected 2'
+  '(read-csv "/tmp/vdlisp-csv-test.csv" ";;")' 'err:read-csv: separator must be one character'
+  $'(set f (open "/tmp/vdlisp-csv-missing.csv" "w"))\n(write f "x,y\\n1,2\\n,5\\n")\n(close f)\n(set x (table-get (read-csv "/tmp/vdlisp-csv-missing.csv") "x"))\n(list (f64-ref x 0) (f64-ref x 1) (f64array->list x) (f64-sum x) (f64-max x) (f64-min x) (f64-sum (table-get (read-csv "/tmp/vdlisp-csv-missing.csv") "y")))' '(1 nil (1 nil) nil nil nil 7)'
+  $'(set f (open "/tmp/vdlisp-csv-nan.csv" "w"))\n(write f "x,y\\n1,nan\\n2,inf\\n")\n(close f)\n(set t (read-csv "/tmp/vdlisp-csv-nan.csv"))\n(list (table-get t "x") (table-get t "y"))' '(#f64(1 2) #(nan inf))'
+  '(let (f (open "/tmp/vdlisp-csv-dup.csv" "w")) (write f "a,b,a\n1,2,3\n") (close f) (read-csv "/tmp/vdlisp-csv-dup.csv"))' 'err:read-csv: /tmp/vdlisp-csv-dup.csv: duplicate column name a'
+
+  # json-parse / json-emit
+  $'(set v (json-parse "{\\"a\\": [1, 2.5, -3e2, true, false, null], \\"b\\\\u00e9\\": \\"x\\\\\\"y\\\\n\\\\ud83d\\\\ude00\\", \\"c\\": {}, \\"d\\": []}"))\n(list (table-keys v) (table-get v "a") (json-emit v))' $'((a b\xc3\xa9 c d) #(1 2.5 -300 #t nil nil) {"a":[1,2.5,-300,true,null,null],"b\xc3\xa9":"x\\"y\\n\xf0\x9f\x98\x80","c":{},"d":[]})'
+  '(let (v (json-parse "[{\"k\": 1}, {\"k\": [2]}]" #t)) (list v (json-emit v)))' '((((k . 1)) ((k 2))) [{"k":1},[["k",2]]])'
+  '(json-emit (json-parse "[[\"a\",1],[\"b\",2],{}]" #t))' '[["a",1],["b",2],null]'
+  $'(defrecord pt x y)\n(json-emit (list 1 "a\\t" (quote sym) (f64-scale (f64array 1e-300 0.5 1e300) 1e300) (vector) (pt 1 2) (hash-map "z" 1) (= 1 2)))' '[1,"a\t","sym",[1,5e+299,null],[],{"x":1,"y":2},{"z":1},null]'
+  $'(set f (open "/tmp/vdlisp-json-test.json" "w"))\n(json-emit (vector 1 "two") f)\n(close f)\n(json-parse (read-file "/tmp/vdlisp-json-test.json"))' '#(1 two)'
+  '(json-parse "[1 2]")' 'err:json-parse: line 1 column 4: expected'
+  '(json-parse "{\"a\": 01}")' 'err:json-parse: line 1 column 8: expected'
+  '(json-emit print)' 'err:json-emit: cannot encode'
+  $'(json-emit (list (json-parse "{\\"ok\\": false}") (quote false) (json-parse "1e-400")))' '[{"ok":null},false,0]'
+  '(json-parse "1e400")' 'err:json-parse: line 1 column 6: number out of range'
+  '(json-parse "\"\\ud800\"")' 'err:json-parse: line 1 column 8: unpaired surrogate'
+  '(json-parse "\"\\udc00x\"")' 'err:json-parse: line 1 column 8: unpaired surrogate'
+
   # Error cases
   '(parse 1)' 'err:parse requires a string'
   '(apply)' 'err:apply requires a function'
@@ -153,28 +353,28 @@ run_one() {
 
   if [[ "$expected" == err:* ]]; then
     local substr="${expected#err:}"
-    if ! echo "$out" | grep -Fq "$substr"; then
+    if ! grep -Fq "$substr" <<<"$out"; then
       echo "FAILED (expected error): $expr"
       echo "  expected to contain: '$substr'"
       echo "  got               : '$out'"
       exit 1
     fi
     # expect the filename to appear in the error output
-    if ! echo "$out" | grep -Fq "$base"; then
+    if ! grep -Fq "$base" <<<"$out"; then
       echo "FAILED (expected filename in error): $expr"
       echo "  expected to contain filename: '$base'"
       echo "  got                       : '$out'"
       exit 1
     fi
     # expect the source line to be echoed
-    if ! echo "$out" | grep -Fq "$srcline"; then
+    if ! grep -Fq "$srcline" <<<"$out"; then
       echo "FAILED (expected source line in error): $expr"
       echo "  expected source line: '$srcline'"
       echo "  got                : '$out'"
       exit 1
     fi
     # caret presence (allow optional ANSI color sequences before '^')
-    if ! echo "$out" | grep -Eq $'^[[:space:]]*(\033\[[0-9;]*m)?\\^'; then
+    if ! grep -Eq $'^[[:space:]]*(\033\[[0-9;]*m)?\\^' <<<"$out"; then
       echo "FAILED (expected caret in error): $expr"
       echo "  expected a line containing '^' under the source line (optionally colored)"
       echo "  got: '$out'"
@@ -199,19 +399,223 @@ for ((i=0;i<${#TESTS[@]};i+=2)); do
   run_one "${TESTS[i]}" "${TESTS[i+1]}"
 done
 
+# Event loop tests: run once with the default backend (io_uring where the
+# kernel allows it) and once with VDLISP__EVENT_BACKEND=epoll.
+EVENT_TESTS=(
+  $'(set p (pipe))\n(set got nil)\n(go (fn () (set got (list (fd-read (car p)) (fd-read (car p))))))\n(go (fn (s) (sleep 5) (fd-write (car (cdr p)) s) (fd-close (car (cdr p)))) "hi")\n(run-loop)\ngot' '(hi nil)'
+  $'(set out nil)\n(go (fn () (sleep 30) (set out (cons 3 out))))\n(go (fn () (sleep 10) (set out (cons 1 out))))\n(go (fn () (sleep 20) (set out (cons 2 out))))\n(run-loop)\nout' '(3 2 1)'
+  $'(set n 0)\n(set i 0)\n(while (< i 100) (go (fn () (sleep 1) (yield) (set n (+ n 1)))) (set i (+ i 1)))\n(run-loop)\nn' '100'
+  $'(set l (unix-listen "/tmp/vdlisp-event-test.sock"))\n(go (fn () (let (c (unix-accept l)) (fd-write c (fd-read c)) (fd-close c))))\n(set c (unix-connect "/tmp/vdlisp-event-test.sock"))\n(fd-write c "ping")\n(set r (fd-read c))\n(fd-close c)\n(fd-close l)\nr' 'ping'
+  $'(set p (pipe))\n(go (fn () (fd-read (car p))))\n(sleep 1)\n(quote parked-task-cancelled)' 'parked-task-cancelled'
+  '(let (t (go (fn () (sleep 1) (/ 1 0)))) (run-loop))' 'err:division by zero'
+  $'(set p (pipe))\n(set buf (make-bytes 8))\n(fd-write (car (cdr p)) (bytes-slice (string->bytes "xhey") 1))\n(fd-close (car (cdr p)))\n(list (fd-read-into (car p) (bytes-slice buf 2)) buf (fd-read-into (car p) buf))' '(3 #u8(0 0 104 101 121 0 0 0) 0)'
+  '(fd-read -1)' 'err:invalid file descriptor'
+  $'(set r (fn (n) (cond ((< n 1) 0) (#t (+ 1 (r (- n 1)))))))\n(set got nil)\n(go (fn () (sleep 1) (set got (r 2000))))\n(run-loop)\ngot' '2000'
+  '(go 1)' 'err:go requires a function'
+  $'(set f (fd-open "/tmp/vdlisp-event-test.txt" "w"))\n(fd-write f "from a file")\n(fd-close f)\n(set f (fd-open "/tmp/vdlisp-event-test.txt"))\n(set got nil)\n(go (fn () (set got (fd-read f))))\n(run-loop)\n(fd-close f)\ngot' 'from a file'
+)
+for backend in default epoll; do
+  for ((i=0;i<${#EVENT_TESTS[@]};i+=2)); do
+    if [[ "$backend" == epoll ]]; then
+      VDLISP__EVENT_BACKEND=epoll run_one "${EVENT_TESTS[i]}" "${EVENT_TESTS[i+1]}"
+    else
+      run_one "${EVENT_TESTS[i]}" "${EVENT_TESTS[i+1]}"
+    fi
+  done
+done
+rm -f /tmp/vdlisp-event-test.txt
+
+# A task reading an inherited (blocking) stdin must not stall the other
+# tasks: the loop makes the fd non-blocking before it waits on it
+{
+  echo "Running event loop stdin test..."
+  for backend in default epoll; do
+    out=$({ sleep 1; echo x; } | VDLISP__EVENT_BACKEND=$backend timeout 10 "$VDLISP__BIN" -e '(set out nil) (go (fn () (set out (cons (fd-read 0) out)))) (go (fn () (sleep 10) (set out (cons (quote tick) out)))) (run-loop) (reverse out)')
+    if [[ "$out" != $'(tick x\n)' ]]; then
+      echo "FAILED: event loop stdin ($backend)"; echo "$out"; exit 1; fi
+  done
+  echo "ok: event loop stdin"
+}
+
+# f64array kernels and substring search: once per instruction set
+# (VDLISP__SIMD caps the choice; sets the CPU lacks fall back to the next one).
+# 37 elements cover the unrolled loop, single registers and the scalar tail.
+SIMD_TESTS=(
+  $'(set a (make-f64array 37))\n(set i 0)\n(while (< i 37) (f64-set! a i (+ i 1)) (set i (+ i 1)))\n(list (f64-sum a) (f64-dot a a) (f64-min a) (f64-max a))' '(703 17575 1 37)'
+  $'(set a (make-f64array 37 1))\n(f64-set! a 30 -4)\n(f64-set! a 5 100)\n(list (f64-min a) (f64-max a))' '(-4 100)'
+  $'(set a (make-f64array 37))\n(set i 0)\n(while (< i 37) (f64-set! a i (+ i 1)) (set i (+ i 1)))\n(set p (f64-prefix-sum a))\n(list (f64-ref p 0) (f64-ref p 8) (f64-ref p 20) (f64-ref p 36))' '(1 45 231 703)'
+  $'(set a (make-f64array 37))\n(set i 0)\n(while (< i 37) (f64-set! a i (+ i 1)) (set i (+ i 1)))\n(set ten (make-f64array 37 10))\n(list (f64-sum (f64-lt a ten)) (f64-sum (f64-le a ten)) (f64-sum (f64-eq a ten)))' '(9 10 1)'
+  $'(set a (make-f64array 37))\n(set i 0)\n(while (< i 37) (f64-set! a i (+ i 1)) (set i (+ i 1)))\n(list (f64-sum (f64-axpy! 2 a (make-f64array 37 1))) (f64-sum (f64-scale a 0.5)) (f64-sum (f64-add a a)) (f64-sum (f64-mul a a)))' '(1443 351.5 1406 17575)'
+  # 70 bytes: two 32-position blocks, then the tail; "nexdle" matches the
+  # first and last byte only
+  $'(set s (string-append "aaaaaaaaaanexdleaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa" "needle"))\n(list (string-length s) (string-find s "needle") (string-find s "nexdle") (string-find s "nexdle" 11) (string-find s "le" 20) (string-find s "e"))' '(70 64 10 nil 68 11)'
+  '(string-split "alpha--beta--gamma--delta--epsilon--zeta--eta--theta--iota" "--")' '(alpha beta gamma delta epsilon zeta eta theta iota)'
+)
+for simd in scalar avx2 avx512; do
+  for ((i=0;i<${#SIMD_TESTS[@]};i+=2)); do
+    VDLISP__SIMD=$simd run_one "${SIMD_TESTS[i]}" "${SIMD_TESTS[i+1]}"
+  done
+done
+
+# Buffered output: print / write / write-line share one buffer that is
+# flushed in order with errors, worker output and exit
+{
+  echo "Running buffered output test..."
+  tmpf=$(mktemp --suffix=.lisp)
+  printf '%s' '(write "a" 1 " ") (write-line "b" 2.5) (print "c" (list 1 "s")) (output-buffer-size 0) (write-line "d") (output-buffer-size 4) (write-line "longer than four") (await (spawn (fn () (print "worker")))) (write "e") (flush) (write-line "f") (error "boom")' > "$tmpf"
+  out=$("$VDLISP__BIN" "$tmpf" 2>&1 || true)
+  expected=$'a1 b2.5\nc (1 s)\nd\nlonger than four\nworker\nef\nerror: '
+  if [[ "$out" != "$expected"* ]] || ! grep -Fq "boom" <<<"$out"; then
+    echo "FAILED: buffered output"; echo "$out"; rm -f "$tmpf"; exit 1; fi
+  printf '%s' '(write-line "bye") (exit 0)' > "$tmpf"
+  out=$("$VDLISP__BIN" "$tmpf")
+  rm -f "$tmpf"
+  if [[ "$out" != "bye" ]]; then
+    echo "FAILED: output flushed at exit"; echo "$out"; exit 1; fi
+  echo "ok: buffered output"
+}
+
+# Command-line programs: -e / -n / -p over stdin and files
+{
+  echo "Running line filter test..."
+  out=$("$VDLISP__BIN" -e '(+ 1 2)')
+  if [[ "$out" != "3" ]]; then
+    echo "FAILED: -e"; echo "$out"; exit 1; fi
+  out=$(printf 'a b\nc\nlast' | "$VDLISP__BIN" -n -e '(print nr line)')
+  if [[ "$out" != $'1 a b\n2 c\n3 last' ]]; then
+    echo "FAILED: -n"; echo "$out"; exit 1; fi
+  out=$(printf 'x\ny\n' | "$VDLISP__BIN" -p -e '(set line (string-append "<" line ">"))')
+  if [[ "$out" != $'<x>\n<y>' ]]; then
+    echo "FAILED: -p"; echo "$out"; exit 1; fi
+  tmpf=$(mktemp)
+  printf '1\n2\n3\n' > "$tmpf"
+  out=$("$VDLISP__BIN" --begin '(set t 0)' -n -e '(set t (+ t (string->number line)))' --end '(print (list t nr))' "$tmpf" - "$tmpf" < "$tmpf")
+  rm -f "$tmpf"
+  if [[ "$out" != "(18 9)" ]]; then
+    echo "FAILED: --begin / --end over several inputs"; echo "$out"; exit 1; fi
+  out=$(echo 1 | "$VDLISP__BIN" -n -e '(car 1 2' 2>&1 || true)
+  if ! grep -Fq "unexpected EOF" <<<"$out"; then
+    echo "FAILED: -n parse error"; echo "$out"; exit 1; fi
+  echo "ok: line filter"
+}
+
+# Resident server: requests over a unix socket, state kept between them
+{
+  echo "Running server test..."
+  CLIENT_BIN="$(dirname "$VDLISP__BIN")/vdlisp-client"
+  sock=$(mktemp -u /tmp/vdlisp-test-XXXXXX.sock)
+  VDLISP__SERVE_STATES=2 "$VDLISP__BIN" --serve "$sock" &
+  server_pid=$!
+  for _ in $(seq 100); do [ -S "$sock" ] && break; sleep 0.05; done
+  out=$("$CLIENT_BIN" "$sock" -e '(print "hi") (+ 1 2)')
+  if [[ "$out" != $'hi\n3' ]]; then
+    echo "FAILED: server eval"; echo "$out"; kill "$server_pid"; exit 1; fi
+  out=$("$CLIENT_BIN" "$sock" -e '(set tmp 1) (/ 1 0)' 2>&1 || true)
+  if ! grep -Fq "division by zero" <<<"$out"; then
+    echo "FAILED: server error report"; echo "$out"; kill "$server_pid"; exit 1; fi
+  out=$("$CLIENT_BIN" "$sock" -e 'tmp' 2>&1 || true)
+  if ! grep -Fq "unbound symbol: tmp" <<<"$out"; then
+    echo "FAILED: server request definitions should not persist"; echo "$out"; kill "$server_pid"; exit 1; fi
+  for _ in 1 2 3 4; do "$CLIENT_BIN" "$sock" -e '(set car 5)' >/dev/null; done
+  for _ in 1 2 3 4; do
+    out=$("$CLIENT_BIN" "$sock" -e '(car (list 1 2))' 2>&1 || true)
+    if [[ "$out" != "1" ]]; then
+      echo "FAILED: server request set should not persist"; echo "$out"; kill "$server_pid"; exit 1; fi
+  done
+  status=0
+  "$CLIENT_BIN" "$sock" -e '(exit 3)' || status=$?
+  if [[ "$status" != 3 ]]; then
+    echo "FAILED: server exit status ($status)"; kill "$server_pid"; exit 1; fi
+  tmpf=$(mktemp --suffix=.lisp)
+  printf '%s' '(car (cdr argv))' > "$tmpf"
+  out=$("$VDLISP__BIN" --client "$sock" "$tmpf" arg1)
+  rm -f "$tmpf"
+  if [[ "$out" != "arg1" ]]; then
+    echo "FAILED: server run file"; echo "$out"; kill "$server_pid"; exit 1; fi
+  if [[ "$(stat -c %a "$sock")" != 600 ]]; then
+    echo "FAILED: server socket should be private"; stat -c %a "$sock"; kill "$server_pid"; exit 1; fi
+  "$CLIENT_BIN" "$sock" --stop
+  wait "$server_pid"
+  if [ -e "$sock" ]; then
+    echo "FAILED: server left its socket behind"; exit 1; fi
+  # a connection that sends nothing does not keep the only State
+  VDLISP__SERVE_STATES=1 VDLISP__SERVE_IDLE_MS=300 "$VDLISP__BIN" --serve "$sock" &
+  server_pid=$!
+  for _ in $(seq 100); do [ -S "$sock" ] && break; sleep 0.05; done
+  "$VDLISP__BIN" -e "(let (fd (unix-connect \"$sock\")) (sleep 5000))" >/dev/null &
+  idle_pid=$!
+  sleep 0.1
+  out=$(timeout 3 "$CLIENT_BIN" "$sock" -e '(+ 1 2)' 2>&1 || true)
+  kill -KILL "$idle_pid" 2>/dev/null; wait "$idle_pid" 2>/dev/null || true
+  "$CLIENT_BIN" "$sock" --stop
+  wait "$server_pid"
+  if [[ "$out" != 3 ]]; then
+    echo "FAILED: server idle timeout"; echo "$out"; exit 1; fi
+  echo "ok: server"
+}
+
+# Batch mode: independent jobs in one process, output collated in file order
+{
+  echo "Running batch test..."
+  bdir=$(mktemp -d)
+  for i in 1 2 3 4 5 6; do printf '(print "job %s") (set x %s) (* x 10)' "$i" "$i" > "$bdir/job$i.lisp"; done
+  printf '%s' '(print x)' > "$bdir/fresh.lisp"
+  status=0
+  out=$("$VDLISP__BIN" --batch --jobs 3 "$bdir"/job*.lisp "$bdir/fresh.lisp" 2>&1) || status=$?
+  # a missing or malformed count is a usage error, not a file name
+  for bad in "$bdir/job1.lisp --jobs" "--jobs $bdir/job1.lisp" "-j 3x $bdir/job1.lisp"; do
+    bstatus=0
+    bout=$("$VDLISP__BIN" --batch $bad 2>&1) || bstatus=$?
+    if [[ "$bstatus" != 2 ]] || ! grep -Fq -- "--jobs requires a positive number" <<<"$bout"; then
+      echo "FAILED: batch --jobs usage error for '$bad' (status $bstatus)"; echo "$bout"; rm -rf "$bdir"; exit 1; fi
+  done
+  rm -rf "$bdir"
+  expected=$'job 1\n10\njob 2\n20\njob 3\n30\njob 4\n40\njob 5\n50\njob 6\n60'
+  if [[ "$out" != "$expected"* ]] || ! grep -Fq "unbound symbol: x" <<<"$out" || [[ "$status" != 1 ]]; then
+    echo "FAILED: batch mode (status $status)"; echo "$out"; exit 1; fi
+  echo "ok: batch"
+}
+
+# Biased refcounts: `share` only exists in a build with -D VDLISP_BIASED_RC=ON,
+# made here in build-biased (set VDLISP__SKIP_BIASED=1 to skip it).
+# Shared values are read by several workers at once and refuse mutation.
+if [[ -z "${VDLISP__SKIP_BIASED:-}" ]]; then
+  echo "Running biased refcount tests..."
+  if [ ! -d build-biased ]; then
+    # same llvm-config as the main build
+    llvm_config=$(sed -n 's/^LLVM_CONFIG:FILEPATH=//p' build/CMakeCache.txt 2>/dev/null || true)
+    cmake -S . -B build-biased -D ENABLE_LTO=OFF -D VDLISP_BIASED_RC=ON ${llvm_config:+-D LLVM_CONFIG="$llvm_config"}
+  fi
+  cmake --build build-biased -j$(nproc)
+  BIASED_TESTS=(
+    "$RNG"$'(set v (share (list->vector (pmap (fn (i) (list i (f64array i) (bytes 1 2))) (rng 200)))))\n(set total (fn (v) (let (s 0 i 0) (while (< i (vector-length v)) (set s (+ s (f64-ref (car (cdr (vector-ref v i))) 0))) (set i (+ i 1))) s)))\n(set fs (pmap (fn (k) (spawn total v)) (rng 8)))\n(fold (fn (acc f) (+ acc (await f))) 0 fs)' '159200'
+    $'(set l (list 1 (vector 2)))\n(share l)\n(list (await (spawn (fn (x) (vector-ref (car (cdr x)) 0)) (share l))) (car l))' '(2 1)'
+    '(let (l (list 1 2)) (share l) (setcar l 5))' 'err:setcar: cannot modify a shared value'
+    '(await (spawn (fn (v) (vector-set! v 0 1)) (share (vector 1 2))))' 'err:vector-set!: cannot modify a shared value'
+    '(let (a (f64array 1 2)) (share (list a)) (f64-set! a 0 5))' 'err:f64-set!: cannot modify a shared value'
+    '(let (b (bytes 1 2 3)) (share (bytes-slice b 1)) (bytes-fill! (bytes-slice b 0 1) 9))' 'err:bytes-fill!: cannot modify a shared value'
+    '(share (make-table))' 'err:share: cannot share a table'
+    $'(set a (f64array 1 2))\n(set bump (fn (i) (f64-set! a i (+ (f64-ref a i) 1))))\n(bump 0)\n(bump 0)\n(bump 0)\n(bump 0)\n(bump 0)\n(list (type bump) (f64-ref a 0))' '(jit_func 6)'
+    '(set a (f64array 1 2)) (set bump (fn (i) (f64-set! a i (+ (f64-ref a i) 1)))) (bump 0) (bump 0) (bump 0) (bump 0) (bump 0) (share a) (bump 1)' 'err:f64-set!: cannot modify a shared value'
+  )
+  for ((i=0;i<${#BIASED_TESTS[@]};i+=2)); do
+    VDLISP__BIN=build-biased/vdlisp run_one "${BIASED_TESTS[i]}" "${BIASED_TESTS[i+1]}"
+  done
+fi
+
 # Run JIT control forms script to exercise cond/let/while compiled paths
 {
   echo "Running JIT control forms script..."
   out=$("$VDLISP__BIN" tests/jit_control_forms.lisp 2>&1 || true)
-  if ! echo "$out" | grep -Fq "COND_DONE"; then
+  if ! grep -Fq "COND_DONE" <<<"$out"; then
     echo "FAILED: jit control forms (cond)"; echo "$out"; exit 1; fi
-  if ! echo "$out" | grep -Fq "LET_DONE"; then
+  if ! grep -Fq "LET_DONE" <<<"$out"; then
     echo "FAILED: jit control forms (let)"; echo "$out"; exit 1; fi
-  if ! echo "$out" | grep -Fq "WHILE_DONE"; then
+  if ! grep -Fq "WHILE_DONE" <<<"$out"; then
     echo "FAILED: jit control forms (while)"; echo "$out"; exit 1; fi
-  if ! echo "$out" | grep -Fq "jit_func"; then
+  if ! grep -Fq "jit_func" <<<"$out"; then
     echo "FAILED: JIT not triggered"; echo "$out"; exit 1; fi
-  if ! echo "$out" | grep -Fq "<jit_func>"; then
+  if ! grep -Fq "<jit_func>" <<<"$out"; then
     echo "FAILED: JIT print form not found"; echo "$out"; exit 1; fi
   echo "ok: jit control forms script"
 }